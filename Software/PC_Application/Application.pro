@@ -1,5 +1,8 @@
 HEADERS += \
     ../VNA_embedded/Application/Communication/Protocol.hpp \
+    ../VNA_embedded/Application/Drivers/PLLCalculation.hpp \
+    ../VNA_embedded/Application/Drivers/algorithm.hpp \
+    ../VNA_embedded/Application/SweepPlan.hpp \
     Calibration/calibration.h \
     Calibration/calibrationtracedialog.h \
     Calibration/calkit.h \
@@ -12,8 +15,12 @@ HEADERS += \
     CustomWidgets/touchstoneimport.h \
     Device/device.h \
     Device/devicelog.h \
+    Device/devicetransport.h \
     Device/firmwareupdatedialog.h \
     Device/manualcontroldialog.h \
+    Device/simulateddevice.h \
+    Device/spscqueue.h \
+    Device/usbtransport.h \
     Generator/generator.h \
     Generator/signalgenwidget.h \
     SpectrumAnalyzer/spectrumanalyzer.h \
@@ -33,6 +40,8 @@ HEADERS += \
     Traces/tracewidget.h \
     Traces/tracexyplot.h \
     Traces/xyplotaxisdialog.h \
+    VNA/segmenttabledialog.h \
+    VNA/sweepprocessor.h \
     VNA/vna.h \
     appwindow.h \
     averaging.h \
@@ -44,6 +53,9 @@ HEADERS += \
 
 SOURCES += \
     ../VNA_embedded/Application/Communication/Protocol.cpp \
+    ../VNA_embedded/Application/Drivers/PLLCalculation.cpp \
+    ../VNA_embedded/Application/Drivers/algorithm.cpp \
+    ../VNA_embedded/Application/SweepPlan.cpp \
     Calibration/calibration.cpp \
     Calibration/calibrationtracedialog.cpp \
     Calibration/calkit.cpp \
@@ -57,8 +69,11 @@ SOURCES += \
     CustomWidgets/touchstoneimport.cpp \
     Device/device.cpp \
     Device/devicelog.cpp \
+    Device/devicetransport.cpp \
     Device/firmwareupdatedialog.cpp \
     Device/manualcontroldialog.cpp \
+    Device/simulateddevice.cpp \
+    Device/usbtransport.cpp \
     Generator/generator.cpp \
     Generator/signalgenwidget.cpp \
     SpectrumAnalyzer/spectrumanalyzer.cpp \
@@ -78,6 +93,8 @@ SOURCES += \
     Traces/tracewidget.cpp \
     Traces/tracexyplot.cpp \
     Traces/xyplotaxisdialog.cpp \
+    VNA/segmenttabledialog.cpp \
+    VNA/sweepprocessor.cpp \
     VNA/vna.cpp \
     appwindow.cpp \
     averaging.cpp \
@@ -88,6 +105,8 @@ SOURCES += \
     unit.cpp
 
 LIBS += -lusb-1.0
+# shared firmware sources include their headers relative to the firmware include paths
+INCLUDEPATH += ../VNA_embedded/Application/Communication ../VNA_embedded/Application/Drivers
 unix:INCLUDEPATH += /usr/include/qwt
 unix:LIBS += -L/usr/lib/ -lqwt-qt5
 win32:INCLUDEPATH += C:\Qwt-6.1.4\include
@@ -111,6 +130,7 @@ FORMS += \
     Traces/traceimportdialog.ui \
     Traces/tracewidget.ui \
     Traces/xyplotaxisdialog.ui \
+    VNA/segmenttabledialog.ui \
     main.ui \
     preferencesdialog.ui
 
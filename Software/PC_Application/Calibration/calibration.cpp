@@ -395,30 +395,39 @@ void Calibration::correctMeasurement(Protocol::Datapoint &d)
     d.imag_S22 = S22.imag();
 }
 
-Calibration::InterpolationType Calibration::getInterpolation(Protocol::SweepSettings settings)
+Calibration::InterpolationType Calibration::getInterpolation(Protocol::SweepSettings settings, const Protocol::SweepSegments *segments)
 {
-    if(!points.size()) {
+    if(!points.size() || !settings.points) {
         return InterpolationType::NoCalibration;
     }
-    if(settings.f_start < points.front().frequency || settings.f_stop > points.back().frequency) {
-        return InterpolationType::Extrapolate;
-    }
-    // Either exact or interpolation, check individual frequencies
-    uint32_t f_step;
-    if(settings.points > 1) {
-        f_step = (settings.f_stop - settings.f_start) / (settings.points - 1);
-    } else {
-        f_step = settings.f_stop - settings.f_start;
-    }
-    for(uint64_t f = settings.f_start; f <= settings.f_stop; f += f_step) {
-        if(find_if(points.begin(), points.end(), [&f](const Point& p){
-            return abs(f - p.frequency) < 100;
-        }) == points.end()) {
-            return InterpolationType::Interpolate;
+    // Either exact or interpolation, check individual frequencies (the spacing is not necessarily constant)
+    bool exact = true;
+    for(uint32_t i=0;i<settings.points;i++) {
+        double f = Protocol::SweepFrequency(settings, i, segments);
+        if(f < points.front().frequency || f > points.back().frequency) {
+            return InterpolationType::Extrapolate;
         }
+        if(!exact) {
+            // only checking for extrapolation
+            continue;
+        }
+        auto p = lower_bound(points.begin(), points.end(), f, [](const Point &p, double freq) -> bool {
+            return p.frequency < freq;
+        });
+        bool match = p != points.end() && abs(p->frequency - f) < 100;
+        if(!match && p != points.begin()) {
+            match = abs(prev(p)->frequency - f) < 100;
+        }
+        if(!match) {
+            exact = false;
+        }
+    }
+    if(!exact) {
+        return InterpolationType::Interpolate;
     }
     // if we get here all frequency points were matched
-    if(points.front().frequency == settings.f_start && points.back().frequency == settings.f_stop) {
+    if(points.size() == settings.points && points.front().frequency == Protocol::SweepFrequency(settings, 0, segments)
+            && points.back().frequency == Protocol::SweepFrequency(settings, settings.points - 1, segments)) {
         return InterpolationType::Unchanged;
     } else {
         return InterpolationType::Exact;
@@ -56,7 +56,8 @@ public:
         NoCalibration, // No calibration available
     };
 
-    InterpolationType getInterpolation(Protocol::SweepSettings settings);
+    // segments is only used if settings.segmentTable is set. The sweep frequencies do not have to be evenly spaced
+    InterpolationType getInterpolation(Protocol::SweepSettings settings, const Protocol::SweepSegments *segments = nullptr);
 
     static QString MeasurementToString(Measurement m);
     static QString TypeToString(Type t);
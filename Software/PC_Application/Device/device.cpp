@@ -1,117 +1,16 @@
 #include "device.h"
 
-#include <signal.h>
+#include "usbtransport.h"
+#include "../VNA_embedded/Application/SweepPlan.hpp"
 #include <QDebug>
 #include <QString>
-#include <QMessageBox>
 #include <mutex>
+#include <cstring>
+#include <algorithm>
+#include <vector>
 
 using namespace std;
 
-using USBID = struct {
-    int VID;
-    int PID;
-};
-static constexpr USBID IDs[] = {
-    {0x0483, 0x564e},
-    {0x0483, 0x4121},
-};
-
-USBInBuffer::USBInBuffer(libusb_device_handle *handle, unsigned char endpoint, int buffer_size) :
-    buffer_size(buffer_size),
-    received_size(0),
-    inCallback(false)
-{
-    buffer = new unsigned char[buffer_size];
-    transfer = libusb_alloc_transfer(0);
-    libusb_fill_bulk_transfer(transfer, handle, endpoint, buffer, buffer_size, CallbackTrampoline, this, 100);
-    libusb_submit_transfer(transfer);
-}
-
-USBInBuffer::~USBInBuffer()
-{
-    if(transfer) {
-        libusb_cancel_transfer(transfer);
-        // wait for cancellation to complete
-        mutex mtx;
-        unique_lock<mutex> lck(mtx);
-        using namespace std::chrono_literals;
-        if(cv.wait_for(lck, 100ms) == cv_status::timeout) {
-            qWarning() << "Timed out waiting for mutex acquisition during disconnect";
-        }
-    }
-    delete buffer;
-}
-
-void USBInBuffer::removeBytes(int handled_bytes)
-{
-    if(!inCallback) {
-        throw runtime_error("Removing of bytes is only allowed from within receive callback");
-    }
-    if(handled_bytes >= received_size) {
-        received_size = 0;
-    } else {
-        // not removing all bytes, have to move remaining data to the beginning of the buffer
-        memmove(buffer, &buffer[handled_bytes], received_size - handled_bytes);
-        received_size -= handled_bytes;
-    }
-}
-
-int USBInBuffer::getReceived() const
-{
-    return received_size;
-}
-
-void USBInBuffer::Callback(libusb_transfer *transfer)
-{
-    switch(transfer->status) {
-    case LIBUSB_TRANSFER_COMPLETED:
-        received_size += transfer->actual_length;
-        inCallback = true;
-        emit DataReceived();
-        inCallback = false;
-        break;
-    case LIBUSB_TRANSFER_ERROR:
-        qCritical() << "LIBUSB_TRANSFER_ERROR";
-    case LIBUSB_TRANSFER_NO_DEVICE:
-        qCritical() << "LIBUSB_TRANSFER_NO_DEVICE";
-    case LIBUSB_TRANSFER_OVERFLOW:
-        qCritical() << "LIBUSB_TRANSFER_OVERFLOW";
-    case LIBUSB_TRANSFER_STALL:
-        qCritical() << "LIBUSB_TRANSFER_STALL";
-        libusb_free_transfer(transfer);
-        this->transfer = nullptr;
-        emit TransferError();
-        return;
-        break;
-    case LIBUSB_TRANSFER_TIMED_OUT:
-        // nothing to do
-        break;
-    case LIBUSB_TRANSFER_CANCELLED:
-        // destructor called, do not resubmit
-        libusb_free_transfer(transfer);
-        this->transfer = nullptr;
-        cv.notify_all();
-        return;
-        break;
-    }
-    // Resubmit the transfer
-    transfer->buffer = &buffer[received_size];
-    transfer->length = buffer_size - received_size;
-    libusb_submit_transfer(transfer);
-}
-
-void USBInBuffer::CallbackTrampoline(libusb_transfer *transfer)
-{
-    auto usb = (USBInBuffer*) transfer->user_data;
-    usb->Callback(transfer);
-}
-
-uint8_t *USBInBuffer::getBuffer() const
-{
-    return buffer;
-}
-
 static Protocol::DeviceLimits limits = {
     .minFreq = 0,
     .maxFreq = 6000000000,
@@ -122,111 +21,255 @@ static Protocol::DeviceLimits limits = {
     .cdbm_max = 0,
     .minRBW = 10,
     .maxRBW = 100000,
+    .maxSweepPoints = 4501,
+};
+// maxSweepPoints is only valid if the device also supports Capabilities::LongSweeps
+static bool longSweeps = false;
+// limits and longSweeps are written by the receive thread and read from the GUI thread
+static mutex limitsMutex;
+
+// Optional protocol features supported by this application
+static constexpr Protocol::Capabilities hostCapabilities = {
+    .DatapointBatches = 1,
+    .CompactDatapoints = 1,
+    .SequencedAcks = 1,
+    .SweepPlans = 1,
+    .PortBlockedSweeps = 1,
+    .LongSweeps = 1,
+    .SegmentTables = 1,
+    .LogSweeps = 1,
+    .SweepModes = 1,
+    .PointAveraging = 1,
 };
 
-Device::Device(QString serial)
+// The sweep plan only depends on these settings (and the SweepPlanParameters it was calculated with)
+static bool SamePlanInputs(const Protocol::SweepSettings &a, const Protocol::SweepSettings &b)
 {
-    qDebug() << "Starting device connection...";
-
-    m_handle = nullptr;
-    libusb_init(&m_context);
+    return a.f_start == b.f_start && a.f_stop == b.f_stop && a.points == b.points && a.logSweep == b.logSweep
+            && a.if_bandwidth == b.if_bandwidth && a.averages == b.averages && a.cdbm_excitation == b.cdbm_excitation
+            && a.suppressPeaks == b.suppressPeaks && a.extendedSettling == b.extendedSettling;
+}
 
-    SearchDevices([=](libusb_device_handle *handle, QString found_serial) -> bool {
-        if(serial.isEmpty() || serial == found_serial) {
-            // accept connection to this device
-            m_serial = found_serial;
-            m_handle = handle;
-            // abort device search
-            return false;
-        } else {
-            // not the requested device, continue search
-            return true;
-        }
-    }, m_context);
-
-    if(!m_handle) {
-        QString message =  "No device found";
-        auto msg = new QMessageBox(QMessageBox::Icon::Warning, "Error opening device", message);
-        msg->exec();
-        libusb_exit(m_context);
-        throw std::runtime_error(message.toStdString());
-        return;
-    }
+Device::Device(QString serial) :
+    Device(new USBTransport(serial))
+{
+}
 
-    // Found the correct device, now connect
-    /* claim the interfaces */
-    for (int if_num = 0; if_num < 1; if_num++) {
-        int ret = libusb_claim_interface(m_handle, if_num);
-        if (ret < 0) {
-            libusb_close(m_handle);
-            /* Failed to open */
-            QString message =  "Failed to claim interface: \"";
-            message.append(libusb_strerror((libusb_error) ret));
-            message.append("\" Maybe you are already connected to this device?");
-            qWarning() << message;
-            auto msg = new QMessageBox(QMessageBox::Icon::Warning, "Error opening device", message);
-            msg->exec();
-            libusb_exit(m_context);
-            throw std::runtime_error(message.toStdString());
-        }
-    }
-    qInfo() << "USB connection established" << flush;
-    m_connected = true;
-    m_receiveThread = new std::thread(&Device::USBHandleThread, this);
-    dataBuffer = new USBInBuffer(m_handle, EP_Data_In_Addr, 65536);
-    logBuffer = new USBInBuffer(m_handle, EP_Log_In_Addr, 65536);
-    connect(dataBuffer, &USBInBuffer::DataReceived, this, &Device::ReceivedData, Qt::DirectConnection);
-    connect(dataBuffer, &USBInBuffer::TransferError, this, &Device::ConnectionLost);
-    connect(logBuffer, &USBInBuffer::DataReceived, this, &Device::ReceivedLog, Qt::DirectConnection);
+Device::Device(DeviceTransport *transport) :
+    transport(transport),
+    // Only has to bridge delays of the GUI thread, it takes the points while the sweep is running. Long sweeps
+    // (up to Limits().maxSweepPoints) do not have to fit into the queue completely
+    datapointQueue(8192),
+    datapointsAvailablePending(false),
+    datapointsDiscarded(0)
+{
+    dataBuffer = transport->dataBuffer();
+    logBuffer = transport->logBuffer();
+    connect(dataBuffer, &InBuffer::DataReceived, this, &Device::ReceivedData, Qt::DirectConnection);
+    connect(transport, &DeviceTransport::ConnectionLost, this, &Device::ConnectionLost);
+    connect(logBuffer, &InBuffer::DataReceived, this, &Device::ReceivedLog, Qt::DirectConnection);
     connect(&transmissionTimer, &QTimer::timeout, this, &Device::transmissionTimeout);
     connect(this, &Device::receivedAnswer, this, &Device::transmissionFinished, Qt::QueuedConnection);
     transmissionTimer.setSingleShot(true);
-    transmissionActive = false;
+    nextSequence = 1;
+    lastInfoValid = false;
+    planParametersValid = false;
+    uploadedPlanRevision = 0;
+    uploadedPlanValid = false;
+    sweepSettingsValid = false;
+    sentSegments.count = 0;
+    // until the device reports otherwise, assume it does not support any optional features
+    deviceCapabilities = {};
+    {
+        lock_guard<mutex> lock(limitsMutex);
+        longSweeps = false;
+    }
     // got a new connection, request limits
     SendCommandWithoutPayload(Protocol::PacketType::RequestDeviceLimits);
+    // announce optional features. Older firmware does not know this packet and answers with a Nack,
+    // in that case the device keeps using the basic protocol
+    Protocol::PacketInfo p;
+    p.type = Protocol::PacketType::Capabilities;
+    p.capabilities = hostCapabilities;
+    SendPacket(p);
+    // required for calculating sweep plans, older firmware answers with a Nack
+    SendCommandWithoutPayload(Protocol::PacketType::RequestSweepPlanParameters);
 }
 
 Device::~Device()
 {
-    if(m_connected) {
-        SetIdle();
-        delete dataBuffer;
-        delete logBuffer;
-        m_connected = false;
-        for (int if_num = 0; if_num < 1; if_num++) {
-            int ret = libusb_release_interface(m_handle, if_num);
-            if (ret < 0) {
-                qCritical() << "Error releasing interface" << libusb_error_name(ret);
-            }
-        }
-        libusb_close(m_handle);
-        m_receiveThread->join();
-        libusb_exit(m_context);
-    }
+    SetIdle();
+    delete transport;
 }
 
 bool Device::SendPacket(const Protocol::PacketInfo& packet, std::function<void(TransmissionResult)> cb, unsigned int timeout)
 {
+    if(packet.type == Protocol::PacketType::ManualControl || packet.type == Protocol::PacketType::Generator
+            || packet.type == Protocol::PacketType::SpectrumAnalyzerSettings) {
+        // the other modes overwrite the sweep configuration in the device
+        lock_guard<mutex> lock(planParametersMutex);
+        uploadedPlanValid = false;
+    }
     Transmission t;
     t.packet = packet;
     t.timeout = timeout;
     t.callback = cb;
     transmissionQueue.enqueue(t);
 //    qDebug() << "Enqueued packet, queue at " << transmissionQueue.size();
-    if(!transmissionActive) {
-        startNextTransmission();
-    }
+    startNextTransmissions();
     return true;
 }
 
 bool Device::Configure(Protocol::SweepSettings settings, std::function<void(TransmissionResult)> cb)
 {
+    Protocol::SweepSegments segments;
+    segments.count = 0;
+    settings.segmentTable = 0;
+    return Configure(settings, segments, cb);
+}
+
+bool Device::Configure(Protocol::SweepSettings settings, const Protocol::SweepSegments &segments, std::function<void(TransmissionResult)> cb)
+{
+    // the capabilities and limits may change at any time in the receive thread, use a consistent copy
+    auto capabilities = getCapabilities();
+    auto deviceLimits = Limits();
+    if(settings.segmentTable) {
+        if(capabilities.SegmentTables && segments.count > 0) {
+            settings.points = Protocol::SegmentTablePoints(segments);
+        } else {
+            settings.segmentTable = 0;
+            if(segments.count > 0) {
+                // no support for segment tables, cover the same frequency range instead
+                settings.f_start = segments.segments[0].f_start;
+                settings.f_stop = segments.segments[segments.count - 1].f_stop;
+            }
+        }
+    }
+    if(!capabilities.LogSweeps) {
+        // the device would measure linearly spaced points
+        settings.logSweep = 0;
+    }
+    if(!capabilities.SweepModes) {
+        // the device only sweeps continuously
+        settings.triggered = 0;
+        settings.sweeps = 0;
+    }
+    if(!capabilities.PointAveraging || settings.segmentTable) {
+        settings.averages = 0;
+    }
+    if(!capabilities.DatapointBatches || !capabilities.CompactDatapoints) {
+        // device can only send the full datapoint format
+        settings.dataFormat = (int) Protocol::DatapointFormat::Full;
+    }
+    if(!capabilities.PortBlockedSweeps || !capabilities.DatapointBatches) {
+        settings.portBlocked = 0;
+    }
+    if(settings.points > deviceLimits.maxSweepPoints) {
+        settings.points = deviceLimits.maxSweepPoints;
+    }
+    // packets of a previous configuration that have not been sent yet are outdated
+    DropSupersededPlan();
+    settings.uploadedPlan = 0;
+    // sweeps with more points than the device can hold at once (or with a segment table) are always calculated on the device
+    if(capabilities.SweepPlans && (settings.excitePort1 || settings.excitePort2) && settings.points <= deviceLimits.maxPoints
+            && !settings.segmentTable) {
+        // the device falls back to calculating the plan itself if the upload fails
+        settings.uploadedPlan = UploadSweepPlan(settings);
+    } else {
+        // the device calculates the sweep itself (or does not sweep at all) and replaces the uploaded plan
+        lock_guard<mutex> lock(planParametersMutex);
+        uploadedPlanValid = false;
+    }
+    // the settings used for decoding the received datapoints are switched when the device acknowledges them
     Protocol::PacketInfo p;
+    if(settings.segmentTable) {
+        // the device uses the table with the following settings
+        p.type = Protocol::PacketType::SweepSegments;
+        p.segments = segments;
+        SendPacket(p);
+    }
     p.type = Protocol::PacketType::SweepSettings;
     p.settings = settings;
     return SendPacket(p, cb);
 }
 
+bool Device::UploadSweepPlan(const Protocol::SweepSettings &settings)
+{
+    lock_guard<mutex> lock(planParametersMutex);
+    if(!planParametersValid) {
+        uploadedPlanValid = false;
+        return false;
+    }
+    if(uploadedPlanValid && uploadedPlanRevision == planParameters.revision && SamePlanInputs(settings, uploadedPlanSettings)) {
+        // the device still holds this plan
+        return true;
+    }
+    uploadedPlanValid = false;
+    auto samplesPerPoint = SweepPlan::SamplesPerPoint(settings.if_bandwidth, planParameters.ADCSamplerate, settings.averages);
+    SweepPlan::Calculator calc(planParameters, settings, planParameters.ADCSamplerate / samplesPerPoint);
+    // calculate the complete plan first, nothing is uploaded if any point can not be reached
+    vector<Protocol::PacketInfo> packets;
+    for(uint32_t i=0;i<settings.points;i++) {
+        if(i % Protocol::MaxPlanPoints == 0) {
+            Protocol::PacketInfo p;
+            p.type = Protocol::PacketType::SweepPlanPoints;
+            p.planPoints.revision = planParameters.revision;
+            p.planPoints.firstPoint = i;
+            p.planPoints.count = 0;
+            packets.push_back(p);
+        }
+        auto &plan = packets.back().planPoints;
+        if(!calc.Next(plan.points[plan.count])) {
+            qWarning() << "Unable to calculate sweep plan at" << calc.GetFrequency() << "Hz, device calculates the sweep itself";
+            return false;
+        }
+        plan.count++;
+    }
+    for(auto &p : packets) {
+        SendPacket(p, [=](TransmissionResult res) {
+            if(res != TransmissionResult::Ack) {
+                // the device does not have the complete plan, upload it again next time
+                lock_guard<mutex> lock(planParametersMutex);
+                uploadedPlanValid = false;
+            }
+        });
+    }
+    uploadedPlanSettings = settings;
+    uploadedPlanRevision = planParameters.revision;
+    uploadedPlanValid = true;
+    return true;
+}
+
+void Device::DropSupersededPlan()
+{
+    bool dropped = false;
+    for(auto it = transmissionQueue.begin(); it != transmissionQueue.end();) {
+        if(it->packet.type == Protocol::PacketType::SweepPlanPoints) {
+            it = transmissionQueue.erase(it);
+            dropped = true;
+        } else {
+            it++;
+        }
+    }
+    if(!dropped) {
+        return;
+    }
+    {
+        lock_guard<mutex> lock(planParametersMutex);
+        uploadedPlanValid = false;
+    }
+    for(auto &t : transmissionQueue) {
+        if(t.packet.type == Protocol::PacketType::SweepSettings && t.packet.settings.uploadedPlan) {
+            // The plan of these settings is incomplete now, the device would calculate the sweep itself just to
+            // replace it with the new configuration. Let the device idle instead
+            t.packet.settings.excitePort1 = 0;
+            t.packet.settings.excitePort2 = 0;
+            t.packet.settings.uploadedPlan = 0;
+        }
+    }
+    qDebug() << "Dropped sweep plan of a superseded configuration";
+}
+
 bool Device::Configure(Protocol::SpectrumAnalyzerSettings settings)
 {
     Protocol::PacketInfo p;
@@ -245,18 +288,28 @@ bool Device::SetManual(Protocol::ManualControl manual)
 
 bool Device::SetIdle()
 {
-    Protocol::SweepSettings s;
+    Protocol::SweepSettings s = {};
     s.excitePort1 = 0;
     s.excitePort2 = 0;
     return Configure(s);
 }
 
-bool Device::SendFirmwareChunk(Protocol::FirmwarePacket &fw)
+bool Device::TriggerSweep(std::function<void(TransmissionResult)> cb)
+{
+    if(!getCapabilities().SweepModes) {
+        return false;
+    }
+    Protocol::PacketInfo p;
+    p.type = Protocol::PacketType::SweepTrigger;
+    return SendPacket(p, cb);
+}
+
+bool Device::SendFirmwareChunk(Protocol::FirmwarePacket &fw, std::function<void(TransmissionResult)> cb)
 {
     Protocol::PacketInfo p;
     p.type = Protocol::PacketType::FirmwarePacket;
     p.firmware = fw;
-    return SendPacket(p);
+    return SendPacket(p, cb);
 }
 
 bool Device::SendCommandWithoutPayload(Protocol::PacketType type)
@@ -268,108 +321,39 @@ bool Device::SendCommandWithoutPayload(Protocol::PacketType type)
 
 std::set<QString> Device::GetDevices()
 {
-    std::set<QString> serials;
-
-    libusb_context *ctx;
-    libusb_init(&ctx);
-
-    SearchDevices([&serials](libusb_device_handle *, QString serial) -> bool {
-        serials.insert(serial);
-        return true;
-    }, ctx);
-
-    libusb_exit(ctx);
-
-    return serials;
+    return USBTransport::GetDevices();
 }
 
 Protocol::DeviceLimits Device::Limits()
 {
-    return limits;
+    lock_guard<mutex> lock(limitsMutex);
+    auto l = limits;
+    if(!longSweeps) {
+        l.maxSweepPoints = l.maxPoints;
+    }
+    return l;
 }
 
-void Device::USBHandleThread()
+Protocol::Capabilities Device::getCapabilities() const
 {
-    qInfo() << "Receive thread started" << flush;
-    while (m_connected) {
-        libusb_handle_events(m_context);
-    }
-    qDebug() << "Disconnected, receive thread exiting";
+    lock_guard<mutex> lock(capabilitiesMutex);
+    return deviceCapabilities;
 }
 
-void Device::SearchDevices(std::function<bool (libusb_device_handle *, QString)> foundCallback, libusb_context *context)
+Protocol::DeviceInfo Device::getLastInfo() const
 {
-    libusb_device **devList;
-    auto ndevices = libusb_get_device_list(context, &devList);
-
-    for (ssize_t idx = 0; idx < ndevices; idx++) {
-        int ret;
-        libusb_device *device = devList[idx];
-        libusb_device_descriptor desc = {};
-
-        ret = libusb_get_device_descriptor(device, &desc);
-        if (ret) {
-            /* some error occured */
-            qCritical() << "Failed to get device descriptor: "
-                    << libusb_strerror((libusb_error) ret);
-            continue;
-        }
-
-        bool correctID = false;
-        int numIDs = sizeof(IDs)/sizeof(IDs[0]);
-        for(int i=0;i<numIDs;i++) {
-            if(desc.idVendor == IDs[i].VID && desc.idProduct == IDs[i].PID) {
-                correctID = true;
-                break;
-            }
-        }
-        if(!correctID) {
-            continue;
-        }
-
-        /* Try to open the device */
-        libusb_device_handle *handle = nullptr;
-        ret = libusb_open(device, &handle);
-        if (ret) {
-            /* Failed to open */
-            QString message =  "Found potential device but failed to open usb connection: \"";
-            message.append(libusb_strerror((libusb_error) ret));
-            message.append("\" On Linux this is most likely caused by a missing udev rule. On Windows it could be a missing driver. Try installing the WinUSB driver using Zadig (https://zadig.akeo.ie/)");
-            qWarning() << message;
-            auto msg = new QMessageBox(QMessageBox::Icon::Warning, "Error opening device", message);
-            msg->exec();
-            continue;
-        }
+    return lastInfo;
+}
 
-        char c_product[256];
-        char c_serial[256];
-        libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber,
-                (unsigned char*) c_serial, sizeof(c_serial));
-        ret = libusb_get_string_descriptor_ascii(handle, desc.iProduct,
-                (unsigned char*) c_product, sizeof(c_product));
-        if (ret > 0) {
-            /* managed to read the product string */
-            QString product(c_product);
-            qDebug() << "Opened device: " << product;
-            if (product == "VNA") {
-                // this is a match
-                if(!foundCallback(handle, QString(c_serial))) {
-                    // abort search
-                    break;
-                }
-            }
-        } else {
-            qWarning() << "Failed to get product descriptor: "
-                    << libusb_strerror((libusb_error) ret);
-        }
-        libusb_close(handle);
-    }
-    libusb_free_device_list(devList, 1);
+uint32_t Device::getADCSamplerate()
+{
+    lock_guard<mutex> lock(planParametersMutex);
+    return planParametersValid ? planParameters.ADCSamplerate : 0;
 }
 
-Protocol::DeviceInfo Device::getLastInfo() const
+double Device::getDataThroughput() const
 {
-    return lastInfo;
+    return dataBuffer->getThroughput();
 }
 
 QString Device::getLastDeviceInfoString()
@@ -391,20 +375,47 @@ QString Device::getLastDeviceInfoString()
                 ret.append(" (External available)");
             }
         }
+        if(lastInfo.transmit.stalls > 0) {
+            ret.append(" USB stalls: "+QString::number(lastInfo.transmit.stalls)+" (FIFO peak "+QString::number(lastInfo.transmit.fifoHighWater)+" bytes)");
+        }
+        if(lastInfo.sweepTime > 0) {
+            ret.append(" Sweep time: "+QString::number(lastInfo.sweepTime / 1000.0, 'f', 1)+"ms");
+        }
     }
     return ret;
 }
 
 void Device::ReceivedData()
 {
+    Protocol::FrameView frame;
     Protocol::PacketInfo packet;
     uint16_t handled_len;
+    bool sweepComplete = false;
     do {
-        handled_len = Protocol::DecodeBuffer(dataBuffer->getBuffer(), dataBuffer->getReceived(), &packet);
-        dataBuffer->removeBytes(handled_len);
+        // The frame is located directly in the receive buffer, its payload is only decoded (copied) when handled below.
+        // Datapoint batches are not decoded at all, each point is extracted from the buffer when it is passed on
+        handled_len = Protocol::FindFrame(dataBuffer->getBuffer(), dataBuffer->getReceived(), &frame);
+        Protocol::DecodeFrame(frame, &packet);
+        // Note: bytes are only removed from the buffer after handling the packet, some packets (e.g. datapoint batches) still reference it
         switch(packet.type) {
         case Protocol::PacketType::Datapoint:
-            emit DatapointReceived(packet.datapoint);
+            queueDatapoint(packet.datapoint);
+            break;
+        case Protocol::PacketType::DatapointBatch: {
+            lock_guard<mutex> lock(sweepSettingsMutex);
+            if(!sweepSettingsValid && packet.batch.format != Protocol::DatapointFormat::Full) {
+                // the frequencies can not be calculated without the settings of the sweep
+                break;
+            }
+            for(int i=0;i<packet.batch.count;i++) {
+                auto d = Protocol::GetBatchDatapoint(packet.batch, i, &sweepSettings, &sweepSegments);
+                if(d.ports == Protocol::DatapointPorts::Both) {
+                    queueDatapoint(d);
+                } else {
+                    mergeDatapoint(d);
+                }
+            }
+        }
             break;
         case Protocol::PacketType::Status:
             emit ManualStatusReceived(packet.status);
@@ -418,20 +429,113 @@ void Device::ReceivedData()
             emit DeviceInfoUpdated();
             break;
         case Protocol::PacketType::Ack:
+            // handled here, the following datapoints may already belong to the new sweep
+            settingsAnswered(true, packet.sequence);
             emit AckReceived();
-            emit receivedAnswer(TransmissionResult::Ack);
+            emit receivedAnswer(TransmissionResult::Ack, packet.sequence);
             break;
         case Protocol::PacketType::Nack:
+            settingsAnswered(false, packet.sequence);
             emit NackReceived();
-            emit receivedAnswer(TransmissionResult::Nack);
+            emit receivedAnswer(TransmissionResult::Nack, packet.sequence);
             break;
-        case Protocol::PacketType::DeviceLimits:
+        case Protocol::PacketType::DeviceLimits: {
+            lock_guard<mutex> lock(limitsMutex);
             limits = packet.limits;
+        }
+            break;
+        case Protocol::PacketType::Capabilities: {
+            // only use features supported by both sides
+            Protocol::Capabilities c = {};
+            c.DatapointBatches = packet.capabilities.DatapointBatches & hostCapabilities.DatapointBatches;
+            c.CompactDatapoints = packet.capabilities.CompactDatapoints & hostCapabilities.CompactDatapoints;
+            c.SequencedAcks = packet.capabilities.SequencedAcks & hostCapabilities.SequencedAcks;
+            c.SweepPlans = packet.capabilities.SweepPlans & hostCapabilities.SweepPlans;
+            c.PortBlockedSweeps = packet.capabilities.PortBlockedSweeps & hostCapabilities.PortBlockedSweeps;
+            // the point numbers of long sweeps are only transferred in batches
+            c.LongSweeps = packet.capabilities.LongSweeps & hostCapabilities.LongSweeps
+                    & c.DatapointBatches;
+            c.SegmentTables = packet.capabilities.SegmentTables & hostCapabilities.SegmentTables;
+            c.LogSweeps = packet.capabilities.LogSweeps & hostCapabilities.LogSweeps;
+            c.SweepModes = packet.capabilities.SweepModes & hostCapabilities.SweepModes;
+            c.PointAveraging = packet.capabilities.PointAveraging & hostCapabilities.PointAveraging;
+            {
+                lock_guard<mutex> lock(capabilitiesMutex);
+                deviceCapabilities = c;
+            }
+            lock_guard<mutex> lock(limitsMutex);
+            longSweeps = c.LongSweeps;
+        }
+            break;
+        case Protocol::PacketType::SweepPlanParameters: {
+            // the VCO maps may change whenever the device reinitializes its hardware
+            lock_guard<mutex> lock(planParametersMutex);
+            planParameters = packet.planParameters;
+            planParametersValid = true;
+            // plans calculated for another revision are rejected by the device
+            if(planParameters.revision != uploadedPlanRevision) {
+                uploadedPlanValid = false;
+            }
+        }
+            break;
+        case Protocol::PacketType::SweepComplete:
+            // emitted after DatapointsAvailable, the receiver handles the last points first
+            sweepComplete = true;
             break;
         default:
             break;
         }
+        dataBuffer->removeBytes(handled_len);
     } while (handled_len > 0);
+    // notify about all points of this transfer at once
+    if(datapointQueue.size() && !datapointsAvailablePending.exchange(true)) {
+        emit DatapointsAvailable(datapointQueue.size());
+    }
+    if(sweepComplete) {
+        emit SweepComplete();
+    }
+}
+
+void Device::queueDatapoint(const Protocol::Datapoint &d)
+{
+    if(!datapointQueue.push(d)) {
+        // the GUI thread did not take the points in time, reported once the queue accepts points again
+        datapointsDiscarded++;
+        return;
+    }
+    if(datapointsDiscarded) {
+        qWarning() << "Datapoint queue was full," << datapointsDiscarded << "points discarded";
+        datapointsDiscarded = 0;
+    }
+}
+
+void Device::mergeDatapoint(const Protocol::Datapoint &d)
+{
+    if(d.pointNum >= forwardPoints.size()) {
+        // not expecting a port-blocked sweep
+        return;
+    }
+    if(d.ports == Protocol::DatapointPorts::Port1) {
+        forwardPoints[d.pointNum] = d;
+        forwardValid[d.pointNum] = true;
+    } else if(forwardValid[d.pointNum]) {
+        // got both halves of this point
+        auto merged = forwardPoints[d.pointNum];
+        merged.real_S12 = d.real_S12;
+        merged.imag_S12 = d.imag_S12;
+        merged.real_S22 = d.real_S22;
+        merged.imag_S22 = d.imag_S22;
+        merged.ports = Protocol::DatapointPorts::Both;
+        forwardValid[d.pointNum] = false;
+        queueDatapoint(merged);
+    }
+}
+
+bool Device::getDatapoint(Protocol::Datapoint &d)
+{
+    // clear the flag before taking points, points queued afterwards trigger a new signal
+    datapointsAvailablePending = false;
+    return datapointQueue.pop(d);
 }
 
 void Device::ReceivedLog()
@@ -451,61 +555,135 @@ void Device::ReceivedLog()
 
 QString Device::serial() const
 {
-    return m_serial;
+    return transport->serial();
 }
 
-bool Device::startNextTransmission()
+void Device::startNextTransmissions()
 {
-    if(transmissionQueue.isEmpty() || !m_connected) {
-        // nothing more to transmit
-        transmissionActive = false;
-        return false;
+    // Without sequence numbers an answer can not be assigned to a specific packet, only a single packet may be unanswered
+    bool sequencedAcks = getCapabilities().SequencedAcks;
+    int window = sequencedAcks ? Protocol::SendWindow : 1;
+    while(!transmissionQueue.isEmpty() && transmissionsInFlight.size() < window) {
+        auto t = transmissionQueue.dequeue();
+        t.packet.sequence = 0;
+        if(sequencedAcks) {
+            t.packet.sequence = nextSequence;
+            // zero is reserved for packets without sequence number
+            nextSequence = nextSequence == 255 ? 1 : nextSequence + 1;
+        }
+        if(t.packet.type == Protocol::PacketType::SweepSegments || t.packet.type == Protocol::PacketType::SweepSettings) {
+            // the answer may arrive before send() returns
+            lock_guard<mutex> lock(sweepSettingsMutex);
+            if(t.packet.type == Protocol::PacketType::SweepSegments) {
+                sentSegments = t.packet.segments;
+            } else {
+                SentSettings s;
+                s.sequence = t.packet.sequence;
+                s.settings = t.packet.settings;
+                s.segments = sentSegments;
+                if(!s.settings.segmentTable) {
+                    s.segments.count = 0;
+                }
+                sentSettings.enqueue(s);
+            }
+        }
+        unsigned char buffer[1024];
+        unsigned int length = Protocol::EncodePacket(t.packet, buffer, sizeof(buffer));
+        if(!length) {
+            qCritical() << "Failed to encode packet";
+        }
+        if(!length || !transport->send(buffer, length)) {
+            // failed to send this packet
+            forgetSentSettings(t.packet);
+            if(t.callback) {
+                t.callback(TransmissionResult::InternalError);
+            }
+            continue;
+        }
+        transmissionsInFlight.enqueue(t);
+        if(transmissionsInFlight.size() == 1) {
+            // the device handles packets in order, the timeout only starts once all previous packets have been answered
+            transmissionTimer.start(t.timeout);
+        }
     }
-    transmissionActive = true;
-    auto t = transmissionQueue.head();
-    unsigned char buffer[1024];
-    unsigned int length = Protocol::EncodePacket(t.packet, buffer, sizeof(buffer));
-    if(!length) {
-        qCritical() << "Failed to encode packet";
-        return false;
+}
+
+void Device::forgetSentSettings(const Protocol::PacketInfo &packet)
+{
+    if(packet.type != Protocol::PacketType::SweepSettings) {
+        return;
     }
-    int actual_length;
-    auto ret = libusb_bulk_transfer(m_handle, EP_Data_Out_Addr, buffer, length, &actual_length, 0);
-    if(ret < 0) {
-        qCritical() << "Error sending data: "
-                                << libusb_strerror((libusb_error) ret);
-        return false;
+    // a later packet may reuse the sequence number
+    lock_guard<mutex> lock(sweepSettingsMutex);
+    auto it = std::find_if(sentSettings.begin(), sentSettings.end(), [&](const SentSettings &s) {
+        return s.sequence == packet.sequence;
+    });
+    if(it != sentSettings.end()) {
+        sentSettings.erase(it);
     }
-    transmissionTimer.start(t.timeout);
-//    qDebug() << "Transmission started, queue at " << transmissionQueue.size();
-    return true;
 }
 
-void Device::transmissionFinished(TransmissionResult result)
+void Device::settingsAnswered(bool ack, quint8 sequence)
 {
-    // remove transmitted packet
-//    qDebug() << "Transmission finsished (" << result << "), queue at " << transmissionQueue.size();
-    if(transmissionQueue.empty()) {
-        qWarning() << "transmissionFinished with empty transmission queue, stray Ack?";
+    lock_guard<mutex> lock(sweepSettingsMutex);
+    // without sequence numbers only a single packet is unanswered, the answer belongs to it
+    auto answered = std::find_if(sentSettings.begin(), sentSettings.end(), [=](const SentSettings &s) {
+        return s.sequence == sequence;
+    });
+    if(answered == sentSettings.end()) {
+        // answer to a different packet
         return;
     }
-    auto t = transmissionQueue.dequeue();
-    if(t.callback) {
-        t.callback(result);
+    auto s = *answered;
+    // settings sent before the answered ones will not be answered anymore
+    sentSettings.erase(sentSettings.begin(), answered + 1);
+    if(!ack) {
+        // the device keeps sweeping with the previous settings
+        return;
     }
-    transmissionTimer.stop();
-    bool success = false;
-    while(!transmissionQueue.isEmpty() && !success) {
-        success = startNextTransmission();
-        if(!success) {
-            // failed to send this packet
-            auto t = transmissionQueue.dequeue();
-            if(t.callback) {
-                t.callback(TransmissionResult::InternalError);
+    // all following points belong to the new sweep
+    sweepSettings = s.settings;
+    sweepSegments = s.segments;
+    sweepSettingsValid = true;
+    // points of a previous port-blocked sweep can not be merged with the new settings
+    bool blocked = sweepSettings.portBlocked && sweepSettings.excitePort1 && sweepSettings.excitePort2;
+    forwardPoints.resize(blocked ? sweepSettings.points : 0);
+    forwardValid.assign(forwardPoints.size(), false);
+}
+
+void Device::transmissionFinished(TransmissionResult result, quint8 sequence)
+{
+    if(transmissionsInFlight.isEmpty()) {
+        qWarning() << "transmissionFinished without pending transmission, stray Ack?";
+        return;
+    }
+    if(sequence) {
+        auto answered = std::find_if(transmissionsInFlight.begin(), transmissionsInFlight.end(), [=](const Transmission &t) {
+            return t.packet.sequence == sequence;
+        });
+        if(answered == transmissionsInFlight.end()) {
+            qWarning() << "Received answer for unknown sequence number" << (int) sequence << "(already timed out?)";
+            return;
+        }
+        // The device answers packets in order, any packet sent before the answered one got lost
+        while(transmissionsInFlight.head().packet.sequence != sequence) {
+            auto lost = transmissionsInFlight.dequeue();
+            forgetSentSettings(lost.packet);
+            if(lost.callback) {
+                lost.callback(TransmissionResult::Timeout);
             }
         }
     }
-    if(transmissionQueue.isEmpty()) {
-        transmissionActive = false;
+    auto t = transmissionsInFlight.dequeue();
+    if(result == TransmissionResult::Timeout) {
+        forgetSentSettings(t.packet);
+    }
+    transmissionTimer.stop();
+    if(!transmissionsInFlight.isEmpty()) {
+        transmissionTimer.start(transmissionsInFlight.head().timeout);
+    }
+    if(t.callback) {
+        t.callback(result);
     }
+    startNextTransmissions();
 }
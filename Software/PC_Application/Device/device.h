@@ -2,12 +2,13 @@
 #define DEVICE_H
 
 #include "../VNA_embedded/Application/Communication/Protocol.hpp"
+#include "devicetransport.h"
+#include "spscqueue.h"
 #include <functional>
-#include <libusb-1.0/libusb.h>
-#include <thread>
 #include <QObject>
-#include <condition_variable>
+#include <mutex>
 #include <set>
+#include <vector>
 #include <QQueue>
 #include <QTimer>
 
@@ -16,32 +17,6 @@ Q_DECLARE_METATYPE(Protocol::ManualStatus);
 Q_DECLARE_METATYPE(Protocol::DeviceInfo);
 Q_DECLARE_METATYPE(Protocol::SpectrumAnalyzerResult);
 
-class USBInBuffer : public QObject {
-    Q_OBJECT;
-public:
-    USBInBuffer(libusb_device_handle *handle, unsigned char endpoint, int buffer_size);
-    ~USBInBuffer();
-
-    void removeBytes(int handled_bytes);
-    int getReceived() const;
-    uint8_t *getBuffer() const;
-
-signals:
-    void DataReceived();
-    void TransferError();
-
-private:
-    void Callback(libusb_transfer *transfer);
-    static void LIBUSB_CALL CallbackTrampoline(libusb_transfer *transfer);
-    libusb_transfer *transfer;
-    unsigned char *buffer;
-    int buffer_size;
-    int received_size;
-    bool inCallback;
-    std::condition_variable cv;
-};
-
-
 class Device : public QObject
 {
     Q_OBJECT
@@ -54,28 +29,51 @@ public:
     };
     Q_ENUM(TransmissionResult)
 
-    // connect to a VNA device. If serial is specified only connecting to this device, otherwise to the first one found
+    // connect to a VNA device over USB. If serial is specified only connecting to this device, otherwise to the first one found.
+    // Throws std::runtime_error if the connection could not be established
     Device(QString serial = QString());
+    // use an already established connection (e.g. a simulated device). The device takes ownership of the transport
+    Device(DeviceTransport *transport);
     ~Device();
     bool SendPacket(const Protocol::PacketInfo& packet, std::function<void(TransmissionResult)> cb = nullptr, unsigned int timeout = 200);
     bool Configure(Protocol::SweepSettings settings, std::function<void(TransmissionResult)> cb = nullptr);
+    // Sweep defined by a segment table (only used if settings.segmentTable is set). Devices without support for segment
+    // tables sweep from the start of the first to the stop of the last segment with the IF bandwidth and level of the settings
+    bool Configure(Protocol::SweepSettings settings, const Protocol::SweepSegments &segments, std::function<void(TransmissionResult)> cb = nullptr);
     bool Configure(Protocol::SpectrumAnalyzerSettings settings);
     bool SetManual(Protocol::ManualControl manual);
     bool SetIdle();
-    bool SendFirmwareChunk(Protocol::FirmwarePacket &fw);
+    // Starts a triggered sweep or restarts a sweep held after SweepSettings::sweeps sweeps. Nack if the device is
+    // still sweeping. Requires Capabilities::SweepModes
+    bool TriggerSweep(std::function<void(TransmissionResult)> cb = nullptr);
+    bool SendFirmwareChunk(Protocol::FirmwarePacket &fw, std::function<void(TransmissionResult)> cb = nullptr);
     bool SendCommandWithoutPayload(Protocol::PacketType type);
     QString serial() const;
+    // Returns the optional protocol features that are supported by both the device and the application
+    Protocol::Capabilities getCapabilities() const;
     Protocol::DeviceInfo getLastInfo() const;
     QString getLastDeviceInfoString();
+    // ADC samplerate of the device (see Protocol::SweepPlanParameters), zero if it has not been reported yet
+    uint32_t getADCSamplerate();
+    // Receive rate of the data endpoint in bytes per second
+    double getDataThroughput() const;
+    // Takes the oldest received datapoint from the queue. Returns false if no datapoint is available.
+    // Only call from a single thread (usually the receiver of DatapointsAvailable)
+    bool getDatapoint(Protocol::Datapoint &d);
 
     // Returns serial numbers of all connected devices
     static std::set<QString> GetDevices();
     static Protocol::DeviceLimits Limits();
 signals:
-    void DatapointReceived(Protocol::Datapoint);
+    // New datapoints have been added to the queue, count is the number of queued points at the time of emitting.
+    // Only one of these signals is pending at a time: the signal is emitted again once getDatapoint() was called
+    // after the previous one, the receiver should fetch all available datapoints
+    void DatapointsAvailable(unsigned int count);
     void ManualStatusReceived(Protocol::ManualStatus);
     void SpectrumResultReceived(Protocol::SpectrumAnalyzerResult);
     void DeviceInfoUpdated();
+    // The requested number of sweeps is complete, emitted after the last datapoint has been queued
+    void SweepComplete();
     void ConnectionLost();
     void AckReceived();
     void NackReceived();
@@ -84,26 +82,18 @@ private slots:
     void ReceivedData();
     void ReceivedLog();
     void transmissionTimeout() {
-        transmissionFinished(TransmissionResult::Timeout);
+        transmissionFinished(TransmissionResult::Timeout, 0);
     }
-    void transmissionFinished(TransmissionResult result);
+    // sequence is the sequence number of the answered packet (zero for the oldest pending packet)
+    void transmissionFinished(TransmissionResult result, quint8 sequence);
 signals:
-    void receivedAnswer(TransmissionResult result);
+    void receivedAnswer(TransmissionResult result, quint8 sequence);
 
 private:
-    static constexpr int EP_Data_Out_Addr = 0x01;
-    static constexpr int EP_Data_In_Addr = 0x81;
-    static constexpr int EP_Log_In_Addr = 0x82;
 
-    void USBHandleThread();
-    // foundCallback is called for every device that is found. If it returns true the search continues, otherwise it is aborted.
-    // When the search is aborted the last found device is still opened
-    static void SearchDevices(std::function<bool(libusb_device_handle *handle, QString serial)> foundCallback, libusb_context *context);
-
-    libusb_device_handle *m_handle;
-    libusb_context *m_context;
-    USBInBuffer *dataBuffer;
-    USBInBuffer *logBuffer;
+    DeviceTransport *transport;
+    InBuffer *dataBuffer;
+    InBuffer *logBuffer;
 
     using Transmission = struct {
         Protocol::PacketInfo packet;
@@ -111,16 +101,63 @@ private:
         std::function<void(TransmissionResult)> callback;
     };
 
+    // packets waiting for transmission
     QQueue<Transmission> transmissionQueue;
-    bool startNextTransmission();
+    // transmitted packets waiting for their Ack/Nack, in order of transmission
+    QQueue<Transmission> transmissionsInFlight;
+    void startNextTransmissions();
+    // runs for the oldest packet in transmissionsInFlight
     QTimer transmissionTimer;
-    bool transmissionActive;
+    uint8_t nextSequence;
+
+    // Received datapoints, filled by the receive thread
+    SPSCQueue<Protocol::Datapoint> datapointQueue;
+    std::atomic<bool> datapointsAvailablePending;
+    // points lost because the queue was full, only accessed by the receive thread
+    unsigned int datapointsDiscarded;
+    void queueDatapoint(const Protocol::Datapoint &d);
+    // Port-blocked sweeps: points of the port 1 half (S11/S21) waiting for the port 2 half, indexed by the point number.
+    // Only accessed with sweepSettingsMutex held
+    std::vector<Protocol::Datapoint> forwardPoints;
+    std::vector<bool> forwardValid;
+    void mergeDatapoint(const Protocol::Datapoint &d);
 
-    QString m_serial;
-    bool m_connected;
-    std::thread *m_receiveThread;
     Protocol::DeviceInfo lastInfo;
     bool lastInfoValid;
+    // written by the receive thread, use getCapabilities() to read it
+    Protocol::Capabilities deviceCapabilities;
+    mutable std::mutex capabilitiesMutex;
+    // Settings (and segment table) of the sweep the received datapoints belong to. Only replaced once the device
+    // acknowledged new settings, batches received before the Ack still belong to the previous sweep
+    Protocol::SweepSettings sweepSettings;
+    Protocol::SweepSegments sweepSegments;
+    bool sweepSettingsValid;
+    // SweepSettings packets sent to the device and not answered yet, with the segment table sent before them
+    using SentSettings = struct {
+        quint8 sequence;
+        Protocol::SweepSettings settings;
+        Protocol::SweepSegments segments;
+    };
+    QQueue<SentSettings> sentSettings;
+    Protocol::SweepSegments sentSegments;
+    // Called by the receive thread for every Ack/Nack, switches to the acknowledged settings
+    void settingsAnswered(bool ack, quint8 sequence);
+    // Settings packet that will not be answered (timeout or not sent)
+    void forgetSentSettings(const Protocol::PacketInfo &packet);
+    std::mutex sweepSettingsMutex;
+    // Calculates the sweep plan and uploads it to the device. Returns false if the plan could not be calculated.
+    // Nothing is uploaded if the device still holds the plan for these settings
+    bool UploadSweepPlan(const Protocol::SweepSettings &settings);
+    // Removes the queued points of a sweep plan that have not been sent yet, a new configuration supersedes them
+    void DropSupersededPlan();
+    // device properties required for calculating sweep plans, filled by the receive thread
+    Protocol::SweepPlanParameters planParameters;
+    bool planParametersValid;
+    // settings and revision of the last uploaded plan, valid as long as the device holds it
+    Protocol::SweepSettings uploadedPlanSettings;
+    uint8_t uploadedPlanRevision;
+    bool uploadedPlanValid;
+    std::mutex planParametersMutex;
 };
 
 #endif // DEVICE_H
@@ -0,0 +1,141 @@
+#include "devicetransport.h"
+
+#include <QDebug>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+using namespace std;
+
+InBuffer::InBuffer(int buffer_size, int spill_size) :
+    buffer_size(buffer_size),
+    spill_size(spill_size),
+    read_pos(0),
+    received_size(0),
+    inCallback(false),
+    totalReceived(0),
+    throughput(0.0),
+    lastUpdate(chrono::steady_clock::now().time_since_epoch().count()),
+    intervalStart(chrono::steady_clock::now()),
+    intervalStartReceived(0)
+{
+    if(spill_size <= 0 || buffer_size < 2 * spill_size) {
+        throw runtime_error("Invalid receive buffer configuration");
+    }
+    buffer = new unsigned char[buffer_size + spill_size];
+}
+
+InBuffer::~InBuffer()
+{
+    delete[] buffer;
+}
+
+void InBuffer::removeBytes(int handled_bytes)
+{
+    if(!inCallback) {
+        throw runtime_error("Removing of bytes is only allowed from within receive callback");
+    }
+    if(handled_bytes >= received_size) {
+        // no write is active while in the callback, start at the beginning of the ring again
+        clear();
+    } else {
+        read_pos = (read_pos + handled_bytes) % buffer_size;
+        received_size -= handled_bytes;
+    }
+}
+
+int InBuffer::getReceived() const
+{
+    return min(received_size, buffer_size + spill_size - read_pos);
+}
+
+uint8_t *InBuffer::getBuffer() const
+{
+    return &buffer[read_pos];
+}
+
+constexpr chrono::milliseconds InBuffer::ThroughputInterval;
+
+uint64_t InBuffer::getTotalReceived() const
+{
+    return totalReceived;
+}
+
+double InBuffer::getThroughput() const
+{
+    auto sinceUpdate = chrono::steady_clock::now().time_since_epoch() - chrono::steady_clock::duration(lastUpdate);
+    if(sinceUpdate > 2 * ThroughputInterval) {
+        // nothing received for at least one complete interval
+        return 0.0;
+    }
+    return throughput;
+}
+
+bool InBuffer::write(const uint8_t *data, int length)
+{
+    if(length > buffer_size - received_size) {
+        return false;
+    }
+    while(length > 0) {
+        auto dest = getWritePointer();
+        int chunk = min(length, getMaxWrite());
+        memcpy(dest, data, chunk);
+        data += chunk;
+        length -= chunk;
+        commitWrite(dest, chunk);
+    }
+    return true;
+}
+
+uint8_t *InBuffer::getWritePointer() const
+{
+    return &buffer[(read_pos + received_size) % buffer_size];
+}
+
+int InBuffer::getMaxWrite() const
+{
+    int write_pos = (read_pos + received_size) % buffer_size;
+    // the write may continue into the spill area, the data is moved to the beginning of the ring in commitWrite
+    return min(buffer_size - received_size, buffer_size + spill_size - write_pos);
+}
+
+void InBuffer::commitWrite(uint8_t *pos, int length)
+{
+    int start = pos - buffer;
+    int end = start + length;
+    if(end > buffer_size) {
+        // the write continued into the spill area, this data belongs to the beginning of the ring
+        int from = max(start, buffer_size);
+        memcpy(&buffer[from - buffer_size], &buffer[from], end - from);
+    }
+    if(start < spill_size) {
+        // received data at the beginning of the ring, mirror into the spill area
+        int to = min(end, spill_size);
+        memcpy(&buffer[buffer_size + start], &buffer[start], to - start);
+    }
+    received_size += length;
+    updateThroughput(length);
+    inCallback = true;
+    emit DataReceived();
+    inCallback = false;
+}
+
+void InBuffer::clear()
+{
+    read_pos = 0;
+    received_size = 0;
+}
+
+void InBuffer::updateThroughput(int length)
+{
+    totalReceived += length;
+    auto now = chrono::steady_clock::now();
+    auto elapsed = now - intervalStart;
+    if(elapsed >= ThroughputInterval) {
+        double seconds = chrono::duration<double>(elapsed).count();
+        throughput = (totalReceived - intervalStartReceived) / seconds;
+        intervalStart = now;
+        intervalStartReceived = totalReceived;
+        lastUpdate = now.time_since_epoch().count();
+    }
+}
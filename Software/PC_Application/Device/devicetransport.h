@@ -0,0 +1,88 @@
+#ifndef DEVICETRANSPORT_H
+#define DEVICETRANSPORT_H
+
+#include <QObject>
+#include <QString>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+
+// Buffer for data received from a device.
+// The received data is stored in a ring buffer of buffer_size bytes. Behind the ring is a spill area of
+// spill_size bytes which mirrors the beginning of the ring. This guarantees that up to spill_size bytes
+// starting at any position of the ring are available contiguously in memory, without moving any data.
+class InBuffer : public QObject {
+    Q_OBJECT;
+public:
+    InBuffer(int buffer_size, int spill_size = 4096);
+    virtual ~InBuffer();
+
+    // Only allowed from within a slot directly connected to DataReceived
+    void removeBytes(int handled_bytes);
+    // Returns the number of received bytes that are available contiguously at getBuffer().
+    // This might be less than the total amount of received bytes if the data wraps around the ring but
+    // is always at least min(<received bytes>, spill_size)
+    int getReceived() const;
+    uint8_t *getBuffer() const;
+
+    // Copies data into the buffer and emits DataReceived. Returns false if there is not enough space left
+    bool write(const uint8_t *data, int length);
+
+    // Total number of bytes received since the buffer was created
+    uint64_t getTotalReceived() const;
+    // Receive rate in bytes per second, averaged over the last measurement interval of ThroughputInterval
+    double getThroughput() const;
+    static constexpr std::chrono::milliseconds ThroughputInterval = std::chrono::milliseconds(1000);
+
+signals:
+    void DataReceived();
+    void TransferError();
+
+protected:
+    // Returns the position of the next write. Up to getMaxWrite() bytes may be written directly to this
+    // position (possibly into the spill area), the write has to be completed by calling commitWrite()
+    uint8_t *getWritePointer() const;
+    int getMaxWrite() const;
+    // Moves data written into the spill area into the ring (and vice versa) and emits DataReceived
+    void commitWrite(uint8_t *start, int length);
+    // Discards all received data
+    void clear();
+
+    unsigned char *buffer;
+    int buffer_size;
+    int spill_size;
+    int read_pos;
+    int received_size;
+    bool inCallback;
+
+private:
+    void updateThroughput(int length);
+    std::atomic<uint64_t> totalReceived;
+    std::atomic<double> throughput;
+    // time of the last throughput update, also read from other threads in getThroughput()
+    std::atomic<std::chrono::steady_clock::rep> lastUpdate;
+    std::chrono::steady_clock::time_point intervalStart;
+    uint64_t intervalStartReceived;
+};
+
+// Connection to a device. The transport only moves raw bytes, the protocol is handled by the Device class
+class DeviceTransport : public QObject
+{
+    Q_OBJECT
+public:
+    virtual ~DeviceTransport(){};
+
+    virtual QString serial() const = 0;
+    // Transmits an encoded packet to the device. The transmission might still be in progress when this function
+    // returns, the data is copied if necessary. Returns true if the data was sent (or queued for sending)
+    virtual bool send(const uint8_t *data, int length) = 0;
+    // Data received from the device. The DataReceived signals are emitted from a transport specific thread,
+    // the data has to be handled in a directly connected slot
+    virtual InBuffer *dataBuffer() = 0;
+    virtual InBuffer *logBuffer() = 0;
+
+signals:
+    void ConnectionLost();
+};
+
+#endif // DEVICETRANSPORT_H
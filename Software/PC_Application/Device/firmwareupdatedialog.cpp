@@ -2,6 +2,7 @@
 #include "ui_firmwareupdatedialog.h"
 #include <QFileDialog>
 #include <QStyle>
+#include <QPointer>
 
 FirmwareUpdateDialog::FirmwareUpdateDialog(Device *dev, QWidget *parent) :
     QDialog(parent),
@@ -124,23 +125,16 @@ void FirmwareUpdateDialog::receivedAck()
         // FLASH erased, begin transferring firmware
         state = State::TransferringData;
         transferredBytes = 0;
+        sentBytes = 0;
         addStatus("Transferring firmware...");
-        sendNextFirmwareChunk();
+        // queue several chunks, the device can receive the next chunk while still writing the previous one
+        for(unsigned int i=0;i<ChunksInFlight && sentBytes < file->size();i++) {
+            sendNextFirmwareChunk();
+        }
         timer.start(1000);
         break;
     case State::TransferringData:
-        transferredBytes += Protocol::FirmwareChunkSize;
-        ui->progress->setValue(100 * transferredBytes / file->size());
-        if(transferredBytes >= file->size()) {
-            // complete file transferred
-            addStatus("Triggering device update...");
-            state = State::TriggeringUpdate;
-            dev->SendCommandWithoutPayload(Protocol::PacketType::PerformFirmwareUpdate);
-            timer.start(5000);
-        } else {
-            sendNextFirmwareChunk();
-            timer.start(1000);
-        }
+        // handled in firmwareChunkAnswered
         break;
     case State::TriggeringUpdate:
         addStatus("Rebooting device...");
@@ -158,6 +152,9 @@ void FirmwareUpdateDialog::receivedAck()
 void FirmwareUpdateDialog::receivedNack()
 {
     switch(state) {
+    case State::TransferringData:
+        // handled in firmwareChunkAnswered
+        break;
     case State::ErasingFLASH:
         abortWithError("Nack received, device does not support firmware update");
         break;
@@ -168,10 +165,49 @@ void FirmwareUpdateDialog::receivedNack()
 
 }
 
+void FirmwareUpdateDialog::firmwareChunkAnswered(Device::TransmissionResult result)
+{
+    if(state != State::TransferringData) {
+        // transfer already aborted
+        return;
+    }
+    switch(result) {
+    case Device::TransmissionResult::Ack:
+        break;
+    case Device::TransmissionResult::Nack:
+        abortWithError("Nack received, something went wrong");
+        return;
+    default:
+        abortWithError("Response timed out");
+        return;
+    }
+    transferredBytes += Protocol::FirmwareChunkSize;
+    ui->progress->setValue(100 * transferredBytes / file->size());
+    if(transferredBytes >= file->size()) {
+        // complete file transferred
+        addStatus("Triggering device update...");
+        state = State::TriggeringUpdate;
+        dev->SendCommandWithoutPayload(Protocol::PacketType::PerformFirmwareUpdate);
+        timer.start(5000);
+    } else {
+        if(sentBytes < file->size()) {
+            sendNextFirmwareChunk();
+        }
+        timer.start(1000);
+    }
+}
+
 void FirmwareUpdateDialog::sendNextFirmwareChunk()
 {
     Protocol::FirmwarePacket fw;
-    fw.address = transferredBytes;
+    fw.address = sentBytes;
     file->read((char*) &fw.data, Protocol::FirmwareChunkSize);
-    dev->SendFirmwareChunk(fw);
+    sentBytes += Protocol::FirmwareChunkSize;
+    // the answer might arrive after the dialog has been closed
+    QPointer<FirmwareUpdateDialog> dialog = this;
+    dev->SendFirmwareChunk(fw, [=](Device::TransmissionResult result) {
+        if(dialog) {
+            dialog->firmwareChunkAnswered(result);
+        }
+    });
 }
@@ -35,6 +35,7 @@ private slots:
     void timerCallback();
     void receivedAck();
     void receivedNack();
+    void firmwareChunkAnswered(Device::TransmissionResult result);
 
 private:
     void addStatus(QString line);
@@ -54,7 +55,10 @@ private:
         WaitBeforeInitializing,
     };
     State state;
+    // Number of firmware chunks that are queued for transmission at the same time
+    static constexpr unsigned int ChunksInFlight = 8;
     unsigned int transferredBytes;
+    unsigned int sentBytes;
     QString serialnumber;
 };
 
@@ -0,0 +1,484 @@
+#include "simulateddevice.h"
+
+#include <QDebug>
+#include <cmath>
+#include <cstring>
+
+using namespace std;
+
+const QString SimulatedDevice::Serial = "Simulation";
+
+// Same limits as the real hardware
+static constexpr Protocol::DeviceLimits simulatedLimits = {
+    .minFreq = 0,
+    .maxFreq = 6000000000,
+    .minIFBW = 6,
+    .maxIFBW = 50000,
+    .maxPoints = 4501,
+    .cdbm_min = -4000,
+    .cdbm_max = 0,
+    .minRBW = 13,
+    .maxRBW = 111500,
+    .maxSweepPoints = 100000,
+};
+
+static constexpr Protocol::Capabilities simulatedCapabilities = {
+    .DatapointBatches = 1,
+    .CompactDatapoints = 1,
+    .SequencedAcks = 1,
+    .LongSweeps = 1,
+    .SegmentTables = 1,
+    .LogSweeps = 1,
+    .SweepModes = 1,
+    .PointAveraging = 1,
+};
+
+// The device holds back datapoints for at most this time when collecting them into batches
+static constexpr auto maxBatchDelay = chrono::milliseconds(20);
+// Spectrum analyzer test signal (at the center of the span, passed through the DUT)
+static constexpr double SAToneLevel = -30.0;
+static constexpr double SANoiseFloor = -120.0;
+// Scaling of the spectrum analyzer results, reverted in the application
+static const double SAResultScaling = pow(10.0, 7.5);
+
+SimulatedDevice::Config SimulatedDevice::DefaultConfig()
+{
+    Config c;
+    c.dut = DUT::SeriesRLC;
+    c.R = 10.0;
+    c.L = 100e-9;
+    c.C = 10e-12;
+    c.lineLength = 1.0;
+    c.lineImpedance = 50.0;
+    c.lineLoss = 0.5;
+    c.lineVelocityFactor = 0.66;
+    c.noise = 0.001;
+    c.pointRate = 10000;
+    return c;
+}
+
+SimulatedDevice::SimulatedDevice(Config config) :
+    config(config),
+    running(true),
+    mode(Mode::Idle),
+    hostCapabilities({}),
+    pointNum(0),
+    sweepCnt(0),
+    pointRate(config.pointRate),
+    pointsMeasured(0),
+    batchCnt(0)
+{
+    if(config.pointRate <= 0) {
+        throw runtime_error("Invalid point rate for simulated device");
+    }
+    vnaSegments.count = 0;
+    m_dataBuffer = new InBuffer(65536);
+    m_logBuffer = new InBuffer(65536);
+    m_thread = new thread(&SimulatedDevice::SimulationThread, this);
+    qInfo() << "Simulated device started";
+}
+
+SimulatedDevice::~SimulatedDevice()
+{
+    {
+        lock_guard<mutex> lock(rxMutex);
+        running = false;
+    }
+    rxCondition.notify_all();
+    m_thread->join();
+    delete m_thread;
+    delete m_dataBuffer;
+    delete m_logBuffer;
+}
+
+QString SimulatedDevice::serial() const
+{
+    return Serial;
+}
+
+bool SimulatedDevice::send(const uint8_t *data, int length)
+{
+    // decode the packet(s) right away, the simulation thread only handles complete packets
+    uint8_t buf[1024];
+    if(length > (int) sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, data, length);
+    Protocol::PacketInfo p;
+    uint16_t handled;
+    int offset = 0;
+    do {
+        handled = Protocol::DecodeBuffer(&buf[offset], length - offset, &p);
+        offset += handled;
+        if(p.type != Protocol::PacketType::None) {
+            lock_guard<mutex> lock(rxMutex);
+            rxQueue.push(p);
+        }
+    } while(handled > 0);
+    rxCondition.notify_one();
+    return true;
+}
+
+InBuffer *SimulatedDevice::dataBuffer()
+{
+    return m_dataBuffer;
+}
+
+InBuffer *SimulatedDevice::logBuffer()
+{
+    return m_logBuffer;
+}
+
+void SimulatedDevice::DUTParameters(double frequency, complex<double> &S11, complex<double> &S21, complex<double> &S12, complex<double> &S22) const
+{
+    constexpr double Z0 = 50.0;
+    constexpr complex<double> j(0.0, 1.0);
+    // avoid divisions by zero at DC
+    double w = 2 * M_PI * std::max(frequency, 1.0);
+    // the two port DUTs are described by their ABCD matrix
+    complex<double> A = 1.0, B = 0.0, C = 0.0, D = 1.0;
+    switch(config.dut) {
+    case DUT::Open:
+        S11 = S22 = 1.0;
+        S21 = S12 = 0.0;
+        return;
+    case DUT::Short:
+        S11 = S22 = -1.0;
+        S21 = S12 = 0.0;
+        return;
+    case DUT::Load:
+        S11 = S22 = S21 = S12 = 0.0;
+        return;
+    case DUT::SeriesRLC:
+        B = config.R + j * w * config.L;
+        if(config.C > 0) {
+            B += 1.0 / (j * w * config.C);
+        }
+        break;
+    case DUT::ShuntRLC:
+        C = j * w * config.C;
+        if(config.R > 0) {
+            C += 1.0 / config.R;
+        }
+        if(config.L > 0) {
+            C += 1.0 / (j * w * config.L);
+        }
+        break;
+    case DUT::TransmissionLine: {
+        constexpr double c0 = 299792458.0;
+        double beta = w / (c0 * config.lineVelocityFactor);
+        // convert from dB to Neper
+        double alpha = config.lineLoss * sqrt(frequency / 1e9) / 8.686;
+        auto gl = complex<double>(alpha, beta) * config.lineLength;
+        A = D = cosh(gl);
+        B = config.lineImpedance * sinh(gl);
+        C = sinh(gl) / config.lineImpedance;
+    }
+        break;
+    }
+    auto denom = A + B / Z0 + C * Z0 + D;
+    S11 = (A + B / Z0 - C * Z0 - D) / denom;
+    S21 = 2.0 / denom;
+    S12 = 2.0 * (A * D - B * C) / denom;
+    S22 = (-A + B / Z0 - C * Z0 + D) / denom;
+}
+
+void SimulatedDevice::SimulationThread()
+{
+    while(running) {
+        queue<Protocol::PacketInfo> packets;
+        {
+            // wait until the next point is due or a packet has been received
+            auto timeout = clock::now() + chrono::milliseconds(100);
+            if(mode == Mode::VNA || mode == Mode::SA) {
+                auto next = measurementStart + chrono::duration_cast<clock::duration>(
+                            chrono::duration<double>((pointsMeasured + 1) / pointRate));
+                timeout = std::min(timeout, next);
+            }
+            unique_lock<mutex> lock(rxMutex);
+            rxCondition.wait_until(lock, timeout, [=]() {
+                return !rxQueue.empty() || !running;
+            });
+            swap(packets, rxQueue);
+        }
+        while(!packets.empty()) {
+            handlePacket(packets.front());
+            packets.pop();
+        }
+        if(mode != Mode::VNA && mode != Mode::SA) {
+            continue;
+        }
+        // take all points that are due
+        auto now = clock::now();
+        auto due = (uint64_t) (chrono::duration<double>(now - measurementStart).count() * pointRate);
+        // limit the number of points per iteration, packets from the host still need to be handled at high point rates
+        unsigned int limit = 1000;
+        // the VNA sweep may be held after its last point
+        while(pointsMeasured < due && limit-- && mode != Mode::VNAHeld) {
+            if(mode == Mode::VNA) {
+                nextVNAPoint();
+            } else {
+                nextSAPoint();
+            }
+            pointsMeasured++;
+        }
+        if(batchCnt) {
+            auto next = measurementStart + chrono::duration_cast<clock::duration>(
+                        chrono::duration<double>((pointsMeasured + 1) / pointRate));
+            if(next - now > maxBatchDelay) {
+                // slow sweep, do not hold back points for too long
+                flushBatch();
+            }
+        }
+    }
+}
+
+void SimulatedDevice::handlePacket(const Protocol::PacketInfo &p)
+{
+    switch(p.type) {
+    case Protocol::PacketType::SweepSettings:
+        vnaSettings = p.settings;
+        if(vnaSettings.segmentTable && Protocol::SegmentTablePoints(vnaSegments) < vnaSettings.points) {
+            vnaSettings.points = Protocol::SegmentTablePoints(vnaSegments);
+        }
+        if(vnaSettings.points > simulatedLimits.maxPoints && (!hostCapabilities.LongSweeps || !hostCapabilities.DatapointBatches)) {
+            vnaSettings.points = simulatedLimits.maxPoints;
+        } else if(vnaSettings.points > simulatedLimits.maxSweepPoints) {
+            vnaSettings.points = simulatedLimits.maxSweepPoints;
+        }
+        if(!hostCapabilities.SweepModes) {
+            vnaSettings.triggered = 0;
+            vnaSettings.sweeps = 0;
+        }
+        if(!hostCapabilities.PointAveraging || vnaSettings.segmentTable || vnaSettings.averages < 1) {
+            vnaSettings.averages = 1;
+        }
+        sweepCnt = 0;
+        if(!vnaSettings.excitePort1 && !vnaSettings.excitePort2) {
+            // both ports disabled, nothing to do
+            mode = Mode::Idle;
+        } else if(vnaSettings.triggered) {
+            mode = Mode::VNAHeld;
+        } else {
+            startMeasurement(Mode::VNA);
+        }
+        transmitWithoutPayload(Protocol::PacketType::Ack, p.sequence);
+        break;
+    case Protocol::PacketType::SweepTrigger:
+        if(mode == Mode::VNAHeld) {
+            sweepCnt = 0;
+            startMeasurement(Mode::VNA);
+            transmitWithoutPayload(Protocol::PacketType::Ack, p.sequence);
+        } else {
+            // no sweep configured or still sweeping
+            transmitWithoutPayload(Protocol::PacketType::Nack, p.sequence);
+        }
+        break;
+    case Protocol::PacketType::SweepSegments:
+        // used by the following sweep settings
+        mode = Mode::Idle;
+        vnaSegments = p.segments;
+        transmitWithoutPayload(Protocol::PacketType::Ack, p.sequence);
+        break;
+    case Protocol::PacketType::SpectrumAnalyzerSettings:
+        saSettings = p.spectrumSettings;
+        startMeasurement(Mode::SA);
+        transmitWithoutPayload(Protocol::PacketType::Ack, p.sequence);
+        break;
+    case Protocol::PacketType::ManualControl:
+    case Protocol::PacketType::Generator:
+        // not simulated, but stop any ongoing measurement
+        mode = Mode::Idle;
+        log("Manual control/generator mode is not simulated");
+        transmitWithoutPayload(Protocol::PacketType::Ack, p.sequence);
+        break;
+    case Protocol::PacketType::Reference:
+        transmitWithoutPayload(Protocol::PacketType::Ack, p.sequence);
+        break;
+    case Protocol::PacketType::RequestDeviceLimits: {
+        Protocol::PacketInfo answer;
+        answer.type = Protocol::PacketType::DeviceLimits;
+        answer.limits = simulatedLimits;
+        transmit(answer);
+        transmitWithoutPayload(Protocol::PacketType::Ack, p.sequence);
+    }
+        break;
+    case Protocol::PacketType::Capabilities: {
+        hostCapabilities = p.capabilities;
+        Protocol::PacketInfo answer;
+        answer.type = Protocol::PacketType::Capabilities;
+        answer.capabilities = simulatedCapabilities;
+        transmit(answer);
+        transmitWithoutPayload(Protocol::PacketType::Ack, p.sequence);
+    }
+        break;
+    default:
+        // this packet type is not supported
+        transmitWithoutPayload(Protocol::PacketType::Nack, p.sequence);
+        break;
+    }
+}
+
+void SimulatedDevice::transmit(const Protocol::PacketInfo &p)
+{
+    uint8_t buf[1024];
+    auto length = Protocol::EncodePacket(p, buf, sizeof(buf));
+    if(!length) {
+        qCritical() << "Simulated device failed to encode packet";
+        return;
+    }
+    if(!m_dataBuffer->write(buf, length)) {
+        qWarning() << "Simulated device: receive buffer full, packet dropped";
+    }
+}
+
+void SimulatedDevice::transmitWithoutPayload(Protocol::PacketType type, uint8_t sequence)
+{
+    Protocol::PacketInfo p;
+    p.type = type;
+    p.sequence = sequence;
+    transmit(p);
+}
+
+void SimulatedDevice::log(QString line)
+{
+    line.append("\r\n");
+    auto data = line.toLatin1();
+    m_logBuffer->write((const uint8_t*) data.constData(), data.size());
+}
+
+void SimulatedDevice::startMeasurement(Mode m)
+{
+    mode = m;
+    pointNum = 0;
+    pointRate = config.pointRate;
+    if(m == Mode::VNA) {
+        // each averaged point takes as long as the individual measurements
+        pointRate /= vnaSettings.averages;
+    }
+    pointsMeasured = 0;
+    // points from the previous measurement are discarded
+    batchCnt = 0;
+    measurementStart = clock::now();
+}
+
+void SimulatedDevice::nextVNAPoint()
+{
+    Protocol::Datapoint d;
+    d.pointNum = pointNum;
+    d.frequency = Protocol::SweepFrequency(vnaSettings, pointNum, &vnaSegments);
+    complex<double> S11, S21, S12, S22;
+    DUTParameters(d.frequency, S11, S21, S12, S22);
+    // averaging reduces the noise like the longer measurement of the real device
+    normal_distribution<double> dist(0.0, config.noise / sqrt(vnaSettings.averages));
+    auto noisy = [&](complex<double> S) -> complex<double> {
+        return S + complex<double>(dist(rng), dist(rng));
+    };
+    // only the parameters of excited ports are measured
+    S11 = vnaSettings.excitePort1 ? noisy(S11) : 0.0;
+    S21 = vnaSettings.excitePort1 ? noisy(S21) : 0.0;
+    S12 = vnaSettings.excitePort2 ? noisy(S12) : 0.0;
+    S22 = vnaSettings.excitePort2 ? noisy(S22) : 0.0;
+    d.real_S11 = S11.real();
+    d.imag_S11 = S11.imag();
+    d.real_S21 = S21.real();
+    d.imag_S21 = S21.imag();
+    d.real_S12 = S12.real();
+    d.imag_S12 = S12.imag();
+    d.real_S22 = S22.real();
+    d.imag_S22 = S22.imag();
+
+    bool lastPoint = pointNum >= vnaSettings.points - 1;
+    if(hostCapabilities.DatapointBatches) {
+        batch[batchCnt++] = d;
+        if(batchCnt >= Protocol::MaxBatchPoints || lastPoint) {
+            flushBatch();
+        }
+    } else {
+        Protocol::PacketInfo p;
+        p.type = Protocol::PacketType::Datapoint;
+        p.datapoint = d;
+        transmit(p);
+    }
+    if(lastPoint) {
+        // end of sweep, the device sends its status and starts the next sweep
+        pointNum = 0;
+        Protocol::PacketInfo p;
+        p.type = Protocol::PacketType::DeviceInfo;
+        p.info = {};
+        p.info.FW_major = 0;
+        p.info.FW_minor = 1;
+        p.info.HW_Revision = 'S';
+        p.info.FPGA_configured = 1;
+        p.info.source_locked = 1;
+        p.info.LO1_locked = 1;
+        p.info.temperatures.source = 40;
+        p.info.temperatures.LO1 = 40;
+        p.info.temperatures.MCU = 35;
+        p.info.sweepTime = vnaSettings.points * 1000000.0 / pointRate;
+        transmit(p);
+        // a triggered sweep measures at least once per trigger
+        uint16_t sweeps = vnaSettings.sweeps ? vnaSettings.sweeps : vnaSettings.triggered;
+        if(sweeps && ++sweepCnt >= sweeps) {
+            // wait for the next trigger
+            mode = Mode::VNAHeld;
+            transmitWithoutPayload(Protocol::PacketType::SweepComplete);
+        }
+    } else {
+        pointNum++;
+    }
+}
+
+void SimulatedDevice::nextSAPoint()
+{
+    Protocol::SpectrumAnalyzerResult r;
+    r.pointNum = pointNum;
+    if(saSettings.pointNum < 2) {
+        r.frequency = saSettings.f_start;
+    } else {
+        r.frequency = saSettings.f_start + (saSettings.f_stop - saSettings.f_start) * pointNum / (saSettings.pointNum - 1);
+    }
+    // test signal at the center of the span, shaped by the RBW filter
+    double center = (saSettings.f_start + saSettings.f_stop) / 2.0;
+    double sigma = std::max(saSettings.RBW, 1u) / 2.0;
+    double shape = exp(-0.5 * pow((r.frequency - center) / sigma, 2.0));
+    complex<double> S11, S21, S12, S22;
+    DUTParameters(center, S11, S21, S12, S22);
+    double tone = pow(10.0, SAToneLevel / 20.0) * shape;
+    // noise floor with Rayleigh distributed amplitude
+    normal_distribution<double> dist(0.0, pow(10.0, SANoiseFloor / 20.0));
+    auto noise = [&]() -> double {
+        return abs(complex<double>(dist(rng), dist(rng)));
+    };
+    r.port1 = (tone * abs(S11) + noise()) * SAResultScaling;
+    r.port2 = (tone * abs(S21) + noise()) * SAResultScaling;
+
+    Protocol::PacketInfo p;
+    p.type = Protocol::PacketType::SpectrumAnalyzerResult;
+    p.spectrumResult = r;
+    transmit(p);
+    if(pointNum >= saSettings.pointNum - 1) {
+        pointNum = 0;
+    } else {
+        pointNum++;
+    }
+}
+
+void SimulatedDevice::flushBatch()
+{
+    if(!batchCnt) {
+        return;
+    }
+    Protocol::PacketInfo p;
+    p.type = Protocol::PacketType::DatapointBatch;
+    p.batch.firstPointNum = batch[0].pointNum;
+    p.batch.count = batchCnt;
+    p.batch.format = Protocol::DatapointFormat::Full;
+    p.batch.ports = Protocol::DatapointPorts::Both;
+    if(hostCapabilities.CompactDatapoints && vnaSettings.dataFormat <= (uint8_t) Protocol::DatapointFormat::Compact16) {
+        p.batch.format = (Protocol::DatapointFormat) vnaSettings.dataFormat;
+    }
+    p.batch.points = batch;
+    transmit(p);
+    batchCnt = 0;
+}
@@ -0,0 +1,113 @@
+#ifndef SIMULATEDDEVICE_H
+#define SIMULATEDDEVICE_H
+
+#include "devicetransport.h"
+#include "../VNA_embedded/Application/Communication/Protocol.hpp"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <complex>
+#include <random>
+#include <chrono>
+#include <atomic>
+
+// Simulates a VNA without any hardware. Received packets are answered like the firmware does, measurements
+// are calculated from a model of the DUT. All data is transferred with the real protocol framing.
+class SimulatedDevice : public DeviceTransport
+{
+    Q_OBJECT
+public:
+    static const QString Serial;
+
+    enum class DUT {
+        // reflection standards on both ports, no transmission
+        Open,
+        Short,
+        Load,
+        // R, L and C in series between port 1 and port 2
+        SeriesRLC,
+        // R, L and C in parallel, connected from the through connection between port 1 and port 2 to ground
+        ShuntRLC,
+        // (lossy) transmission line between port 1 and port 2
+        TransmissionLine,
+    };
+
+    using Config = struct {
+        DUT dut;
+        // RLC values in Ohm, Henry and Farad. A value of zero removes the component
+        double R, L, C;
+        // transmission line parameters
+        double lineLength; // in meter
+        double lineImpedance; // in Ohm
+        double lineLoss; // in dB/m at 1GHz, scales with sqrt(frequency)
+        double lineVelocityFactor;
+        // standard deviation of the noise added to the real and imaginary part of each S-parameter
+        double noise;
+        // number of points measured per second
+        double pointRate;
+    };
+    static Config DefaultConfig();
+
+    SimulatedDevice(Config config = DefaultConfig());
+    ~SimulatedDevice();
+
+    QString serial() const override;
+    bool send(const uint8_t *data, int length) override;
+    InBuffer *dataBuffer() override;
+    InBuffer *logBuffer() override;
+
+    // S-parameters of the simulated DUT (without noise)
+    void DUTParameters(double frequency, std::complex<double> &S11, std::complex<double> &S21,
+                       std::complex<double> &S12, std::complex<double> &S22) const;
+
+private:
+    enum class Mode {
+        Idle,
+        VNA,
+        // VNA sweep configured, waiting for a SweepTrigger
+        VNAHeld,
+        SA,
+    };
+    using clock = std::chrono::steady_clock;
+
+    void SimulationThread();
+    void handlePacket(const Protocol::PacketInfo &p);
+    void transmit(const Protocol::PacketInfo &p);
+    void transmitWithoutPayload(Protocol::PacketType type, uint8_t sequence = 0);
+    void log(QString line);
+    void startMeasurement(Mode m);
+    void nextVNAPoint();
+    void nextSAPoint();
+    void flushBatch();
+
+    Config config;
+    InBuffer *m_dataBuffer;
+    InBuffer *m_logBuffer;
+
+    // packets received from the host, handled by the simulation thread
+    std::queue<Protocol::PacketInfo> rxQueue;
+    std::mutex rxMutex;
+    std::condition_variable rxCondition;
+    std::atomic<bool> running;
+    std::thread *m_thread;
+
+    // state of the simulated device, only accessed from the simulation thread
+    Mode mode;
+    Protocol::SweepSettings vnaSettings;
+    Protocol::SweepSegments vnaSegments;
+    Protocol::SpectrumAnalyzerSettings saSettings;
+    Protocol::Capabilities hostCapabilities;
+    uint32_t pointNum;
+    // completed sweeps since the last trigger (see SweepSettings::sweeps)
+    uint16_t sweepCnt;
+    // points per second of the current measurement, lower than configured with point averaging
+    double pointRate;
+    clock::time_point measurementStart;
+    uint64_t pointsMeasured;
+    Protocol::Datapoint batch[Protocol::MaxBatchPoints];
+    uint8_t batchCnt;
+    std::mt19937 rng;
+};
+
+#endif // SIMULATEDDEVICE_H
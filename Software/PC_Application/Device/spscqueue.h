@@ -0,0 +1,65 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+// Lock-free queue for exactly one producer thread and one consumer thread.
+// The capacity is rounded up to the next power of two.
+template<typename T>
+class SPSCQueue
+{
+public:
+    SPSCQueue(size_t capacity) :
+        head(0),
+        tail(0)
+    {
+        size_t size = 1;
+        while(size < capacity) {
+            size <<= 1;
+        }
+        buffer.resize(size);
+        mask = size - 1;
+    }
+
+    // Only call from the producer thread. Returns false if the queue is full
+    bool push(const T &item) {
+        auto t = tail.load(std::memory_order_relaxed);
+        if(t - head.load(std::memory_order_acquire) >= buffer.size()) {
+            return false;
+        }
+        buffer[t & mask] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Only call from the consumer thread. Returns false if the queue is empty
+    bool pop(T &item) {
+        auto h = head.load(std::memory_order_relaxed);
+        if(h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = buffer[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Number of queued items. Only a snapshot if called while the other thread is active
+    size_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const {
+        return buffer.size();
+    }
+
+private:
+    std::vector<T> buffer;
+    size_t mask;
+    // head is only written by the consumer, tail only by the producer. Keep them on separate cache lines
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+#endif // SPSCQUEUE_H
@@ -0,0 +1,381 @@
+#include "usbtransport.h"
+
+#include <QDebug>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+using USBID = struct {
+    int VID;
+    int PID;
+};
+static constexpr USBID IDs[] = {
+    {0x0483, 0x564e},
+    {0x0483, 0x4121},
+};
+
+USBInBuffer::USBInBuffer(libusb_device_handle *handle, unsigned char endpoint, int buffer_size, int transfers, int transfer_size) :
+    InBuffer(buffer_size),
+    transfers(max(transfers, 1)),
+    cancelling(false),
+    errorReported(false)
+{
+    // only request complete USB packets, otherwise the transfer might overflow
+    transfer_size -= transfer_size % USBPacketSize;
+    transfer_size = max(transfer_size, USBPacketSize);
+    lock_guard<mutex> lck(mtx);
+    for(auto &t : this->transfers) {
+        t.buffer = this;
+        t.transfer = libusb_alloc_transfer(0);
+        auto data = new unsigned char[transfer_size];
+        libusb_fill_bulk_transfer(t.transfer, handle, endpoint, data, transfer_size, CallbackTrampoline, &t, 100);
+        submitTransfer(&t);
+    }
+}
+
+USBInBuffer::~USBInBuffer()
+{
+    unique_lock<mutex> lck(mtx);
+    cancelling = true;
+    for(auto t : queued) {
+        libusb_cancel_transfer(t->transfer);
+    }
+    // wait for cancellation to complete
+    using namespace std::chrono_literals;
+    if(!cv.wait_for(lck, 100ms, [=]() { return queued.empty(); })) {
+        qWarning() << "Timed out waiting for transfer cancellation during disconnect";
+        // the remaining transfers might still be accessed by libusb, leak them instead of freeing
+        return;
+    }
+    for(auto &t : transfers) {
+        delete[] t.transfer->buffer;
+        libusb_free_transfer(t.transfer);
+    }
+}
+
+void USBInBuffer::Callback(Transfer *t)
+{
+    lock_guard<mutex> lck(mtx);
+    t->completed = true;
+    bool error = false;
+    switch(t->transfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+    case LIBUSB_TRANSFER_TIMED_OUT:
+        // the transfer might contain data in both cases
+        break;
+    case LIBUSB_TRANSFER_CANCELLED:
+        if(!cancelling) {
+            qCritical() << "LIBUSB_TRANSFER_CANCELLED";
+            error = true;
+        }
+        break;
+    case LIBUSB_TRANSFER_ERROR:
+        qCritical() << "LIBUSB_TRANSFER_ERROR";
+        error = true;
+        break;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+        qCritical() << "LIBUSB_TRANSFER_NO_DEVICE";
+        error = true;
+        break;
+    case LIBUSB_TRANSFER_OVERFLOW:
+        qCritical() << "LIBUSB_TRANSFER_OVERFLOW";
+        error = true;
+        break;
+    case LIBUSB_TRANSFER_STALL:
+        qCritical() << "LIBUSB_TRANSFER_STALL";
+        error = true;
+        break;
+    }
+    if(cancelling || error) {
+        // do not resubmit
+        queued.erase(find(queued.begin(), queued.end(), t));
+        if(cancelling) {
+            cv.notify_all();
+        } else if(!errorReported) {
+            errorReported = true;
+            emit TransferError();
+        }
+        return;
+    }
+    // Transfers usually complete in order. If not, the data is held back until all earlier transfers have completed
+    while(queued.size() && queued.front()->completed) {
+        auto next = queued.front();
+        queued.pop_front();
+        storeData(next->transfer->buffer, next->transfer->actual_length);
+        if(!submitTransfer(next) && !errorReported) {
+            errorReported = true;
+            emit TransferError();
+        }
+    }
+}
+
+bool USBInBuffer::submitTransfer(Transfer *t)
+{
+    t->completed = false;
+    auto ret = libusb_submit_transfer(t->transfer);
+    if(ret < 0) {
+        qCritical() << "Failed to submit transfer:" << libusb_strerror((libusb_error) ret);
+        return false;
+    }
+    queued.push_back(t);
+    return true;
+}
+
+void USBInBuffer::storeData(const uint8_t *data, int length)
+{
+    if(length <= 0) {
+        return;
+    }
+    if(!write(data, length)) {
+        qWarning() << "USB receive buffer full, discarding data";
+        clear();
+        write(data, length);
+    }
+}
+
+void USBInBuffer::CallbackTrampoline(libusb_transfer *transfer)
+{
+    auto t = (Transfer*) transfer->user_data;
+    t->buffer->Callback(t);
+}
+
+USBTransport::USBTransport(QString serial, int dataTransfers)
+{
+    qDebug() << "Starting USB connection...";
+
+    m_handle = nullptr;
+    m_cancellingSends = false;
+    libusb_init(&m_context);
+
+    QString openError;
+    SearchDevices([=](libusb_device_handle *handle, QString found_serial) -> bool {
+        if(serial.isEmpty() || serial == found_serial) {
+            // accept connection to this device
+            m_serial = found_serial;
+            m_handle = handle;
+            // abort device search
+            return false;
+        } else {
+            // not the requested device, continue search
+            return true;
+        }
+    }, m_context, &openError);
+
+    if(!m_handle) {
+        QString message =  "No device found";
+        if(!openError.isEmpty()) {
+            message = openError;
+        }
+        libusb_exit(m_context);
+        throw std::runtime_error(message.toStdString());
+    }
+
+    // Found the correct device, now connect
+    /* claim the interfaces */
+    for (int if_num = 0; if_num < 1; if_num++) {
+        int ret = libusb_claim_interface(m_handle, if_num);
+        if (ret < 0) {
+            libusb_close(m_handle);
+            /* Failed to open */
+            QString message =  "Failed to claim interface: \"";
+            message.append(libusb_strerror((libusb_error) ret));
+            message.append("\" Maybe you are already connected to this device?");
+            qWarning() << message;
+            libusb_exit(m_context);
+            throw std::runtime_error(message.toStdString());
+        }
+    }
+    qInfo() << "USB connection established" << flush;
+    m_connected = true;
+    m_receiveThread = new std::thread(&USBTransport::USBHandleThread, this);
+    m_dataBuffer = new USBInBuffer(m_handle, EP_Data_In_Addr, 65536, dataTransfers);
+    m_logBuffer = new USBInBuffer(m_handle, EP_Log_In_Addr, 65536);
+    connect(m_dataBuffer, &InBuffer::TransferError, this, &DeviceTransport::ConnectionLost);
+}
+
+USBTransport::~USBTransport()
+{
+    {
+        // give queued packets (e.g. the idle command sent on disconnect) a chance to reach the device
+        unique_lock<mutex> lck(m_sendMutex);
+        using namespace std::chrono_literals;
+        if(!m_sendCv.wait_for(lck, 100ms, [=]() { return m_pendingSends.empty(); })) {
+            qWarning() << "Timed out waiting for pending transmissions during disconnect";
+            // OUT transfers have no timeout, cancel them. Their callbacks access this object and have to run
+            // (in the event thread) before the handle is closed
+            m_cancellingSends = true;
+            for(auto t : m_pendingSends) {
+                libusb_cancel_transfer(t);
+            }
+            m_sendCv.wait(lck, [=]() { return m_pendingSends.empty(); });
+        }
+    }
+    delete m_dataBuffer;
+    delete m_logBuffer;
+    m_connected = false;
+    for (int if_num = 0; if_num < 1; if_num++) {
+        int ret = libusb_release_interface(m_handle, if_num);
+        if (ret < 0) {
+            qCritical() << "Error releasing interface" << libusb_error_name(ret);
+        }
+    }
+    libusb_close(m_handle);
+    m_receiveThread->join();
+    libusb_exit(m_context);
+}
+
+QString USBTransport::serial() const
+{
+    return m_serial;
+}
+
+bool USBTransport::send(const uint8_t *data, int length)
+{
+    if(!m_connected) {
+        return false;
+    }
+    // the transfer is asynchronous, the data has to stay valid until it completes
+    auto buffer = new unsigned char[length];
+    memcpy(buffer, data, length);
+    auto transfer = libusb_alloc_transfer(0);
+    libusb_fill_bulk_transfer(transfer, m_handle, EP_Data_Out_Addr, buffer, length, SendCallbackTrampoline, this, 0);
+    lock_guard<mutex> lck(m_sendMutex);
+    auto ret = libusb_submit_transfer(transfer);
+    if(ret < 0) {
+        qCritical() << "Error sending data: "
+                                << libusb_strerror((libusb_error) ret);
+        delete[] buffer;
+        libusb_free_transfer(transfer);
+        return false;
+    }
+    m_pendingSends.insert(transfer);
+    return true;
+}
+
+void USBTransport::SendCallbackTrampoline(libusb_transfer *transfer)
+{
+    auto usb = (USBTransport*) transfer->user_data;
+    usb->SendCallback(transfer);
+}
+
+void USBTransport::SendCallback(libusb_transfer *transfer)
+{
+    lock_guard<mutex> lck(m_sendMutex);
+    if(transfer->status != LIBUSB_TRANSFER_COMPLETED && !m_cancellingSends) {
+        // the packet is lost, the device will not answer it
+        qCritical() << "Error sending data, transfer status" << transfer->status;
+    }
+    delete[] transfer->buffer;
+    libusb_free_transfer(transfer);
+    m_pendingSends.erase(transfer);
+    m_sendCv.notify_all();
+}
+
+InBuffer *USBTransport::dataBuffer()
+{
+    return m_dataBuffer;
+}
+
+InBuffer *USBTransport::logBuffer()
+{
+    return m_logBuffer;
+}
+
+std::set<QString> USBTransport::GetDevices()
+{
+    std::set<QString> serials;
+
+    libusb_context *ctx;
+    libusb_init(&ctx);
+
+    SearchDevices([&serials](libusb_device_handle *, QString serial) -> bool {
+        serials.insert(serial);
+        return true;
+    }, ctx);
+
+    libusb_exit(ctx);
+
+    return serials;
+}
+
+void USBTransport::USBHandleThread()
+{
+    qInfo() << "Receive thread started" << flush;
+    while (m_connected) {
+        libusb_handle_events(m_context);
+    }
+    qDebug() << "Disconnected, receive thread exiting";
+}
+
+void USBTransport::SearchDevices(std::function<bool (libusb_device_handle *, QString)> foundCallback, libusb_context *context, QString *openError)
+{
+    libusb_device **devList;
+    auto ndevices = libusb_get_device_list(context, &devList);
+
+    for (ssize_t idx = 0; idx < ndevices; idx++) {
+        int ret;
+        libusb_device *device = devList[idx];
+        libusb_device_descriptor desc = {};
+
+        ret = libusb_get_device_descriptor(device, &desc);
+        if (ret) {
+            /* some error occured */
+            qCritical() << "Failed to get device descriptor: "
+                    << libusb_strerror((libusb_error) ret);
+            continue;
+        }
+
+        bool correctID = false;
+        int numIDs = sizeof(IDs)/sizeof(IDs[0]);
+        for(int i=0;i<numIDs;i++) {
+            if(desc.idVendor == IDs[i].VID && desc.idProduct == IDs[i].PID) {
+                correctID = true;
+                break;
+            }
+        }
+        if(!correctID) {
+            continue;
+        }
+
+        /* Try to open the device */
+        libusb_device_handle *handle = nullptr;
+        ret = libusb_open(device, &handle);
+        if (ret) {
+            /* Failed to open */
+            QString message =  "Found potential device but failed to open usb connection: \"";
+            message.append(libusb_strerror((libusb_error) ret));
+            message.append("\" On Linux this is most likely caused by a missing udev rule. On Windows it could be a missing driver. Try installing the WinUSB driver using Zadig (https://zadig.akeo.ie/)");
+            qWarning() << message;
+            if(openError) {
+                *openError = message;
+            }
+            continue;
+        }
+
+        char c_product[256];
+        char c_serial[256];
+        libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber,
+                (unsigned char*) c_serial, sizeof(c_serial));
+        ret = libusb_get_string_descriptor_ascii(handle, desc.iProduct,
+                (unsigned char*) c_product, sizeof(c_product));
+        if (ret > 0) {
+            /* managed to read the product string */
+            QString product(c_product);
+            qDebug() << "Opened device: " << product;
+            if (product == "VNA") {
+                // this is a match
+                if(!foundCallback(handle, QString(c_serial))) {
+                    // abort search
+                    break;
+                }
+            }
+        } else {
+            qWarning() << "Failed to get product descriptor: "
+                    << libusb_strerror((libusb_error) ret);
+        }
+        libusb_close(handle);
+    }
+    libusb_free_device_list(devList, 1);
+}
@@ -0,0 +1,95 @@
+#ifndef USBTRANSPORT_H
+#define USBTRANSPORT_H
+
+#include "devicetransport.h"
+#include <libusb-1.0/libusb.h>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <deque>
+#include <condition_variable>
+#include <functional>
+#include <set>
+
+// Receives data from a bulk IN endpoint. Several transfers are kept queued at the endpoint so that the host
+// controller always has a buffer to receive into. Completed transfers are copied into the ring buffer in the
+// order they were submitted.
+class USBInBuffer : public InBuffer {
+    Q_OBJECT;
+public:
+    USBInBuffer(libusb_device_handle *handle, unsigned char endpoint, int buffer_size, int transfers = 1, int transfer_size = 4096);
+    ~USBInBuffer();
+
+private:
+    // USB full speed bulk packet size, transfers must be a multiple of this to avoid overflows
+    static constexpr int USBPacketSize = 64;
+    class Transfer {
+    public:
+        USBInBuffer *buffer;
+        libusb_transfer *transfer;
+        bool completed;
+    };
+    void Callback(Transfer *t);
+    static void LIBUSB_CALL CallbackTrampoline(libusb_transfer *transfer);
+    bool submitTransfer(Transfer *t);
+    void storeData(const uint8_t *data, int length);
+    std::vector<Transfer> transfers;
+    // submitted transfers, in the order of submission
+    std::deque<Transfer*> queued;
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool cancelling;
+    bool errorReported;
+};
+
+// Connection to a VNA over USB
+class USBTransport : public DeviceTransport
+{
+    Q_OBJECT
+public:
+    // connect to a VNA device. If serial is specified only connecting to this device, otherwise to the first one found.
+    // dataTransfers sets the number of bulk transfers kept queued at the data endpoint.
+    // Throws std::runtime_error if the connection could not be established
+    USBTransport(QString serial = QString(), int dataTransfers = DefaultDataTransfers);
+    ~USBTransport();
+
+    QString serial() const override;
+    bool send(const uint8_t *data, int length) override;
+    InBuffer *dataBuffer() override;
+    InBuffer *logBuffer() override;
+
+    // Returns serial numbers of all connected devices
+    static std::set<QString> GetDevices();
+
+    static constexpr int DefaultDataTransfers = 8;
+
+private:
+    static constexpr int EP_Data_Out_Addr = 0x01;
+    static constexpr int EP_Data_In_Addr = 0x81;
+    static constexpr int EP_Log_In_Addr = 0x82;
+
+    void USBHandleThread();
+    static void LIBUSB_CALL SendCallbackTrampoline(libusb_transfer *transfer);
+    void SendCallback(libusb_transfer *transfer);
+    // foundCallback is called for every device that is found. If it returns true the search continues, otherwise it is aborted.
+    // When the search is aborted the last found device is still opened. If a potential device could not be opened and
+    // openError is not nullptr, a description of the problem is stored in openError
+    static void SearchDevices(std::function<bool(libusb_device_handle *handle, QString serial)> foundCallback, libusb_context *context, QString *openError = nullptr);
+
+    libusb_device_handle *m_handle;
+    libusb_context *m_context;
+    USBInBuffer *m_dataBuffer;
+    USBInBuffer *m_logBuffer;
+
+    QString m_serial;
+    bool m_connected;
+    // submitted but not yet completed OUT transfers
+    std::set<libusb_transfer*> m_pendingSends;
+    // set while the remaining OUT transfers are cancelled on disconnect
+    bool m_cancellingSends;
+    std::mutex m_sendMutex;
+    std::condition_variable m_sendCv;
+    std::thread *m_receiveThread;
+};
+
+#endif // USBTRANSPORT_H
@@ -4,6 +4,9 @@
 
 using namespace std;
 
+// Upper limit for the number of frequency steps used in the time domain transformation
+static constexpr unsigned int maxTDRSteps = 65536;
+
 Trace::Trace(QString name, QColor color, LiveParameter live)
     : tdr_users(0),
       _name(name),
@@ -156,16 +159,26 @@ void Trace::updateTimeDomainData()
 //        system_clock::now().time_since_epoch()
 //    ).count();
     auto steps = size();
+    // frequency spacing of the data used for the FFT
+    double df = minFreq();
     if(minFreq() * size() != maxFreq()) {
         // data is not available with correct frequency spacing, calculate required steps
-        steps = maxFreq() / minFreq();
+        double requiredSteps = maxFreq() / minFreq();
+        if(requiredSteps > maxTDRSteps) {
+            // sweeps starting at a very low frequency (e.g. logarithmic sweeps): limit the size of the FFT,
+            // the steps below the first point use its value
+            steps = maxTDRSteps;
+            df = maxFreq() / steps;
+        } else {
+            steps = requiredSteps;
+        }
     }
     const double PI = 3.141592653589793238463;
     // reserve vector for negative frequenies and DC as well
     vector<complex<double>> frequencyDomain(2*steps + 1);
     // copy frequencies, use the flipped conjugate for negative part
     for(unsigned int i = 1;i<=steps;i++) {
-        auto S = getData(minFreq() * i);
+        auto S = getData(std::min(std::max(df * i, minFreq()), maxFreq()));
         constexpr double alpha0 = 0.54;
         auto hamming = alpha0 - (1.0 - alpha0) * -cos(PI * i / steps);
         S *= hamming;
@@ -180,7 +193,7 @@ void Trace::updateTimeDomainData()
     auto fft_bins = frequencyDomain.size();
     timeDomain.clear();
     timeDomain.resize(fft_bins);
-    const double fs = 1.0 / (minFreq() * fft_bins);
+    const double fs = 1.0 / (df * fft_bins);
     double last_step = 0.0;
 
     Fft::transform(frequencyDomain, true);
@@ -7,6 +7,7 @@
 #include <QFrame>
 #include <qwt_plot_canvas.h>
 #include <qwt_scale_div.h>
+#include <qwt_scale_engine.h>
 #include <qwt_plot_layout.h>
 #include "tracemarker.h"
 #include <qwt_symbol.h>
@@ -150,7 +151,7 @@ TraceXYPlot::TraceXYPlot(TraceModel &model, QWidget *parent)
     setYAxis(1, YAxisType::Phase, false, false, -180, 180, 30);
     // enable autoscaling and set for full span (no information about actual span available yet)
     setXAxis(0, 6000000000);
-    setXAxis(XAxisType::Frequency, true, 0, 6000000000, 600000000);
+    setXAxis(XAxisType::Frequency, false, true, 0, 6000000000, 600000000);
     // get notified when the span changes
     connect(&model, &TraceModel::SpanChanged, this, qOverload<double, double>(&TraceXYPlot::setXAxis));
 
@@ -233,9 +234,10 @@ void TraceXYPlot::setYAxis(int axis, TraceXYPlot::YAxisType type, bool log, bool
     replot();
 }
 
-void TraceXYPlot::setXAxis(XAxisType type, bool autorange, double min, double max, double div)
+void TraceXYPlot::setXAxis(XAxisType type, bool log, bool autorange, double min, double max, double div)
 {
     XAxis.Xtype = type;
+    XAxis.log = log;
     XAxis.autorange = autorange;
     XAxis.rangeMin = min;
     XAxis.rangeMax = max;
@@ -417,7 +419,25 @@ bool TraceXYPlot::supported(Trace *t, TraceXYPlot::YAxisType type)
 
 void TraceXYPlot::updateXAxis()
 {
-    if(XAxis.autorange && sweep_fmax-sweep_fmin > 0) {
+    // the scale engine is replaced when switching between linear and logarithmic axis
+    bool logEngine = dynamic_cast<const QwtLogScaleEngine*>(plot->axisScaleEngine(QwtPlot::xBottom)) != nullptr;
+    if(XAxis.log != logEngine) {
+        if(XAxis.log) {
+            plot->setAxisScaleEngine(QwtPlot::xBottom, new QwtLogScaleEngine);
+        } else {
+            plot->setAxisScaleEngine(QwtPlot::xBottom, new QwtLinearScaleEngine);
+        }
+    }
+    if(XAxis.log) {
+        // the ticks are placed by the scale engine (at the decades). A logarithmic axis can not include 0Hz
+        double start = XAxis.autorange ? sweep_fmin : XAxis.rangeMin;
+        double stop = XAxis.autorange ? sweep_fmax : XAxis.rangeMax;
+        start = std::max(start, 1.0);
+        if(stop <= start) {
+            stop = start * 10;
+        }
+        plot->setAxisScale(QwtPlot::xBottom, start, stop);
+    } else if(XAxis.autorange && sweep_fmax-sweep_fmin > 0) {
         QList<double> tickList;
         for(double tick = sweep_fmin;tick <= sweep_fmax;tick+= (sweep_fmax-sweep_fmin)/10) {
             tickList.append(tick);
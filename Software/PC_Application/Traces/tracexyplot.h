@@ -53,7 +53,8 @@ public:
 
     virtual void setXAxis(double min, double max) override;
     void setYAxis(int axis, YAxisType type, bool log, bool autorange, double min, double max, double div);
-    void setXAxis(XAxisType type, bool autorange, double min, double max, double div);
+    // log is only supported for the frequency axis
+    void setXAxis(XAxisType type, bool log, bool autorange, double min, double max, double div);
     void enableTrace(Trace *t, bool enabled) override;
 
     // Applies potentially changed colors to all XY-plots
@@ -58,7 +58,11 @@ XYplotAxisDialog::XYplotAxisDialog(TraceXYPlot *plot) :
     connect(ui->Xauto, &QCheckBox::toggled, [this](bool checked) {
        ui->Xmin->setEnabled(!checked);
        ui->Xmax->setEnabled(!checked);
-       ui->Xdivs->setEnabled(!checked);
+       ui->Xdivs->setEnabled(!checked && !ui->Xlog->isChecked());
+    });
+    // a logarithmic axis is always divided into decades
+    connect(ui->Xlog, &QRadioButton::toggled, [this](bool checked) {
+       ui->Xdivs->setEnabled(!checked && !ui->Xauto->isChecked());
     });
 
     ui->XType->setCurrentIndex((int) plot->XAxis.Xtype);
@@ -90,6 +94,11 @@ XYplotAxisDialog::XYplotAxisDialog(TraceXYPlot *plot) :
     ui->Y2max->setValueQuiet(plot->YAxis[1].rangeMax);
     ui->Y2divs->setValueQuiet(plot->YAxis[1].rangeDiv);
 
+    if(plot->XAxis.log) {
+        ui->Xlog->setChecked(true);
+    } else {
+        ui->Xlinear->setChecked(true);
+    }
     ui->Xauto->setChecked(plot->XAxis.autorange);
     ui->Xmin->setValueQuiet(plot->XAxis.rangeMin);
     ui->Xmax->setValueQuiet(plot->XAxis.rangeMax);
@@ -106,7 +115,7 @@ void XYplotAxisDialog::on_buttonBox_accepted()
     // set plot values to the ones selected in the dialog
     plot->setYAxis(0, (TraceXYPlot::YAxisType) ui->Y1type->currentIndex(), ui->Y1log->isChecked(), ui->Y1auto->isChecked(), ui->Y1min->value(), ui->Y1max->value(), ui->Y1divs->value());
     plot->setYAxis(1, (TraceXYPlot::YAxisType) ui->Y2type->currentIndex(), ui->Y2log->isChecked(), ui->Y2auto->isChecked(), ui->Y2min->value(), ui->Y2max->value(), ui->Y2divs->value());
-    plot->setXAxis((TraceXYPlot::XAxisType) ui->XType->currentIndex(), ui->Xauto->isChecked(), ui->Xmin->value(), ui->Xmax->value(), ui->Xdivs->value());
+    plot->setXAxis((TraceXYPlot::XAxisType) ui->XType->currentIndex(), ui->Xlog->isChecked(), ui->Xauto->isChecked(), ui->Xmin->value(), ui->Xmax->value(), ui->Xdivs->value());
 }
 
 void XYplotAxisDialog::XAxisTypeChanged(int XAxisIndex)
@@ -142,6 +151,11 @@ void XYplotAxisDialog::XAxisTypeChanged(int XAxisIndex)
     ui->Xmin->setUnit(unit);
     ui->Xmax->setUnit(unit);
     ui->Xdivs->setUnit(unit);
+    // time and distance axes start at zero or negative values
+    ui->Xlog->setEnabled(type == TraceXYPlot::XAxisType::Frequency);
+    if(type != TraceXYPlot::XAxisType::Frequency) {
+        ui->Xlinear->setChecked(true);
+    }
 }
 
 QString XYplotAxisDialog::YAxisUnit(TraceXYPlot::YAxisType type)
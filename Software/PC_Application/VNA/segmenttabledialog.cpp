@@ -0,0 +1,133 @@
+#include "segmenttabledialog.h"
+#include "ui_segmenttabledialog.h"
+#include "unit.h"
+#include <QMessageBox>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+SegmentTableDialog::SegmentTableDialog(const Protocol::SweepSegments &segments, bool enabled, QWidget *parent) :
+    QDialog(parent),
+    ui(new Ui::SegmentTableDialog)
+{
+    ui->setupUi(this);
+    ui->cbEnable->setChecked(enabled);
+    for(int i=0;i<segments.count;i++) {
+        addRow(segments.segments[i]);
+    }
+}
+
+SegmentTableDialog::~SegmentTableDialog()
+{
+    delete ui;
+}
+
+void SegmentTableDialog::on_bAdd_clicked()
+{
+    Protocol::SweepSegment s;
+    int rows = ui->table->rowCount();
+    if(rows > 0 && getRow(rows - 1, s)) {
+        // continue above the last segment with the same span
+        auto span = s.f_stop - s.f_start;
+        s.f_start = s.f_stop;
+        s.f_stop = min(s.f_start + span, Device::Limits().maxFreq);
+    } else {
+        s.f_start = Device::Limits().minFreq;
+        s.f_stop = Device::Limits().maxFreq;
+        s.points = 101;
+        s.if_bandwidth = 1000;
+        s.cdbm_excitation = -1000;
+    }
+    addRow(s);
+    ui->bAdd->setEnabled(ui->table->rowCount() < Protocol::MaxSweepSegments);
+}
+
+void SegmentTableDialog::on_bRemove_clicked()
+{
+    auto row = ui->table->currentRow();
+    if(row >= 0) {
+        ui->table->removeRow(row);
+    }
+    ui->bAdd->setEnabled(ui->table->rowCount() < Protocol::MaxSweepSegments);
+}
+
+void SegmentTableDialog::on_buttonBox_accepted()
+{
+    vector<Protocol::SweepSegment> segments;
+    for(int i=0;i<ui->table->rowCount();i++) {
+        Protocol::SweepSegment s;
+        if(!getRow(i, s)) {
+            QMessageBox::warning(this, "Invalid segment", "Segment " + QString::number(i + 1) + " contains an invalid entry and is ignored.");
+            continue;
+        }
+        segments.push_back(s);
+    }
+    // the device measures the segments in order, they have to be sorted and must not overlap
+    sort(segments.begin(), segments.end(), [](const Protocol::SweepSegment &a, const Protocol::SweepSegment &b) {
+        return a.f_start < b.f_start;
+    });
+    auto limits = Device::Limits();
+    Protocol::SweepSegments table;
+    table.count = 0;
+    uint64_t lastStop = limits.minFreq;
+    for(auto s : segments) {
+        if(table.count >= Protocol::MaxSweepSegments) {
+            break;
+        }
+        s.f_start = max(s.f_start, lastStop);
+        s.f_stop = min(max(s.f_stop, s.f_start), limits.maxFreq);
+        if(s.f_start > s.f_stop) {
+            // completely above the frequency range
+            continue;
+        }
+        s.points = max<uint16_t>(s.points, 1);
+        s.if_bandwidth = min(max(s.if_bandwidth, limits.minIFBW), limits.maxIFBW);
+        s.cdbm_excitation = min(max(s.cdbm_excitation, limits.cdbm_min), limits.cdbm_max);
+        table.segments[table.count++] = s;
+        lastStop = s.f_stop;
+    }
+    emit segmentTableChanged(table, ui->cbEnable->isChecked() && table.count > 0);
+}
+
+void SegmentTableDialog::addRow(const Protocol::SweepSegment &s)
+{
+    auto row = ui->table->rowCount();
+    ui->table->insertRow(row);
+    ui->table->setItem(row, ColStart, new QTableWidgetItem(Unit::ToString(s.f_start, "Hz", " kMG", 6)));
+    ui->table->setItem(row, ColStop, new QTableWidgetItem(Unit::ToString(s.f_stop, "Hz", " kMG", 6)));
+    ui->table->setItem(row, ColPoints, new QTableWidgetItem(QString::number(s.points)));
+    ui->table->setItem(row, ColIFBW, new QTableWidgetItem(Unit::ToString(s.if_bandwidth, "Hz", " k", 3)));
+    ui->table->setItem(row, ColLevel, new QTableWidgetItem(QString::number(s.cdbm_excitation / 100.0) + "dbm"));
+}
+
+bool SegmentTableDialog::getRow(int row, Protocol::SweepSegment &s)
+{
+    auto value = [=](Column col, QString unit, QString prefixes) -> double {
+        auto item = ui->table->item(row, col);
+        if(!item) {
+            return numeric_limits<double>::quiet_NaN();
+        }
+        return Unit::FromString(item->text().trimmed(), unit, prefixes);
+    };
+    auto start = value(ColStart, "Hz", " kMG");
+    auto stop = value(ColStop, "Hz", " kMG");
+    auto points = value(ColPoints, "", " ");
+    auto bandwidth = value(ColIFBW, "Hz", " k");
+    auto level = value(ColLevel, "dbm", " ");
+    for(auto v : {start, stop, points, bandwidth, level}) {
+        if(std::isnan(v)) {
+            return false;
+        }
+    }
+    if(start < 0 || stop < 0 || points < 1 || points > UINT16_MAX || bandwidth <= 0 || abs(level) > 100) {
+        return false;
+    }
+    s.f_start = start;
+    s.f_stop = stop;
+    s.points = points;
+    s.if_bandwidth = bandwidth;
+    s.cdbm_excitation = level * 100;
+    return true;
+}
@@ -0,0 +1,44 @@
+#ifndef SEGMENTTABLEDIALOG_H
+#define SEGMENTTABLEDIALOG_H
+
+#include <QDialog>
+#include "Device/device.h"
+
+namespace Ui {
+class SegmentTableDialog;
+}
+
+// Edits the segment table of a VNA sweep: each segment has its own frequency range, number of points,
+// IF bandwidth and stimulus level (see Protocol::SweepSegments)
+class SegmentTableDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit SegmentTableDialog(const Protocol::SweepSegments &segments, bool enabled, QWidget *parent = nullptr);
+    ~SegmentTableDialog();
+
+signals:
+    // Emitted when the dialog is accepted. The segments are sorted, free of overlaps and within the device limits
+    void segmentTableChanged(Protocol::SweepSegments segments, bool enabled);
+
+private slots:
+    void on_bAdd_clicked();
+    void on_bRemove_clicked();
+    void on_buttonBox_accepted();
+
+private:
+    enum Column {
+        ColStart = 0,
+        ColStop = 1,
+        ColPoints = 2,
+        ColIFBW = 3,
+        ColLevel = 4,
+    };
+    void addRow(const Protocol::SweepSegment &s);
+    // Reads the segment of a row, returns false if any entry is invalid
+    bool getRow(int row, Protocol::SweepSegment &s);
+    Ui::SegmentTableDialog *ui;
+};
+
+#endif // SEGMENTTABLEDIALOG_H
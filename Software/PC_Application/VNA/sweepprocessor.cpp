@@ -0,0 +1,164 @@
+#include "sweepprocessor.h"
+
+#include <QDebug>
+
+using namespace std;
+
+SweepProcessor::SweepProcessor() :
+    // Only has to bridge delays of the worker thread, it processes the points while the sweep is running.
+    // Long sweeps (up to Device::Limits().maxSweepPoints) do not have to fit into the queue completely
+    input(8192),
+    inputDiscarded(0),
+    processPending(false),
+    generation(0),
+    resetPending(false),
+    pendingPoints(0),
+    averagesPending(false),
+    pendingAverages(1),
+    calibrationPending(false),
+    pendingCalValid(false),
+    front(&buffers[0]),
+    back(&buffers[1]),
+    frontPublished(false),
+    points(0),
+    calValid(false)
+{
+    buffers[0].averageLevel = 0;
+    buffers[1].averageLevel = 0;
+    moveToThread(&thread);
+    connect(this, &SweepProcessor::datapointsQueued, this, &SweepProcessor::process, Qt::QueuedConnection);
+    thread.start();
+}
+
+SweepProcessor::~SweepProcessor()
+{
+    thread.quit();
+    thread.wait();
+}
+
+void SweepProcessor::addDatapoint(const Protocol::Datapoint &d)
+{
+    if(!input.push(d)) {
+        // reported once the queue accepts points again instead of once per point
+        inputDiscarded++;
+        return;
+    }
+    if(inputDiscarded) {
+        qWarning() << "Sweep processing queue was full," << inputDiscarded << "points discarded";
+        inputDiscarded = 0;
+    }
+    if(!processPending.exchange(true)) {
+        emit datapointsQueued();
+    }
+}
+
+void SweepProcessor::reset(unsigned int points)
+{
+    lock_guard<mutex> lock(mtx);
+    pendingPoints = points;
+    resetPending = true;
+    // results the worker is currently calculating are discarded
+    generation++;
+    front->points.clear();
+    back->points.clear();
+    front->averageLevel = 0;
+    back->averageLevel = 0;
+    frontPublished = false;
+}
+
+void SweepProcessor::setAverages(unsigned int averages)
+{
+    lock_guard<mutex> lock(mtx);
+    pendingAverages = averages;
+    averagesPending = true;
+}
+
+void SweepProcessor::setCalibration(const Calibration *calibration)
+{
+    lock_guard<mutex> lock(mtx);
+    if(calibration) {
+        pendingCal = *calibration;
+        pendingCalValid = true;
+    } else {
+        pendingCalValid = false;
+    }
+    calibrationPending = true;
+}
+
+void SweepProcessor::applyPendingSettings()
+{
+    // same order as the calls in VNA::SettingsChanged: averages, then reset
+    if(averagesPending) {
+        average.setAverages(pendingAverages);
+        averagesPending = false;
+    }
+    if(resetPending) {
+        points = pendingPoints;
+        average.reset(points);
+        resetPending = false;
+    }
+    if(calibrationPending) {
+        if(pendingCalValid) {
+            cal = pendingCal;
+        }
+        calValid = pendingCalValid;
+        average.reset(points);
+        calibrationPending = false;
+    }
+}
+
+bool SweepProcessor::takeSnapshot(SweepProcessor::Snapshot &s)
+{
+    lock_guard<mutex> lock(mtx);
+    if(!frontPublished && !back->points.empty()) {
+        // the worker collected more results while the previous snapshot was handled
+        swap(front, back);
+        frontPublished = true;
+    }
+    if(!frontPublished) {
+        return false;
+    }
+    // swap instead of copying, this also reuses the memory of the previous snapshot
+    swap(s.points, front->points);
+    s.averageLevel = front->averageLevel;
+    front->points.clear();
+    frontPublished = false;
+    return true;
+}
+
+void SweepProcessor::process()
+{
+    // clear the flag before taking points, points queued afterwards trigger another call
+    processPending = false;
+    unsigned int processedGeneration;
+    {
+        lock_guard<mutex> lock(mtx);
+        applyPendingSettings();
+        processedGeneration = generation;
+    }
+    // averaging and calibration without holding the lock, the GUI thread is not blocked by a long batch
+    results.clear();
+    Protocol::Datapoint d;
+    while(input.pop(d)) {
+        Point p;
+        p.raw = average.process(d);
+        p.sweep = average.currentSweep();
+        p.corrected = p.raw;
+        if(calValid) {
+            cal.correctMeasurement(p.corrected);
+        }
+        results.push_back(p);
+    }
+    lock_guard<mutex> lock(mtx);
+    if(generation != processedGeneration) {
+        // reset while processing, the results belong to the previous settings
+        return;
+    }
+    back->points.insert(back->points.end(), results.begin(), results.end());
+    back->averageLevel = average.getLevel();
+    if(!frontPublished && !back->points.empty()) {
+        swap(front, back);
+        frontPublished = true;
+        emit snapshotAvailable();
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef SWEEPPROCESSOR_H
+#define SWEEPPROCESSOR_H
+
+#include <QObject>
+#include <QThread>
+#include "Device/device.h"
+#include "Device/spscqueue.h"
+#include "Calibration/calibration.h"
+#include "averaging.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Averages and calibrates received datapoints in a worker thread.
+// Results are collected in a back buffer by the worker. Once the GUI has taken the previous results,
+// the back buffer is swapped with the front buffer and snapshotAvailable() is emitted. The GUI takes the
+// front buffer with takeSnapshot(), the worker never has to wait for the GUI to finish processing.
+class SweepProcessor : public QObject
+{
+    Q_OBJECT
+public:
+    class Point {
+    public:
+        // averaged but uncorrected data (required for calibration measurements)
+        Protocol::Datapoint raw;
+        // averaged and calibrated data
+        Protocol::Datapoint corrected;
+        // averaging sweep this point belongs to (see Averaging::currentSweep())
+        unsigned int sweep;
+    };
+    class Snapshot {
+    public:
+        // points processed since the previous snapshot, in the order they were received
+        std::vector<Point> points;
+        // number of averaged sweeps after the last point (see Averaging::getLevel())
+        unsigned int averageLevel;
+    };
+
+    SweepProcessor();
+    ~SweepProcessor();
+
+    // All of the following functions have to be called from the same thread (usually the GUI thread)
+    // Queues a received datapoint for processing
+    void addDatapoint(const Protocol::Datapoint &d);
+    // Discards all results and restarts averaging, e.g. after the sweep settings changed
+    void reset(unsigned int points);
+    void setAverages(unsigned int averages);
+    // Copies the calibration for use in the worker thread. Pass nullptr to disable calibration. Restarts averaging
+    void setCalibration(const Calibration *calibration);
+    // Moves the latest results into s. Returns false if no new results are available
+    bool takeSnapshot(Snapshot &s);
+
+signals:
+    // Emitted from the worker thread when new results are available
+    void snapshotAvailable();
+    // Internal, wakes up the worker thread
+    void datapointsQueued();
+
+private slots:
+    void process();
+
+private:
+    QThread thread;
+    SPSCQueue<Protocol::Datapoint> input;
+    // points lost because the worker did not keep up, only accessed from the thread calling addDatapoint
+    unsigned int inputDiscarded;
+    std::atomic<bool> processPending;
+
+    // protects the following members up to the buffers
+    std::mutex mtx;
+    // incremented by reset(), results calculated before are not published
+    unsigned int generation;
+    // settings changed by the GUI thread, applied by the worker before it processes the next points
+    bool resetPending;
+    unsigned int pendingPoints;
+    bool averagesPending;
+    unsigned int pendingAverages;
+    bool calibrationPending;
+    Calibration pendingCal;
+    bool pendingCalValid;
+    Snapshot buffers[2];
+    Snapshot *front, *back;
+    // the front buffer contains results that have not been taken yet
+    bool frontPublished;
+
+    // only accessed by the worker thread
+    void applyPendingSettings();
+    unsigned int points;
+    Averaging average;
+    Calibration cal;
+    bool calValid;
+    std::vector<Point> results;
+};
+
+#endif // SWEEPPROCESSOR_H
@@ -28,6 +28,7 @@
 #include "Traces/tracesmithchart.h"
 #include "Traces/tracexyplot.h"
 #include "Traces/traceimportdialog.h"
+#include "segmenttabledialog.h"
 #include "CustomWidgets/tilewidget.h"
 #include "CustomWidgets/siunitedit.h"
 #include <QDockWidget>
@@ -37,6 +38,7 @@
 #include "ui_main.h"
 #include "Device/firmwareupdatedialog.h"
 #include "preferences.h"
+#include "../VNA_embedded/Application/SweepPlan.hpp"
 #include "Generator/signalgenwidget.h"
 #include <QDesktopWidget>
 #include <QApplication>
@@ -47,8 +49,17 @@ VNA::VNA(AppWindow *window)
       central(new TileWidget(traceModel))
 {
     averages = 1;
+    sweepAverages = 1;
+    singleSweep = false;
+    settings.logSweep = 0;
+    settings.triggered = 0;
+    settings.extendedSettling = 0;
+    settings.sweeps = 0;
+    segments.count = 0;
+    segmentTableEnabled = false;
     calValid = false;
     calMeasuring = false;
+    calWaitFirst = false;
     calDialog.reset();
 
     // Create default traces
@@ -194,6 +205,22 @@ VNA::VNA(AppWindow *window)
     connect(bZoomOut, &QPushButton::clicked, this, &VNA::SpanZoomOut);
     tb_sweep->addWidget(bZoomOut);
 
+    auto cbLogSweep = new QCheckBox("Log");
+    cbLogSweep->setToolTip("Logarithmic frequency spacing");
+    connect(cbLogSweep, &QCheckBox::toggled, this, &VNA::SetLogSweep);
+    connect(this, &VNA::logSweepChanged, cbLogSweep, &QCheckBox::setChecked);
+    tb_sweep->addWidget(cbLogSweep);
+
+    auto bSegments = new QPushButton("Segments");
+    bSegments->setToolTip("Edit the segment table");
+    connect(bSegments, &QPushButton::clicked, [=](){
+        auto dialog = new SegmentTableDialog(segments, segmentTableEnabled);
+        connect(dialog, &SegmentTableDialog::segmentTableChanged, this, &VNA::SetSegmentTable);
+        dialog->setAttribute(Qt::WA_DeleteOnClose);
+        dialog->show();
+    });
+    tb_sweep->addWidget(bSegments);
+
     window->addToolBar(tb_sweep);
     toolbars.insert(tb_sweep);
 
@@ -212,8 +239,9 @@ VNA::VNA(AppWindow *window)
     tb_acq->addWidget(dbm);
 
     auto points = new QSpinBox();
-    points->setFixedWidth(55);
-    points->setRange(1, 4501);
+    points->setFixedWidth(65);
+    // the actual limit depends on the connected device (see SetPoints)
+    points->setRange(1, 100000);
     points->setValue(settings.points);
     points->setSingleStep(100);
     points->setToolTip("Points/sweep");
@@ -241,6 +269,25 @@ VNA::VNA(AppWindow *window)
     connect(this, &VNA::averagingChanged, sbAverages, &QSpinBox::setValue);
     tb_acq->addWidget(sbAverages);
 
+    auto cbSweepMode = new QComboBox();
+    cbSweepMode->addItem("Continuous");
+    cbSweepMode->addItem("Single");
+    cbSweepMode->setToolTip("Single: measure all averaging sweeps once per trigger");
+    connect(cbSweepMode, qOverload<int>(&QComboBox::currentIndexChanged), [=](int index) {
+        SetSingleSweep(index == 1);
+    });
+    connect(this, &VNA::singleSweepChanged, [=](bool single) {
+        cbSweepMode->setCurrentIndex(single ? 1 : 0);
+    });
+    tb_acq->addWidget(new QLabel("Sweep:"));
+    tb_acq->addWidget(cbSweepMode);
+    auto bTrigger = new QPushButton("Trigger");
+    bTrigger->setToolTip("Start a single sweep");
+    bTrigger->setEnabled(false);
+    connect(bTrigger, &QPushButton::clicked, this, &VNA::TriggerSweep);
+    connect(this, &VNA::triggerPossible, bTrigger, &QPushButton::setEnabled);
+    tb_acq->addWidget(bTrigger);
+
     window->addToolBar(tb_acq);
     toolbars.insert(tb_acq);
 
@@ -327,6 +374,7 @@ VNA::VNA(AppWindow *window)
     docks.insert(markerDock);
 
     qRegisterMetaType<Protocol::Datapoint>("Datapoint");
+    connect(&processor, &SweepProcessor::snapshotAvailable, this, &VNA::NewProcessedData);
 
     // Set initial sweep settings
     auto pref = Preferences::getInstance();
@@ -369,7 +417,8 @@ void VNA::deactivate()
 void VNA::initializeDevice()
 {
     defaultCalMenu->setEnabled(true);
-    connect(window->getDevice(), &Device::DatapointReceived, this, &VNA::NewDatapoint, Qt::UniqueConnection);
+    connect(window->getDevice(), &Device::DatapointsAvailable, this, &VNA::NewDatapoints, Qt::UniqueConnection);
+    connect(window->getDevice(), &Device::SweepComplete, this, &VNA::SweepComplete, Qt::UniqueConnection);
     // Check if default calibration exists and attempt to load it
     QSettings s;
     auto key = "DefaultCalibration"+window->getDevice()->serial();
@@ -396,51 +445,125 @@ void VNA::deviceDisconnected()
 
 using namespace std;
 
-void VNA::NewDatapoint(Protocol::Datapoint d)
+void VNA::NewDatapoints()
 {
-    d = average.process(d);
-    if(calMeasuring) {
+    auto device = window->getDevice();
+    if(!device) {
+        // device already disconnected
+        return;
+    }
+    Protocol::Datapoint d;
+    while(device->getDatapoint(d)) {
+        processor.addDatapoint(d);
+    }
+}
+
+void VNA::NewProcessedData()
+{
+    while(processor.takeSnapshot(snapshot)) {
+        bool sweepComplete = false;
+        for(const auto &p : snapshot.points) {
+            NewDatapoint(p);
+            if(p.corrected.pointNum == deviceSettings.points - 1) {
+                sweepComplete = true;
+            }
+        }
+        emit dataChanged();
+        if(sweepComplete) {
+            UpdateAverageCount(snapshot.averageLevel);
+            markerModel->updateMarkers();
+        }
+    }
+}
 
-        if(average.currentSweep() == averages) {
+void VNA::NewDatapoint(const SweepProcessor::Point &p)
+{
+    if(calMeasuring) {
+        auto d = p.raw;
+        if(p.sweep == sweepAverages) {
             // this is the last averaging sweep, use values for calibration
             if(!calWaitFirst || d.pointNum == 0) {
                 calWaitFirst = false;
                 cal.addMeasurement(calMeasurement, d);
-                if(d.pointNum == settings.points - 1) {
+                if(d.pointNum == deviceSettings.points - 1) {
                     calMeasuring = false;
                     emit CalibrationMeasurementComplete(calMeasurement);
                 }
             }
         }
-        int percentage = (((average.currentSweep() - 1) * 100) + (d.pointNum + 1) * 100 / settings.points) / averages;
+        int percentage = (((p.sweep - 1) * 100) + (d.pointNum + 1) * 100 / deviceSettings.points) / sweepAverages;
         calDialog.setValue(percentage);
     }
-    if(calValid) {
-        cal.correctMeasurement(d);
-    }
-    traceModel.addVNAData(d);
-    emit dataChanged();
-    if(d.pointNum == settings.points - 1) {
-        UpdateAverageCount();
-        markerModel->updateMarkers();
-    }
+    traceModel.addVNAData(p.corrected);
 }
 
-void VNA::UpdateAverageCount()
+void VNA::UpdateAverageCount(unsigned int level)
 {
-    lAverages->setText(QString::number(average.getLevel()) + "/");
+    // every sweep contributes the averages done on the device
+    if(deviceSettings.averages > 1) {
+        level *= deviceSettings.averages;
+    }
+    lAverages->setText(QString::number(level) + "/");
 }
 
 void VNA::SettingsChanged(std::function<void (Device::TransmissionResult)> cb)
 {
     settings.suppressPeaks = Preferences::getInstance().Acquisition.suppressPeaks ? 1 : 0;
-    if(window->getDevice()) {
-        window->getDevice()->Configure(settings, cb);
+    settings.portBlocked = Preferences::getInstance().Acquisition.portBlocked ? 1 : 0;
+    settings.extendedSettling = Preferences::getInstance().Acquisition.extendedSettling ? 1 : 0;
+    // calibration measurements need full precision
+    bool calibrationPending = calMeasuring || calWaitFirst;
+    if(Preferences::getInstance().Acquisition.reducedPrecision && !calibrationPending) {
+        settings.dataFormat = (int) Protocol::DatapointFormat::Compact16;
+    } else {
+        settings.dataFormat = (int) Protocol::DatapointFormat::ImplicitFrequency;
+    }
+    deviceSettings = settings;
+    deviceSettings.segmentTable = 0;
+    if(segmentTableEnabled && segments.count > 0) {
+        deviceSettings.segmentTable = 1;
+        deviceSettings.points = min(Protocol::SegmentTablePoints(segments), Device::Limits().maxSweepPoints);
+        deviceSettings.f_start = segments.segments[0].f_start;
+        deviceSettings.f_stop = segments.segments[segments.count - 1].f_stop;
+    }
+    // averaging on the device only transfers the averaged points
+    auto device = window->getDevice();
+    deviceSettings.averages = 0;
+    sweepAverages = averages;
+    if(Preferences::getInstance().Acquisition.deviceAveraging && !deviceSettings.segmentTable
+            && device && device->getCapabilities().PointAveraging && device->getADCSamplerate()) {
+        // the device limits the samples per point, only the part of the averaging that fits is done there
+        auto pointAverages = SweepPlan::PointAverages(deviceSettings.if_bandwidth, device->getADCSamplerate(), averages);
+        if(pointAverages > 1) {
+            deviceSettings.averages = pointAverages;
+            sweepAverages = averages / pointAverages;
+        }
+    }
+    processor.setAverages(sweepAverages);
+    // calibration measurements wait for the start of the next (continuous) sweep
+    if(singleSweep && !calibrationPending) {
+        deviceSettings.triggered = 1;
+        deviceSettings.sweeps = sweepAverages;
+    } else {
+        deviceSettings.triggered = 0;
+        deviceSettings.sweeps = 0;
     }
-    average.reset(settings.points);
+    emit triggerPossible(deviceSettings.triggered);
+    if(calValid && !calibrationPending) {
+        // the calibration only applies if it covers every point of the new sweep (possibly non-uniform with a segment table)
+        auto interpolation = cal.getInterpolation(deviceSettings, deviceSettings.segmentTable ? &segments : nullptr);
+        if(interpolation == Calibration::InterpolationType::Extrapolate
+                || interpolation == Calibration::InterpolationType::NoCalibration) {
+            DisableCalibration();
+        }
+    }
+    if(device) {
+        device->Configure(deviceSettings, segments, cb);
+    }
+    processor.reset(deviceSettings.points);
     traceModel.clearVNAData();
-    UpdateAverageCount();
-    emit traceModel.SpanChanged(settings.f_start, settings.f_stop);
+    UpdateAverageCount(0);
+    emit traceModel.SpanChanged(deviceSettings.f_start, deviceSettings.f_stop);
 }
 
 void VNA::StartImpedanceMatching()
@@ -521,6 +644,16 @@ void VNA::SpanZoomOut()
     ConstrainAndUpdateFrequencies();
 }
 
+void VNA::SetLogSweep(bool log)
+{
+    if(settings.logSweep == log) {
+        return;
+    }
+    settings.logSweep = log ? 1 : 0;
+    emit logSweepChanged(log);
+    SettingsChanged();
+}
+
 void VNA::SetSourceLevel(double level)
 {
     // TODO remove hardcoded limits
@@ -539,8 +672,8 @@ void VNA::SetPoints(unsigned int points)
     // TODO remove hardcoded limits
     if (points < 1) {
         points = 1;
-    } else if(points > Device::Limits().maxPoints) {
-        points = Device::Limits().maxPoints;
+    } else if(points > Device::Limits().maxSweepPoints) {
+        points = Device::Limits().maxSweepPoints;
     }
     emit pointsChanged(points);
     settings.points = points;
@@ -562,11 +695,48 @@ void VNA::SetIFBandwidth(double bandwidth)
 void VNA::SetAveraging(unsigned int averages)
 {
     this->averages = averages;
-    average.setAverages(averages);
     emit averagingChanged(averages);
     SettingsChanged();
 }
 
+void VNA::SetSingleSweep(bool single)
+{
+    if(singleSweep == single) {
+        return;
+    }
+    singleSweep = single;
+    emit singleSweepChanged(single);
+    SettingsChanged();
+}
+
+void VNA::TriggerSweep()
+{
+    auto device = window->getDevice();
+    if(!device || !deviceSettings.triggered) {
+        return;
+    }
+    // every trigger starts a new average
+    processor.reset(deviceSettings.points);
+    UpdateAverageCount(0);
+    emit triggerPossible(false);
+    if(!device->TriggerSweep([=](Device::TransmissionResult res) {
+        if(res != Device::TransmissionResult::Ack) {
+            // the device is still sweeping or does not support triggered sweeps
+            emit triggerPossible(true);
+        }
+    })) {
+        // not supported by the device, it sweeps continuously
+        emit triggerPossible(true);
+    }
+}
+
+void VNA::SweepComplete()
+{
+    if(deviceSettings.triggered) {
+        emit triggerPossible(true);
+    }
+}
+
 void VNA::ExcitationRequired(bool port1, bool port2)
 {
     if(Preferences::getInstance().Acquisition.alwaysExciteBothPorts) {
@@ -582,12 +752,19 @@ void VNA::ExcitationRequired(bool port1, bool port2)
     }
 }
 
+void VNA::SetSegmentTable(Protocol::SweepSegments segments, bool enabled)
+{
+    this->segments = segments;
+    segmentTableEnabled = enabled;
+    SettingsChanged();
+}
+
 void VNA::DisableCalibration(bool force)
 {
     if(calValid || force) {
         calValid = false;
         emit CalibrationDisabled();
-        average.reset(settings.points);
+        processor.setCalibration(nullptr);
     }
 }
 
@@ -597,7 +774,7 @@ void VNA::ApplyCalibration(Calibration::Type type)
         try {
             if(cal.constructErrorTerms(type)) {
                 calValid = true;
-                average.reset(settings.points);
+                processor.setCalibration(&cal);
                 emit CalibrationApplied(type);
             }
         } catch (runtime_error e) {
@@ -638,6 +815,7 @@ void VNA::StartCalibrationMeasurement(Calibration::Measurement m)
     connect(&calDialog, &QProgressDialog::canceled, [=]() {
         // the user aborted the calibration measurement
         calMeasuring = false;
+        calWaitFirst = false;
         cal.clearMeasurement(calMeasurement);
     });
     // Trigger sweep to start from beginning
@@ -676,6 +854,7 @@ void VNA::LoadSweepSettings()
     SetPoints(s.value("SweepPoints", pref.Startup.DefaultSweep.points).toInt());
     SetAveraging(s.value("SweepAveraging", pref.Startup.DefaultSweep.averaging).toInt());
     SetSourceLevel(s.value("SweepLevel", pref.Startup.DefaultSweep.excitation).toDouble());
+    SetLogSweep(s.value("SweepLog", false).toBool());
 }
 
 void VNA::StoreSweepSettings()
@@ -687,6 +866,7 @@ void VNA::StoreSweepSettings()
     s.setValue("SweepPoints", settings.points);
     s.setValue("SweepAveraging", averages);
     s.setValue("SweepLevel", (double) settings.cdbm_excitation / 100.0);
+    s.setValue("SweepLog", settings.logSweep == 1);
 }
 
 void VNA::StopSweep()
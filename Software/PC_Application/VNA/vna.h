@@ -7,6 +7,7 @@
 #include "mode.h"
 #include "CustomWidgets/tilewidget.h"
 #include "Device/device.h"
+#include "sweepprocessor.h"
 #include <functional>
 
 class VNA : public Mode
@@ -19,7 +20,10 @@ public:
     void initializeDevice() override;
     void deviceDisconnected() override;
 private slots:
-    void NewDatapoint(Protocol::Datapoint d);
+    // fetches all queued datapoints from the device and passes them on to the processing thread
+    void NewDatapoints();
+    // takes the processed datapoints from the processing thread
+    void NewProcessedData();
     void StartImpedanceMatching();
     // Sweep control
     void SetStartFreq(double freq);
@@ -29,12 +33,18 @@ private slots:
     void SetFullSpan();
     void SpanZoomIn();
     void SpanZoomOut();
+    void SetLogSweep(bool log);
     // Acquisition control
     void SetSourceLevel(double level);
     void SetPoints(unsigned int points);
     void SetIFBandwidth(double bandwidth);
     void SetAveraging(unsigned int averages);
+    // Single sweep mode: the device measures the averaging sweeps once per TriggerSweep and then holds
+    void SetSingleSweep(bool single);
+    void TriggerSweep();
+    void SweepComplete();
     void ExcitationRequired(bool port1, bool port2);
+    void SetSegmentTable(Protocol::SweepSegments segments, bool enabled);
     // Calibration
     void DisableCalibration(bool force = false);
     void ApplyCalibration(Calibration::Type type);
@@ -44,7 +54,8 @@ signals:
     void CalibrationMeasurementComplete(Calibration::Measurement m);
 
 private:
-    void UpdateAverageCount();
+    void NewDatapoint(const SweepProcessor::Point &p);
+    void UpdateAverageCount(unsigned int level);
     void SettingsChanged(std::function<void (Device::TransmissionResult)> cb = nullptr);
     void ConstrainAndUpdateFrequencies();
     void LoadSweepSettings();
@@ -53,10 +64,20 @@ private:
     void StartCalibrationDialog(Calibration::Type type = Calibration::Type::None);
 
     Protocol::SweepSettings settings;
+    // sweep segments, replace the start/stop frequency, points, IF bandwidth and level if enabled
+    Protocol::SweepSegments segments;
+    bool segmentTableEnabled;
+    // settings of the current sweep as sent to the device (settings with the segment table applied)
+    Protocol::SweepSettings deviceSettings;
     unsigned int averages;
+    // sweeps averaged by the processor, one if the device averages each point
+    unsigned int sweepAverages;
+    bool singleSweep;
     TraceModel traceModel;
     TraceMarkerModel *markerModel;
-    Averaging average;
+    // averaging and calibration run in the processing thread
+    SweepProcessor processor;
+    SweepProcessor::Snapshot snapshot;
 
     // Calibration
     Calibration cal;
@@ -80,11 +101,15 @@ signals:
     void stopFreqChanged(double freq);
     void centerFreqChanged(double freq);
     void spanChanged(double span);
+    void logSweepChanged(bool log);
 
     void sourceLevelChanged(double level);
     void pointsChanged(unsigned int points);
     void IFBandwidthChanged(double bandwidth);
     void averagingChanged(unsigned int averages);
+    void singleSweepChanged(bool single);
+    // false while the sweeps of a single sweep are measured
+    void triggerPossible(bool possible);
 
     void CalibrationDisabled();
     void CalibrationApplied(Calibration::Type type);
@@ -35,6 +35,7 @@
 #include "Calibration/calibrationtracedialog.h"
 #include "ui_main.h"
 #include "Device/firmwareupdatedialog.h"
+#include "Device/simulateddevice.h"
 #include "preferences.h"
 #include "Generator/signalgenwidget.h"
 #include <QDesktopWidget>
@@ -66,7 +67,16 @@ AppWindow::AppWindow(QWidget *parent)
     div1->setFrameShape(QFrame::VLine);
     ui->statusbar->addWidget(div1);
     ui->statusbar->addWidget(&lDeviceInfo);
+    auto div2 = new QFrame;
+    div2->setFrameShape(QFrame::VLine);
+    ui->statusbar->addWidget(div2);
+    ui->statusbar->addWidget(&lThroughput);
     ui->statusbar->addWidget(new QLabel, 1);
+    connect(&throughputTimer, &QTimer::timeout, [=](){
+        if(device) {
+            lThroughput.setText("USB: " + Unit::ToString(device->getDataThroughput(), "B/s", " kM", 3));
+        }
+    });
     //ui->statusbar->setStyleSheet("QStatusBar::item { border: 1px solid black; };");
 
     CreateToolbars();
@@ -150,6 +160,23 @@ void AppWindow::closeEvent(QCloseEvent *event)
     QMainWindow::closeEvent(event);
 }
 
+static SimulatedDevice::Config SimulationConfig()
+{
+    auto &pref = Preferences::getInstance().Simulation;
+    SimulatedDevice::Config c;
+    c.dut = (SimulatedDevice::DUT) pref.dut;
+    c.R = pref.R;
+    c.L = pref.L;
+    c.C = pref.C;
+    c.lineLength = pref.lineLength;
+    c.lineImpedance = pref.lineImpedance;
+    c.lineLoss = pref.lineLoss;
+    c.lineVelocityFactor = pref.lineVelocityFactor;
+    c.noise = pref.noise;
+    c.pointRate = pref.pointRate;
+    return c;
+}
+
 void AppWindow::ConnectToDevice(QString serial)
 {
     if(device) {
@@ -157,10 +184,16 @@ void AppWindow::ConnectToDevice(QString serial)
     }
     try {
         qDebug() << "Attempting to connect to device...";
-        device = new Device(serial);
+        bool simulation = Preferences::getInstance().Simulation.enabled;
+        if(simulation && (serial == SimulatedDevice::Serial || (serial.isEmpty() && Device::GetDevices().empty()))) {
+            device = new Device(new SimulatedDevice(SimulationConfig()));
+        } else {
+            device = new Device(serial);
+        }
         lConnectionStatus.setText("Connected to " + device->serial());
         qInfo() << "Connected to " << device->serial();
         lDeviceInfo.setText(device->getLastDeviceInfoString());
+        throughputTimer.start(1000);
         connect(device, &Device::LogLineReceived, &deviceLog, &DeviceLog::addLine);
         connect(device, &Device::ConnectionLost, this, &AppWindow::DeviceConnectionLost);
         connect(device, &Device::DeviceInfoUpdated, [this]() {
@@ -182,6 +215,7 @@ void AppWindow::ConnectToDevice(QString serial)
             }
         }
     } catch (const runtime_error e) {
+        QMessageBox::warning(this, "Error opening device", e.what());
         DisconnectDevice();
         UpdateDeviceList();
     }
@@ -202,6 +236,8 @@ void AppWindow::DisconnectDevice()
     }
     lConnectionStatus.setText("No device connected");
     lDeviceInfo.setText("No device information available yet");
+    throughputTimer.stop();
+    lThroughput.clear();
     Mode::getActiveMode()->deviceDisconnected();
     qDebug() << "Disconnected device";
 }
@@ -250,6 +286,9 @@ int AppWindow::UpdateDeviceList()
     deviceActionGroup->setExclusive(true);
     ui->menuConnect_to->clear();
     auto devices = Device::GetDevices();
+    if(Preferences::getInstance().Simulation.enabled) {
+        devices.insert(SimulatedDevice::Serial);
+    }
     if(devices.size()) {
         for(auto d : devices) {
             auto connectAction = ui->menuConnect_to->addAction(d);
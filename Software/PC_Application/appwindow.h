@@ -66,6 +66,8 @@ private:
     // Status bar widgets
     QLabel lConnectionStatus;
     QLabel lDeviceInfo;
+    QLabel lThroughput;
+    QTimer throughputTimer;
 
     Ui::MainWindow *ui;
 };
@@ -13,6 +13,7 @@ void Averaging::reset(unsigned int points)
     for(unsigned int i = 0;i<points;i++) {
         avg.push_back(deque<array<complex<double>, 4>>());
     }
+    frequencies.assign(points, 0);
 }
 
 void Averaging::setAverages(unsigned int a)
@@ -32,12 +33,18 @@ Protocol::Datapoint Averaging::process(Protocol::Datapoint d)
         // add moving average entry
         deque<array<complex<double>, 4>> deque;
         avg.push_back(deque);
+        frequencies.push_back(d.frequency);
     }
 
     if (d.pointNum < avg.size()) {
         // can compute average
         // get correct queue
         auto deque = &avg[d.pointNum];
+        if (frequencies[d.pointNum] != d.frequency) {
+            // the point moved to another frequency (e.g. points left over from the previous sweep settings)
+            deque->clear();
+            frequencies[d.pointNum] = d.frequency;
+        }
         // add newest sample to queue
         array<complex<double>, 4> sample = {S11, S12, S21, S22};
         deque->push_back(sample);
@@ -77,6 +84,7 @@ Protocol::SpectrumAnalyzerResult Averaging::process(Protocol::SpectrumAnalyzerRe
         // add moving average entry
         deque<array<complex<double>, 4>> deque;
         avg.push_back(deque);
+        frequencies.push_back(d.frequency);
     }
 
     if (d.pointNum < avg.size()) {
@@ -22,6 +22,9 @@ public:
     unsigned int currentSweep();
 private:
     std::vector<std::deque<std::array<std::complex<double>, 4>>> avg;
+    // frequency of each averaged point. The frequencies of a sweep are not necessarily evenly spaced (segment tables),
+    // a point is only averaged with previous sweeps if its frequency is unchanged
+    std::vector<uint64_t> frequencies;
     int maxPoints;
     unsigned int averages;
 };
@@ -107,6 +107,11 @@ PreferencesDialog::PreferencesDialog(Preferences *pref, QWidget *parent) :
         p->Startup.SA.signalID = ui->StartupSASignalID->isChecked();
         p->Acquisition.alwaysExciteBothPorts = ui->AcquisitionAlwaysExciteBoth->isChecked();
         p->Acquisition.suppressPeaks = ui->AcquisitionSuppressPeaks->isChecked();
+        p->Acquisition.reducedPrecision = ui->AcquisitionReducedPrecision->isChecked();
+        p->Acquisition.portBlocked = ui->AcquisitionPortBlocked->isChecked();
+        p->Acquisition.deviceAveraging = ui->AcquisitionDeviceAveraging->isChecked();
+        p->Acquisition.extendedSettling = ui->AcquisitionExtendedSettling->isChecked();
+        p->Simulation.enabled = ui->SimulationEnabled->isChecked();
         p->General.graphColors.background = ui->GeneralGraphBackground->getColor();
         p->General.graphColors.axis = ui->GeneralGraphAxis->getColor();
         p->General.graphColors.divisions = ui->GeneralGraphDivisions->getColor();
@@ -147,6 +152,11 @@ void PreferencesDialog::setInitialGUIState()
 
     ui->AcquisitionAlwaysExciteBoth->setChecked(p->Acquisition.alwaysExciteBothPorts);
     ui->AcquisitionSuppressPeaks->setChecked(p->Acquisition.suppressPeaks);
+    ui->AcquisitionReducedPrecision->setChecked(p->Acquisition.reducedPrecision);
+    ui->AcquisitionPortBlocked->setChecked(p->Acquisition.portBlocked);
+    ui->AcquisitionDeviceAveraging->setChecked(p->Acquisition.deviceAveraging);
+    ui->AcquisitionExtendedSettling->setChecked(p->Acquisition.extendedSettling);
+    ui->SimulationEnabled->setChecked(p->Simulation.enabled);
 
     ui->GeneralGraphBackground->setColor(p->General.graphColors.background);
     ui->GeneralGraphAxis->setColor(p->General.graphColors.axis);
@@ -66,7 +66,24 @@ public:
     struct {
         bool alwaysExciteBothPorts;
         bool suppressPeaks;
+        bool reducedPrecision;
+        bool portBlocked;
+        bool deviceAveraging;
+        bool extendedSettling;
     } Acquisition;
+    struct {
+        // offer a simulated device in addition to the connected devices
+        bool enabled;
+        // see SimulatedDevice::Config
+        int dut;
+        double R, L, C;
+        double lineLength;
+        double lineImpedance;
+        double lineLoss;
+        double lineVelocityFactor;
+        double noise;
+        double pointRate;
+    } Simulation;
     struct {
         struct {
             QColor background;
@@ -82,7 +99,7 @@ private:
         QString name;
         QVariant def;
     };
-    const std::array<SettingDescription, 22> descr = {{
+    const std::array<SettingDescription, 34> descr = {{
         {&Startup.ConnectToFirstDevice, "Startup.ConnectToFirstDevice", true},
         {&Startup.RememberSweepSettings, "Startup.RememberSweepSettings", false},
         {&Startup.DefaultSweep.start, "Startup.DefaultSweep.start", 1000000.0},
@@ -102,6 +119,21 @@ private:
         {&Startup.SA.signalID, "Startup.SA.signalID", true},
         {&Acquisition.alwaysExciteBothPorts, "Acquisition.alwaysExciteBothPorts", true},
         {&Acquisition.suppressPeaks, "Acquisition.suppressPeaks", true},
+        {&Acquisition.reducedPrecision, "Acquisition.reducedPrecision", false},
+        {&Acquisition.portBlocked, "Acquisition.portBlocked", false},
+        {&Acquisition.deviceAveraging, "Acquisition.deviceAveraging", false},
+        {&Acquisition.extendedSettling, "Acquisition.extendedSettling", false},
+        {&Simulation.enabled, "Simulation.enabled", false},
+        {&Simulation.dut, "Simulation.dut", 3},
+        {&Simulation.R, "Simulation.R", 10.0},
+        {&Simulation.L, "Simulation.L", 100e-9},
+        {&Simulation.C, "Simulation.C", 10e-12},
+        {&Simulation.lineLength, "Simulation.lineLength", 1.0},
+        {&Simulation.lineImpedance, "Simulation.lineImpedance", 50.0},
+        {&Simulation.lineLoss, "Simulation.lineLoss", 0.5},
+        {&Simulation.lineVelocityFactor, "Simulation.lineVelocityFactor", 0.66},
+        {&Simulation.noise, "Simulation.noise", 0.001},
+        {&Simulation.pointRate, "Simulation.pointRate", 10000.0},
         {&General.graphColors.background, "General.graphColors.background", QColor(Qt::black)},
         {&General.graphColors.axis, "General.graphColors.axis", QColor(Qt::white)},
         {&General.graphColors.divisions, "General.graphColors.divisions", QColor(Qt::gray)},
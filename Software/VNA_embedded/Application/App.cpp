@@ -17,6 +17,7 @@
 #include "Manual.hpp"
 #include "Generator.hpp"
 #include "SpectrumAnalyzer.hpp"
+#include "DatapointQueue.hpp"
 
 #define LOG_LEVEL	LOG_LEVEL_INFO
 #define LOG_MODULE	"App"
@@ -25,9 +26,30 @@
 static Protocol::Datapoint result;
 static Protocol::SweepSettings settings;
 
-static Protocol::PacketInfo recv_packet, transmit_packet;
+static Protocol::PacketInfo transmit_packet;
+
+// Completed datapoints, filled by the VNA interrupt and sent by the App task
+static DatapointQueue<32> datapoints;
+// Overflows of the datapoint queue that have already been logged
+static uint32_t reportedOverflows = 0;
+
+// Received packets are queued until handled by the App task. With SequencedAcks, the host sends up
+// to Protocol::SendWindow packets without waiting for their Acks
+static constexpr uint8_t RecvQueueSize = Protocol::SendWindow + 1;
+static Protocol::PacketInfo recv_queue[RecvQueueSize];
+static volatile uint8_t recv_read = 0, recv_write = 0;
 static TaskHandle_t handle;
 
+// Features supported by the connected host, only features that are also set in HW::Capabilities are used.
+// Cleared whenever the USB connection changes, a host that does not send its capabilities gets none
+static Protocol::Capabilities hostCapabilities;
+
+// Consecutive datapoints are collected and sent in a single packet if the host supports it
+static constexpr uint32_t MaxBatchDelay = 20;
+static Protocol::Datapoint batch[Protocol::MaxBatchPoints];
+static uint8_t batchCnt = 0;
+static uint32_t batchStarted;
+
 #if HW_REVISION >= 'B'
 // has MCU controllable flash chip, firmware update supported
 #define HAS_FLASH
@@ -40,27 +62,85 @@ extern ADC_HandleTypeDef hadc1;
 
 #define FLAG_USB_PACKET		0x01
 #define FLAG_DATAPOINT		0x02
+#define FLAG_SWEEP_COMPLETE	0x04
+#define FLAG_USB_CONNECTION	0x08
 
 static void VNACallback(const Protocol::Datapoint &res) {
 	DEBUG2_HIGH();
-	transmit_packet.type = Protocol::PacketType::Datapoint;
-	transmit_packet.datapoint = res;
+	if(!datapoints.Push(res)) {
+		// task did not keep up, the point is dropped (and counted by the queue)
+		DEBUG2_LOW();
+		return;
+	}
 	BaseType_t woken = false;
 	xTaskNotifyFromISR(handle, FLAG_DATAPOINT, eSetBits, &woken);
 	portYIELD_FROM_ISR(woken);
 	DEBUG2_LOW();
 }
+static void VNASweepComplete() {
+	// the last point has already been queued by VNACallback
+	BaseType_t woken = false;
+	xTaskNotifyFromISR(handle, FLAG_SWEEP_COMPLETE, eSetBits, &woken);
+	portYIELD_FROM_ISR(woken);
+}
+static void FlushBatch() {
+	if(!batchCnt) {
+		return;
+	}
+	Protocol::PacketInfo p;
+	p.type = Protocol::PacketType::DatapointBatch;
+	p.batch.firstPointNum = batch[0].pointNum;
+	p.batch.count = batchCnt;
+	p.batch.format = Protocol::DatapointFormat::Full;
+	p.batch.ports = batch[0].ports;
+	if(hostCapabilities.CompactDatapoints && HW::Capabilities.CompactDatapoints
+			&& settings.dataFormat <= (uint8_t) Protocol::DatapointFormat::Compact16) {
+		p.batch.format = (Protocol::DatapointFormat) settings.dataFormat;
+	}
+	p.batch.points = batch;
+	Communication::Send(p);
+	batchCnt = 0;
+}
+static void AddToBatch(const Protocol::Datapoint &d) {
+	if(batchCnt && (d.pointNum != batch[batchCnt - 1].pointNum + 1 || d.ports != batch[batchCnt - 1].ports)) {
+		// not consecutive (sweep restarted or other port of a port-blocked sweep), send previous points first
+		FlushBatch();
+	}
+	if(!batchCnt) {
+		batchStarted = HAL_GetTick();
+	}
+	batch[batchCnt++] = d;
+	if(batchCnt >= Protocol::MaxBatchPoints || d.pointNum == settings.points - 1) {
+		// batch is full or sweep complete
+		FlushBatch();
+	}
+}
+
 static void USBPacketReceived(const Protocol::PacketInfo &p) {
-	recv_packet = p;
+	uint8_t next = (recv_write + 1) % RecvQueueSize;
+	if(next == recv_read) {
+		// queue full, drop packet (the host will not receive an Ack and run into a timeout)
+		return;
+	}
+	recv_queue[recv_write] = p;
+	recv_write = next;
 	BaseType_t woken = false;
 	xTaskNotifyFromISR(handle, FLAG_USB_PACKET, eSetBits, &woken);
 	portYIELD_FROM_ISR(woken);
 }
 
+static void USBConnectionChanged(bool) {
+	BaseType_t woken = false;
+	xTaskNotifyFromISR(handle, FLAG_USB_CONNECTION, eSetBits, &woken);
+	portYIELD_FROM_ISR(woken);
+}
+
 void App_Start() {
 	STM::Init();
+	Protocol::SetCRCFunction(STM::CRC32);
 	HAL_ADCEx_Calibration_Start(&hadc1, ADC_SINGLE_ENDED);
 	handle = xTaskGetCurrentTaskHandle();
+	usb_set_connection_callback(USBConnectionChanged);
 	usb_init(communication_usb_input);
 	Log_Init();
 	LED::Init();
@@ -110,107 +190,254 @@ void App_Start() {
 
 	uint32_t lastNewPoint = HAL_GetTick();
 	bool sweepActive = false;
+	bool sweepStalled = false;
 
 	LED::Off();
 	while (1) {
 		uint32_t notification;
-		if(xTaskNotifyWait(0x00, UINT32_MAX, &notification, 100) == pdPASS) {
+		uint32_t waitTime = 100;
+		if(sweepStalled) {
+			// poll the USB fifo until the sweep can continue
+			waitTime = 1;
+		} else if(batchCnt) {
+			waitTime = MaxBatchDelay;
+		}
+		if(xTaskNotifyWait(0x00, UINT32_MAX, &notification, waitTime) == pdPASS) {
 			// something happened
+			if(notification & FLAG_USB_CONNECTION) {
+				// handled before any received packets, the new host may already have sent its capabilities
+				hostCapabilities = {};
+				// the new host may be fast enough to sweep without halts
+				VNA::ResetBackpressure();
+			}
 			if(notification & FLAG_DATAPOINT) {
-				Communication::Send(transmit_packet);
+				// notifications coalesce, send all queued points
+				while(datapoints.Pop(result)) {
+					if(hostCapabilities.DatapointBatches && HW::Capabilities.DatapointBatches) {
+						AddToBatch(result);
+					} else {
+						transmit_packet.type = Protocol::PacketType::Datapoint;
+						transmit_packet.datapoint = result;
+						Communication::Send(transmit_packet);
+					}
+				}
 				lastNewPoint = HAL_GetTick();
+				if(datapoints.Overflows() != reportedOverflows) {
+					uint32_t overflows = datapoints.Overflows();
+					LOG_WARN("Datapoint queue overflow, %lu points lost (%lu total)", overflows - reportedOverflows, overflows);
+					reportedOverflows = overflows;
+				}
 			}
 			if(notification & FLAG_USB_PACKET) {
-				switch(recv_packet.type) {
-				case Protocol::PacketType::SweepSettings:
-					LOG_INFO("New settings received");
-					settings = recv_packet.settings;
-					sweepActive = VNA::Setup(settings, VNACallback);
-					lastNewPoint = HAL_GetTick();
-					Communication::SendWithoutPayload(Protocol::PacketType::Ack);
-					break;
-				case Protocol::PacketType::ManualControl:
-					sweepActive = false;
-					Manual::Setup(recv_packet.manual);
-					Communication::SendWithoutPayload(Protocol::PacketType::Ack);
-					break;
-				case Protocol::PacketType::Reference:
-					HW::Ref::set(recv_packet.reference);
-					if(!sweepActive) {
-						// can update right now
-						HW::Ref::update();
+				while(recv_read != recv_write) {
+					auto &recv_packet = recv_queue[recv_read];
+					switch(recv_packet.type) {
+					case Protocol::PacketType::SweepSettings:
+						LOG_INFO("New settings received");
+						settings = recv_packet.settings;
+						if(!hostCapabilities.PortBlockedSweeps || !hostCapabilities.DatapointBatches) {
+							// the halves of a port-blocked sweep can only be told apart in batches
+							settings.portBlocked = 0;
+						}
+						if(settings.points > HW::MaxPoints && (!hostCapabilities.LongSweeps || !hostCapabilities.DatapointBatches)) {
+							// the host has to handle 32 bit point numbers, these are only transferred in batches
+							settings.points = HW::MaxPoints;
+						} else if(settings.points > HW::MaxSweepPoints) {
+							settings.points = HW::MaxSweepPoints;
+						}
+						if(!hostCapabilities.SweepModes) {
+							// the host would never trigger the sweep or learn about the held sweep
+							settings.triggered = 0;
+							settings.sweeps = 0;
+						}
+						// discard any points left over from the previous sweep. The host decodes the points with the new
+						// settings once it received the Ack, no point of the previous sweep may follow it
+						VNA::Stop();
+						while(datapoints.Pop(result));
+						batchCnt = 0;
+						sweepActive = VNA::Setup(settings, VNACallback, VNASweepComplete);
+						lastNewPoint = HAL_GetTick();
+						Communication::SendWithoutPayload(Protocol::PacketType::Ack, recv_packet.sequence);
+						break;
+					case Protocol::PacketType::SweepTrigger:
+						if(sweepActive && VNA::Trigger()) {
+							lastNewPoint = HAL_GetTick();
+							Communication::SendWithoutPayload(Protocol::PacketType::Ack, recv_packet.sequence);
+						} else {
+							// no sweep configured or the previous sweeps are still running
+							Communication::SendWithoutPayload(Protocol::PacketType::Nack, recv_packet.sequence);
+						}
+						break;
+					case Protocol::PacketType::ManualControl:
+						sweepActive = false;
+						Manual::Setup(recv_packet.manual);
+						Communication::SendWithoutPayload(Protocol::PacketType::Ack, recv_packet.sequence);
+						break;
+					case Protocol::PacketType::Reference:
+						HW::Ref::set(recv_packet.reference);
+						if(!sweepActive) {
+							// can update right now
+							HW::Ref::update();
+						}
+						Communication::SendWithoutPayload(Protocol::PacketType::Ack, recv_packet.sequence);
+						break;
+					case Protocol::PacketType::Generator:
+						sweepActive = false;
+						LOG_INFO("Updating generator setting");
+						Generator::Setup(recv_packet.generator);
+						Communication::SendWithoutPayload(Protocol::PacketType::Ack, recv_packet.sequence);
+						break;
+					case Protocol::PacketType::SpectrumAnalyzerSettings:
+						sweepActive = false;
+						LOG_INFO("Updating spectrum analyzer settings");
+						SA::Setup(recv_packet.spectrumSettings);
+						Communication::SendWithoutPayload(Protocol::PacketType::Ack, recv_packet.sequence);
+						break;
+					case Protocol::PacketType::RequestDeviceLimits: {
+						Protocol::PacketInfo p;
+						p.type = Protocol::PacketType::DeviceLimits;
+						p.limits = HW::Limits;
+						Communication::Send(p);
+						Communication::SendWithoutPayload(Protocol::PacketType::Ack, recv_packet.sequence);
 					}
-					Communication::SendWithoutPayload(Protocol::PacketType::Ack);
-					break;
-				case Protocol::PacketType::Generator:
-					sweepActive = false;
-					LOG_INFO("Updating generator setting");
-					Generator::Setup(recv_packet.generator);
-					Communication::SendWithoutPayload(Protocol::PacketType::Ack);
-					break;
-				case Protocol::PacketType::SpectrumAnalyzerSettings:
-					sweepActive = false;
-					LOG_INFO("Updating spectrum analyzer settings");
-					SA::Setup(recv_packet.spectrumSettings);
-					Communication::SendWithoutPayload(Protocol::PacketType::Ack);
-					break;
-				case Protocol::PacketType::RequestDeviceLimits:
-					Protocol::PacketInfo p;
-					p.type = Protocol::PacketType::DeviceLimits;
-					p.limits = HW::Limits;
-					Communication::Send(p);
-					break;
-#ifdef HAS_FLASH
-				case Protocol::PacketType::ClearFlash:
-					HW::SetMode(HW::Mode::Idle);
-					sweepActive = false;
-					LOG_DEBUG("Erasing FLASH in preparation for firmware update...");
-					if(flash.eraseChip()) {
-						LOG_DEBUG("...FLASH erased")
-						Communication::SendWithoutPayload(Protocol::PacketType::Ack);
-					} else {
-						LOG_ERR("Failed to erase FLASH");
-						Communication::SendWithoutPayload(Protocol::PacketType::Nack);
+						break;
+					case Protocol::PacketType::RequestSweepPlanParameters: {
+						Protocol::PacketInfo p;
+						p.type = Protocol::PacketType::SweepPlanParameters;
+						VNA::GetPlanParameters(p.planParameters);
+						Communication::Send(p);
+						Communication::SendWithoutPayload(Protocol::PacketType::Ack, recv_packet.sequence);
 					}
-					break;
-				case Protocol::PacketType::FirmwarePacket:
-					LOG_INFO("Writing firmware packet at address %u", recv_packet.firmware.address);
-					if(flash.write(recv_packet.firmware.address, sizeof(recv_packet.firmware.data), recv_packet.firmware.data)) {
-						Communication::SendWithoutPayload(Protocol::PacketType::Ack);
-					} else {
-						LOG_ERR("Failed to write FLASH");
-						Communication::SendWithoutPayload(Protocol::PacketType::Nack);
+						break;
+					case Protocol::PacketType::SweepPlanPoints:
+						// loading the plan stops the sweep, it is restarted by the following SweepSettings
+						sweepActive = false;
+						batchCnt = 0;
+						if(VNA::LoadPlan(recv_packet.planPoints)) {
+							Communication::SendWithoutPayload(Protocol::PacketType::Ack, recv_packet.sequence);
+						} else {
+							if(recv_packet.planPoints.firstPoint == 0
+									&& recv_packet.planPoints.revision != HW::GetInitCount()) {
+								// the plan was calculated with outdated parameters, let the host know about the current ones
+								Protocol::PacketInfo p;
+								p.type = Protocol::PacketType::SweepPlanParameters;
+								VNA::GetPlanParameters(p.planParameters);
+								Communication::Send(p);
+							}
+							Communication::SendWithoutPayload(Protocol::PacketType::Nack, recv_packet.sequence);
+						}
+						break;
+					case Protocol::PacketType::SweepSegments:
+						// the new table is used by the following SweepSettings
+						sweepActive = false;
+						batchCnt = 0;
+						if(VNA::SetSegments(recv_packet.segments)) {
+							Communication::SendWithoutPayload(Protocol::PacketType::Ack, recv_packet.sequence);
+						} else {
+							Communication::SendWithoutPayload(Protocol::PacketType::Nack, recv_packet.sequence);
+						}
+						break;
+					case Protocol::PacketType::Capabilities: {
+						hostCapabilities = recv_packet.capabilities;
+						Protocol::PacketInfo p;
+						p.type = Protocol::PacketType::Capabilities;
+						p.capabilities = HW::Capabilities;
+						Communication::Send(p);
+						Communication::SendWithoutPayload(Protocol::PacketType::Ack, recv_packet.sequence);
 					}
-					break;
-				case Protocol::PacketType::PerformFirmwareUpdate: {
-					LOG_INFO("Firmware update process triggered");
-					auto fw_info = Firmware::GetFlashContentInfo(&flash);
-					if(fw_info.valid) {
-						Communication::SendWithoutPayload(Protocol::PacketType::Ack);
-						// Some delay to allow communication to finish
-						vTaskDelay(100);
-						Firmware::PerformUpdate(&flash, fw_info);
-						// should never get here
-						Communication::SendWithoutPayload(Protocol::PacketType::Nack);
+						break;
+#ifdef HAS_FLASH
+					case Protocol::PacketType::ClearFlash:
+						HW::SetMode(HW::Mode::Idle);
+						sweepActive = false;
+						LOG_DEBUG("Erasing FLASH in preparation for firmware update...");
+						if(flash.eraseChip()) {
+							LOG_DEBUG("...FLASH erased")
+							Communication::SendWithoutPayload(Protocol::PacketType::Ack, recv_packet.sequence);
+						} else {
+							LOG_ERR("Failed to erase FLASH");
+							Communication::SendWithoutPayload(Protocol::PacketType::Nack, recv_packet.sequence);
+						}
+						break;
+					case Protocol::PacketType::FirmwarePacket:
+						LOG_INFO("Writing firmware packet at address %u", recv_packet.firmware.address);
+						if(flash.write(recv_packet.firmware.address, sizeof(recv_packet.firmware.data), recv_packet.firmware.data)) {
+							Communication::SendWithoutPayload(Protocol::PacketType::Ack, recv_packet.sequence);
+						} else {
+							LOG_ERR("Failed to write FLASH");
+							Communication::SendWithoutPayload(Protocol::PacketType::Nack, recv_packet.sequence);
+						}
+						break;
+					case Protocol::PacketType::PerformFirmwareUpdate: {
+						LOG_INFO("Firmware update process triggered");
+						auto fw_info = Firmware::GetFlashContentInfo(&flash);
+						if(fw_info.valid) {
+							Communication::SendWithoutPayload(Protocol::PacketType::Ack, recv_packet.sequence);
+							// Some delay to allow communication to finish
+							vTaskDelay(100);
+							Firmware::PerformUpdate(&flash, fw_info);
+							// should never get here
+							Communication::SendWithoutPayload(Protocol::PacketType::Nack, recv_packet.sequence);
+						}
 					}
-				}
-					break;
+						break;
 #endif
-				default:
-					// this packet type is not supported
-					Communication::SendWithoutPayload(Protocol::PacketType::Nack);
-					break;
+					default:
+						// this packet type is not supported
+						Communication::SendWithoutPayload(Protocol::PacketType::Nack, recv_packet.sequence);
+						break;
+					}
+					recv_read = (recv_read + 1) % RecvQueueSize;
 				}
 			}
+			if(notification & FLAG_SWEEP_COMPLETE) {
+				// all points of the sweep have been handled above, send them before the notification
+				FlushBatch();
+				Communication::SendWithoutPayload(Protocol::PacketType::SweepComplete);
+			}
 		}
 
-		if(sweepActive && HAL_GetTick() - lastNewPoint > 1000) {
-			LOG_WARN("Timed out waiting for point, last received point was %d (Status 0x%04x)", result.pointNum, FPGA::GetStatus());
+		if(sweepActive) {
+			// measured points make room for the next segment of a long sweep
+			VNA::PrepareSegment();
+		}
+		sweepStalled = sweepActive && VNA::ResumeStalled();
+		if(sweepStalled) {
+			// no points will arrive until the host has read the pending data
+			lastNewPoint = HAL_GetTick();
+			FlushBatch();
+		}
+
+		if(sweepActive && VNA::BackpressureRequired()) {
+			// points have been lost, the sweep is restarted with halts that wait for the host
+			LOG_INFO("Host is not keeping up, restarting sweep with backpressure halts");
+			bool wasSweeping = VNA::Sweeping();
+			FlushBatch();
+			sweepActive = VNA::Setup(settings, VNACallback, VNASweepComplete);
+			if(sweepActive && settings.triggered && wasSweeping) {
+				// the sweep was already triggered, continue without waiting for the host
+				VNA::Trigger();
+			}
+			lastNewPoint = HAL_GetTick();
+		}
+
+		if(batchCnt && HAL_GetTick() - batchStarted >= MaxBatchDelay) {
+			// do not hold back points for too long (e.g. slow sweep with low IF bandwidth)
+			FlushBatch();
+		}
+
+		if(sweepActive && VNA::Sweeping() && HAL_GetTick() - lastNewPoint > 1000) {
+			LOG_WARN("Timed out waiting for point, last received point was %lu (Status 0x%04x)", result.pointNum, FPGA::GetStatus());
 			FPGA::AbortSweep();
+			batchCnt = 0;
 			// restart the current sweep
 			HW::Init();
 			HW::Ref::update();
-			VNA::Setup(settings, VNACallback);
+			VNA::Setup(settings, VNACallback, VNASweepComplete);
+			if(settings.triggered) {
+				// the sweep was already triggered, continue without waiting for the host
+				VNA::Trigger();
+			}
 			sweepActive = true;
 			lastNewPoint = HAL_GetTick();
 		}
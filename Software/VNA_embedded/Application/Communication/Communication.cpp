@@ -22,10 +22,12 @@ void Communication::Input(const uint8_t *buf, uint16_t len) {
 		memcpy(&inputBuffer[inputCnt], buf, len);
 		inputCnt += len;
 	}
+	Protocol::FrameView frame;
 	Protocol::PacketInfo packet;
 	uint16_t handled_len;
 	do {
-		handled_len = Protocol::DecodeBuffer(inputBuffer, inputCnt, &packet);
+		handled_len = Protocol::FindFrame(inputBuffer, inputCnt, &frame);
+		Protocol::DecodeFrame(frame, &packet);
 		if (handled_len == inputCnt) {
 			// complete input buffer used up, reset counter
 			inputCnt = 0;
@@ -39,15 +41,33 @@ void Communication::Input(const uint8_t *buf, uint16_t len) {
 			if(callback) {
 				callback(packet);
 			}
+		} else if(frame.type != Protocol::PacketType::None) {
+			// complete frame with a malformed payload, the host would otherwise wait for a timeout
+			SendWithoutPayload(Protocol::PacketType::Nack, frame.sequence);
 		}
 	} while (handled_len > 0);
 }
 #include "Hardware.hpp"
 bool Communication::Send(const Protocol::PacketInfo &packet) {
 //	DEBUG1_HIGH();
+	// Encode directly into the USB fifo if the packet fits into the contiguous free space
+	uint8_t *dest;
+	uint16_t space = usb_transmit_reserve(&dest);
+	if(space) {
+		uint16_t len = Protocol::EncodePacket(packet, dest, space);
+		if(len) {
+			return usb_transmit_commit(len);
+		}
+		// release the reservation
+		usb_transmit_commit(0);
+	}
+	// Free space wraps around the end of the fifo (or fifo is already in use), encode into buffer and copy
 	uint16_t len = Protocol::EncodePacket(packet, outputBuffer,
 					sizeof(outputBuffer));
 //	DEBUG1_LOW();
+	if(!len) {
+		return false;
+	}
 	return usb_transmit(outputBuffer, len);
 //	if (hUsbDeviceFS.dev_state == USBD_STATE_CONFIGURED) {
 //		uint16_t len = Protocol::EncodePacket(packet, outputBuffer,
@@ -65,8 +85,9 @@ void communication_usb_input(const uint8_t *buf, uint16_t len) {
 	Communication::Input(buf, len);
 }
 
-bool Communication::SendWithoutPayload(Protocol::PacketType type) {
+bool Communication::SendWithoutPayload(Protocol::PacketType type, uint8_t sequence) {
 	Protocol::PacketInfo p;
 	p.type = type;
+	p.sequence = sequence;
 	return Send(p);
 }
@@ -13,7 +13,8 @@ using Callback = void(*)(const Protocol::PacketInfo&);
 void SetCallback(Callback cb);
 void Input(const uint8_t *buf, uint16_t len);
 bool Send(const Protocol::PacketInfo &packet);
-bool SendWithoutPayload(Protocol::PacketType type);
+// sequence is only used for Ack/Nack, pass the sequence number of the acknowledged packet
+bool SendWithoutPayload(Protocol::PacketType type, uint8_t sequence = 0);
 
 }
 
@@ -1,6 +1,8 @@
 #include "Protocol.hpp"
 
 #include <cstring>
+#include <cstddef>
+#include <cmath>
 
 /*
  * General packet format:
@@ -9,34 +11,95 @@
  * 3. packet type
  * 4. packet payload
  * 5. 4 byte CRC32 (with header)
+ *
+ * If the most significant bit of the packet type is set, a 1 byte sequence number
+ * is inserted between the packet type and the payload
  */
 
 static constexpr uint8_t header = 0x5A;
 static constexpr uint8_t header_size = 4;
+static constexpr uint8_t sequence_flag = 0x80;
 
 #define CRC32_POLYGON 0xEDB88320
-uint32_t Protocol::CRC32(uint32_t crc, const void *data, uint32_t len) {
-	uint8_t *u8buf = (uint8_t*) data;
-	int k;
+
+// Number of lookup tables used by the software CRC. 8 tables (slice-by-8) process eight bytes per
+// iteration at the cost of 8kB of tables, a single table (1kB) processes one byte per iteration
+#ifndef PROTOCOL_CRC_SLICES
+#define PROTOCOL_CRC_SLICES 8
+#endif
+static_assert(PROTOCOL_CRC_SLICES == 1 || PROTOCOL_CRC_SLICES == 8, "Only 1 or 8 CRC slices are supported");
+
+using CRCTable = struct _crcTable {
+	uint32_t t[PROTOCOL_CRC_SLICES][256];
+};
+
+static constexpr CRCTable GenerateCRCTable() {
+	CRCTable table = {};
+	for (uint16_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (uint8_t k = 0; k < 8; k++) {
+			crc = crc & 1 ? (crc >> 1) ^ CRC32_POLYGON : crc >> 1;
+		}
+		table.t[0][i] = crc;
+	}
+	for (uint8_t s = 1; s < PROTOCOL_CRC_SLICES; s++) {
+		for (uint16_t i = 0; i < 256; i++) {
+			uint32_t prev = table.t[s - 1][i];
+			table.t[s][i] = (prev >> 8) ^ table.t[0][prev & 0xFF];
+		}
+	}
+	return table;
+}
+static constexpr CRCTable crcTable = GenerateCRCTable();
+
+static Protocol::CRCFunction crcFunction = nullptr;
+
+void Protocol::SetCRCFunction(CRCFunction f) {
+	crcFunction = f;
+}
+
+static uint32_t SoftwareCRC32(uint32_t crc, const void *data, uint32_t len) {
+	auto u8buf = (const uint8_t*) data;
+	auto &t = crcTable.t;
 
 	crc = ~crc;
+#if PROTOCOL_CRC_SLICES == 8
+	// Note: assumes a little endian CPU (true for both the device and x86/ARM hosts)
+	while (len >= 8) {
+		uint32_t one, two;
+		memcpy(&one, u8buf, 4);
+		memcpy(&two, u8buf + 4, 4);
+		one ^= crc;
+		crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24]
+				^ t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+		u8buf += 8;
+		len -= 8;
+	}
+#endif
 	while (len--) {
-		crc ^= *u8buf++;
-		for (k = 0; k < 8; k++)
-			crc = crc & 1 ? (crc >> 1) ^ CRC32_POLYGON : crc >> 1;
+		crc = (crc >> 8) ^ t[0][(crc ^ *u8buf++) & 0xFF];
 	}
 	return ~crc;
 }
 
+uint32_t Protocol::CRC32(uint32_t crc, const void *data, uint32_t len) {
+	uint32_t result = crc;
+	if (crcFunction && crcFunction(result, data, len)) {
+		return result;
+	}
+	// no replacement or it is currently not available
+	return SoftwareCRC32(crc, data, len);
+}
+
 class Encoder {
 public:
+    // The buffer is not cleared, only the bytes that are actually used are written
     Encoder(uint8_t *buf, uint16_t size) :
         buf(buf),
         bufSize(size),
         usedSize(0),
-        bitpos(0) {
-        memset(buf, 0, size);
-    };
+        bitpos(0),
+        overflow(false) {};
     template<typename T> bool add(T data) {
         if(bitpos != 0) {
             // add padding to next byte boundary
@@ -45,6 +108,7 @@ public:
         }
         if(bufSize - usedSize < (long) sizeof(T)) {
             // not enough space left
+            overflow = true;
             return false;
         }
         memcpy(&buf[usedSize], &data, sizeof(T));
@@ -53,14 +117,20 @@ public:
     }
     bool addBits(uint8_t value, uint8_t bits) {
         if(bits >= 8 || usedSize >= bufSize) {
+            overflow = true;
             return false;
         }
+        if(bitpos == 0) {
+            // start of a new byte, clear any previous buffer content
+            buf[usedSize] = 0;
+        }
         buf[usedSize] |= (value << bitpos) & 0xFF;
         bitpos += bits;
         if(bitpos > 8) {
             // the value did not fit completely into the current byte
             if(usedSize >= bufSize - 1) {
                 // already at maximum limit, not enough space for remaining bits
+                overflow = true;
                 return false;
             }
             // move access to next byte
@@ -74,8 +144,11 @@ public:
         }
         return true;
     }
-    uint16_t getSize() const {
-        if(bitpos == 0) {
+    // Returns -1 if the buffer was too small for any of the added values
+    int16_t getSize() const {
+        if(overflow) {
+            return -1;
+        } else if(bitpos == 0) {
             return usedSize;
         } else {
             return usedSize + 1;
@@ -87,21 +160,29 @@ private:
     uint16_t bufSize;
     uint16_t usedSize;
     uint8_t bitpos;
+    bool overflow;
 };
 
 class Decoder {
 public:
-    Decoder(uint8_t *buf) :
+    // With a length, values beyond the end of the buffer are decoded as zero and mark the decoder as overflowed
+    Decoder(const uint8_t *buf, uint16_t len = UINT16_MAX) :
         buf(buf),
+        len(len),
         usedSize(0),
-        bitpos(0) {};
+        bitpos(0),
+        overflow(false) {};
     template<typename T> void get(T &t) {
         if(bitpos != 0) {
             // add padding to next byte boundary
             bitpos = 0;
             usedSize++;
         }
-        // still enough bytes available
+        if(usedSize + sizeof(T) > len) {
+            memset(&t, 0, sizeof(T));
+            overflow = true;
+            return;
+        }
         memcpy(&t, &buf[usedSize], sizeof(T));
         usedSize += sizeof(T);
     }
@@ -109,6 +190,10 @@ public:
         if(bits >= 8) {
             return 0;
         }
+        if(usedSize + (bitpos + bits > 8 ? 2 : 1) > len) {
+            overflow = true;
+            return 0;
+        }
         uint8_t mask = 0x00;
         for(uint8_t i=0;i<bits;i++) {
             mask <<= 1;
@@ -129,13 +214,23 @@ public:
         }
         return value;
     }
+    // Number of bytes decoded so far (including a partially used byte)
+    uint16_t getSize() const {
+        return bitpos ? usedSize + 1 : usedSize;
+    }
+    // Returns true if all values were within the buffer and exactly the complete buffer was decoded
+    bool complete() const {
+        return !overflow && getSize() == len;
+    }
 private:
-    uint8_t *buf;
+    const uint8_t *buf;
+    uint16_t len;
     uint16_t usedSize;
     uint8_t bitpos;
+    bool overflow;
 };
 
-static Protocol::Datapoint DecodeDatapoint(uint8_t *buf) {
+static Protocol::Datapoint DecodeDatapoint(const uint8_t *buf) {
     Protocol::Datapoint d;
     Decoder e(buf);
     e.get<float>(d.real_S11);
@@ -147,7 +242,10 @@ static Protocol::Datapoint DecodeDatapoint(uint8_t *buf) {
     e.get<float>(d.real_S22);
     e.get<float>(d.imag_S22);
     e.get<uint64_t>(d.frequency);
-    e.get<uint16_t>(d.pointNum);
+    uint16_t pointNum;
+    e.get<uint16_t>(pointNum);
+    d.pointNum = pointNum;
+    d.ports = Protocol::DatapointPorts::Both;
     return d;
 }
 static int16_t EncodeDatapoint(Protocol::Datapoint d, uint8_t *buf,
@@ -157,7 +255,13 @@ static int16_t EncodeDatapoint(Protocol::Datapoint d, uint8_t *buf,
 	// Protocol::Datapoint struct is setup without any padding between
 	// the variables. In this case it is allowed to simply copy its
 	// content into the buffer. Compared to using the encoder, this
-	// saves approximately 40us for each datapoint
+	// saves approximately 40us for each datapoint. The lower 16 bits of
+	// the point number are at the same position as in the original
+	// 16 bit field, older hosts still decode the point number correctly
+	if(bufSize < sizeof(d)) {
+		// unable to encode, not enough space
+		return -1;
+	}
 	memcpy(buf, &d, sizeof(d));
 	return sizeof(d);
 //    Encoder e(buf, bufSize);
@@ -174,17 +278,308 @@ static int16_t EncodeDatapoint(Protocol::Datapoint d, uint8_t *buf,
 //    return e.getSize();
 }
 
-static Protocol::SweepSettings DecodeSweepSettings(uint8_t *buf) {
+// Size of a point within a batch. The pointNum is never transmitted (implicit from position in batch)
+static constexpr uint8_t batchFullPointSize = offsetof(Protocol::Datapoint, pointNum);
+static_assert(batchFullPointSize == 8 * sizeof(float) + sizeof(uint64_t), "Unexpected padding in Protocol::Datapoint");
+static constexpr uint8_t batchFloatPointSize = offsetof(Protocol::Datapoint, frequency);
+static constexpr uint8_t batchCompactPointSize = 4 * (1 + 2 * sizeof(int16_t));
+
+static uint8_t BatchPointSize(Protocol::DatapointFormat format, Protocol::DatapointPorts ports) {
+	if(ports == Protocol::DatapointPorts::Port1 || ports == Protocol::DatapointPorts::Port2) {
+		// only two of the four S-parameters
+		switch(format) {
+		case Protocol::DatapointFormat::Full: return batchFloatPointSize / 2 + sizeof(uint64_t);
+		case Protocol::DatapointFormat::ImplicitFrequency: return batchFloatPointSize / 2;
+		case Protocol::DatapointFormat::Compact16: return batchCompactPointSize / 2;
+		default: return 0;
+		}
+	} else if(ports != Protocol::DatapointPorts::Both) {
+		// unknown ports
+		return 0;
+	}
+	switch(format) {
+	case Protocol::DatapointFormat::Full: return batchFullPointSize;
+	case Protocol::DatapointFormat::ImplicitFrequency: return batchFloatPointSize;
+	case Protocol::DatapointFormat::Compact16: return batchCompactPointSize;
+	default: return 0;
+	}
+}
+
+// The S-parameters of a point with only two S-parameters (S11/S21 or S12/S22) in transmission order.
+// Each value is accessed individually, the struct members are separate objects
+template<typename D, typename F> static void HalfPointParameters(D &d, Protocol::DatapointPorts ports, F *param[4]) {
+	if(ports == Protocol::DatapointPorts::Port2) {
+		param[0] = &d.real_S12;
+		param[1] = &d.imag_S12;
+		param[2] = &d.real_S22;
+		param[3] = &d.imag_S22;
+	} else {
+		param[0] = &d.real_S11;
+		param[1] = &d.imag_S11;
+		param[2] = &d.real_S21;
+		param[3] = &d.imag_S21;
+	}
+}
+
+// Compact16: both values share the exponent of the larger one. Mantissas are scaled to the full int16 range
+static void EncodeCompact(float real, float imag, uint8_t *buf) {
+	float max = fabsf(real) > fabsf(imag) ? fabsf(real) : fabsf(imag);
+	int exp = 0;
+	if(max > 0) {
+		// max = m * 2^exp with 0.5 <= m < 1
+		frexpf(max, &exp);
+	}
+	if(exp < INT8_MIN) {
+		exp = INT8_MIN;
+	} else if(exp > INT8_MAX) {
+		exp = INT8_MAX;
+	}
+	auto mantissa = [exp](float f) -> int16_t {
+		long m = lrintf(ldexpf(f, 15 - exp));
+		if(m > INT16_MAX) {
+			m = INT16_MAX;
+		} else if(m < -INT16_MAX) {
+			m = -INT16_MAX;
+		}
+		return m;
+	};
+	int16_t m_real = mantissa(real);
+	int16_t m_imag = mantissa(imag);
+	buf[0] = (int8_t) exp;
+	memcpy(&buf[1], &m_real, 2);
+	memcpy(&buf[3], &m_imag, 2);
+}
+static void DecodeCompact(const uint8_t *buf, float &real, float &imag) {
+	int exp = (int8_t) buf[0];
+	int16_t m_real, m_imag;
+	memcpy(&m_real, &buf[1], 2);
+	memcpy(&m_imag, &buf[3], 2);
+	real = ldexpf(m_real, exp - 15);
+	imag = ldexpf(m_imag, exp - 15);
+}
+
+// Set in the format byte of a batch if the header is followed by the upper 16 bits of the first point number
+static constexpr uint8_t batchLongPointNumFlag = 0x20;
+// Returns false if the batch is malformed: unknown format or ports, too many points or a payload length that does
+// not match the number of points
+static bool DecodeDatapointBatch(const uint8_t *buf, uint16_t len, Protocol::DatapointBatch &d) {
+    d.count = 0;
+    d.points = nullptr;
+    d.raw = nullptr;
+    if(len < 4) {
+        return false;
+    }
+    Decoder e(buf);
+    uint16_t pointNum;
+    e.get<uint16_t>(pointNum);
+    d.firstPointNum = pointNum;
+    e.get<uint8_t>(d.count);
+    // the upper two bits contain the ports
+    uint8_t format;
+    e.get<uint8_t>(format);
+    d.format = (Protocol::DatapointFormat) (format & 0x1F);
+    d.ports = (Protocol::DatapointPorts) (format >> 6);
+    // the datapoints themselves are only decoded on request (see Protocol::GetBatchDatapoint)
+    d.raw = &buf[4];
+    uint16_t headerSize = 4;
+    if(format & batchLongPointNumFlag) {
+        if(len < 6) {
+            d.count = 0;
+            d.raw = nullptr;
+            return false;
+        }
+        e.get<uint16_t>(pointNum);
+        d.firstPointNum |= (uint32_t) pointNum << 16;
+        d.raw = &buf[6];
+        headerSize = 6;
+    }
+    uint8_t pointSize = BatchPointSize(d.format, d.ports);
+    if(!pointSize || d.count > Protocol::MaxBatchPoints || len != headerSize + d.count * pointSize) {
+        d.count = 0;
+        d.raw = nullptr;
+        return false;
+    }
+    return true;
+}
+static int16_t EncodeDatapointBatch(const Protocol::DatapointBatch &d, uint8_t *buf,
+		uint16_t bufSize) {
+	uint8_t pointSize = BatchPointSize(d.format, d.ports);
+	// the upper 16 bits of the point number are only transmitted if required
+	uint8_t headerSize = d.firstPointNum > 0xFFFF ? 6 : 4;
+	if(!pointSize || d.count > Protocol::MaxBatchPoints || bufSize < headerSize + d.count * pointSize) {
+		// unable to encode, not enough space
+		return -1;
+	}
+	memcpy(buf, &d.firstPointNum, 2);
+	buf[2] = d.count;
+	buf[3] = (uint8_t) d.format | (uint8_t) d.ports << 6;
+	if(headerSize > 4) {
+		buf[3] |= batchLongPointNumFlag;
+		uint16_t upper = d.firstPointNum >> 16;
+		memcpy(&buf[4], &upper, 2);
+	}
+	buf += headerSize;
+	for(uint8_t i=0;i<d.count;i++) {
+		auto &p = d.points[i];
+		if(d.ports != Protocol::DatapointPorts::Both) {
+			const float *param[4];
+			HalfPointParameters(p, d.ports, param);
+			if(d.format == Protocol::DatapointFormat::Compact16) {
+				EncodeCompact(*param[0], *param[1], &buf[0]);
+				EncodeCompact(*param[2], *param[3], &buf[5]);
+			} else {
+				for(uint8_t j=0;j<4;j++) {
+					memcpy(&buf[j * sizeof(float)], param[j], sizeof(float));
+				}
+				if(d.format == Protocol::DatapointFormat::Full) {
+					memcpy(&buf[batchFloatPointSize / 2], &p.frequency, sizeof(p.frequency));
+				}
+			}
+		} else if(d.format == Protocol::DatapointFormat::Compact16) {
+			EncodeCompact(p.real_S11, p.imag_S11, &buf[0]);
+			EncodeCompact(p.real_S21, p.imag_S21, &buf[5]);
+			EncodeCompact(p.real_S12, p.imag_S12, &buf[10]);
+			EncodeCompact(p.real_S22, p.imag_S22, &buf[15]);
+		} else {
+			// Same reasoning as in EncodeDatapoint: the struct has no padding between the
+			// variables, copying is much faster than using the encoder
+			memcpy(buf, &p, pointSize);
+		}
+		buf += pointSize;
+	}
+	return headerSize + d.count * pointSize;
+}
+
+uint64_t Protocol::SweepFrequency(const SweepSettings &settings, uint32_t pointNum, const SweepSegments *segments) {
+	if(settings.segmentTable && segments && segments->count > 0) {
+		uint8_t count = segments->count <= MaxSweepSegments ? segments->count : MaxSweepSegments;
+		for(uint8_t i=0;i<count;i++) {
+			auto &segment = segments->segments[i];
+			if(pointNum < segment.points) {
+				return SegmentFrequency(segment, pointNum);
+			}
+			pointNum -= segment.points;
+		}
+		// beyond the end of the table
+		return segments->segments[count - 1].f_stop;
+	}
+	if(settings.points < 2) {
+		return settings.f_start;
+	}
+	if(settings.logSweep && settings.f_start > 0) {
+		// same spacing as SweepPlan::Frequencies (which steps by the ratio between consecutive points)
+		double exponent = (double) pointNum / (settings.points - 1);
+		return settings.f_start * pow((double) settings.f_stop / settings.f_start, exponent) + 0.5;
+	}
+	return settings.f_start + (settings.f_stop - settings.f_start) * pointNum / (settings.points - 1);
+}
+
+uint64_t Protocol::SegmentFrequency(const SweepSegment &segment, uint16_t pointNum) {
+	if(segment.points < 2) {
+		return segment.f_start;
+	}
+	return segment.f_start + (segment.f_stop - segment.f_start) * pointNum / (segment.points - 1);
+}
+
+uint32_t Protocol::SegmentTablePoints(const SweepSegments &segments) {
+	uint32_t points = 0;
+	for(uint8_t i=0;i<segments.count && i<MaxSweepSegments;i++) {
+		points += segments.segments[i].points;
+	}
+	return points;
+}
+
+Protocol::Datapoint Protocol::GetBatchDatapoint(const DatapointBatch &batch, uint8_t index, const SweepSettings *settings,
+		const SweepSegments *segments) {
+	Datapoint d = {};
+	auto pointSize = BatchPointSize(batch.format, batch.ports);
+	d.pointNum = batch.firstPointNum + index;
+	d.ports = batch.ports;
+	if(!pointSize || index >= batch.count || !batch.raw) {
+		// not part of the batch (or a batch that failed to decode), no data available
+		return d;
+	}
+	auto buf = &batch.raw[index * pointSize];
+	if(batch.ports != DatapointPorts::Both) {
+		// the S-parameters of the port that was not excited are not transferred
+		memset(&d, 0, batchFloatPointSize);
+		float *param[4];
+		HalfPointParameters(d, batch.ports, param);
+		if(batch.format == DatapointFormat::Compact16) {
+			DecodeCompact(&buf[0], *param[0], *param[1]);
+			DecodeCompact(&buf[5], *param[2], *param[3]);
+		} else {
+			for(uint8_t j=0;j<4;j++) {
+				memcpy(param[j], &buf[j * sizeof(float)], sizeof(float));
+			}
+			if(batch.format == DatapointFormat::Full) {
+				memcpy(&d.frequency, &buf[batchFloatPointSize / 2], sizeof(d.frequency));
+			}
+		}
+	} else switch(batch.format) {
+	case DatapointFormat::Full:
+		memcpy(&d, buf, batchFullPointSize);
+		break;
+	case DatapointFormat::ImplicitFrequency:
+		memcpy(&d, buf, batchFloatPointSize);
+		break;
+	case DatapointFormat::Compact16:
+		DecodeCompact(&buf[0], d.real_S11, d.imag_S11);
+		DecodeCompact(&buf[5], d.real_S21, d.imag_S21);
+		DecodeCompact(&buf[10], d.real_S12, d.imag_S12);
+		DecodeCompact(&buf[15], d.real_S22, d.imag_S22);
+		break;
+	default:
+		// rejected by BatchPointSize
+		break;
+	}
+	if(batch.format != DatapointFormat::Full && settings) {
+		d.frequency = SweepFrequency(*settings, d.pointNum, segments);
+	}
+	return d;
+}
+
+// Size of the SweepSettings payload before the number of points was extended to 32 bit
+static constexpr uint16_t sweepSettingsBaseSize = 25;
+static Protocol::SweepSettings DecodeSweepSettings(const uint8_t *buf, uint16_t len) {
     Protocol::SweepSettings d;
     Decoder e(buf);
     e.get<uint64_t>(d.f_start);
     e.get<uint64_t>(d.f_stop);
-    e.get<uint16_t>(d.points);
+    // lower 16 bits, the upper bits are appended at the end
+    uint16_t points;
+    e.get<uint16_t>(points);
+    d.points = points;
     e.get<uint32_t>(d.if_bandwidth);
     e.get<int16_t>(d.cdbm_excitation);
     d.excitePort1 = e.getBits(1);
     d.excitePort2 = e.getBits(1);
     d.suppressPeaks = e.getBits(1);
+    d.dataFormat = e.getBits(2);
+    d.uploadedPlan = e.getBits(1);
+    d.portBlocked = e.getBits(1);
+    d.segmentTable = e.getBits(1);
+    if(len > sweepSettingsBaseSize) {
+        e.get<uint16_t>(points);
+        d.points |= (uint32_t) points << 16;
+    }
+    // appended after the upper bits of the number of points
+    d.logSweep = 0;
+    d.triggered = 0;
+    d.extendedSettling = 0;
+    d.sweeps = 0;
+    if(len > sweepSettingsBaseSize + 2) {
+        d.logSweep = e.getBits(1);
+        d.triggered = e.getBits(1);
+        d.extendedSettling = e.getBits(1);
+    }
+    if(len > sweepSettingsBaseSize + 3) {
+        e.get<uint16_t>(d.sweeps);
+    }
+    d.averages = 0;
+    if(len > sweepSettingsBaseSize + 5) {
+        e.get<uint16_t>(d.averages);
+    }
     return d;
 }
 static int16_t EncodeSweepSettings(Protocol::SweepSettings d, uint8_t *buf,
@@ -192,16 +587,26 @@ static int16_t EncodeSweepSettings(Protocol::SweepSettings d, uint8_t *buf,
     Encoder e(buf, bufSize);
     e.add<uint64_t>(d.f_start);
     e.add<uint64_t>(d.f_stop);
-    e.add<uint16_t>(d.points);
+    e.add<uint16_t>(d.points & 0xFFFF);
     e.add<uint32_t>(d.if_bandwidth);
     e.add<int16_t>(d.cdbm_excitation);
     e.addBits(d.excitePort1, 1);
     e.addBits(d.excitePort2, 1);
     e.addBits(d.suppressPeaks, 1);
+    e.addBits(d.dataFormat, 2);
+    e.addBits(d.uploadedPlan, 1);
+    e.addBits(d.portBlocked, 1);
+    e.addBits(d.segmentTable, 1);
+    e.add<uint16_t>(d.points >> 16);
+    e.addBits(d.logSweep, 1);
+    e.addBits(d.triggered, 1);
+    e.addBits(d.extendedSettling, 1);
+    e.add<uint16_t>(d.sweeps);
+    e.add<uint16_t>(d.averages);
     return e.getSize();
 }
 
-static Protocol::ReferenceSettings DecodeReferenceSettings(uint8_t *buf) {
+static Protocol::ReferenceSettings DecodeReferenceSettings(const uint8_t *buf) {
     Protocol::ReferenceSettings d;
     Decoder e(buf);
     e.get<uint32_t>(d.ExtRefOuputFreq);
@@ -218,7 +623,7 @@ static int16_t EncodeReferenceSettings(Protocol::ReferenceSettings d, uint8_t *b
     return e.getSize();
 }
 
-static Protocol::GeneratorSettings DecodeGeneratorSettings(uint8_t *buf) {
+static Protocol::GeneratorSettings DecodeGeneratorSettings(const uint8_t *buf) {
     Protocol::GeneratorSettings d;
     Decoder e(buf);
     e.get<uint64_t>(d.frequency);
@@ -235,7 +640,11 @@ static int16_t EncodeGeneratorSettings(Protocol::GeneratorSettings d, uint8_t *b
     return e.getSize();
 }
 
-static Protocol::DeviceInfo DecodeDeviceInfo(uint8_t *buf) {
+// Size of the DeviceInfo payload before the transmit statistics were added
+static constexpr uint16_t deviceInfoBaseSize = 9;
+// Size of the DeviceInfo payload before the sweep time was added
+static constexpr uint16_t deviceInfoTransmitSize = deviceInfoBaseSize + 4;
+static Protocol::DeviceInfo DecodeDeviceInfo(const uint8_t *buf, uint16_t len) {
     Protocol::DeviceInfo d;
     Decoder e(buf);
     e.get<uint16_t>(d.FW_major);
@@ -250,6 +659,19 @@ static Protocol::DeviceInfo DecodeDeviceInfo(uint8_t *buf) {
     e.get<uint8_t>(d.temperatures.source);
     e.get<uint8_t>(d.temperatures.LO1);
     e.get<uint8_t>(d.temperatures.MCU);
+    if(len > deviceInfoBaseSize) {
+        e.get<uint16_t>(d.transmit.fifoHighWater);
+        e.get<uint16_t>(d.transmit.stalls);
+    } else {
+        // older firmware, statistics not available
+        d.transmit.fifoHighWater = 0;
+        d.transmit.stalls = 0;
+    }
+    if(len > deviceInfoTransmitSize) {
+        e.get<uint32_t>(d.sweepTime);
+    } else {
+        d.sweepTime = 0;
+    }
     return d;
 }
 static int16_t EncodeDeviceInfo(Protocol::DeviceInfo d, uint8_t *buf,
@@ -267,10 +689,13 @@ static int16_t EncodeDeviceInfo(Protocol::DeviceInfo d, uint8_t *buf,
     e.add<uint8_t>(d.temperatures.source);
     e.add<uint8_t>(d.temperatures.LO1);
     e.add<uint8_t>(d.temperatures.MCU);
+    e.add<uint16_t>(d.transmit.fifoHighWater);
+    e.add<uint16_t>(d.transmit.stalls);
+    e.add<uint32_t>(d.sweepTime);
     return e.getSize();
 }
 
-static Protocol::ManualStatus DecodeStatus(uint8_t *buf) {
+static Protocol::ManualStatus DecodeStatus(const uint8_t *buf) {
     Protocol::ManualStatus d;
     Decoder e(buf);
     e.get<int16_t>(d.port1min);
@@ -313,7 +738,7 @@ static int16_t EncodeStatus(Protocol::ManualStatus d, uint8_t *buf,
     return e.getSize();
 }
 
-static Protocol::ManualControl DecodeManualControl(uint8_t *buf) {
+static Protocol::ManualControl DecodeManualControl(const uint8_t *buf) {
     Protocol::ManualControl d;
     Decoder e(buf);
     d.SourceHighCE = e.getBits(1);
@@ -368,7 +793,7 @@ static int16_t EncodeManualControl(Protocol::ManualControl d, uint8_t *buf,
     return e.getSize();
 }
 
-static Protocol::SpectrumAnalyzerSettings DecodeSpectrumAnalyzerSettings(uint8_t *buf) {
+static Protocol::SpectrumAnalyzerSettings DecodeSpectrumAnalyzerSettings(const uint8_t *buf) {
     Protocol::SpectrumAnalyzerSettings d;
     Decoder e(buf);
     e.get<uint64_t>(d.f_start);
@@ -393,7 +818,7 @@ static int16_t EncodeSpectrumAnalyzerSettings(Protocol::SpectrumAnalyzerSettings
     return e.getSize();
 }
 
-static Protocol::SpectrumAnalyzerResult DecodeSpectrumAnalyzerResult(uint8_t *buf) {
+static Protocol::SpectrumAnalyzerResult DecodeSpectrumAnalyzerResult(const uint8_t *buf) {
     Protocol::SpectrumAnalyzerResult d;
     Decoder e(buf);
     e.get<float>(d.port1);
@@ -412,7 +837,9 @@ static int16_t EncodeSpectrumAnalyzerResult(Protocol::SpectrumAnalyzerResult d,
     return e.getSize();
 }
 
-static Protocol::DeviceLimits DecodeDeviceLimits(uint8_t *buf) {
+// Size of the DeviceLimits payload before the maximum number of sweep points was added
+static constexpr uint16_t deviceLimitsBaseSize = 38;
+static Protocol::DeviceLimits DecodeDeviceLimits(const uint8_t *buf, uint16_t len) {
     Protocol::DeviceLimits d;
     Decoder e(buf);
     e.get(d.minFreq);
@@ -424,6 +851,12 @@ static Protocol::DeviceLimits DecodeDeviceLimits(uint8_t *buf) {
     e.get(d.cdbm_max);
     e.get(d.minRBW);
     e.get(d.maxRBW);
+    if(len > deviceLimitsBaseSize) {
+        e.get(d.maxSweepPoints);
+    } else {
+        // older firmware, no long sweeps
+        d.maxSweepPoints = d.maxPoints;
+    }
     return d;
 }
 static int16_t EncodeDeviceLimits(Protocol::DeviceLimits d, uint8_t *buf,
@@ -438,10 +871,11 @@ static int16_t EncodeDeviceLimits(Protocol::DeviceLimits d, uint8_t *buf,
     e.add(d.cdbm_max);
     e.add(d.minRBW);
     e.add(d.maxRBW);
+    e.add(d.maxSweepPoints);
     return e.getSize();
 }
 
-static Protocol::FirmwarePacket DecodeFirmwarePacket(uint8_t *buf) {
+static Protocol::FirmwarePacket DecodeFirmwarePacket(const uint8_t *buf) {
     Protocol::FirmwarePacket d;
     // simple packet format, memcpy is faster than using the decoder
     memcpy(&d.address, buf, 4);
@@ -449,6 +883,205 @@ static Protocol::FirmwarePacket DecodeFirmwarePacket(uint8_t *buf) {
     memcpy(d.data, buf, Protocol::FirmwareChunkSize);
     return d;
 }
+static Protocol::Capabilities DecodeCapabilities(const uint8_t *buf, uint16_t len) {
+    Protocol::Capabilities d;
+    Decoder e(buf);
+    d.DatapointBatches = e.getBits(1);
+    d.CompactDatapoints = e.getBits(1);
+    d.SequencedAcks = e.getBits(1);
+    d.SweepPlans = e.getBits(1);
+    d.PortBlockedSweeps = e.getBits(1);
+    d.LongSweeps = e.getBits(1);
+    d.SegmentTables = e.getBits(1);
+    d.LogSweeps = e.getBits(1);
+    // second byte, not sent by older firmware
+    d.SweepModes = 0;
+    d.PointAveraging = 0;
+    if(len > 1) {
+        d.SweepModes = e.getBits(1);
+        d.PointAveraging = e.getBits(1);
+    }
+    return d;
+}
+static int16_t EncodeCapabilities(Protocol::Capabilities d, uint8_t *buf,
+                                                   uint16_t bufSize) {
+    Encoder e(buf, bufSize);
+    e.addBits(d.DatapointBatches, 1);
+    e.addBits(d.CompactDatapoints, 1);
+    e.addBits(d.SequencedAcks, 1);
+    e.addBits(d.SweepPlans, 1);
+    e.addBits(d.PortBlockedSweeps, 1);
+    e.addBits(d.LongSweeps, 1);
+    e.addBits(d.SegmentTables, 1);
+    e.addBits(d.LogSweeps, 1);
+    e.addBits(d.SweepModes, 1);
+    e.addBits(d.PointAveraging, 1);
+    return e.getSize();
+}
+
+// Returns false if the payload length does not match the parameters
+static bool DecodeSweepPlanParameters(const uint8_t *buf, uint16_t len, Protocol::SweepPlanParameters &d) {
+    Decoder e(buf, len);
+    e.get(d.revision);
+    e.get(d.sourcePFD);
+    e.get(d.LO1PFD);
+    e.get(d.LO2PLL);
+    e.get(d.IF1);
+    e.get(d.IF2);
+    e.get(d.ADCSamplerate);
+    e.get(d.bandSwitch);
+    e.get(d.maxLO2Shifts);
+    d.sourceVCOMapValid = e.getBits(1);
+    d.LO1VCOMapValid = e.getBits(1);
+    for(auto &v : d.sourceVCOMap) {
+        e.get(v);
+    }
+    for(auto &v : d.LO1VCOMap) {
+        e.get(v);
+    }
+    return e.complete();
+}
+static int16_t EncodeSweepPlanParameters(const Protocol::SweepPlanParameters &d, uint8_t *buf,
+                                                   uint16_t bufSize) {
+    Encoder e(buf, bufSize);
+    e.add(d.revision);
+    e.add(d.sourcePFD);
+    e.add(d.LO1PFD);
+    e.add(d.LO2PLL);
+    e.add(d.IF1);
+    e.add(d.IF2);
+    e.add(d.ADCSamplerate);
+    e.add(d.bandSwitch);
+    e.add(d.maxLO2Shifts);
+    e.addBits(d.sourceVCOMapValid, 1);
+    e.addBits(d.LO1VCOMapValid, 1);
+    for(auto v : d.sourceVCOMap) {
+        e.add(v);
+    }
+    for(auto v : d.LO1VCOMap) {
+        e.add(v);
+    }
+    return e.getSize();
+}
+
+static void DecodeSweepPlanPLL(Decoder &e, Protocol::SweepPlanPLL &d) {
+    e.get(d.N);
+    e.get(d.F);
+    e.get(d.M);
+    e.get(d.div);
+    e.get(d.VCO);
+}
+static void EncodeSweepPlanPLL(Encoder &e, const Protocol::SweepPlanPLL &d) {
+    e.add(d.N);
+    e.add(d.F);
+    e.add(d.M);
+    e.add(d.div);
+    e.add(d.VCO);
+}
+
+// Returns false if there are too many points or the payload length does not match them. The points end up in
+// the FPGA sweep configuration, a truncated packet must not be used
+static bool DecodeSweepPlanPoints(const uint8_t *buf, uint16_t len, Protocol::SweepPlanPoints &d) {
+    Decoder e(buf, len);
+    e.get(d.revision);
+    e.get(d.firstPoint);
+    e.get(d.count);
+    if(d.count > Protocol::MaxPlanPoints) {
+        d.count = 0;
+        return false;
+    }
+    for(uint8_t i=0;i<d.count;i++) {
+        auto &p = d.points[i];
+        DecodeSweepPlanPLL(e, p.source);
+        DecodeSweepPlanPLL(e, p.LO1);
+        p.attenuator = e.getBits(7);
+        p.lowband = e.getBits(1);
+        p.halt = e.getBits(1);
+        p.filter = e.getBits(2);
+        p.LO2Shift = e.getBits(1);
+        p.settling = e.getBits(2);
+        p.samples = 0;
+        // the 2.LO configuration is only transmitted if it changes
+        if(p.LO2Shift) {
+            for(auto &c : p.LO2Config) {
+                e.get(c);
+            }
+        }
+    }
+    if(!e.complete()) {
+        d.count = 0;
+        return false;
+    }
+    return true;
+}
+static int16_t EncodeSweepPlanPoints(const Protocol::SweepPlanPoints &d, uint8_t *buf,
+                                                   uint16_t bufSize) {
+    if(d.count > Protocol::MaxPlanPoints) {
+        return -1;
+    }
+    Encoder e(buf, bufSize);
+    e.add(d.revision);
+    e.add(d.firstPoint);
+    e.add(d.count);
+    for(uint8_t i=0;i<d.count;i++) {
+        auto &p = d.points[i];
+        EncodeSweepPlanPLL(e, p.source);
+        EncodeSweepPlanPLL(e, p.LO1);
+        e.addBits(p.attenuator, 7);
+        e.addBits(p.lowband, 1);
+        e.addBits(p.halt, 1);
+        e.addBits(p.filter, 2);
+        e.addBits(p.LO2Shift, 1);
+        e.addBits(p.settling, 2);
+        if(p.LO2Shift) {
+            for(auto c : p.LO2Config) {
+                e.add(c);
+            }
+        }
+    }
+    return e.getSize();
+}
+
+// Returns false if there are too many segments or the payload length does not match them
+static bool DecodeSweepSegments(const uint8_t *buf, uint16_t len, Protocol::SweepSegments &d) {
+    Decoder e(buf, len);
+    e.get(d.count);
+    if(d.count > Protocol::MaxSweepSegments) {
+        d.count = 0;
+        return false;
+    }
+    for(uint8_t i=0;i<d.count;i++) {
+        auto &s = d.segments[i];
+        e.get(s.f_start);
+        e.get(s.f_stop);
+        e.get(s.points);
+        e.get(s.if_bandwidth);
+        e.get(s.cdbm_excitation);
+    }
+    if(!e.complete()) {
+        d.count = 0;
+        return false;
+    }
+    return true;
+}
+static int16_t EncodeSweepSegments(const Protocol::SweepSegments &d, uint8_t *buf,
+                                                   uint16_t bufSize) {
+    if(d.count > Protocol::MaxSweepSegments) {
+        return -1;
+    }
+    Encoder e(buf, bufSize);
+    e.add(d.count);
+    for(uint8_t i=0;i<d.count;i++) {
+        auto &s = d.segments[i];
+        e.add(s.f_start);
+        e.add(s.f_stop);
+        e.add(s.points);
+        e.add(s.if_bandwidth);
+        e.add(s.cdbm_excitation);
+    }
+    return e.getSize();
+}
+
 static int16_t EncodeFirmwarePacket(const Protocol::FirmwarePacket &d, uint8_t *buf, uint16_t bufSize) {
     if(bufSize < 4 + Protocol::FirmwareChunkSize) {
         // unable to encode, not enough space
@@ -461,34 +1094,37 @@ static int16_t EncodeFirmwarePacket(const Protocol::FirmwarePacket &d, uint8_t *
     return 4 + Protocol::FirmwareChunkSize;
 }
 
-uint16_t Protocol::DecodeBuffer(uint8_t *buf, uint16_t len, PacketInfo *info) {
-    if (!info || !len) {
-        info->type = PacketType::None;
+uint16_t Protocol::FindFrame(const uint8_t *buf, uint16_t len, FrameView *frame) {
+	frame->type = PacketType::None;
+	if (!len) {
 		return 0;
 	}
-	uint8_t *data = buf;
+	const uint8_t *data = buf;
 	/* Remove any out-of-order bytes in front of the frame */
 	while (*data != header) {
 		data++;
 		if(--len == 0) {
 			/* Reached end of data */
 			/* No frame contained in data */
-			info->type = PacketType::None;
 			return data - buf;
 		}
 	}
 	/* At this point, data points to the beginning of the frame */
 	if(len < header_size) {
 		/* the frame header has not been completely received */
-		info->type = PacketType::None;
 		return data - buf;
 	}
 
 	/* Evaluate frame size */
-	uint16_t length = *(uint16_t*) &data[1];
+	uint16_t length;
+	memcpy(&length, &data[1], 2);
+	if(length < header_size + 4) {
+		/* Not a valid frame, remove header */
+		data += 1;
+		return data - buf;
+	}
 	if(len < length) {
 		/* The frame payload has not been completely received */
-		info->type = PacketType::None;
 		return data - buf;
 	}
 
@@ -500,123 +1136,216 @@ uint16_t Protocol::DecodeBuffer(uint8_t *buf, uint16_t len, PacketInfo *info) {
 //		if(crc != compare) {
 //			// CRC mismatch, remove header
 //			data += 1;
-//			info->type = PacketType::None;
 //			return data - buf;
 //		}
 //	} else {
 //		// Datapoint has the CRC set to zero
 //		if(crc != 0x00000000) {
 //			data += 1;
-//			info->type = PacketType::None;
 //			return data - buf;
 //		}
 //	}
 
-	// Valid packet, extract packet info
-	info->type = (PacketType) data[3];
+	auto type = (PacketType) (data[3] & ~sequence_flag);
+	uint8_t payload_offset = header_size;
+	frame->sequence = 0;
+	if(data[3] & sequence_flag) {
+		if(length < header_size + 5) {
+			/* Not a valid frame, remove header */
+			data += 1;
+			return data - buf;
+		}
+		frame->sequence = data[header_size];
+		payload_offset++;
+	}
+
+	if(type == PacketType::DatapointBatch || type == PacketType::SweepPlanParameters
+			|| type == PacketType::SweepPlanPoints || type == PacketType::SweepSegments) {
+		// Batches are the bulk of the transferred data and the sweep plan packets end up in the FPGA sweep
+		// configuration, check their CRC even though the check is (still) disabled for the other packet types
+		uint32_t crc;
+		memcpy(&crc, &data[length - 4], 4);
+		if(crc != CRC32(0, data, length - 4)) {
+			// CRC mismatch, remove header
+			data += 1;
+			return data - buf;
+		}
+	}
+
+	// Valid frame
+	frame->type = type;
+	frame->payload = &data[payload_offset];
+	frame->payloadLength = length - payload_offset - 4;
+	return data - buf + length;
+}
+
+void Protocol::DecodeFrame(const FrameView &frame, PacketInfo *info) {
+	auto data = frame.payload;
+	info->type = frame.type;
+	info->sequence = frame.sequence;
 	switch (info->type) {
 	case PacketType::Datapoint:
-		info->datapoint = DecodeDatapoint(&data[4]);
+		info->datapoint = DecodeDatapoint(data);
 		break;
 	case PacketType::SweepSettings:
-		info->settings = DecodeSweepSettings(&data[4]);
+		info->settings = DecodeSweepSettings(data, frame.payloadLength);
 		break;
 	case PacketType::Reference:
-		info->reference = DecodeReferenceSettings(&data[4]);
+		info->reference = DecodeReferenceSettings(data);
 		break;
     case PacketType::DeviceInfo:
-        info->info = DecodeDeviceInfo(&data[4]);
+        info->info = DecodeDeviceInfo(data, frame.payloadLength);
         break;
     case PacketType::Status:
-        info->status = DecodeStatus(&data[4]);
+        info->status = DecodeStatus(data);
         break;
     case PacketType::ManualControl:
-        info->manual = DecodeManualControl(&data[4]);
+        info->manual = DecodeManualControl(data);
         break;
     case PacketType::FirmwarePacket:
-        info->firmware = DecodeFirmwarePacket(&data[4]);
+        info->firmware = DecodeFirmwarePacket(data);
         break;
     case PacketType::Generator:
-    	info->generator = DecodeGeneratorSettings(&data[4]);
+    	info->generator = DecodeGeneratorSettings(data);
     	break;
     case PacketType::SpectrumAnalyzerSettings:
-    	info->spectrumSettings = DecodeSpectrumAnalyzerSettings(&data[4]);
+    	info->spectrumSettings = DecodeSpectrumAnalyzerSettings(data);
     	break;
     case PacketType::SpectrumAnalyzerResult:
-    	info->spectrumResult = DecodeSpectrumAnalyzerResult(&data[4]);
+    	info->spectrumResult = DecodeSpectrumAnalyzerResult(data);
     	break;
     case PacketType::DeviceLimits:
-        info->limits = DecodeDeviceLimits(&data[4]);
+        info->limits = DecodeDeviceLimits(data, frame.payloadLength);
+        break;
+    case PacketType::DatapointBatch:
+        if(!DecodeDatapointBatch(data, frame.payloadLength, info->batch)) {
+            // the points can not be located in the payload, drop the packet
+            info->type = PacketType::None;
+        }
+        break;
+    case PacketType::Capabilities:
+        info->capabilities = DecodeCapabilities(data, frame.payloadLength);
+        break;
+    case PacketType::SweepPlanParameters:
+        if(!DecodeSweepPlanParameters(data, frame.payloadLength, info->planParameters)) {
+            info->type = PacketType::None;
+        }
+        break;
+    case PacketType::SweepPlanPoints:
+        if(!DecodeSweepPlanPoints(data, frame.payloadLength, info->planPoints)) {
+            info->type = PacketType::None;
+        }
+        break;
+    case PacketType::SweepSegments:
+        if(!DecodeSweepSegments(data, frame.payloadLength, info->segments)) {
+            info->type = PacketType::None;
+        }
         break;
     case PacketType::Ack:
     case PacketType::PerformFirmwareUpdate:
     case PacketType::ClearFlash:
     case PacketType::Nack:
     case PacketType::RequestDeviceLimits:
+    case PacketType::RequestSweepPlanParameters:
+    case PacketType::SweepTrigger:
+    case PacketType::SweepComplete:
         // no payload, nothing to do
         break;
     case PacketType::None:
         break;
 	}
+}
 
-	return data - buf + length;
+uint16_t Protocol::DecodeBuffer(uint8_t *buf, uint16_t len, PacketInfo *info) {
+	FrameView frame;
+	uint16_t handled = FindFrame(buf, len, &frame);
+	DecodeFrame(frame, info);
+	return handled;
 }
 
 uint16_t Protocol::EncodePacket(const PacketInfo &packet, uint8_t *dest, uint16_t destsize) {
-   int16_t payload_size = 0;
+    uint8_t payload_offset = packet.sequence ? header_size + 1 : header_size;
+    if(destsize < payload_offset + 4) {
+        return 0;
+    }
+    auto payload = &dest[payload_offset];
+    uint16_t payload_space = destsize - payload_offset - 4;
+    int16_t payload_size = 0;
 	switch (packet.type) {
 	case PacketType::Datapoint:
-        payload_size = EncodeDatapoint(packet.datapoint, &dest[4], destsize - 8);
+        payload_size = EncodeDatapoint(packet.datapoint, payload, payload_space);
         break;
 	case PacketType::SweepSettings:
-        payload_size = EncodeSweepSettings(packet.settings, &dest[4], destsize - 8);
+        payload_size = EncodeSweepSettings(packet.settings, payload, payload_space);
 		break;
 	case PacketType::Reference:
-		payload_size = EncodeReferenceSettings(packet.reference, &dest[4], destsize - 8);
+		payload_size = EncodeReferenceSettings(packet.reference, payload, payload_space);
 		break;
     case PacketType::DeviceInfo:
-        payload_size = EncodeDeviceInfo(packet.info, &dest[4], destsize - 8);
+        payload_size = EncodeDeviceInfo(packet.info, payload, payload_space);
         break;
     case PacketType::Status:
-        payload_size = EncodeStatus(packet.status, &dest[4], destsize - 8);
+        payload_size = EncodeStatus(packet.status, payload, payload_space);
         break;
     case PacketType::ManualControl:
-        payload_size = EncodeManualControl(packet.manual, &dest[4], destsize - 8);
+        payload_size = EncodeManualControl(packet.manual, payload, payload_space);
         break;
     case PacketType::FirmwarePacket:
-        payload_size = EncodeFirmwarePacket(packet.firmware, &dest[4], destsize - 8);
+        payload_size = EncodeFirmwarePacket(packet.firmware, payload, payload_space);
         break;
     case PacketType::Generator:
-    	payload_size = EncodeGeneratorSettings(packet.generator, &dest[4], destsize - 8);
+    	payload_size = EncodeGeneratorSettings(packet.generator, payload, payload_space);
     	break;
     case PacketType::SpectrumAnalyzerSettings:
-    	payload_size = EncodeSpectrumAnalyzerSettings(packet.spectrumSettings, &dest[4], destsize - 8);
+    	payload_size = EncodeSpectrumAnalyzerSettings(packet.spectrumSettings, payload, payload_space);
     	break;
     case PacketType::SpectrumAnalyzerResult:
-		payload_size = EncodeSpectrumAnalyzerResult(packet.spectrumResult, &dest[4], destsize - 8);
+		payload_size = EncodeSpectrumAnalyzerResult(packet.spectrumResult, payload, payload_space);
 		break;
     case PacketType::DeviceLimits:
-        payload_size = EncodeDeviceLimits(packet.limits, &dest[4], destsize - 8);
+        payload_size = EncodeDeviceLimits(packet.limits, payload, payload_space);
+        break;
+    case PacketType::DatapointBatch:
+        payload_size = EncodeDatapointBatch(packet.batch, payload, payload_space);
+        break;
+    case PacketType::Capabilities:
+        payload_size = EncodeCapabilities(packet.capabilities, payload, payload_space);
+        break;
+    case PacketType::SweepPlanParameters:
+        payload_size = EncodeSweepPlanParameters(packet.planParameters, payload, payload_space);
+        break;
+    case PacketType::SweepPlanPoints:
+        payload_size = EncodeSweepPlanPoints(packet.planPoints, payload, payload_space);
+        break;
+    case PacketType::SweepSegments:
+        payload_size = EncodeSweepSegments(packet.segments, payload, payload_space);
         break;
     case PacketType::Ack:
     case PacketType::PerformFirmwareUpdate:
     case PacketType::ClearFlash:
     case PacketType::Nack:
     case PacketType::RequestDeviceLimits:
+    case PacketType::RequestSweepPlanParameters:
+    case PacketType::SweepTrigger:
+    case PacketType::SweepComplete:
         // no payload, nothing to do
         break;
     case PacketType::None:
         break;
     }
-    if (payload_size < 0 || payload_size + 8 > destsize) {
+    if (payload_size < 0 || payload_size + payload_offset + 4 > destsize) {
 		// encoding failed, buffer too small
 		return 0;
 	}
 	// Write header
 	dest[0] = header;
-	uint16_t overall_size = payload_size + 8;
+	uint16_t overall_size = payload_size + payload_offset + 4;
 	memcpy(&dest[1], &overall_size, 2);
 	dest[3] = (int) packet.type;
+	if(packet.sequence) {
+		dest[3] |= sequence_flag;
+		dest[header_size] = packet.sequence;
+	}
 	// Calculate checksum
 	uint32_t crc = 0x00000000;
 	if(packet.type == PacketType::Datapoint) {
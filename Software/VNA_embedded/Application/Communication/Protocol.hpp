@@ -6,24 +6,111 @@ namespace Protocol {
 
 // When changing/adding/removing variables from these structs also adjust the decode/encode functions in Protocol.cpp
 
+// S-parameters contained in a datapoint
+enum class DatapointPorts : uint8_t {
+	// all S-parameters
+	Both = 0,
+	// only S11/S21, port 1 was excited (see SweepSettings::portBlocked)
+	Port1 = 1,
+	// only S12/S22, port 2 was excited
+	Port2 = 2,
+};
+
 using Datapoint = struct _datapoint {
 	float real_S11, imag_S11;
 	float real_S21, imag_S21;
 	float real_S12, imag_S12;
 	float real_S22, imag_S22;
 	uint64_t frequency;
-	uint16_t pointNum;
+	// Single datapoints only transfer the lower 16 bits, sweeps with more points require batches (see Capabilities::LongSweeps)
+	uint32_t pointNum;
+	// only transferred in batches, single datapoints always contain all S-parameters
+	DatapointPorts ports;
+};
+
+// Encoding of the points in a DatapointBatch
+enum class DatapointFormat : uint8_t {
+	// S-parameters as float and the frequency, 40 bytes per point
+	Full = 0,
+	// S-parameters as float, frequency is calculated from the point number and the sweep settings. 32 bytes per point
+	ImplicitFrequency = 1,
+	// Each S-parameter as 16 bit real/imaginary mantissas with a shared 8 bit exponent, frequency is calculated
+	// from the point number. 20 bytes per point, reduced precision (only intended for displaying data)
+	Compact16 = 2,
+};
+
+// A run of consecutive datapoints, transmitted with a single header and CRC.
+// Only the point number of the first point is transmitted, the following points are numbered consecutively.
+static constexpr uint8_t MaxBatchPoints = 16;
+using DatapointBatch = struct _datapointBatch {
+	// Point numbers above 0xFFFF extend the batch header, they are only sent if the host supports Capabilities::LongSweeps
+	uint32_t firstPointNum;
+	uint8_t count;
+	DatapointFormat format;
+	// All points in a batch contain the same S-parameters. Points with only two S-parameters are transferred
+	// with half the size
+	DatapointPorts ports;
+	// Only used when encoding: points to an array of (at least) count datapoints
+	const Datapoint *points;
+	// Only set when decoding: points to the encoded datapoints within the decoded buffer.
+	// Only valid as long as the buffer is not modified, use GetBatchDatapoint to extract the datapoints
+	const uint8_t *raw;
 };
 
 using SweepSettings = struct _sweepSettings {
 	uint64_t f_start;
 	uint64_t f_stop;
-    uint16_t points;
+	// more than DeviceLimits::maxPoints points are only possible with Capabilities::LongSweeps
+    uint32_t points;
     uint32_t if_bandwidth;
     int16_t cdbm_excitation; // in 1/100 dbm
 	uint8_t excitePort1:1;
 	uint8_t excitePort2:1;
 	uint8_t suppressPeaks:1;
+	// requested DatapointFormat, only used if the datapoints are transferred in batches
+	uint8_t dataFormat:2;
+	// use the sweep plan uploaded with SweepPlanPoints packets instead of calculating it on the device.
+	// The device falls back to calculating the plan if the uploaded plan is incomplete or no longer valid
+	uint8_t uploadedPlan:1;
+	// If both ports are excited, measure all points with port 1 excited first, then all points with port 2 excited.
+	// Each point is transferred twice with half of the S-parameters (see DatapointPorts), only used with batches
+	uint8_t portBlocked:1;
+	// The points are defined by the segment table sent before the settings (see SweepSegments). points is the
+	// total number of points in the table, f_start/f_stop/if_bandwidth/cdbm_excitation are not used
+	uint8_t segmentTable:1;
+	// The points are spaced logarithmically between f_start and f_stop (only with Capabilities::LogSweeps).
+	// A sweep starting at 0Hz is spaced linearly, not used with segmentTable
+	uint8_t logSweep:1;
+	// Sweep modes (only with Capabilities::SweepModes). The sweep is held after the given number of sweeps
+	// (zero sweeps continuously) and the device sends SweepComplete. With triggered set, the device waits for a
+	// SweepTrigger before each set of sweeps (at least one sweep per trigger)
+	uint8_t triggered:1;
+	// Longer settling time after large PLL steps, the first point and RF path switches (see
+	// SweepPlan::Calculator::Settling). Without it, every point uses the shortest settling time
+	uint8_t extendedSettling:1;
+	uint16_t sweeps;
+	// Point averaging (only with Capabilities::PointAveraging, not used with segmentTable): each point is measured
+	// over averages times the samples of the IF bandwidth (limited to SweepPlan::MaxSamples). Only the averaged
+	// points are transferred. Zero or one disables averaging
+	uint16_t averages;
+};
+
+// Part of a segmented sweep with its own number of points, IF bandwidth and excitation level
+using SweepSegment = struct _sweepSegment {
+	uint64_t f_start;
+	uint64_t f_stop;
+	uint16_t points;
+	uint32_t if_bandwidth;
+	int16_t cdbm_excitation; // in 1/100 dbm
+};
+
+// Segment table of a sweep with SweepSettings::segmentTable set. The segments are measured in order and their
+// points are numbered consecutively. The segments must not overlap and have to be in ascending frequency order
+// (a segment may start at the stop frequency of the previous one)
+static constexpr uint8_t MaxSweepSegments = 8;
+using SweepSegments = struct _sweepSegments {
+	uint8_t count;
+	SweepSegment segments[MaxSweepSegments];
 };
 
 using ReferenceSettings = struct _referenceSettings {
@@ -53,6 +140,15 @@ using DeviceInfo = struct _deviceInfo {
         uint8_t LO1;
         uint8_t MCU;
     } temperatures;
+    // USB flow control statistics since the previous DeviceInfo (zero if not reported by the device)
+    struct {
+        // highest level of the transmit fifo in bytes
+        uint16_t fifoHighWater;
+        // number of times the sweep was held because the host did not read the data fast enough
+        uint16_t stalls;
+    } transmit;
+    // estimated duration of a single sweep in us (zero if not reported by the device)
+    uint32_t sweepTime;
 };
 
 using ManualStatus = struct _manualstatus {
@@ -126,8 +222,101 @@ using DeviceLimits = struct _deviceLimits {
     int16_t cdbm_max;
     uint32_t minRBW;
     uint32_t maxRBW;
+    // maximum number of points in a VNA sweep, only used with Capabilities::LongSweeps (otherwise maxPoints)
+    uint32_t maxSweepPoints;
 };
 
+// Properties of the device required by the host to calculate a sweep plan (see SweepPlanPoints)
+static constexpr uint8_t SweepPlanNumVCOs = 64;
+using SweepPlanParameters = struct _sweepPlanParameters {
+	// changes whenever the hardware was initialized again. Plans calculated for another revision are rejected
+	uint8_t revision;
+	uint32_t sourcePFD;
+	uint32_t LO1PFD;
+	// frequency of the Si5351 PLL generating the 2.LO
+	uint32_t LO2PLL;
+	uint32_t IF1;
+	uint32_t IF2;
+	uint32_t ADCSamplerate;
+	// points below this frequency use the lowband source
+	uint32_t bandSwitch;
+	// maximum number of 2.LO changes within a sweep
+	uint16_t maxLO2Shifts;
+	uint8_t sourceVCOMapValid:1;
+	uint8_t LO1VCOMapValid:1;
+	// highest frequency of each VCO in 100kHz, only valid if the corresponding VCOMapValid is set
+	uint16_t sourceVCOMap[SweepPlanNumVCOs];
+	uint16_t LO1VCOMap[SweepPlanNumVCOs];
+};
+
+using SweepPlanPLL = struct _sweepPlanPLL {
+	uint16_t N;
+	uint16_t F;
+	uint16_t M;
+	uint8_t div;
+	uint8_t VCO;
+};
+
+// Precalculated configuration of a single sweep point
+using SweepPlanPoint = struct _sweepPlanPoint {
+	// source is unused for lowband points
+	SweepPlanPLL source;
+	SweepPlanPLL LO1;
+	uint8_t attenuator:7;
+	uint8_t lowband:1;
+	uint8_t halt:1;
+	// source lowpass filter (0: 947MHz, 1: 1880MHz, 2: 3500MHz, 3: none)
+	uint8_t filter:2;
+	// the 2.LO has to be changed before this point, LO2Config is only valid if this is set
+	uint8_t LO2Shift:1;
+	// settling time after configuring the PLLs (0: 20us, 1: 60us, 2: 180us, 3: 540us)
+	uint8_t settling:2;
+	// number of samples (see SweepPlan::FixedSamples), 0 uses the samples per point register. Only used in sweeps
+	// with a segment table, which are always calculated on the device. Not transferred in SweepPlanPoints
+	uint8_t samples:3;
+	// raw multisynth configuration of the 2.LO outputs (see Si5351C::WriteRawCLKConfig)
+	uint8_t LO2Config[8];
+};
+
+// Consecutive points of a sweep plan. A plan is uploaded in order, starting at point 0
+static constexpr uint8_t MaxPlanPoints = 8;
+using SweepPlanPoints = struct _sweepPlanPoints {
+	// revision of the SweepPlanParameters the plan was calculated with
+	uint8_t revision;
+	uint16_t firstPoint;
+	uint8_t count;
+	SweepPlanPoint points[MaxPlanPoints];
+};
+
+// Optional protocol features. Exchanged after connecting, a feature is only used if both sides support it
+using Capabilities = struct _capabilities {
+	uint8_t DatapointBatches:1;
+	// DatapointFormat other than Full (only in batches)
+	uint8_t CompactDatapoints:1;
+	// Packets carry sequence numbers which are returned in the Ack/Nack. Up to SendWindow packets
+	// may be sent without waiting for their Ack
+	uint8_t SequencedAcks:1;
+	// The host calculates the sweep plan and uploads it (SweepPlanParameters/SweepPlanPoints)
+	uint8_t SweepPlans:1;
+	// SweepSettings::portBlocked
+	uint8_t PortBlockedSweeps:1;
+	// VNA sweeps with more points than fit into the FPGA (up to DeviceLimits::maxSweepPoints). The device
+	// measures these sweeps in segments, the datapoints are transferred in batches with 32 bit point numbers
+	uint8_t LongSweeps:1;
+	// Sweeps defined by a segment table (SweepSegments/SweepSettings::segmentTable)
+	uint8_t SegmentTables:1;
+	// SweepSettings::logSweep
+	uint8_t LogSweeps:1;
+	// SweepSettings::sweeps/triggered, SweepTrigger and SweepComplete
+	uint8_t SweepModes:1;
+	// SweepSettings::averages
+	uint8_t PointAveraging:1;
+};
+
+// Number of unacknowledged packets the host may send if SequencedAcks is supported. The device has
+// to be able to queue this many received packets
+static constexpr uint8_t SendWindow = 4;
+
 static constexpr uint16_t FirmwareChunkSize = 256;
 using FirmwarePacket = struct _firmwarePacket {
     uint32_t address;
@@ -152,10 +341,23 @@ enum class PacketType : uint8_t {
 	SpectrumAnalyzerResult =  14,
     RequestDeviceLimits = 15,
     DeviceLimits = 16,
+	DatapointBatch = 17,
+	Capabilities = 18,
+	RequestSweepPlanParameters = 19,
+	SweepPlanParameters = 20,
+	SweepPlanPoints = 21,
+	SweepSegments = 22,
+	// Starts the sweeps of a triggered sweep or restarts a held sweep (no payload). Nack if the sweep is still running
+	SweepTrigger = 23,
+	// Sent by the device after the last point of the requested sweeps (no payload)
+	SweepComplete = 24,
 };
 
 using PacketInfo = struct _packetinfo {
 	PacketType type;
+	// Sequence number of a packet that requires an Ack/Nack, the answer carries the same number.
+	// Zero if the packet has no sequence number
+	uint8_t sequence = 0;
 	union {
 		Datapoint datapoint;
 		SweepSettings settings;
@@ -168,11 +370,47 @@ using PacketInfo = struct _packetinfo {
         SpectrumAnalyzerSettings spectrumSettings;
         SpectrumAnalyzerResult spectrumResult;
         DeviceLimits limits;
+        DatapointBatch batch;
+        Capabilities capabilities;
+        SweepPlanParameters planParameters;
+        SweepPlanPoints planPoints;
+        SweepSegments segments;
 	};
 };
 
 uint32_t CRC32(uint32_t crc, const void *data, uint32_t len);
+// Replaces the software CRC calculation (e.g. with a hardware CRC unit). The function must calculate
+// the same result as the software implementation (CRC-32, polynomial 0xEDB88320), crc contains the
+// previous CRC and is replaced by the result. If it returns false (e.g. the CRC unit is in use), the
+// software implementation is used for this calculation. Pass nullptr to use the software implementation again
+using CRCFunction = bool(*)(uint32_t &crc, const void *data, uint32_t len);
+void SetCRCFunction(CRCFunction f);
+// Location of a complete frame within a receive buffer. The payload is not decoded and only valid
+// as long as the buffer content is not modified
+using FrameView = struct _frameView {
+	PacketType type;
+	uint8_t sequence;
+	const uint8_t *payload;
+	uint16_t payloadLength;
+};
+
+// Searches for the next complete frame in buf. Returns the number of bytes that can be removed from
+// the buffer (including the frame). If no complete frame was found, the frame type is set to None
+uint16_t FindFrame(const uint8_t *buf, uint16_t len, FrameView *frame);
+// Decodes the payload of a frame found by FindFrame
+void DecodeFrame(const FrameView &frame, PacketInfo *info);
 uint16_t DecodeBuffer(uint8_t *buf, uint16_t len, PacketInfo *info);
 uint16_t EncodePacket(const PacketInfo &packet, uint8_t *dest, uint16_t destsize);
+// Frequency of a point within a sweep. segments is only used if settings.segmentTable is set, pass the
+// segment table the settings were sent with
+uint64_t SweepFrequency(const SweepSettings &settings, uint32_t pointNum, const SweepSegments *segments = nullptr);
+// Frequency of a point within a single segment
+uint64_t SegmentFrequency(const SweepSegment &segment, uint16_t pointNum);
+// Total number of points in a segment table
+uint32_t SegmentTablePoints(const SweepSegments &segments);
+// Extracts a datapoint from a received batch. For formats without frequency information the frequency
+// is calculated from the settings (set to zero if settings is nullptr)
+Datapoint GetBatchDatapoint(const DatapointBatch &batch, uint8_t index, const SweepSettings *settings = nullptr,
+		const SweepSegments *segments = nullptr);
 
 }
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Protocol.hpp"
+#include "stm.hpp"
+
+// Completed datapoints are queued by the VNA interrupt and sent by the App task. Single producer (interrupt)
+// and single consumer (task), no locking required. Size must be a power of two
+template<uint8_t size> class DatapointQueue {
+	static_assert(size > 0 && (size & (size - 1)) == 0, "DatapointQueue size must be a power of two");
+public:
+	constexpr DatapointQueue() : queue(), read(0), write(0), overflows(0) {}
+
+	// Only call from the producer. Returns false (and counts the point as lost) if the queue is full
+	bool Push(const Protocol::Datapoint &d) {
+		uint8_t w = write;
+		if((uint8_t) (w - read) >= size) {
+			overflows++;
+			return false;
+		}
+		queue[w % size] = d;
+		// point has to be completely stored before it becomes visible to the consumer
+		__DMB();
+		write = w + 1;
+		return true;
+	}
+	// Only call from the consumer. Returns false if the queue is empty
+	bool Pop(Protocol::Datapoint &d) {
+		uint8_t r = read;
+		if(r == write) {
+			return false;
+		}
+		d = queue[r % size];
+		// slot may only be reused by the producer after the point has been copied
+		__DMB();
+		read = r + 1;
+		return true;
+	}
+	// Number of points that had to be discarded because the queue was full
+	uint32_t Overflows() const {
+		return overflows;
+	}
+
+private:
+	Protocol::Datapoint queue[size];
+	volatile uint8_t read, write;
+	volatile uint32_t overflows;
+};
@@ -12,8 +12,24 @@ static FPGA::HaltedCallback halted_cb;
 static uint16_t SysCtrlReg = 0x0000;
 static uint16_t ISRMaskReg = 0x0000;
 
+// Sweep configurations are transferred with the DMA. Two staging buffers allow the next configuration
+// to be assembled while the previous one is still being transferred
+static uint16_t sweepConfigStaging[2][7];
+static uint8_t sweepConfigIndex = 0;
+static bool sweepConfigTransfer = false;
+
 using namespace FPGAHAL;
 
+// Waits for a pending sweep configuration transfer and releases the bus. Has to be called before any other SPI access
+static void FinishTransfer() {
+	if(!sweepConfigTransfer) {
+		return;
+	}
+	while(HAL_SPI_GetState(&FPGA_SPI) != HAL_SPI_STATE_READY);
+	High(CS);
+	sweepConfigTransfer = false;
+}
+
 static void SwitchBytes(uint16_t &value) {
 	value = (value & 0xFF00) >> 8 | (value & 0x00FF) << 8;
 }
@@ -23,6 +39,7 @@ static void SwitchBytes(int16_t &value) {
 
 void FPGA::WriteRegister(FPGA::Reg reg, uint16_t value) {
 	uint8_t cmd[4] = {0x80, (uint8_t) reg, (uint8_t) (value >> 8), (uint8_t) (value & 0xFF)};
+	FinishTransfer();
 	Low(CS);
 	HAL_SPI_Transmit(&FPGA_SPI, (uint8_t*) cmd, 4, 100);
 	High(CS);
@@ -93,6 +110,7 @@ bool FPGA::Init(HaltedCallback cb) {
 	// Check if FPGA response is as expected
 	uint8_t cmd[4] = {0x40, 0x00, 0x00, 0x00};
 	uint8_t recv[4];
+	FinishTransfer();
 	Low(CS);
 	HAL_SPI_TransmitReceive(&FPGA_SPI, (uint8_t*) cmd, (uint8_t*) recv, 4, 100);
 	High(CS);
@@ -173,52 +191,56 @@ void FPGA::WriteMAX2871Default(uint32_t *DefaultRegs) {
 	WriteRegister(Reg::MAX2871Def4MSB, DefaultRegs[4] >> 16);
 }
 
+static PLLCalculation::MAX2871Dividers DividersFromRegisters(const uint32_t *regs) {
+	PLLCalculation::MAX2871Dividers d;
+	d.N = (regs[0] & 0x7FFF8000) >> 15;
+	d.F = (regs[0] & 0x00007FF8) >> 3;
+	d.M = (regs[1] & 0x00007FF8) >> 3;
+	d.VCO = (regs[3] & 0xFC000000) >> 26;
+	d.div = (regs[4] & 0x00700000) >> 20;
+	return d;
+}
+
 void FPGA::WriteSweepConfig(uint16_t pointnum, bool lowband, uint32_t *SourceRegs, uint32_t *LORegs,
 		uint8_t attenuation, uint64_t frequency, SettlingTime settling, Samples samples, bool halt, LowpassFilter filter) {
-	uint16_t send[7];
-	// select which point this sweep config is for
-	send[0] = pointnum & 0x1FFF;
-	// assemble sweep config from required fields of PLL registers
-	uint16_t LO_N = (LORegs[0] & 0x7FFF8000) >> 15;
-	uint16_t LO_FRAC = (LORegs[0] & 0x00007FF8) >> 3;
-	uint16_t LO_M = (LORegs[1] & 0x00007FF8) >> 3;
-	uint16_t LO_VCO = (LORegs[3] & 0xFC000000) >> 26;
-	uint16_t LO_DIV_A = (LORegs[4] & 0x00700000) >> 20;
-
-	uint16_t Source_N = (SourceRegs[0] & 0x7FFF8000) >> 15;
-	uint16_t Source_FRAC = (SourceRegs[0] & 0x00007FF8) >> 3;
-	uint16_t Source_M = (SourceRegs[1] & 0x00007FF8) >> 3;
-	uint16_t Source_VCO = (SourceRegs[3] & 0xFC000000) >> 26;
-	uint16_t Source_DIV_A = (SourceRegs[4] & 0x00700000) >> 20;
-
-	send[1] = LO_M >> 4;
-	if (halt) {
-		send[1] |= 0x8000;
-	}
-	send[1] |= (int) settling << 13;
-	send[1] |= (int) samples << 10;
 	if(filter == LowpassFilter::Auto) {
 		// Select source LP filter
 		if (frequency >= 3500000000) {
-			send[1] |= (int) LowpassFilter::None << 8;
+			filter = LowpassFilter::None;
 		} else if (frequency >= 1800000000) {
-			send[1] |= (int) LowpassFilter::M3500 << 8;
+			filter = LowpassFilter::M3500;
 		} else if (frequency >= 900000000) {
-			send[1] |= (int) LowpassFilter::M1880 << 8;
+			filter = LowpassFilter::M1880;
 		} else {
-			send[1] |= (int) LowpassFilter::M947 << 8;
+			filter = LowpassFilter::M947;
 		}
-	} else {
-		send[1] |= (int) filter << 8;
 	}
-	send[2] = (LO_M & 0x000F) << 12 | LO_FRAC;
-	send[3] = LO_DIV_A << 13 | LO_VCO << 7 | LO_N;
-	send[4] = (uint16_t) attenuation << 8 | Source_M >> 4;
+	WriteSweepConfig(pointnum, lowband, DividersFromRegisters(SourceRegs), DividersFromRegisters(LORegs),
+			attenuation, filter, settling, samples, halt);
+}
+
+// Assembles the 14 byte SPI command that writes the configuration of a single point
+static void AssembleSweepConfig(uint16_t *send, uint16_t pointnum, bool lowband, const PLLCalculation::MAX2871Dividers &source,
+		const PLLCalculation::MAX2871Dividers &LO, uint8_t attenuation, FPGA::LowpassFilter filter, FPGA::SettlingTime settling,
+		FPGA::Samples samples, bool halt) {
+	// select which point this sweep config is for
+	send[0] = pointnum & 0x1FFF;
+	// assemble sweep config from the PLL dividers
+	send[1] = LO.M >> 4;
+	if (halt) {
+		send[1] |= 0x8000;
+	}
+	send[1] |= (int) settling << 13;
+	send[1] |= (int) samples << 10;
+	send[1] |= (int) filter << 8;
+	send[2] = (LO.M & 0x000F) << 12 | LO.F;
+	send[3] = LO.div << 13 | LO.VCO << 7 | LO.N;
+	send[4] = (uint16_t) attenuation << 8 | source.M >> 4;
 	if (lowband) {
 		send[4] |= 0x8000;
 	}
-	send[5] = (Source_M & 0x000F) << 12 | Source_FRAC;
-	send[6] = Source_DIV_A << 13 | Source_VCO << 7 | Source_N;
+	send[5] = (source.M & 0x000F) << 12 | source.F;
+	send[6] = source.div << 13 | source.VCO << 7 | source.N;
 	SwitchBytes(send[0]);
 	SwitchBytes(send[1]);
 	SwitchBytes(send[2]);
@@ -226,9 +248,23 @@ void FPGA::WriteSweepConfig(uint16_t pointnum, bool lowband, uint32_t *SourceReg
 	SwitchBytes(send[4]);
 	SwitchBytes(send[5]);
 	SwitchBytes(send[6]);
+}
+
+void FPGA::WriteSweepConfig(uint16_t pointnum, bool lowband, const PLLCalculation::MAX2871Dividers &source,
+		const PLLCalculation::MAX2871Dividers &LO, uint8_t attenuation, LowpassFilter filter, SettlingTime settling,
+		Samples samples, bool halt) {
+	// use the staging buffer that is not part of a possibly still active transfer
+	uint16_t *send = sweepConfigStaging[sweepConfigIndex];
+	sweepConfigIndex ^= 1;
+	AssembleSweepConfig(send, pointnum, lowband, source, LO, attenuation, filter, settling, samples, halt);
+	// The FPGA expects each configuration in a separate transfer (CS has to toggle in between)
+	FinishTransfer();
 	Low(CS);
-	HAL_SPI_Transmit(&FPGA_SPI, (uint8_t*) send, 14, 100);
-	High(CS);
+	sweepConfigTransfer = true;
+	if(HAL_SPI_Transmit_DMA(&FPGA_SPI, (uint8_t*) send, 14) != HAL_OK) {
+		// fall back to blocking transfer
+		HAL_SPI_Transmit(&FPGA_SPI, (uint8_t*) send, 14, 100);
+	}
 }
 
 static inline int64_t sign_extend_64(int64_t x, uint16_t bits) {
@@ -239,7 +275,7 @@ static inline int64_t sign_extend_64(int64_t x, uint16_t bits) {
 static FPGA::ReadCallback callback;
 static uint8_t raw[38];
 static FPGA::SamplingResult result;
-static bool busy_reading = false;
+static volatile bool busy_reading = false;
 
 bool FPGA::InitiateSampleRead(ReadCallback cb) {
 	if(busy_reading) {
@@ -249,12 +285,35 @@ bool FPGA::InitiateSampleRead(ReadCallback cb) {
 	callback = cb;
 	uint8_t cmd[38] = {0xC0, 0x00};
 	// Start data read
+	FinishTransfer();
 	Low(CS);
 	busy_reading = true;
 	HAL_SPI_TransmitReceive_DMA(&FPGA_SPI, cmd, raw, 38);
 	return true;
 }
 
+void FPGA::WriteSweepConfigDuringSweep(uint16_t pointnum, bool lowband, const PLLCalculation::MAX2871Dividers &source,
+		const PLLCalculation::MAX2871Dividers &LO, uint8_t attenuation, LowpassFilter filter, SettlingTime settling,
+		Samples samples, bool halt) {
+	uint16_t send[7];
+	AssembleSweepConfig(send, pointnum, lowband, source, LO, attenuation, filter, settling, samples, halt);
+	FinishTransfer();
+	// The sample read is started from the EXTI interrupt and uses the same bus. Wait until no read is active
+	// and keep the interrupt from starting a new one until the configuration has been transferred. A DMA
+	// transfer can not be used here: the EXTI interrupt would block its completion while waiting for the bus
+	while(true) {
+		__disable_irq();
+		if(!busy_reading) {
+			break;
+		}
+		__enable_irq();
+	}
+	Low(CS);
+	HAL_SPI_Transmit(&FPGA_SPI, (uint8_t*) send, 14, 100);
+	High(CS);
+	__enable_irq();
+}
+
 static int64_t assembleSampleResultValue(uint8_t *raw) {
 	return sign_extend_64(
 			(uint16_t) raw[0] << 8 | raw[1] | (uint32_t) raw[2] << 24
@@ -284,6 +343,8 @@ void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi) {
 }
 
 void FPGA::StartSweep() {
+	// sweep configuration has to be complete before the sweep starts
+	FinishTransfer();
 	Low(AUX3);
 	Delay::us(1);
 	High(AUX3);
@@ -294,6 +355,7 @@ void FPGA::AbortSweep() {
 }
 
 void FPGA::SetMode(Mode mode) {
+	FinishTransfer();
 	switch(mode) {
 	case Mode::FPGA:
 		// Both AUX1/2 low
@@ -327,6 +389,7 @@ void FPGA::SetMode(Mode mode) {
 uint16_t FPGA::GetStatus() {
 	uint8_t cmd[2] = {0x40, 0x00};
 	uint8_t status[2];
+	FinishTransfer();
 	Low(CS);
 	HAL_SPI_TransmitReceive(&FPGA_SPI, (uint8_t*) &cmd, (uint8_t*) &status, 2,
 			100);
@@ -337,6 +400,7 @@ uint16_t FPGA::GetStatus() {
 FPGA::ADCLimits FPGA::GetADCLimits() {
 	uint16_t cmd = 0xE000;
 	SwitchBytes(cmd);
+	FinishTransfer();
 	Low(CS);
 	HAL_SPI_Transmit(&FPGA_SPI, (uint8_t*) &cmd, 2, 100);
 	ADCLimits limits;
@@ -354,6 +418,7 @@ FPGA::ADCLimits FPGA::GetADCLimits() {
 void FPGA::ResetADCLimits() {
 	uint16_t cmd = 0x6000;
 	SwitchBytes(cmd);
+	FinishTransfer();
 	Low(CS);
 	HAL_SPI_Transmit(&FPGA_SPI, (uint8_t*) &cmd, 2, 100);
 	High(CS);
@@ -362,6 +427,7 @@ void FPGA::ResetADCLimits() {
 void FPGA::ResumeHaltedSweep() {
 	uint16_t cmd = 0x2000;
 	SwitchBytes(cmd);
+	FinishTransfer();
 	Low(CS);
 	HAL_SPI_Transmit(&FPGA_SPI, (uint8_t*) &cmd, 2, 100);
 	High(CS);
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include "Flash.hpp"
+#include "PLLCalculation.hpp"
 
 namespace FPGA {
 
@@ -108,8 +109,19 @@ void SetWindow(Window w);
 void EnableInterrupt(Interrupt i);
 void DisableInterrupt(Interrupt i);
 void WriteMAX2871Default(uint32_t *DefaultRegs);
+// The configuration is transferred with the DMA, the function returns before the transfer is complete.
+// Calculation of the next point can overlap with the transfer, all other FPGA functions wait for it to finish
 void WriteSweepConfig(uint16_t pointnum, bool lowband, uint32_t *SourceRegs, uint32_t *LORegs,
 		uint8_t attenuation, uint64_t frequency, SettlingTime settling, Samples samples, bool halt = false, LowpassFilter filter = LowpassFilter::Auto);
+// Same as above with precalculated PLL dividers (e.g. from a sweep plan), the filter has to be selected explicitly
+void WriteSweepConfig(uint16_t pointnum, bool lowband, const PLLCalculation::MAX2871Dividers &source,
+		const PLLCalculation::MAX2871Dividers &LO, uint8_t attenuation, LowpassFilter filter, SettlingTime settling,
+		Samples samples, bool halt = false);
+// Same as above, but may be used while a sweep is running (e.g. to overwrite points that have already been measured).
+// The configuration is transferred without the DMA, sample reads are held back until the transfer is complete
+void WriteSweepConfigDuringSweep(uint16_t pointnum, bool lowband, const PLLCalculation::MAX2871Dividers &source,
+		const PLLCalculation::MAX2871Dividers &LO, uint8_t attenuation, LowpassFilter filter, SettlingTime settling,
+		Samples samples, bool halt = false);
 using ReadCallback = void(*)(const SamplingResult &result);
 bool InitiateSampleRead(ReadCallback cb);
 ADCLimits GetADCLimits();
@@ -0,0 +1,112 @@
+#include "PLLCalculation.hpp"
+
+#include "algorithm.hpp"
+
+bool PLLCalculation::MAX2871(uint64_t f, uint32_t f_PFD, const uint16_t *VCOmax, MAX2871Dividers &d, uint64_t &actual) {
+	if (f < MAX2871MinFreq || f > MAX2871MaxFreq) {
+		return false;
+	}
+	// select divider
+	uint64_t f_vco = f;
+	d.div = 0;
+	if (f < 46875000) {
+		d.div = 0x07;
+		f_vco *= 128;
+	} else if (f < 93750000) {
+		d.div = 0x06;
+		f_vco *= 64;
+	} else if (f < 187500000) {
+		d.div = 0x05;
+		f_vco *= 32;
+	} else if (f < 375000000) {
+		d.div = 0x04;
+		f_vco *= 16;
+	} else if (f < 750000000) {
+		d.div = 0x03;
+		f_vco *= 8;
+	} else if (f < 1500000000) {
+		d.div = 0x02;
+		f_vco *= 4;
+	} else if (f < 3000000000) {
+		d.div = 0x01;
+		f_vco *= 2;
+	}
+	d.VCO = 0;
+	if (VCOmax) {
+		// manual VCO selection for lock time improvement
+		uint16_t compare = f_vco / 100000;
+		for (; d.VCO < MAX2871NumVCOs; d.VCO++) {
+			if (VCOmax[d.VCO] >= compare) {
+				break;
+			}
+		}
+	}
+	uint32_t N = f_vco / f_PFD;
+	uint32_t rem_f = f_vco - N * f_PFD;
+	auto approx = Algorithm::BestRationalApproximation(rem_f, f_PFD, 4095);
+	if (approx.num == approx.denom) {
+		// fraction was rounded up to 1, use next integer value instead
+		N++;
+		approx.num = 0;
+	}
+	if (N < 19 || N > 4091) {
+		return false;
+	}
+	if (approx.denom == 1) {
+		// M value must be at least 2
+		approx.denom = 2;
+	}
+	d.N = N;
+	d.F = approx.num;
+	d.M = approx.denom;
+
+	uint32_t rem_approx = ((uint64_t) f_PFD * approx.num) / approx.denom;
+	actual = ((uint64_t) N * f_PFD + rem_approx) >> d.div;
+	return true;
+}
+
+void PLLCalculation::Si5351FractionalDivider(uint32_t f_pll, uint32_t f, uint32_t &P1, uint32_t &P2, uint32_t &P3) {
+	// see https://www.silabs.com/documents/public/application-notes/AN619.pdf (page 3/6)
+	uint32_t a = f_pll / f;
+	uint32_t f_rem = f_pll - f * a;
+	// divider is a + b/c with c < 2^20
+	auto approx = Algorithm::BestRationalApproximation(f_rem, f, (1UL << 20) - 1);
+	if (approx.num == approx.denom) {
+		// fraction was rounded up to 1
+		a++;
+		approx.num = 0;
+	}
+	uint32_t b = approx.num;
+	uint32_t c = approx.denom;
+	// convert to Si5351C parameters
+	uint32_t floor = 128 * b / c;
+	P1 = 128 * a + floor - 512;
+	P2 = 128 * b - c * floor;
+	P3 = c;
+}
+
+bool PLLCalculation::Si5351Output(uint32_t f_pll, uint32_t f, Si5351Dividers &d) {
+	d.RDiv = 1;
+	while (f_pll / (f * d.RDiv) >= 2048 || (f * d.RDiv) < 500000) {
+		if (d.RDiv < 128) {
+			d.RDiv *= 2;
+		} else {
+			return false;
+		}
+	}
+	Si5351FractionalDivider(f_pll, f * d.RDiv, d.P1, d.P2, d.P3);
+	return true;
+}
+
+void PLLCalculation::EncodeSi5351Output(const Si5351Dividers &d, bool divideBy4, uint8_t *data) {
+	// See register map in https://www.silabs.com/documents/public/application-notes/AN619.pdf (page 11)
+	data[0] = (d.P3 >> 8) & 0xFF;
+	data[1] = d.P3 & 0xFF;
+	data[2] = (31 - __builtin_clz(d.RDiv)) << 4
+			| (divideBy4 ? 0xC0 : 0x00) | ((d.P1 >> 16) & 0x03);
+	data[3] = (d.P1 >> 8) & 0xFF;
+	data[4] = d.P1 & 0xFF;
+	data[5] = ((d.P3 >> 12) & 0xF0) | ((d.P2 >> 16) & 0x0F);
+	data[6] = (d.P2 >> 8) & 0xFF;
+	data[7] = d.P2 & 0xFF;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+// Divider calculations for the MAX2871 and the Si5351C without any hardware access. Used by the drivers
+// and by the PC application, which calculates complete sweep plans (see SweepPlan.hpp)
+namespace PLLCalculation {
+
+using MAX2871Dividers = struct _max2871dividers {
+	uint16_t N;
+	uint16_t F;
+	uint16_t M;
+	// output divider is 2^div
+	uint8_t div;
+	// only valid if a VCO map was available
+	uint8_t VCO;
+};
+
+static constexpr uint8_t MAX2871NumVCOs = 64;
+static constexpr uint64_t MAX2871MinFreq = 23500000;
+static constexpr uint64_t MAX2871MaxFreq = 6100000000; // 6GHz according to datasheet, but slight overclocking is possible
+
+// Calculates the dividers of the MAX2871 for the output frequency f. VCOmax is the map of the highest
+// frequency of each VCO (in 100kHz, MAX2871NumVCOs entries), pass nullptr if no map is available.
+// The actual output frequency is stored in actual. Returns false if f can not be reached
+bool MAX2871(uint64_t f, uint32_t f_PFD, const uint16_t *VCOmax, MAX2871Dividers &d, uint64_t &actual);
+
+using Si5351Dividers = struct _si5351dividers {
+	uint32_t P1, P2, P3;
+	uint8_t RDiv; // 1 to 128, only 2^n
+};
+
+// Calculates the fractional divider f_pll/f as register values P1-P3 (also used for the PLL feedback divider)
+void Si5351FractionalDivider(uint32_t f_pll, uint32_t f, uint32_t &P1, uint32_t &P2, uint32_t &P3);
+// Calculates the multisynth and R divider of a fractional Si5351C output (CLK0-5). Returns false if f can not be reached
+bool Si5351Output(uint32_t f_pll, uint32_t f, Si5351Dividers &d);
+// Encodes the dividers into the 8 byte multisynth register block of CLK0-5
+void EncodeSi5351Output(const Si5351Dividers &d, bool divideBy4, uint8_t *data);
+
+}
@@ -1,5 +1,6 @@
 #include "Si5351C.hpp"
 
+#include "PLLCalculation.hpp"
 #include <cmath>
 #include <cstdlib>
 
@@ -67,7 +68,7 @@ bool Si5351C::SetPLL(PLL pll, uint32_t frequency, PLLSource src) {
 		LOG_ERR("Calculated divider out of range (15-90)");
 		return false;
 	}
-	FindOptimalDivider(frequency, srcFreq, c.P1, c.P2, c.P3);
+	PLLCalculation::Si5351FractionalDivider(frequency, srcFreq, c.P1, c.P2, c.P3);
 
 	FreqPLL[(int) pll] = frequency;
 	LOG_INFO("Setting PLL %c to %luHz", pll==PLL::A ? 'A' : 'B', frequency);
@@ -76,6 +77,27 @@ bool Si5351C::SetPLL(PLL pll, uint32_t frequency, PLLSource src) {
 
 bool Si5351C::SetCLK(uint8_t clknum, uint32_t frequency, PLL source, DriveStrength strength, uint32_t PLLFreqOverride) {
 	ClkConfig c;
+	if (!CalculateClkConfig(c, clknum, frequency, source, strength, PLLFreqOverride)) {
+		return false;
+	}
+	LOG_DEBUG("Setting CLK%d to %luHz", clknum, frequency);
+	return WriteClkConfig(c, clknum);
+}
+
+bool Si5351C::CalculateRawCLKConfig(uint8_t clknum, uint32_t frequency, PLL source, uint8_t *config, uint32_t PLLFreqOverride) {
+	if (clknum > 5) {
+		// the raw configuration block only exists for the fractional dividers
+		return false;
+	}
+	ClkConfig c;
+	if (!CalculateClkConfig(c, clknum, frequency, source, DriveStrength::mA2, PLLFreqOverride)) {
+		return false;
+	}
+	EncodeClkData(c, config);
+	return true;
+}
+
+bool Si5351C::CalculateClkConfig(ClkConfig &c, uint8_t clknum, uint32_t frequency, PLL source, DriveStrength strength, uint32_t PLLFreqOverride) {
 	c.DivideBy4 = false;
 	c.IntegerMode = false;
 	c.Inverted = false;
@@ -104,19 +126,18 @@ bool Si5351C::SetCLK(uint8_t clknum, uint32_t frequency, PLL source, DriveStreng
 		}
 		c.P1 = div;
 	} else {
-		while (pllFreq / (frequency * c.RDiv) >= 2048
-				|| (frequency * c.RDiv) < 500000) {
-			if (c.RDiv < 128) {
-				c.RDiv *= 2;
-			} else {
-				LOG_ERR("Unable to reach requested frequency");
-				return false;
-			}
+		PLLCalculation::Si5351Dividers d;
+		if (!PLLCalculation::Si5351Output(pllFreq, frequency, d)) {
+			LOG_ERR("Unable to reach requested frequency");
+			return false;
 		}
-		FindOptimalDivider(pllFreq, frequency * c.RDiv, c.P1, c.P2, c.P3);
+		LOG_DEBUG("P1=%lu, P2=%lu, P3=%lu", d.P1, d.P2, d.P3);
+		c.P1 = d.P1;
+		c.P2 = d.P2;
+		c.P3 = d.P3;
+		c.RDiv = d.RDiv;
 	}
-	LOG_DEBUG("Setting CLK%d to %luHz", clknum, frequency);
-	return WriteClkConfig(c, clknum);
+	return true;
 }
 
 bool Si5351C::SetCLKtoXTAL(uint8_t clknum) {
@@ -233,15 +254,7 @@ bool Si5351C::WriteClkConfig(ClkConfig config, uint8_t clknum) {
 	success &= WriteRegister(reg, clkcontrol);
 	if (clknum <= 5) {
 		uint8_t ClkData[8];
-		ClkData[0] = (config.P3 >> 8) & 0xFF;
-		ClkData[1] = config.P3 & 0xFF;
-		ClkData[2] = (31 - __builtin_clz(config.RDiv)) << 4
-				| (config.DivideBy4 ? 0xC0 : 0x00) | ((config.P1 >> 16) & 0x03);
-		ClkData[3] = (config.P1 >> 8) & 0xFF;
-		ClkData[4] = config.P1 & 0xFF;
-		ClkData[5] = ((config.P3 >> 12) & 0xF0) | ((config.P2 >> 16) & 0x0F);
-		ClkData[6] = (config.P2 >> 8) & 0xFF;
-		ClkData[7] = config.P2 & 0xFF;
+		EncodeClkData(config, ClkData);
 		// Calculate address of register control block
 		reg = (Reg) ((int) Reg::MS0_CONFIG + 8 * clknum);
 		success &= WriteRegisterRange(reg, ClkData, sizeof(ClkData));
@@ -254,6 +267,15 @@ bool Si5351C::WriteClkConfig(ClkConfig config, uint8_t clknum) {
 	return success;
 }
 
+void Si5351C::EncodeClkData(const ClkConfig &config, uint8_t *data) {
+	PLLCalculation::Si5351Dividers d;
+	d.P1 = config.P1;
+	d.P2 = config.P2;
+	d.P3 = config.P3;
+	d.RDiv = config.RDiv;
+	PLLCalculation::EncodeSi5351Output(d, config.DivideBy4, data);
+}
+
 bool Si5351C::WriteRegister(Reg reg, uint8_t data) {
 	return WriteRegisterRange(reg, &data, 1);
 }
@@ -310,42 +332,6 @@ bool Si5351C::ResetPLL(PLL pll) {
 	}
 }
 
-void Si5351C::FindOptimalDivider(uint32_t f_pll, uint32_t f, uint32_t &P1,
-		uint32_t &P2, uint32_t &P3) {
-	// see https://www.silabs.com/documents/public/application-notes/AN619.pdf (page 3/6)
-	uint32_t a = f_pll / f;
-	int32_t f_rem = f_pll - f * a;
-	uint32_t best_b, best_c;
-	uint32_t best_deviation = UINT32_MAX;
-	for (uint32_t c = (1UL << 20) - 1; c >= (1UL << 19); c--) {
-		uint32_t guess_b = (uint64_t) f_rem * c / f;
-		for (uint32_t b = guess_b; b <= guess_b + 1; b++) {
-			int32_t f_div = (uint64_t) f * b / c;
-			uint32_t deviation = abs(f_rem - f_div);
-			if (deviation < best_deviation) {
-				best_b = b;
-				best_c = c;
-				best_deviation = deviation;
-				if (deviation == 0) {
-					break;
-				}
-			}
-		}
-		if (best_deviation == 0) {
-			break;
-		}
-	}
-	LOG_DEBUG(
-			"Optimal divider for %luHz/%luHz is: a=%lu, b=%lu, c=%lu (%luHz deviation)",
-			f_pll, f, a, best_b, best_c, best_deviation);
-	// convert to Si5351C parameters
-	uint32_t floor = 128 * best_b / best_c;
-	P1 = 128 * a + floor - 512;
-	P2 = 128 * best_b - best_c * floor;
-	P3 = best_c;
-	LOG_DEBUG("P1=%lu, P2=%lu, P3=%lu", P1, P2, P3);
-}
-
 bool Si5351C::WriteRawCLKConfig(uint8_t clknum, const uint8_t *config) {
 	// Calculate address of register control block
 	auto reg = (Reg) ((int) Reg::MS0_CONFIG + 8 * clknum);
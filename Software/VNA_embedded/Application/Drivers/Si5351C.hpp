@@ -45,8 +45,13 @@ public:
 	// config has to point to a buffer containing at least 8 bytes
 	bool WriteRawCLKConfig(uint8_t clknum, const uint8_t *config);
 	bool ReadRawCLKConfig(uint8_t clknum, uint8_t *config);
+	// Calculates the raw clk configuration (as used by WriteRawCLKConfig) for CLK0-5 without any bus access.
+	// Only the divider settings are calculated, the configuration has to be applied to an already configured output
+	bool CalculateRawCLKConfig(uint8_t clknum, uint32_t frequency, PLL source, uint8_t *config, uint32_t PLLFreqOverride = 0);
+	uint32_t GetPLLFrequency(PLL pll) {
+		return FreqPLL[(int) pll];
+	}
 private:
-	void FindOptimalDivider(uint32_t f_pll, uint32_t f, uint32_t &P1, uint32_t &P2, uint32_t &P3);
 	enum class Reg : uint8_t {
 		DeviceStatus = 0,
 		InterruptStatusSticky = 1,
@@ -104,6 +109,8 @@ private:
 		bool Inverted;
 		DriveStrength strength;
 	};
+	bool CalculateClkConfig(ClkConfig &c, uint8_t clknum, uint32_t frequency, PLL source, DriveStrength strength, uint32_t PLLFreqOverride);
+	static void EncodeClkData(const ClkConfig &config, uint8_t *data);
 	bool WriteClkConfig(ClkConfig config, uint8_t clknum);
 
 	static constexpr uint8_t address = 0xC0;
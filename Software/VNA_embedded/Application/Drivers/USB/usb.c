@@ -18,10 +18,15 @@ static uint8_t  *USBD_Class_GetFSCfgDesc (uint16_t *length);
 static uint8_t  *USBD_Class_GetDeviceQualifierDescriptor (uint16_t *length);
 
 static usbd_recv_callback_t cb;
+static usbd_connection_callback_t connection_cb;
 static uint8_t usb_receive_buffer[1024];
 static uint8_t usb_transmit_fifo[4092];
 static uint16_t usb_transmit_read_index = 0;
 static uint16_t usb_transmit_fifo_level = 0;
+// set while a caller encodes directly into the fifo (see usb_transmit_reserve)
+static bool usb_transmit_reserved = false;
+// highest fifo level since the last call of usb_transmit_highwater
+static uint16_t usb_transmit_fifo_highwater = 0;
 static bool data_transmission_active = false;
 static bool log_transmission_active = true;
 
@@ -131,6 +136,9 @@ static uint8_t  USBD_Class_Init (USBD_HandleTypeDef *pdev, uint8_t cfgidx)
 	USBD_LL_OpenEP(pdev, EP_DATA_OUT_ADDRESS, USBD_EP_TYPE_BULK, USB_FS_MAX_PACKET_SIZE);
 	USBD_LL_OpenEP(pdev, EP_LOG_IN_ADDRESS, USBD_EP_TYPE_BULK, USB_FS_MAX_PACKET_SIZE);
 	USBD_LL_PrepareReceive(pdev, EP_DATA_OUT_ADDRESS, usb_receive_buffer,	USB_FS_MAX_PACKET_SIZE);
+	if(connection_cb) {
+		connection_cb(true);
+	}
 	return USBD_OK;
 }
 static uint8_t  USBD_Class_DeInit(USBD_HandleTypeDef *pdev,
@@ -139,6 +147,9 @@ static uint8_t  USBD_Class_DeInit(USBD_HandleTypeDef *pdev,
   USBD_LL_CloseEP(pdev, EP_DATA_IN_ADDRESS);
   USBD_LL_CloseEP(pdev, EP_DATA_OUT_ADDRESS);
   USBD_LL_CloseEP(pdev, EP_LOG_IN_ADDRESS);
+  if(connection_cb) {
+    connection_cb(false);
+  }
   return USBD_OK;
 }
 static uint8_t USBD_Class_Setup(USBD_HandleTypeDef *pdev , USBD_SetupReqTypedef  *req) {
@@ -221,6 +232,23 @@ void usb_init(usbd_recv_callback_t receive_callback) {
     HAL_NVIC_SetPriority(USB_LP_IRQn, 5, 0);
 	HAL_NVIC_EnableIRQ(USB_LP_IRQn);
 }
+void usb_set_connection_callback(usbd_connection_callback_t connection_callback) {
+	connection_cb = connection_callback;
+}
+static bool start_fifo_transmission() {
+	static bool first = true;
+	if(first) {
+		log_transmission_active = false;
+		first = false;
+	}
+	if(!data_transmission_active) {
+		return trigger_next_fifo_transmission();
+	} else {
+		// still transmitting, no need to trigger
+		return true;
+	}
+}
+
 bool usb_transmit(const uint8_t *data, uint16_t length) {
 	// attempt to add data to fifo
 	if(usb_transmit_fifo_level + length > sizeof(usb_transmit_fifo)) {
@@ -229,6 +257,11 @@ bool usb_transmit(const uint8_t *data, uint16_t length) {
 	}
 	// grab pointer to write position
 	__disable_irq();
+	if(usb_transmit_reserved) {
+		// the space behind the current data is in use by usb_transmit_reserve, abort
+		__enable_irq();
+		return false;
+	}
 	uint16_t write_index = usb_transmit_read_index + usb_transmit_fifo_level;
 	__enable_irq();
 	write_index %= sizeof(usb_transmit_fifo);
@@ -245,19 +278,59 @@ bool usb_transmit(const uint8_t *data, uint16_t length) {
 	// increment fifo level
 	__disable_irq();
 	usb_transmit_fifo_level += length;
+	if(usb_transmit_fifo_level > usb_transmit_fifo_highwater) {
+		usb_transmit_fifo_highwater = usb_transmit_fifo_level;
+	}
 	__enable_irq();
 
-	static bool first = true;
-	if(first) {
-		log_transmission_active = false;
-		first = false;
+	return start_fifo_transmission();
+}
+
+uint16_t usb_transmit_reserve(uint8_t **data) {
+	__disable_irq();
+	if(usb_transmit_reserved) {
+		// only one reservation at a time
+		__enable_irq();
+		return 0;
 	}
-	if(!data_transmission_active) {
-		return trigger_next_fifo_transmission();
-	} else {
-		// still transmitting, no need to trigger
+	uint16_t write_index = (usb_transmit_read_index + usb_transmit_fifo_level) % sizeof(usb_transmit_fifo);
+	uint16_t free_length = sizeof(usb_transmit_fifo) - usb_transmit_fifo_level;
+	// the reserved space can only grow while reserved (data is removed by the USB interrupt), no need to lock
+	uint16_t continous_length = sizeof(usb_transmit_fifo) - write_index;
+	if(continous_length > free_length) {
+		continous_length = free_length;
+	}
+	usb_transmit_reserved = continous_length > 0;
+	__enable_irq();
+	*data = &usb_transmit_fifo[write_index];
+	return continous_length;
+}
+
+bool usb_transmit_commit(uint16_t length) {
+	__disable_irq();
+	usb_transmit_fifo_level += length;
+	if(usb_transmit_fifo_level > usb_transmit_fifo_highwater) {
+		usb_transmit_fifo_highwater = usb_transmit_fifo_level;
+	}
+	usb_transmit_reserved = false;
+	__enable_irq();
+	if(!length) {
+		// reservation released without adding data
 		return true;
 	}
+	return start_fifo_transmission();
+}
+
+uint16_t usb_transmit_space() {
+	return sizeof(usb_transmit_fifo) - usb_transmit_fifo_level;
+}
+
+uint16_t usb_transmit_highwater() {
+	__disable_irq();
+	uint16_t ret = usb_transmit_fifo_highwater;
+	usb_transmit_fifo_highwater = usb_transmit_fifo_level;
+	__enable_irq();
+	return ret;
 }
 
 void usb_log(const char *log, uint16_t length) {
@@ -16,9 +16,24 @@ extern "C" {
 #include <stdbool.h>
 
 typedef void(*usbd_recv_callback_t)(const uint8_t *buf, uint16_t len);
+typedef void(*usbd_connection_callback_t)(bool connected);
 
 void usb_init(usbd_recv_callback_t receive_callback);
+// Called from the USB interrupt when the host configures the device (connected) or resets/deconfigures it
+void usb_set_connection_callback(usbd_connection_callback_t connection_callback);
 bool usb_transmit(const uint8_t *data, uint16_t length);
+// Reserves the contiguous free space at the end of the transmit fifo. Data can be written directly
+// into the returned pointer, then has to be added with usb_transmit_commit. The reserved space might
+// be smaller than the overall free space if it wraps around the end of the fifo. Returns the number of
+// reserved bytes (0 if the fifo is full or another reservation is still active)
+uint16_t usb_transmit_reserve(uint8_t **data);
+// Adds length bytes of the reserved space to the fifo and releases the reservation. Has to be called
+// after every successful usb_transmit_reserve, length may be 0 to release the space without sending
+bool usb_transmit_commit(uint16_t length);
+// Number of free bytes in the transmit fifo
+uint16_t usb_transmit_space();
+// Highest transmit fifo level since the last call
+uint16_t usb_transmit_highwater();
 void usb_log(const char *log, uint16_t length);
 
 
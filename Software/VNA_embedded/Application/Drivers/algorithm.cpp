@@ -1,44 +1,46 @@
 #include "algorithm.hpp"
 
-#include "stm.hpp"
-#include <cmath>
+// Distance between p/q and num/denom, scaled by q*denom. Always less than q for any convergent
+static uint64_t ScaledDeviation(uint32_t p, uint32_t q, uint32_t num, uint32_t denom) {
+	int64_t dev = (int64_t) p * denom - (int64_t) num * q;
+	return dev >= 0 ? dev : -dev;
+}
 
-Algorithm::RationalApproximation Algorithm::BestRationalApproximation(float ratio, uint32_t max_denom) {
+Algorithm::RationalApproximation Algorithm::BestRationalApproximation(uint32_t p, uint32_t q, uint32_t max_denom) {
 	RationalApproximation result;
-	uint32_t a = 0, b = 1, c = 1, d = 1;
-	while (b + d <= max_denom) {
-		auto mediant = (float) (a + c) / (b + d);
-		if (ratio == mediant) {
-			if (b + d <= max_denom) {
-				result.num = a + c;
-				result.denom = b + d;
-				return result;
-			} else if (d > b) {
-				result.num = c;
-				result.denom = d;
-				return result;
-			} else {
-				result.num = a;
-				result.denom = b;
-				return result;
+	// previous two convergents h/k, starting with the special values for h(-2)/k(-2) and h(-1)/k(-1)
+	uint32_t h0 = 0, k0 = 1;
+	uint32_t h1 = 1, k1 = 0;
+	// remaining fraction n/d
+	uint32_t n = p, d = q;
+	while (d) {
+		uint32_t a = n / d;
+		uint64_t k2 = (uint64_t) a * k1 + k0;
+		if (k2 > max_denom) {
+			// The next convergent is out of range. The best approximation is either the last convergent or
+			// the semiconvergent with the largest denominator that is still in range
+			uint32_t t = (max_denom - k0) / k1;
+			uint32_t semi_num = t * h1 + h0;
+			uint32_t semi_denom = t * k1 + k0;
+			// compare deviations without division: dev1/(q*k1) vs dev2/(q*semi_denom)
+			uint64_t dev_conv = ScaledDeviation(p, q, h1, k1) * semi_denom;
+			uint64_t dev_semi = ScaledDeviation(p, q, semi_num, semi_denom) * k1;
+			if (dev_semi < dev_conv) {
+				h1 = semi_num;
+				k1 = semi_denom;
 			}
-		} else if (ratio > mediant) {
-			a = a + c;
-			b = b + d;
-		} else {
-			c = a + c;
-			d = b + d;
+			break;
 		}
+		uint32_t h2 = a * h1 + h0;
+		h0 = h1;
+		k0 = k1;
+		h1 = h2;
+		k1 = k2;
+		uint32_t r = n - a * d;
+		n = d;
+		d = r;
 	}
-	// check which of the two is the better solution
-	float dev_ab = (float) a / b - ratio;
-	float dev_cd = (float) c / d - ratio;
-	if(fabs(dev_cd) < fabs(dev_ab)) {
-		result.num = c;
-		result.denom = d;
-	} else {
-		result.num = a;
-		result.denom = b;
-	}
+	result.num = h1;
+	result.denom = k1;
 	return result;
 }
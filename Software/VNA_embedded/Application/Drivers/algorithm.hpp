@@ -9,6 +9,11 @@ using RationalApproximation = struct _rationalapproximation {
 	uint32_t denom;
 };
 
-RationalApproximation BestRationalApproximation(float ratio, uint32_t max_denom);
+// Finds the fraction num/denom with denom <= max_denom that is closest to the ratio p/q (p < q).
+// Uses continued fractions with integer arithmetic only, the number of iterations is bounded by the
+// number of continued fraction terms (less than 50 for 32 bit values). If two fractions are equally
+// close, the one with the smaller denominator is returned. The result might be 1/1 if the ratio is
+// very close to 1.
+RationalApproximation BestRationalApproximation(uint32_t p, uint32_t q, uint32_t max_denom);
 
 }
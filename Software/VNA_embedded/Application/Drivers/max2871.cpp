@@ -1,6 +1,6 @@
 #include "max2871.hpp"
 #include <string.h>
-#include <algorithm.hpp>
+#include "PLLCalculation.hpp"
 
 #include "delay.hpp"
 #include <cmath>
@@ -133,84 +133,33 @@ void MAX2871::SetCPCurrent(uint8_t mA) {
 }
 
 bool MAX2871::SetFrequency(uint64_t f) {
-	if (f < 23500000 || f > MaxFreq) {
-		LOG_ERR("Frequency must be between 23.5MHz and 6GHz");
-		return false;
-	}
 	LOG_DEBUG("Setting frequency to %lu%06luHz...", (uint32_t ) (f / 1000000),
 			(uint32_t ) (f % 1000000));
-	// select divider
-	uint64_t f_vco = f;
-	uint8_t div = 0;
-	if (f < 46875000) {
-		div = 0x07;
-		f_vco *= 128;
-	} else if (f < 93750000) {
-		div = 0x06;
-		f_vco *= 64;
-	} else if (f < 187500000) {
-		div = 0x05;
-		f_vco *= 32;
-	} else if (f < 375000000) {
-		div = 0x04;
-		f_vco *= 16;
-	} else if (f < 750000000) {
-		div = 0x03;
-		f_vco *= 8;
-	} else if (f < 1500000000) {
-		div = 0x02;
-		f_vco *= 4;
-	} else if (f < 3000000000) {
-		div = 0x01;
-		f_vco *= 2;
-	}
-	LOG_DEBUG("F_VCO: %lu%06luHz",
-			(uint32_t ) (f_vco / 1000000), (uint32_t ) (f_vco % 1000000));
-	if (gotVCOMap) {
-		// manual VCO selection for lock time improvement
-		uint16_t compare = f_vco / 100000;
-		uint8_t vco = 0;
-		for (; vco < 64; vco++) {
-			if (VCOmax[vco] >= compare) {
-				break;
-			}
-		} LOG_DEBUG("Manually selected VCO %d", vco);
-		regs[3] &= ~0xFC000000;
-		regs[3] |= (uint32_t) vco << 26;
-	}
-	uint16_t N = f_vco / f_PFD;
-	if (N < 19 || N > 4091) {
-		LOG_ERR("Invalid N value, should be between 19 and 4091, got %lu", N);
+	PLLCalculation::MAX2871Dividers d;
+	uint64_t f_set;
+	if (!PLLCalculation::MAX2871(f, f_PFD, gotVCOMap ? VCOmax : nullptr, d, f_set)) {
+		LOG_ERR("Unable to reach %lu%06luHz (must be between 23.5MHz and 6GHz)",
+				(uint32_t ) (f / 1000000), (uint32_t ) (f % 1000000));
 		return false;
 	}
-	uint32_t rem_f = f_vco - N * f_PFD;
-	LOG_DEBUG("Remaining fractional frequency: %lu", rem_f);
-	LOG_DEBUG("Looking for best fractional match");
-	float fraction = (float) rem_f / f_PFD;
-
-	auto approx = Algorithm::BestRationalApproximation(fraction, 4095);
-
-	if(approx.denom == 1) {
-		// M value must be at least 2
-		approx.denom = 2;
-	}
-
-	int32_t rem_approx = ((uint64_t) f_PFD * approx.num) / approx.denom;
-	if(rem_approx != rem_f) {
-		LOG_WARN("Best match is F=%u/M=%u, deviation of %luHz",
-				approx.num, approx.denom, abs(rem_f - rem_approx));
+	if (f_set != f) {
+		LOG_WARN("Best match is N=%u F=%u/M=%u, deviation of %luHz", d.N, d.F,
+				d.M, (uint32_t) (f_set > f ? f_set - f : f - f_set));
 	}
 
-	uint64_t f_set = (uint64_t) N * f_PFD + rem_approx;
-	f_set /= (1UL << div);
-
 	// write values to registers
+	if (gotVCOMap) {
+		// manual VCO selection for lock time improvement
+		LOG_DEBUG("Manually selected VCO %d", d.VCO);
+		regs[3] &= ~0xFC000000;
+		regs[3] |= (uint32_t) d.VCO << 26;
+	}
 	regs[4] &= ~0x00700000;
-	regs[4] |= ((uint32_t) div << 20);
+	regs[4] |= ((uint32_t) d.div << 20);
 	regs[0] &= ~0x7FFFFFF8;
-	regs[0] |= ((uint32_t) N << 15) | ((uint32_t) approx.num << 3);
+	regs[0] |= ((uint32_t) d.N << 15) | ((uint32_t) d.F << 3);
 	regs[1] &= ~0x00007FF8;
-	regs[1] |= ((uint32_t) approx.denom << 3);
+	regs[1] |= ((uint32_t) d.M << 3);
 
 	LOG_DEBUG("Set frequency to %lu%06luHz...",
 			(uint32_t ) (f_set / 1000000), (uint32_t ) (f_set % 1000000));
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "stm.hpp"
+#include "PLLCalculation.hpp"
 
 class MAX2871 {
 public:
@@ -60,8 +61,15 @@ public:
 	uint64_t GetActualFrequency() {
 		return outputFrequency;
 	}
+	uint32_t GetPFDFrequency() {
+		return f_PFD;
+	}
+	// Highest frequency of each VCO in 100kHz (PLLCalculation::MAX2871NumVCOs entries). Returns nullptr if no VCO map is available
+	const uint16_t* GetVCOMap() {
+		return gotVCOMap ? VCOmax : nullptr;
+	}
 private:
-	static constexpr uint64_t MaxFreq = 6100000000; // 6GHz according to datasheet, but slight overclocking is possible
+	static constexpr uint64_t MaxFreq = PLLCalculation::MAX2871MaxFreq;
 
 	uint32_t Read();
 	void Write(uint8_t reg, uint32_t val);
@@ -79,6 +87,6 @@ private:
 	GPIO_TypeDef *LD;
 	uint16_t LDpin;
 	uint64_t outputFrequency;
-	uint16_t VCOmax[64];
+	uint16_t VCOmax[PLLCalculation::MAX2871NumVCOs];
 	bool gotVCOMap;
 };
@@ -1,9 +1,13 @@
 #include "stm.hpp"
 
+#include <cstring>
+
 using Callback = void(*)(void);
 static constexpr uint8_t numCallbacks = 10;
 static Callback callbacks[numCallbacks];
 uint8_t read_index, write_index;
+// Set while a calculation is using the CRC unit
+static volatile bool crcInUse = false;
 
 static void increment(uint8_t &index) {
 	if(index < numCallbacks - 1) {
@@ -24,6 +28,7 @@ void STM::Init() {
 	read_index = write_index = 0;
 	HAL_NVIC_SetPriority(COMP4_IRQn, 6, 0);
 	HAL_NVIC_EnableIRQ(COMP4_IRQn);
+	__HAL_RCC_CRC_CLK_ENABLE();
 }
 
 bool STM::DispatchToInterrupt(void (*cb)(void)) {
@@ -38,6 +43,39 @@ bool STM::DispatchToInterrupt(void (*cb)(void)) {
 	}
 }
 
+bool STM::CRC32(uint32_t &crc, const void *data, uint32_t len) {
+	auto u8buf = (const uint8_t*) data;
+	// The CRC unit might be used from tasks and interrupts at the same time. Interrupts are only disabled
+	// while taking the unit, an interrupt that finds it in use falls back to the software CRC instead of waiting
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	bool busy = crcInUse;
+	crcInUse = true;
+	__set_PRIMASK(primask);
+	if(busy) {
+		return false;
+	}
+	// Reflected CRC: input bit reversal per byte, output bit reversal. The CRC unit works on the
+	// non-reflected state, convert the previous CRC accordingly
+	CRC->INIT = __RBIT(~crc);
+	CRC->POL = 0x04C11DB7;
+	CRC->CR = CRC_CR_REV_IN_0 | CRC_CR_REV_OUT | CRC_CR_RESET;
+	while(len >= 4) {
+		// the CRC unit processes the most significant byte first
+		uint32_t word;
+		memcpy(&word, u8buf, 4);
+		CRC->DR = __REV(word);
+		u8buf += 4;
+		len -= 4;
+	}
+	while(len--) {
+		*(__IO uint8_t*) &CRC->DR = *u8buf++;
+	}
+	crc = ~CRC->DR;
+	crcInUse = false;
+	return true;
+}
+
 extern "C" {
 void COMP4_IRQHandler() {
 	while(callbackFifoLevel() > 0) {
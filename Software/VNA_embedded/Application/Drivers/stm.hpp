@@ -13,6 +13,10 @@ void Init();
 // but they also need to trigger FreeRTOS functions. This can be achieved by dispatching a function-pointer
 // to a lower priority interrupt. The passed function can then handle the FreeRTOS function call
 bool DispatchToInterrupt(void (*cb)(void));
+// CRC-32 (polynomial 0xEDB88320) calculated by the CRC unit, same result as Protocol::CRC32. crc contains the
+// previous CRC and is replaced by the result. Returns false without calculating anything if the CRC unit is
+// already in use (by a task that got interrupted), the caller has to calculate the CRC in software then
+bool CRC32(uint32_t &crc, const void *data, uint32_t len);
 
 static inline bool InInterrupt() {
 	return (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk) != 0;
@@ -7,6 +7,7 @@
 #include "VNA.hpp"
 #include "Manual.hpp"
 #include "SpectrumAnalyzer.hpp"
+#include "USB/usb.h"
 
 #define LOG_LEVEL	LOG_LEVEL_INFO
 #define LOG_MODULE	"HW"
@@ -15,6 +16,7 @@
 static uint32_t extOutFreq = 0;
 static bool extRefInUse = false;
 HW::Mode activeMode;
+static uint8_t initCount = 0;
 
 static Protocol::ReferenceSettings ref;
 
@@ -84,6 +86,8 @@ bool HW::Init() {
 	LOG_DEBUG("Initializing...");
 
 	activeMode = Mode::Idle;
+	// the VCO maps are rebuilt below, sweep plans calculated with the previous maps are no longer valid
+	initCount++;
 
 	Si5351.Init();
 
@@ -203,6 +207,14 @@ void HW::SetMode(Mode mode) {
 	activeMode = mode;
 }
 
+HW::Mode HW::GetMode() {
+	return activeMode;
+}
+
+uint8_t HW::GetInitCount() {
+	return initCount;
+}
+
 bool HW::GetTemps(uint8_t *source, uint8_t *lo) {
 	FPGA::SetMode(FPGA::Mode::SourcePLL);
 	*source = Source.GetTemp();
@@ -252,6 +264,9 @@ void HW::fillDeviceInfo(Protocol::DeviceInfo *info) {
 	info->temperatures.LO1 = tempLO;
 	info->temperatures.source = tempSource;
 	info->temperatures.MCU = STM::getTemperature();
+	info->transmit.fifoHighWater = usb_transmit_highwater();
+	info->transmit.stalls = VNA::GetStallCount();
+	info->sweepTime = VNA::GetSweepTime();
 	FPGA::ResetADCLimits();
 }
 
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include "Protocol.hpp"
+#include "SweepPlan.hpp"
 
 #define USE_DEBUG_PINS
 
@@ -28,10 +29,12 @@ static constexpr uint32_t ADCSamplerate = 800000;
 static constexpr uint32_t IF1 = 62000000;
 static constexpr uint32_t IF2 = 250000;
 static constexpr uint32_t LO1_minFreq = 25000000;
-static constexpr uint32_t MaxSamples = 130944;
+static constexpr uint32_t MaxSamples = SweepPlan::MaxSamples;
 static constexpr uint32_t MinSamples = 16;
 static constexpr uint32_t PLLRef = 100000000;
 static constexpr uint16_t MaxPoints = 4501;
+// VNA sweeps with more than MaxPoints points are measured in segments (see Protocol::Capabilities::LongSweeps)
+static constexpr uint32_t MaxSweepPoints = 100000;
 
 static constexpr uint8_t ADCprescaler = 102400000UL / ADCSamplerate;
 static_assert(ADCprescaler * ADCSamplerate == 102400000UL, "ADCSamplerate can not be reached exactly");
@@ -48,6 +51,20 @@ static constexpr Protocol::DeviceLimits Limits = {
 		.cdbm_max = 0,
 		.minRBW = (uint32_t) (ADCSamplerate * 2.23f / MaxSamples),
 		.maxRBW = (uint32_t) (ADCSamplerate * 2.23f / MinSamples),
+		.maxSweepPoints = MaxSweepPoints,
+};
+
+static constexpr Protocol::Capabilities Capabilities = {
+		.DatapointBatches = 1,
+		.CompactDatapoints = 1,
+		.SequencedAcks = 1,
+		.SweepPlans = 1,
+		.PortBlockedSweeps = 1,
+		.LongSweeps = 1,
+		.SegmentTables = 1,
+		.LogSweeps = 1,
+		.SweepModes = 1,
+		.PointAveraging = 1,
 };
 
 enum class Mode {
@@ -59,6 +76,9 @@ enum class Mode {
 
 bool Init();
 void SetMode(Mode mode);
+Mode GetMode();
+// Incremented with every call of Init (used as the revision of the sweep plan parameters)
+uint8_t GetInitCount();
 void SetIdle();
 void Work();
 
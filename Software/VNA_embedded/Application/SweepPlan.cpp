@@ -0,0 +1,400 @@
+#include "SweepPlan.hpp"
+
+#include "PLLCalculation.hpp"
+#include <cmath>
+
+uint32_t SweepPlan::SamplesPerPoint(uint32_t if_bandwidth, uint32_t ADCSamplerate, uint16_t averages) {
+	uint32_t samplesPerPoint = ADCSamplerate / if_bandwidth;
+	// round up to next multiple of 16 (16 samples are spread across 5 IF2 periods)
+	if(samplesPerPoint%16) {
+		samplesPerPoint += 16 - samplesPerPoint%16;
+	}
+	if(averages > 1) {
+		// the DFT over consecutive blocks of samples is the sum of the DFTs of the blocks, measuring longer
+		// averages the point without any further calculation
+		samplesPerPoint *= averages;
+	}
+	if(samplesPerPoint > MaxSamples) {
+		samplesPerPoint = MaxSamples;
+	}
+	return samplesPerPoint;
+}
+
+uint16_t SweepPlan::PointAverages(uint32_t if_bandwidth, uint32_t ADCSamplerate, uint16_t averages) {
+	uint32_t samples = SamplesPerPoint(if_bandwidth, ADCSamplerate);
+	uint16_t fit = samples < MaxSamples ? MaxSamples / samples : 1;
+	for (uint16_t factor = averages < fit ? averages : fit; factor > 1; factor--) {
+		if (averages % factor == 0) {
+			return factor;
+		}
+	}
+	return 1;
+}
+
+uint8_t SweepPlan::Attenuator(int16_t cdbm, bool &highPower) {
+	// use higher source power (approx 0dbm with no attenuation) if possible,
+	// otherwise the lower source power (approx -10dbm with no attenuation)
+	highPower = cdbm > -1000;
+	return Attenuation(cdbm, highPower);
+}
+
+uint8_t SweepPlan::Attenuation(int16_t cdbm, bool highPower) {
+	// Set level (not very accurate)
+	if(!highPower) {
+		cdbm += 1000;
+	}
+	if(cdbm >= 0) {
+		return 0;
+	} else if (cdbm <= -3175){
+		return 127;
+	} else {
+		return (-cdbm) / 25;
+	}
+}
+
+bool SweepPlan::HighPower(const Protocol::SweepSettings &s, const Protocol::SweepSegments *segments) {
+	if(s.segmentTable && segments && segments->count > 0) {
+		for(uint8_t i=0;i<segments->count;i++) {
+			if(segments->segments[i].cdbm_excitation > -1000) {
+				return true;
+			}
+		}
+		return false;
+	}
+	return s.cdbm_excitation > -1000;
+}
+
+uint32_t SweepPlan::SegmentTableSamplesPerPoint(const Protocol::SweepSegments &segments, uint32_t ADCSamplerate) {
+	uint8_t largest = 0;
+	for(uint8_t i=1;i<segments.count;i++) {
+		if(segments.segments[i].points > segments.segments[largest].points) {
+			largest = i;
+		}
+	}
+	return SamplesPerPoint(segments.segments[largest].if_bandwidth, ADCSamplerate);
+}
+
+uint8_t SweepPlan::SegmentSamples(uint32_t if_bandwidth, uint32_t samplesPerPoint, uint32_t ADCSamplerate) {
+	uint32_t required = SamplesPerPoint(if_bandwidth, ADCSamplerate);
+	uint8_t best = 0;
+	uint32_t bestSamples = samplesPerPoint;
+	for(uint8_t i=1;i<8;i++) {
+		uint32_t samples = FixedSamples[i];
+		if(bestSamples < required) {
+			// nothing narrow enough found yet, take anything with more samples
+			if(samples > bestSamples) {
+				best = i;
+				bestSamples = samples;
+			}
+		} else if(samples >= required && samples < bestSamples) {
+			// closer to the requested bandwidth
+			best = i;
+			bestSamples = samples;
+		}
+	}
+	return best;
+}
+
+static Protocol::SweepPlanPLL ToPlan(const PLLCalculation::MAX2871Dividers &d) {
+	Protocol::SweepPlanPLL p;
+	p.N = d.N;
+	p.F = d.F;
+	p.M = d.M;
+	p.div = d.div;
+	p.VCO = d.VCO;
+	return p;
+}
+
+SweepPlan::Frequencies::Frequencies(const Protocol::SweepSettings &s, const Protocol::SweepSegments *segments) :
+		s(&s),
+		segments(s.segmentTable && segments && segments->count > 0 ? segments : nullptr),
+		segment(0),
+		rangeStart(0),
+		rangeEnd(0),
+		next(0),
+		frequency(0),
+		step(0),
+		remainder(0),
+		remainderStep(0),
+		divisor(1),
+		log(false),
+		logFrequency(0),
+		ratio(1),
+		f_min(0),
+		f_max(0) {
+	Seek(0);
+}
+
+void SweepPlan::Frequencies::Seek(uint32_t pointNum) {
+	uint64_t f_start = s->f_start;
+	uint64_t f_stop = s->f_stop;
+	uint32_t points = s->points;
+	rangeStart = 0;
+	log = s->logSweep && f_start > 0;
+	if (segments) {
+		// find the segment containing the point
+		uint8_t count = segments->count <= Protocol::MaxSweepSegments ? segments->count : Protocol::MaxSweepSegments;
+		for (segment = 0; segment < count - 1; segment++) {
+			if (pointNum < rangeStart + segments->segments[segment].points) {
+				break;
+			}
+			rangeStart += segments->segments[segment].points;
+		}
+		f_start = segments->segments[segment].f_start;
+		f_stop = segments->segments[segment].f_stop;
+		points = segments->segments[segment].points;
+		log = false;
+	}
+	rangeEnd = rangeStart + points;
+	next = pointNum;
+	uint32_t index = pointNum - rangeStart;
+	if (points < 2) {
+		log = false;
+		divisor = 1;
+		step = 0;
+		remainderStep = 0;
+		frequency = f_start;
+		remainder = 0;
+	} else if (log) {
+		ratio = pow((double) f_stop / f_start, 1.0 / (points - 1));
+		logFrequency = f_start * pow(ratio, index);
+		f_min = f_start < f_stop ? f_start : f_stop;
+		f_max = f_start < f_stop ? f_stop : f_start;
+	} else {
+		uint64_t span = f_stop - f_start;
+		divisor = points - 1;
+		step = span / divisor;
+		remainderStep = span % divisor;
+		frequency = f_start + span * index / divisor;
+		remainder = span * index % divisor;
+	}
+}
+
+uint64_t SweepPlan::Frequencies::Get(uint32_t pointNum) {
+	if (pointNum != next || (segments && pointNum >= rangeEnd)) {
+		Seek(pointNum);
+	}
+	next = pointNum + 1;
+	uint64_t f;
+	if (log) {
+		f = logFrequency + 0.5;
+		logFrequency *= ratio;
+		// the rounding errors accumulate, never leave the frequency range of the sweep
+		if (f < f_min) {
+			f = f_min;
+		} else if (f > f_max) {
+			f = f_max;
+		}
+	} else {
+		f = frequency;
+		frequency += step;
+		remainder += remainderStep;
+		if (remainder >= divisor) {
+			remainder -= divisor;
+			frequency++;
+		}
+	}
+	return f;
+}
+
+SweepPlan::Calculator::Calculator(const Protocol::SweepPlanParameters &p, const Protocol::SweepSettings &s,
+		uint32_t bandwidth) :
+		p(&p),
+		s(&s),
+		segments(nullptr),
+		segment(0),
+		segmentPointCnt(0),
+		samplesPerPoint(0),
+		highPower(false),
+		frequencies(s),
+		bandwidth(bandwidth),
+		attenuator(0),
+		samples(0),
+		pointCnt(0),
+		lastLowband(false),
+		lastSource(),
+		lastLO1(),
+		lastFilter(0),
+		LO2(p.IF1 - p.IF2),
+		LO2Shifts(0),
+		frequency(0),
+		IFDeviation(0) {
+	attenuator = Attenuator(s.cdbm_excitation, highPower);
+}
+
+SweepPlan::Calculator::Calculator(const Protocol::SweepPlanParameters &p, const Protocol::SweepSettings &s,
+		const Protocol::SweepSegments &segments, uint32_t samplesPerPoint) :
+		p(&p),
+		s(&s),
+		segments(&segments),
+		segment(0),
+		segmentPointCnt(0),
+		samplesPerPoint(samplesPerPoint),
+		highPower(HighPower(s, &segments)),
+		frequencies(s, &segments),
+		bandwidth(0),
+		attenuator(0),
+		samples(0),
+		pointCnt(0),
+		lastLowband(false),
+		lastSource(),
+		lastLO1(),
+		lastFilter(0),
+		LO2(p.IF1 - p.IF2),
+		LO2Shifts(0),
+		frequency(0),
+		IFDeviation(0) {
+	StartSegment();
+}
+
+void SweepPlan::Calculator::StartSegment() {
+	auto &seg = segments->segments[segment];
+	attenuator = Attenuation(seg.cdbm_excitation, highPower);
+	samples = SegmentSamples(seg.if_bandwidth, samplesPerPoint, p->ADCSamplerate);
+	bandwidth = p->ADCSamplerate / (samples ? FixedSamples[samples] : samplesPerPoint);
+}
+
+bool SweepPlan::Calculator::Next(Protocol::SweepPlanPoint &point) {
+	if(segments) {
+		// continue with the next segment once all points of the current one have been calculated
+		while(segmentPointCnt >= segments->segments[segment].points && segment + 1 < segments->count) {
+			segment++;
+			segmentPointCnt = 0;
+			StartSegment();
+		}
+		segmentPointCnt++;
+	}
+	frequency = frequencies.Get(pointCnt);
+	pointCnt++;
+	auto sourceVCOMap = p->sourceVCOMapValid ? p->sourceVCOMap : nullptr;
+	auto LO1VCOMap = p->LO1VCOMapValid ? p->LO1VCOMap : nullptr;
+
+	point.halt = 0;
+	point.LO2Shift = 0;
+	point.attenuator = attenuator;
+	point.samples = samples;
+	uint64_t actualSourceFreq;
+	PLLCalculation::MAX2871Dividers source;
+	if (frequency < p->bandSwitch) {
+		// the lowband source is configured in the halted callback
+		point.halt = 1;
+		point.lowband = 1;
+		actualSourceFreq = frequency;
+		// the source is not used, configure it for a valid frequency anyway
+		uint64_t unused;
+		if(!PLLCalculation::MAX2871(p->bandSwitch, p->sourcePFD, sourceVCOMap, source, unused)) {
+			return false;
+		}
+	} else {
+		point.lowband = 0;
+		if(!PLLCalculation::MAX2871(frequency, p->sourcePFD, sourceVCOMap, source, actualSourceFreq)) {
+			return false;
+		}
+	}
+	if (lastLowband && !point.lowband) {
+		// additional halt before first highband point to enable highband source
+		point.halt = 1;
+	}
+
+	PLLCalculation::MAX2871Dividers LO;
+	uint64_t actualLOFreq;
+	if(!PLLCalculation::MAX2871(frequency + p->IF1, p->LO1PFD, LO1VCOMap, LO, actualLOFreq)) {
+		return false;
+	}
+	point.source = ToPlan(source);
+	point.LO1 = ToPlan(LO);
+
+	uint32_t actualFirstIF = actualLOFreq - actualSourceFreq;
+	int32_t deviation = (int32_t) (actualFirstIF - LO2) - (int32_t) p->IF2;
+	IFDeviation = deviation >= 0 ? deviation : -deviation;
+	if (IFDeviation > bandwidth / 2 && s->suppressPeaks && LO2Shifts < p->maxLO2Shifts) {
+		// Shift the 2.LO to reach the correct 2.IF. This requires a halt to reconfigure the Si5351
+		PLLCalculation::Si5351Dividers d;
+		if(PLLCalculation::Si5351Output(p->LO2PLL, actualFirstIF - p->IF2, d)) {
+			LO2 = actualFirstIF - p->IF2;
+			PLLCalculation::EncodeSi5351Output(d, false, point.LO2Config);
+			point.LO2Shift = 1;
+			point.halt = 1;
+			LO2Shifts++;
+			IFDeviation = 0;
+		}
+	}
+
+	// Select source LP filter (same thresholds as FPGA::LowpassFilter::Auto)
+	if (frequency >= 3500000000) {
+		point.filter = 3;
+	} else if (frequency >= 1800000000) {
+		point.filter = 2;
+	} else if (frequency >= 900000000) {
+		point.filter = 1;
+	} else {
+		point.filter = 0;
+	}
+
+	point.settling = Settling(point);
+	lastLowband = point.lowband;
+	lastSource = point.source;
+	lastLO1 = point.LO1;
+	lastFilter = point.filter;
+	return true;
+}
+
+static bool LargeStep(const Protocol::SweepPlanPLL &a, const Protocol::SweepPlanPLL &b) {
+	// a different output divider means a jump across the whole VCO range. Switching to the neighboring
+	// VCO is part of a normal frequency step (without a VCO map, the VCO is always zero)
+	return a.div != b.div || a.VCO > b.VCO + 1 || b.VCO > a.VCO + 1;
+}
+
+// The FPGA starts the settling time once the PLLs report lock (see SettlingTime in FPGA_protocol.tex). 20us is the
+// settling time the firmware always used for every point. The 60us/180us for the larger steps are estimates (the
+// output still drifts after lock is detected when a new VCO or divider was selected), they have not been measured
+// on the hardware. They only apply with SweepSettings::extendedSettling
+uint8_t SweepPlan::Calculator::Settling(const Protocol::SweepPlanPoint &point) const {
+	if (!s->extendedSettling) {
+		return 0;
+	}
+	if (pointCnt == 1) {
+		// first point, the PLLs jump from the end of the previous sweep
+		return 2;
+	}
+	if (point.lowband != lastLowband || point.filter != lastFilter) {
+		// switching between the sources or the lowpass filters
+		return 1;
+	}
+	if (LargeStep(point.LO1, lastLO1) || (!point.lowband && LargeStep(point.source, lastSource))) {
+		return 1;
+	}
+	// small step within the lock range of the PLLs
+	return 0;
+}
+
+// Rough estimates of the time spent in the halted callback
+static constexpr uint32_t haltTime = 50;
+// Si5351 configured as the lowband source (one 8 byte I2C write)
+static constexpr uint32_t lowbandHaltTime = 300;
+// 2.LO changed (three I2C writes, PLL reset and the following delay)
+static constexpr uint32_t LO2ShiftTime = 2300;
+
+void SweepPlan::DurationEstimate::Add(const Protocol::SweepPlanPoint &point) {
+	settling += SettlingTimes[point.settling];
+	if (point.samples) {
+		fixedSamplesPoints++;
+		fixedSamples += FixedSamples[point.samples];
+	}
+	if (point.halt) {
+		halts += haltTime;
+		if (point.lowband) {
+			halts += lowbandHaltTime;
+		}
+		if (point.LO2Shift) {
+			halts += LO2ShiftTime;
+		}
+	}
+}
+
+uint32_t SweepPlan::DurationEstimate::Get(uint32_t points, uint32_t samplesPerPoint, uint32_t ADCSamplerate,
+		uint8_t ports) const {
+	uint32_t registerPoints = points > fixedSamplesPoints ? points - fixedSamplesPoints : 0;
+	uint64_t sampling = ((uint64_t) registerPoints * samplesPerPoint + fixedSamples) * 1000000 / ADCSamplerate;
+	return (sampling + settling) * ports + halts;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include "Protocol.hpp"
+
+// Calculation of the per point sweep configuration without any hardware access. Used by the device and by
+// the PC application, which calculates the plan and uploads it (see Protocol::SweepPlanPoints)
+namespace SweepPlan {
+
+// Largest value of the samples per point register
+static constexpr uint32_t MaxSamples = 130944;
+// Number of ADC samples per point for the requested IF bandwidth (rounded up to a multiple of 16). With averages,
+// the point is measured over that many times the samples, limited to MaxSamples (see SweepSettings::averages)
+uint32_t SamplesPerPoint(uint32_t if_bandwidth, uint32_t ADCSamplerate, uint16_t averages = 1);
+// Largest factor of averages that can be averaged within a point without exceeding MaxSamples. The remaining
+// factor (averages divided by the result) has to be averaged over sweeps. Returns 1 if no factor fits
+uint16_t PointAverages(uint32_t if_bandwidth, uint32_t ADCSamplerate, uint16_t averages);
+// Attenuator setting for the requested excitation level (in 1/100 dbm). highPower is set if the source
+// has to use the higher output power
+uint8_t Attenuator(int16_t cdbm, bool &highPower);
+// Attenuator setting for the requested excitation level with the source power already selected
+uint8_t Attenuation(int16_t cdbm, bool highPower);
+// Source power of a sweep. The source power applies to the whole sweep, the higher power is used if any
+// segment of a segment table requires it
+bool HighPower(const Protocol::SweepSettings &s, const Protocol::SweepSegments *segments = nullptr);
+
+// Settling times selected by Protocol::SweepPlanPoint::settling in us
+static constexpr uint16_t SettlingTimes[4] = {20, 60, 180, 540};
+// Sample counts selected by Protocol::SweepPlanPoint::samples, 0 uses the samples per point register
+static constexpr uint32_t FixedSamples[8] = {0, 96, 304, 912, 3040, 9136, 30464, 91392};
+// Value of the samples per point register in a sweep with a segment table. The segment with the most
+// points gets the exact IF bandwidth, the other segments use FixedSamples (see SegmentSamples)
+uint32_t SegmentTableSamplesPerPoint(const Protocol::SweepSegments &segments, uint32_t ADCSamplerate);
+// Selects Protocol::SweepPlanPoint::samples for a segment: the samples per point register if it matches the
+// IF bandwidth, otherwise the smallest fixed sample count that is at least as narrow as the requested bandwidth
+uint8_t SegmentSamples(uint32_t if_bandwidth, uint32_t samplesPerPoint, uint32_t ADCSamplerate);
+
+// Frequencies of the points of a sweep (see Protocol::SweepFrequency). Consecutive points are calculated
+// incrementally, without the 64 bit division (linear spacing) or power function (logarithmic spacing) per point
+class Frequencies {
+public:
+	// The settings and segments have to stay valid as long as the object is used
+	Frequencies(const Protocol::SweepSettings &s, const Protocol::SweepSegments *segments = nullptr);
+	// Frequency of a point. Fastest if called with consecutive point numbers, other points are calculated directly.
+	// Logarithmically spaced points may differ by 1Hz from Protocol::SweepFrequency due to rounding
+	uint64_t Get(uint32_t pointNum);
+private:
+	// Starts the linearly or logarithmically spaced range of points containing pointNum
+	void Seek(uint32_t pointNum);
+	const Protocol::SweepSettings *s;
+	const Protocol::SweepSegments *segments;
+	uint8_t segment;
+	// point numbers of the current range: [rangeStart, rangeEnd), next is the point expected in the next call
+	uint32_t rangeStart, rangeEnd, next;
+	// linear spacing: frequency of next point, integer and fractional part (remainder/divisor) of the step
+	uint64_t frequency, step, remainder, remainderStep, divisor;
+	// logarithmic spacing: exact frequency of the next point, ratio between consecutive points
+	bool log;
+	double logFrequency, ratio;
+	uint64_t f_min, f_max;
+};
+
+// Calculates the configuration of all points of a sweep, one point at a time
+class Calculator {
+public:
+	// bandwidth is the actual IF bandwidth (see SamplesPerPoint). The parameters have to stay valid as long as
+	// the calculator is used (the calculator can be assigned a new calculator, e.g. to restart a sweep that is
+	// calculated in segments)
+	Calculator(const Protocol::SweepPlanParameters &p, const Protocol::SweepSettings &s, uint32_t bandwidth);
+	// Sweep defined by a segment table, samplesPerPoint is the value of the samples per point register (see
+	// SegmentTableSamplesPerPoint). Frequency, attenuator and samples of each point are taken from its segment
+	Calculator(const Protocol::SweepPlanParameters &p, const Protocol::SweepSettings &s,
+			const Protocol::SweepSegments &segments, uint32_t samplesPerPoint);
+
+	// Calculates the configuration of the next point. Returns false if the PLLs can not reach the required frequencies
+	bool Next(Protocol::SweepPlanPoint &point);
+	// Frequency of the point that was calculated last
+	uint64_t GetFrequency() const { return frequency; }
+	// Actual IF bandwidth of the point that was calculated last
+	uint32_t GetBandwidth() const { return bandwidth; }
+	// Current 2.LO frequency (changes with each point that has LO2Shift set)
+	uint32_t GetLO2() const { return LO2; }
+	// Deviation of the final IF from the nominal 2.IF at the last point. If this is larger than half the IF bandwidth,
+	// the point will show a peak (peak suppression disabled or no more 2.LO shifts available)
+	uint32_t GetIFDeviation() const { return IFDeviation; }
+private:
+	// Selects the settling time of a point from the change in PLL and RF path configuration to the previous point.
+	// Always the shortest settling time unless SweepSettings::extendedSettling is set
+	uint8_t Settling(const Protocol::SweepPlanPoint &point) const;
+	// Selects the attenuator, samples and bandwidth of the current segment
+	void StartSegment();
+	const Protocol::SweepPlanParameters *p;
+	const Protocol::SweepSettings *s;
+	// nullptr if the sweep has no segment table
+	const Protocol::SweepSegments *segments;
+	uint8_t segment;
+	uint16_t segmentPointCnt;
+	uint32_t samplesPerPoint;
+	bool highPower;
+	Frequencies frequencies;
+	uint32_t bandwidth;
+	uint8_t attenuator;
+	uint8_t samples;
+	uint32_t pointCnt;
+	bool lastLowband;
+	Protocol::SweepPlanPLL lastSource, lastLO1;
+	uint8_t lastFilter;
+	uint32_t LO2;
+	uint16_t LO2Shifts;
+	uint64_t frequency;
+	uint32_t IFDeviation;
+};
+
+// Estimates the duration of a sweep from the configuration of its points
+class DurationEstimate {
+public:
+	DurationEstimate() : settling(0), halts(0), fixedSamplesPoints(0), fixedSamples(0) {};
+	void Reset() { settling = 0; halts = 0; fixedSamplesPoints = 0; fixedSamples = 0; }
+	void Add(const Protocol::SweepPlanPoint &point);
+	// Duration of one sweep in us. Each point is measured once per excited port (ports). Points with
+	// fixed sample counts are included with their own number of samples
+	uint32_t Get(uint32_t points, uint32_t samplesPerPoint, uint32_t ADCSamplerate, uint8_t ports) const;
+private:
+	uint32_t settling;
+	uint32_t halts;
+	// points that do not use the samples per point register and their total number of samples
+	uint32_t fixedSamplesPoints;
+	uint64_t fixedSamples;
+};
+
+}
@@ -6,9 +6,12 @@
 #include "delay.hpp"
 #include "FPGA/FPGA.hpp"
 #include <complex>
+#include <cstring>
 #include "Exti.hpp"
 #include "Hardware.hpp"
+#include "SweepPlan.hpp"
 #include "Communication.h"
+#include "USB/usb.h"
 #include "FreeRTOS.h"
 #include "task.h"
 
@@ -17,25 +20,131 @@
 #include "Log.h"
 
 static VNA::SweepCallback sweepCallback;
+static VNA::SweepCompleteCallback sweepCompleteCallback;
 static Protocol::SweepSettings settings;
-static uint16_t pointCnt;
+// Segment table of the sweep, only used if settings.segmentTable is set (see VNA::SetSegments)
+static Protocol::SweepSegments segmentTable;
+static uint32_t pointCnt;
 static bool excitingPort1;
+// measure all points with port 1 excited, then all points with port 2 excited (see SweepSettings::portBlocked)
+static bool portBlocked;
 static Protocol::Datapoint data;
 static bool active = false;
 static bool sourceHighPower;
 static bool adcShifted;
+static uint32_t samplesPerPoint;
 static uint32_t actualBandwidth;
+static volatile bool stalled = false;
+static volatile uint16_t stallCnt = 0;
+// Sweep modes: the sweep is held after sweepsPerRun sweeps (zero: continuous) until VNA::Trigger is called
+static uint16_t sweepsPerRun;
+static uint16_t sweepCnt;
+static volatile bool held = false;
+// Time between the start of VNA::Setup and the first measured point (reported once per setup)
+static uint32_t setupStarted;
+static uint32_t firstPointLatency;
+static bool firstPointMeasured, latencyReported;
+
+// The sweep configuration stays in the FPGA until it is overwritten. If none of the settings that affect the
+// configuration changed since the last setup (and no other mode used the FPGA in between), the FPGA and the
+// IF table already contain the correct values and the calculation can be skipped
+using PlanSettings = struct {
+	uint64_t f_start, f_stop;
+	uint16_t points;
+	bool logSweep;
+	uint32_t samplesPerPoint;
+	int16_t cdbm_excitation;
+	bool suppressPeaks;
+	bool extendedSettling;
+	bool backpressureHalts;
+};
+static PlanSettings loadedPlan;
+static bool loadedPlanValid = false;
+// Number of points of the plan uploaded by the host (see LoadPlan), zero if the FPGA contains a plan calculated here
+static uint16_t uploadedPoints = 0;
+// The uploaded points are written with the backpressure halts that were enabled when the upload started
+static bool uploadedBackpressureHalts = false;
+// The host only uploads a plan again if its settings change. A plan for an outdated hardware initialization is
+// not used anymore
+static uint8_t uploadedRevision;
+static Protocol::SweepPlanParameters planParameters;
+// Duration of the loaded plan, updated whenever the FPGA sweep configuration is written
+static SweepPlan::DurationEstimate planDuration;
+static uint32_t sweepTime = 0;
+// Set once every point of the sweep has been calculated (or uploaded), the IF table and planDuration are complete
+static bool planComplete = false;
+
+// Sweeps with more points than the FPGA can hold are measured in segments of up to FPGA::MaxPoints points.
+// While a segment is measured, the configuration of the next segment replaces the points that have already
+// been measured (see VNA::PrepareSegment). Whatever is left is written when the segment is complete
+static bool segmented;
+// Points [segmentStart, segmentEnd) are currently measured. In unsegmented sweeps, this is the whole sweep
+static uint32_t segmentStart, segmentEnd;
+// IF table position at the start of the segment (a port-blocked sweep measures each segment twice)
+static uint16_t segmentIFTableIndex;
+// First point of the segment that is prepared next and the number of its points already written to the FPGA
+static uint32_t nextSegmentStart;
+static uint16_t preparedPoints;
+// Next point of the segment, calculated by the App task but not written to the FPGA yet (see VNA::PrepareSegment)
+static Protocol::SweepPlanPoint pendingPoint;
+static bool pointPending, pendingPointValid;
+// Set by VNA::Work if the current segment is complete before the next one has been prepared. The FPGA is idle
+// until VNA::PrepareSegment has written the remaining points and continues the sweep
+static volatile bool segmentWaiting;
+// The FPGA is already working on the following points when a point is reported as complete. Only table
+// entries at least this far behind the last completed point are overwritten
+static constexpr uint16_t SegmentRefillDistance = 4;
+// Limits the time spent in a single VNA::PrepareSegment call, the App task also has to send the datapoints
+static constexpr uint16_t SegmentRefillMaxPoints = 16;
+// Continues the calculation from one segment to the next
+static SweepPlan::Calculator segmentCalc(planParameters, settings, 0);
+// Frequency of each measured point, set up for the current settings in Setup
+static SweepPlan::Frequencies frequencies(settings);
+
+static bool SamePlan(const PlanSettings &a, const PlanSettings &b) {
+	return a.f_start == b.f_start && a.f_stop == b.f_stop && a.points == b.points && a.logSweep == b.logSweep
+			&& a.samplesPerPoint == b.samplesPerPoint && a.cdbm_excitation == b.cdbm_excitation
+			&& a.suppressPeaks == b.suppressPeaks && a.extendedSettling == b.extendedSettling
+			&& a.backpressureHalts == b.backpressureHalts;
+}
 
 using IFTableEntry = struct {
-	uint16_t pointCnt;
+	uint32_t pointCnt;
 	uint8_t clkconfig[8];
 };
 
 static constexpr uint16_t IFTableNumEntries = 500;
-static IFTableEntry IFTable[IFTableNumEntries];
+// marks the entry after the last used one
+static constexpr uint32_t IFTableEnd = UINT32_MAX;
+// one more entry for the end marker, VNA::SweepHalted must find it even if all entries are used
+static IFTableEntry IFTable[IFTableNumEntries + 1];
+// number of used entries and the next entry that is applied in the halted callback
+static uint16_t IFTableEntries = 0;
 static uint16_t IFTableIndexCnt = 0;
 
 static constexpr uint32_t BandSwitchFrequency = 25000000;
+
+// Below BandSwitchFrequency the Si5351 is used as the source, it is configured in the halted callback.
+// The lowband points are always at the start of the sweep, their Si5351 configuration and ADC samplerate
+// are calculated in Setup. Lowband points beyond the end of the table are calculated in the halted callback
+using LowbandTableEntry = struct {
+	uint8_t clkconfig[8];
+	bool adcShift;
+};
+
+static constexpr uint16_t LowbandTableNumEntries = 128;
+static LowbandTableEntry LowbandTable[LowbandTableNumEntries];
+static uint32_t lowbandPoints = 0;
+// Once the host did not keep up with a sweep, the sweep is halted every BackpressureInterval points. If the host
+// does not read the data fast enough, the sweep is held at these points instead of losing data in the full USB
+// fifo. Each halt costs the time of a FPGA interrupt and SPI command, hosts that keep up are swept without them
+static constexpr uint16_t BackpressureInterval = 16;
+// Free space in the USB fifo required to continue at a backpressure halt. Has to hold all points until the
+// next halt (plus the points still waiting in the App task). A sweep without halts that gets below this
+// limit enables the halts (see VNA::BackpressureRequired)
+static constexpr uint16_t BackpressureMinSpace = 2048;
+static bool backpressureHalts = false;
+static volatile bool hostSlow = false;
 static constexpr float alternativeSamplerate = 914285.7143f;
 static constexpr uint8_t alternativePrescaler = 102400000UL / alternativeSamplerate;
 static_assert(alternativePrescaler * alternativeSamplerate == 102400000UL, "alternative ADCSamplerate can not be reached exactly");
@@ -44,9 +153,320 @@ static_assert(alternativePhaseInc * alternativeSamplerate == 4096 * HW::IF2, "DF
 
 using namespace HWHAL;
 
-bool VNA::Setup(Protocol::SweepSettings s, SweepCallback cb) {
+static PLLCalculation::MAX2871Dividers ToDividers(const Protocol::SweepPlanPLL &p) {
+	PLLCalculation::MAX2871Dividers d;
+	d.N = p.N;
+	d.F = p.F;
+	d.M = p.M;
+	d.div = p.div;
+	d.VCO = p.VCO;
+	return d;
+}
+
+// Transfers the configuration of a single point to the FPGA. With running set, the point may be written while
+// the sweep is running (see FPGA::WriteSweepConfigDuringSweep)
+static void WritePlanPoint(uint16_t pointNum, Protocol::SweepPlanPoint p, bool running = false) {
+	if (backpressureHalts && pointNum % BackpressureInterval == 0) {
+		// check for USB backpressure
+		p.halt = 1;
+	}
+	if (!planComplete) {
+		planDuration.Add(p);
+	}
+	if (running) {
+		FPGA::WriteSweepConfigDuringSweep(pointNum, p.lowband, ToDividers(p.source), ToDividers(p.LO1), p.attenuator,
+				(FPGA::LowpassFilter) p.filter, (FPGA::SettlingTime) p.settling, (FPGA::Samples) p.samples, p.halt);
+	} else {
+		FPGA::WriteSweepConfig(pointNum, p.lowband, ToDividers(p.source), ToDividers(p.LO1), p.attenuator,
+				(FPGA::LowpassFilter) p.filter, (FPGA::SettlingTime) p.settling, (FPGA::Samples) p.samples, p.halt);
+	}
+}
+
+static void ResetIFTable() {
+	IFTableEntries = 0;
+	IFTable[0].pointCnt = IFTableEnd;
+}
+
+static bool AddIFTableEntry(uint32_t pointNum, const uint8_t *clkconfig) {
+	if (IFTableEntries >= IFTableNumEntries) {
+		return false;
+	}
+	auto &entry = IFTable[IFTableEntries];
+	// invalidate entry after the last used one, preventing switching of 2.LO in halted callback
+	IFTable[IFTableEntries + 1].pointCnt = IFTableEnd;
+	memcpy(entry.clkconfig, clkconfig, sizeof(entry.clkconfig));
+	// long sweeps add entries while the sweep is running, the entry may only become visible to the halted
+	// callback once it is complete
+	__DMB();
+	entry.pointCnt = pointNum;
+	IFTableEntries++;
+	return true;
+}
+
+static bool ADCShiftRequired(uint64_t frequency) {
+	// At low frequencies the 1.LO feedtrough mixes with the 2.LO in the second mixer.
+	// Depending on the stimulus frequency, the resulting mixing product might alias to the 2.IF
+	// in the ADC which causes a spike. Check for this and shift the ADC sampling frequency if necessary
+	uint32_t LO_mixing = (HW::IF1 + frequency) - (HW::IF1 - HW::IF2);
+	// move frequency into ADC range
+	LO_mixing %= HW::ADCSamplerate;
+	// fold at half the samplerate
+	if(LO_mixing >= HW::ADCSamplerate / 2) {
+		LO_mixing = HW::ADCSamplerate - LO_mixing;
+	}
+	// the image is in or near the IF bandwidth and would cause a peak
+	return abs(LO_mixing - HW::IF2) <= actualBandwidth * 2;
+}
+
+// Number of points with a frequency below BandSwitchFrequency, calculated without the frequency of each point (long sweeps)
+static uint32_t LowbandPoints(uint64_t f_start, uint64_t f_stop, uint32_t points) {
+	if (f_start >= BandSwitchFrequency) {
+		return 0;
+	} else if (f_stop < BandSwitchFrequency || points < 2) {
+		return points;
+	} else {
+		// first point with a frequency >= BandSwitchFrequency
+		uint64_t span = f_stop - f_start;
+		return ((BandSwitchFrequency - f_start) * (points - 1) + span - 1) / span;
+	}
+}
+
+// Calculates the lowband source configuration (see LowbandTable) and configures the Si5351 output for the first point
+static void CalculateLowband(const Protocol::SweepSettings &s) {
+	if (s.segmentTable) {
+		// the segments are in ascending order, the lowband points end in the first segment that is not completely lowband
+		lowbandPoints = 0;
+		for (uint8_t i = 0; i < segmentTable.count; i++) {
+			auto &segment = segmentTable.segments[i];
+			uint32_t points = LowbandPoints(segment.f_start, segment.f_stop, segment.points);
+			lowbandPoints += points;
+			if (points < segment.points) {
+				break;
+			}
+		}
+		if (lowbandPoints > s.points) {
+			lowbandPoints = s.points;
+		}
+	} else if (s.logSweep && s.f_start > 0) {
+		// count with the same frequencies as the sweep calculation, the rounding may differ from SweepFrequency
+		SweepPlan::Frequencies f(s);
+		lowbandPoints = 0;
+		while (lowbandPoints < s.points && f.Get(lowbandPoints) < BandSwitchFrequency) {
+			lowbandPoints++;
+		}
+	} else {
+		lowbandPoints = LowbandPoints(s.f_start, s.f_stop, s.points);
+	}
+	SweepPlan::Frequencies lowbandFrequencies(s, &segmentTable);
+	for (uint16_t i = 0; i < lowbandPoints && i < LowbandTableNumEntries; i++) {
+		uint64_t frequency = lowbandFrequencies.Get(i);
+		Si5351.CalculateRawCLKConfig(SiChannel::LowbandSource, frequency, Si5351C::PLL::B, LowbandTable[i].clkconfig);
+		LowbandTable[i].adcShift = ADCShiftRequired(frequency);
+	}
+	if (lowbandPoints > 0) {
+		// writes the control register as well, only the divider configuration changes during the sweep
+		Si5351.SetCLK(SiChannel::LowbandSource, Protocol::SweepFrequency(s, 0, &segmentTable), Si5351C::PLL::B,
+				sourceHighPower ? Si5351C::DriveStrength::mA8 : Si5351C::DriveStrength::mA4);
+	}
+}
+
+// Starts the calculation of the sweep plan for the current settings (and segment table) at the first point
+static SweepPlan::Calculator NewCalculator() {
+	if (settings.segmentTable) {
+		return SweepPlan::Calculator(planParameters, settings, segmentTable, samplesPerPoint);
+	} else {
+		return SweepPlan::Calculator(planParameters, settings, actualBandwidth);
+	}
+}
+
+// Calculates the PLL settings for every point, transfers them to the FPGA and fills the IF table
+static void CalculateSweep(uint16_t points) {
+	VNA::GetPlanParameters(planParameters);
+	auto calc = NewCalculator();
+	planDuration.Reset();
+	planComplete = false;
+	ResetIFTable();
+
+	for (uint16_t i = 0; i < points; i++) {
+		Protocol::SweepPlanPoint point;
+		if (!calc.Next(point)) {
+			LOG_ERR("Unable to calculate PLL settings for point %u", i);
+			continue;
+		}
+		uint64_t freq = calc.GetFrequency();
+		if (point.LO2Shift) {
+			LOG_INFO("Changing 2.LO to %lu at point %lu (%lu%06luHz) to reach correct 2.IF frequency",
+					calc.GetLO2(), i, (uint32_t ) (freq / 1000000),
+					(uint32_t ) (freq % 1000000));
+			AddIFTableEntry(i, point.LO2Config);
+		} else if (calc.GetIFDeviation() > calc.GetBandwidth() / 2) {
+			// either peak suppression is disabled or no more room in IFTable was available
+			LOG_WARN(
+					"PLL deviation of %luHz for measurement at %lu%06luHz, will cause a peak",
+					calc.GetIFDeviation(), (uint32_t ) (freq / 1000000), (uint32_t ) (freq % 1000000));
+		}
+		WritePlanPoint(i, point);
+	}
+	planComplete = true;
+}
+
+static void UpdateSweepTime() {
+	if(portBlocked) {
+		// the sweep configuration is used twice, including all halts
+		sweepTime = 2 * planDuration.Get(settings.points, samplesPerPoint, HW::ADCSamplerate, 1);
+	} else {
+		sweepTime = planDuration.Get(settings.points, samplesPerPoint, HW::ADCSamplerate,
+				settings.excitePort1 + settings.excitePort2);
+	}
+}
+
+// Number of points of the segment that is prepared next
+static uint16_t NextSegmentLength() {
+	uint32_t remaining = settings.points - nextSegmentStart;
+	return remaining < FPGA::MaxPoints ? remaining : FPGA::MaxPoints;
+}
+
+// Calculates the next point of a long sweep, it is written to the FPGA by WritePendingPoint. Not called from
+// interrupts, the PLL calculation takes too long
+static void CalculateNextPoint() {
+	uint32_t pointNum = nextSegmentStart + preparedPoints;
+	if (pointNum == 0) {
+		// the calculation starts over with every sweep
+		segmentCalc = NewCalculator();
+	}
+	pendingPointValid = segmentCalc.Next(pendingPoint);
+	if (!pendingPointValid) {
+		LOG_ERR("Unable to calculate PLL settings for point %lu", pointNum);
+	}
+	pointPending = true;
+}
+
+// Writes the calculated point to its position in the FPGA
+static void WritePendingPoint(bool running) {
+	uint32_t pointNum = nextSegmentStart + preparedPoints;
+	if (pendingPointValid) {
+		if (pendingPoint.LO2Shift && !planComplete) {
+			// the calculation is the same for every sweep, the IF table is only filled in the first one
+			AddIFTableEntry(pointNum, pendingPoint.LO2Config);
+		}
+		WritePlanPoint(preparedPoints, pendingPoint, running);
+	}
+	pointPending = false;
+	preparedPoints++;
+	if (pointNum == settings.points - 1 && !planComplete) {
+		planComplete = true;
+		UpdateSweepTime();
+	}
+}
+
+// Selects the next segment for the next FPGA sweep, all of its points have to be prepared.
+// The FPGA must not be measuring
+static void StartNextSegment() {
+	uint16_t length = NextSegmentLength();
+	segmentStart = nextSegmentStart;
+	segmentEnd = segmentStart + length;
+	segmentIFTableIndex = IFTableIndexCnt;
+	nextSegmentStart = segmentEnd < settings.points ? segmentEnd : 0;
+	preparedPoints = 0;
+	FPGA::SetNumberOfPoints(length);
+}
+
+void VNA::GetPlanParameters(Protocol::SweepPlanParameters &p) {
+	static_assert(Protocol::SweepPlanNumVCOs == PLLCalculation::MAX2871NumVCOs, "VCO map size mismatch");
+	p.revision = HW::GetInitCount();
+	p.sourcePFD = Source.GetPFDFrequency();
+	p.LO1PFD = LO1.GetPFDFrequency();
+	p.LO2PLL = Si5351.GetPLLFrequency(Si5351C::PLL::B);
+	p.IF1 = HW::IF1;
+	p.IF2 = HW::IF2;
+	p.ADCSamplerate = HW::ADCSamplerate;
+	p.bandSwitch = BandSwitchFrequency;
+	p.maxLO2Shifts = IFTableNumEntries;
+	auto sourceMap = Source.GetVCOMap();
+	p.sourceVCOMapValid = sourceMap != nullptr;
+	if (sourceMap) {
+		memcpy(p.sourceVCOMap, sourceMap, sizeof(p.sourceVCOMap));
+	}
+	auto LO1Map = LO1.GetVCOMap();
+	p.LO1VCOMapValid = LO1Map != nullptr;
+	if (LO1Map) {
+		memcpy(p.LO1VCOMap, LO1Map, sizeof(p.LO1VCOMap));
+	}
+}
+
+bool VNA::LoadPlan(const Protocol::SweepPlanPoints &p) {
+	if (p.firstPoint == 0) {
+		// start of a new plan, stop the sweep before its configuration is overwritten
+		VNA::Stop();
+		HW::SetMode(HW::Mode::VNA);
+		FPGA::SetMode(FPGA::Mode::FPGA);
+		loadedPlanValid = false;
+		uploadedPoints = 0;
+		uploadedBackpressureHalts = backpressureHalts;
+		planDuration.Reset();
+		planComplete = false;
+		ResetIFTable();
+	}
+	if (p.revision != HW::GetInitCount()) {
+		LOG_WARN("Sweep plan was calculated for outdated parameters");
+		return false;
+	}
+	uploadedRevision = p.revision;
+	if (p.firstPoint != uploadedPoints || p.firstPoint + p.count > FPGA::MaxPoints) {
+		LOG_ERR("Unexpected sweep plan points %u-%u", p.firstPoint, p.firstPoint + p.count - 1);
+		return false;
+	}
+	for (uint8_t i = 0; i < p.count; i++) {
+		uint16_t pointNum = p.firstPoint + i;
+		if (p.points[i].LO2Shift && !AddIFTableEntry(pointNum, p.points[i].LO2Config)) {
+			LOG_ERR("No room for 2.LO change at point %u", pointNum);
+			return false;
+		}
+		WritePlanPoint(pointNum, p.points[i]);
+	}
+	uploadedPoints += p.count;
+	return true;
+}
+
+bool VNA::SetSegments(const Protocol::SweepSegments &segments) {
+	// the running sweep may use the current table, it is restarted by the following Setup
+	VNA::Stop();
+	segmentTable.count = 0;
+	for (uint8_t i = 0; i < segments.count; i++) {
+		auto &segment = segments.segments[i];
+		if (segment.f_start > segment.f_stop || (i > 0 && segment.f_start < segments.segments[i - 1].f_stop)) {
+			LOG_ERR("Segment %u overlaps the previous segments", i);
+			return false;
+		}
+		if (segment.f_stop > HW::Limits.maxFreq || segment.if_bandwidth < HW::Limits.minIFBW || segment.if_bandwidth > HW::Limits.maxIFBW) {
+			LOG_ERR("Segment %u exceeds the device limits", i);
+			return false;
+		}
+	}
+	segmentTable = segments;
+	LOG_INFO("Segment table with %u segments, %lu points", segmentTable.count,
+			Protocol::SegmentTablePoints(segmentTable));
+	return true;
+}
+
+// Stops after the current sweep, no stimulus is applied while waiting for VNA::Trigger
+static void HoldSweep() {
+	held = true;
+	FPGA::Disable(FPGA::Periphery::SourceRF);
+	Si5351.Disable(SiChannel::LowbandSource);
+}
+
+bool VNA::Setup(Protocol::SweepSettings s, SweepCallback cb, SweepCompleteCallback complete) {
+	setupStarted = HAL_GetTick();
+	firstPointMeasured = false;
+	latencyReported = false;
 	VNA::Stop();
 	vTaskDelay(5);
+	if(HW::GetMode() != HW::Mode::VNA) {
+		// switching modes reinitializes the hardware and other modes also use the sweep configuration
+		loadedPlanValid = false;
+		uploadedPoints = 0;
+	}
 	HW::SetMode(HW::Mode::VNA);
 	if(s.excitePort1 == 0 && s.excitePort2 == 0) {
 		// both ports disabled, nothing to do
@@ -56,118 +476,114 @@ bool VNA::Setup(Protocol::SweepSettings s, SweepCallback cb) {
 	}
 	sweepCallback = cb;
 	settings = s;
+	if(settings.segmentTable) {
+		uint32_t tablePoints = Protocol::SegmentTablePoints(segmentTable);
+		if(tablePoints == 0) {
+			LOG_ERR("Segment table is empty, using start/stop frequency instead");
+			settings.segmentTable = 0;
+		} else if(settings.points > tablePoints) {
+			settings.points = tablePoints;
+		}
+	}
+	if(settings.points > HW::MaxSweepPoints) {
+		settings.points = HW::MaxSweepPoints;
+	}
+	frequencies = SweepPlan::Frequencies(settings, &segmentTable);
+	portBlocked = s.portBlocked && s.excitePort1 && s.excitePort2;
+	segmented = settings.points > FPGA::MaxPoints;
 	// Abort possible active sweep first
 	FPGA::SetMode(FPGA::Mode::FPGA);
-	uint16_t points = settings.points <= FPGA::MaxPoints ? settings.points : FPGA::MaxPoints;
+	uint16_t points = segmented ? FPGA::MaxPoints : settings.points;
 	// Configure sweep
 	FPGA::SetNumberOfPoints(points);
-	uint32_t samplesPerPoint = (HW::ADCSamplerate / s.if_bandwidth);
-	// round up to next multiple of 16 (16 samples are spread across 5 IF2 periods)
-	if(samplesPerPoint%16) {
-		samplesPerPoint += 16 - samplesPerPoint%16;
+	if(settings.segmentTable) {
+		// segments with other IF bandwidths use fixed sample counts (part of the per point configuration)
+		samplesPerPoint = SweepPlan::SegmentTableSamplesPerPoint(segmentTable, HW::ADCSamplerate);
+	} else {
+		samplesPerPoint = SweepPlan::SamplesPerPoint(s.if_bandwidth, HW::ADCSamplerate, s.averages);
 	}
 	actualBandwidth = HW::ADCSamplerate / samplesPerPoint;
 	// has to be one less than actual number of samples
 	FPGA::SetSamplesPerPoint(samplesPerPoint);
 
-	// Set level (not very accurate)
-	int16_t cdbm = s.cdbm_excitation;
-	if(cdbm > -1000) {
-		// use higher source power (approx 0dbm with no attenuation)
-		sourceHighPower = true;
+	// Set level (the attenuator is part of the per point configuration)
+	sourceHighPower = SweepPlan::HighPower(settings, &segmentTable);
+	if(sourceHighPower) {
+		// approx 0dbm with no attenuation
 		Source.SetPowerOutA(MAX2871::Power::p5dbm, true);
 	} else {
-		// use lower source power (approx -10dbm with no attenuation)
-		sourceHighPower = false;
+		// approx -10dbm with no attenuation
 		Source.SetPowerOutA(MAX2871::Power::n4dbm, true);
-		cdbm += 1000;
-	}
-	uint8_t attenuator;
-	if(cdbm >= 0) {
-		attenuator = 0;
-	} else if (cdbm <= -3175){
-		attenuator = 127;
-	} else {
-		attenuator = (-cdbm) / 25;
 	}
 	FPGA::WriteMAX2871Default(Source.GetRegisters());
 
-	uint32_t last_LO2 = HW::IF1 - HW::IF2;
-	Si5351.SetCLK(SiChannel::Port1LO2, last_LO2, Si5351C::PLL::B, Si5351C::DriveStrength::mA2);
-	Si5351.SetCLK(SiChannel::Port2LO2, last_LO2, Si5351C::PLL::B, Si5351C::DriveStrength::mA2);
-	Si5351.SetCLK(SiChannel::RefLO2, last_LO2, Si5351C::PLL::B, Si5351C::DriveStrength::mA2);
+	uint32_t LO2 = HW::IF1 - HW::IF2;
+	Si5351.SetCLK(SiChannel::Port1LO2, LO2, Si5351C::PLL::B, Si5351C::DriveStrength::mA2);
+	Si5351.SetCLK(SiChannel::Port2LO2, LO2, Si5351C::PLL::B, Si5351C::DriveStrength::mA2);
+	Si5351.SetCLK(SiChannel::RefLO2, LO2, Si5351C::PLL::B, Si5351C::DriveStrength::mA2);
 	Si5351.ResetPLL(Si5351C::PLL::B);
-
+	CalculateLowband(settings);
 	IFTableIndexCnt = 0;
 
-	bool last_lowband = false;
-
-	// invalidate first entry of IFTable, preventing switing of 2.LO in halted callback
-	IFTable[0].pointCnt = 0xFFFF;
-
-	// Transfer PLL configuration to FPGA
-	for (uint16_t i = 0; i < points; i++) {
-		uint64_t freq = s.f_start + (s.f_stop - s.f_start) * i / (points - 1);
-		// SetFrequency only manipulates the register content in RAM, no SPI communication is done.
-		// No mode-switch of FPGA necessary here.
-
-		bool needs_halt = false;
-		uint64_t actualSourceFreq;
-		bool lowband = false;
-		if (freq < BandSwitchFrequency) {
-			needs_halt = true;
-			lowband = true;
-			actualSourceFreq = freq;
-		} else {
-			Source.SetFrequency(freq);
-			actualSourceFreq = Source.GetActualFrequency();
-		}
-		if (last_lowband && !lowband) {
-			// additional halt before first highband point to enable highband source
-			needs_halt = true;
+	PlanSettings plan;
+	plan.f_start = s.f_start;
+	plan.f_stop = s.f_stop;
+	plan.points = points;
+	plan.logSweep = s.logSweep;
+	plan.samplesPerPoint = samplesPerPoint;
+	plan.cdbm_excitation = s.cdbm_excitation;
+	plan.suppressPeaks = s.suppressPeaks;
+	plan.extendedSettling = s.extendedSettling;
+	plan.backpressureHalts = backpressureHalts;
+	if(segmented) {
+		// long sweeps are always calculated here. Only the first segment is written now, the following
+		// segments are prepared while the sweep is running
+		loadedPlanValid = false;
+		uploadedPoints = 0;
+		VNA::GetPlanParameters(planParameters);
+		planDuration.Reset();
+		planComplete = false;
+		ResetIFTable();
+		nextSegmentStart = 0;
+		preparedPoints = 0;
+		pointPending = false;
+		segmentWaiting = false;
+		while(preparedPoints < NextSegmentLength()) {
+			CalculateNextPoint();
+			WritePendingPoint(false);
 		}
-		LO1.SetFrequency(freq + HW::IF1);
-		uint32_t actualFirstIF = LO1.GetActualFrequency() - actualSourceFreq;
-		uint32_t actualFinalIF = actualFirstIF - last_LO2;
-		uint32_t IFdeviation = abs(actualFinalIF - HW::IF2);
-		bool needs_LO2_shift = false;
-		if(IFdeviation > actualBandwidth / 2) {
-			needs_LO2_shift = true;
-		}
-		if (s.suppressPeaks && needs_LO2_shift) {
-			if (IFTableIndexCnt < IFTableNumEntries) {
-				// still room in table
-				needs_halt = true;
-				IFTable[IFTableIndexCnt].pointCnt = i;
-				// Configure LO2 for the changed IF1. This is not necessary right now but it will generate
-				// the correct clock settings
-				last_LO2 = actualFirstIF - HW::IF2;
-				LOG_INFO("Changing 2.LO to %lu at point %lu (%lu%06luHz) to reach correct 2.IF frequency",
-						last_LO2, i, (uint32_t ) (freq / 1000000),
-						(uint32_t ) (freq % 1000000));
-				Si5351.SetCLK(SiChannel::RefLO2, last_LO2,
-						Si5351C::PLL::B, Si5351C::DriveStrength::mA2);
-				// store calculated clock configuration for later change
-				Si5351.ReadRawCLKConfig(SiChannel::RefLO2, IFTable[IFTableIndexCnt].clkconfig);
-				IFTableIndexCnt++;
-				needs_LO2_shift = false;
-			}
-		}
-		if(needs_LO2_shift) {
-			// if shift is still needed either peak suppression is disabled or no more room in IFTable was available
-			LOG_WARN(
-					"PLL deviation of %luHz for measurement at %lu%06luHz, will cause a peak",
-					IFdeviation, (uint32_t ) (freq / 1000000), (uint32_t ) (freq % 1000000));
+		StartNextSegment();
+	} else if(settings.segmentTable) {
+		// the plan depends on the segment table as well, always calculate it
+		loadedPlanValid = false;
+		uploadedPoints = 0;
+		CalculateSweep(points);
+	} else if(s.uploadedPlan && uploadedPoints == points && uploadedBackpressureHalts == backpressureHalts
+			&& uploadedRevision == HW::GetInitCount()) {
+		LOG_INFO("Using uploaded sweep plan");
+		planComplete = true;
+	} else if(loadedPlanValid && SamePlan(plan, loadedPlan)) {
+		LOG_INFO("Sweep configuration unchanged, skipping calculation");
+	} else {
+		if(s.uploadedPlan) {
+			LOG_WARN("Uploaded sweep plan incomplete (%u of %u points) or without the required halts, calculating it instead",
+					uploadedPoints, points);
 		}
-
-		FPGA::WriteSweepConfig(i, lowband, Source.GetRegisters(),
-				LO1.GetRegisters(), attenuator, freq, FPGA::SettlingTime::us20,
-				FPGA::Samples::SPPRegister, needs_halt);
-		last_lowband = lowband;
+		loadedPlanValid = false;
+		uploadedPoints = 0;
+		CalculateSweep(points);
+		loadedPlan = plan;
+		loadedPlanValid = true;
 	}
-	// revert clk configuration to previous value (might have been changed in sweep calculation)
-	Si5351.SetCLK(SiChannel::RefLO2, HW::IF1 - HW::IF2, Si5351C::PLL::B, Si5351C::DriveStrength::mA2);
-	Si5351.ResetPLL(Si5351C::PLL::B);
+	if(!segmented) {
+		segmentStart = 0;
+		segmentEnd = settings.points;
+		segmentIFTableIndex = 0;
+	}
+	// long sweeps: only includes the settling times and halts of the first segment, the estimate is updated
+	// once all points have been calculated
+	UpdateSweepTime();
+	LOG_INFO("Estimated sweep time: %luus", sweepTime);
 	// Enable mixers/amplifier/PLLs
 	FPGA::SetWindow(FPGA::Window::None);
 	FPGA::Enable(FPGA::Periphery::Port1Mixer);
@@ -179,29 +595,65 @@ bool VNA::Setup(Protocol::SweepSettings s, SweepCallback cb) {
 	FPGA::Enable(FPGA::Periphery::LO1Chip);
 	FPGA::Enable(FPGA::Periphery::LO1RF);
 	FPGA::Enable(FPGA::Periphery::ExcitePort1, s.excitePort1);
-	FPGA::Enable(FPGA::Periphery::ExcitePort2, s.excitePort2);
+	// a port-blocked sweep starts with port 1 only, port 2 is enabled for the second half (see VNA::Work)
+	FPGA::Enable(FPGA::Periphery::ExcitePort2, s.excitePort2 && !portBlocked);
 	FPGA::Enable(FPGA::Periphery::PortSwitch);
 	pointCnt = 0;
 	// starting port depends on whether port 1 is active in sweep
 	excitingPort1 = s.excitePort1;
-	IFTableIndexCnt = 0;
 	adcShifted = false;
+	stalled = false;
+	stallCnt = 0;
+	sweepCompleteCallback = complete;
+	// a triggered sweep measures at least once per trigger
+	sweepsPerRun = s.sweeps ? s.sweeps : s.triggered;
+	sweepCnt = 0;
+	held = false;
 	active = true;
+	if(s.triggered) {
+		// everything is configured, the sweep is started by VNA::Trigger
+		HoldSweep();
+		return true;
+	}
 	// Start the sweep
 	FPGA::StartSweep();
 	return true;
 }
 
+bool VNA::Trigger() {
+	if(!active || !held) {
+		return false;
+	}
+	sweepCnt = 0;
+	held = false;
+	// the lowband source is enabled again by VNA::SweepHalted if the sweep starts in the lowband
+	FPGA::Enable(FPGA::Periphery::SourceRF);
+	FPGA::StartSweep();
+	return true;
+}
+
+bool VNA::Sweeping() {
+	return active && !held;
+}
+
 static void PassOnData() {
 	if (sweepCallback) {
 		sweepCallback(data);
 	}
+	if (!backpressureHalts && usb_transmit_space() < BackpressureMinSpace) {
+		// the host is falling behind and the sweep has no halts to wait for it
+		hostSlow = true;
+	}
 }
 
 bool VNA::MeasurementDone(const FPGA::SamplingResult &result) {
 	if(!active) {
 		return false;
 	}
+	if(!firstPointMeasured) {
+		firstPointLatency = HAL_GetTick() - setupStarted;
+		firstPointMeasured = true;
+	}
 	// normal sweep mode
 	auto port1_raw = std::complex<float>(result.P1I, result.P1Q);
 	auto port2_raw = std::complex<float>(result.P2I, result.P2Q);
@@ -209,7 +661,11 @@ bool VNA::MeasurementDone(const FPGA::SamplingResult &result) {
 	auto port1 = port1_raw / ref;
 	auto port2 = port2_raw / ref;
 	data.pointNum = pointCnt;
-	data.frequency = settings.f_start + (settings.f_stop - settings.f_start) * pointCnt / (settings.points - 1);
+	data.frequency = frequencies.Get(pointCnt);
+	data.ports = Protocol::DatapointPorts::Both;
+	if(portBlocked) {
+		data.ports = excitingPort1 ? Protocol::DatapointPorts::Port1 : Protocol::DatapointPorts::Port2;
+	}
 	if(excitingPort1) {
 		data.real_S11 = port1.real();
 		data.imag_S11 = port1.imag();
@@ -223,7 +679,7 @@ bool VNA::MeasurementDone(const FPGA::SamplingResult &result) {
 	}
 	// figure out whether this sweep point is complete and which port gets excited next
 	bool pointComplete = false;
-	if(settings.excitePort1 == 1 && settings.excitePort2 == 1) {
+	if(settings.excitePort1 == 1 && settings.excitePort2 == 1 && !portBlocked) {
 		// point is complete when port 2 was active
 		pointComplete = !excitingPort1;
 		// next measurement will be from other port
@@ -235,10 +691,22 @@ bool VNA::MeasurementDone(const FPGA::SamplingResult &result) {
 	if(pointComplete) {
 		STM::DispatchToInterrupt(PassOnData);
 		pointCnt++;
-		if (pointCnt >= settings.points) {
-			// reached end of sweep, start again
-			pointCnt = 0;
-			IFTableIndexCnt = 0;
+		if (pointCnt >= segmentEnd) {
+			if(portBlocked) {
+				// the other port is measured next, the ports are switched in VNA::Work
+				excitingPort1 = !excitingPort1;
+				if(!excitingPort1) {
+					// measure the same points again with port 2 excited
+					pointCnt = segmentStart;
+					IFTableIndexCnt = segmentIFTableIndex;
+					return true;
+				}
+			}
+			if(segmentEnd >= settings.points) {
+				// reached end of sweep, start again
+				pointCnt = 0;
+				IFTableIndexCnt = 0;
+			}
 			// request to trigger work function
 			return true;
 		}
@@ -247,7 +715,35 @@ bool VNA::MeasurementDone(const FPGA::SamplingResult &result) {
 }
 
 void VNA::Work() {
+	if(portBlocked) {
+		// the same sweep configuration is used for both ports
+		FPGA::Enable(FPGA::Periphery::ExcitePort1, excitingPort1);
+		FPGA::Enable(FPGA::Periphery::ExcitePort2, !excitingPort1);
+		if(!excitingPort1) {
+			// only the first half of the sweep (or segment) is complete
+			FPGA::StartSweep();
+			return;
+		}
+	}
+	if(segmented) {
+		if(preparedPoints < NextSegmentLength()) {
+			// the App task has not prepared the next segment yet. The PLL calculation is too slow for the
+			// interrupt, VNA::PrepareSegment completes the segment and calls this function again
+			segmentWaiting = true;
+			return;
+		}
+		StartNextSegment();
+		if(segmentStart != 0) {
+			// continue with the next segment of the same sweep
+			FPGA::StartSweep();
+			return;
+		}
+	}
 	// end of sweep
+	if(!latencyReported) {
+		LOG_INFO("Setup to first point: %lums", firstPointLatency);
+		latencyReported = true;
+	}
 	HW::Ref::update();
 	// Compile info packet
 	Protocol::PacketInfo packet;
@@ -259,6 +755,14 @@ void VNA::Work() {
 	HW::fillDeviceInfo(&packet.info);
 	Communication::Send(packet);
 	FPGA::ResetADCLimits();
+	if(sweepsPerRun && ++sweepCnt >= sweepsPerRun) {
+		// requested number of sweeps done, wait for the next trigger
+		HoldSweep();
+		if(sweepCompleteCallback) {
+			sweepCompleteCallback();
+		}
+		return;
+	}
 	// Start next sweep
 	FPGA::StartSweep();
 }
@@ -267,7 +771,7 @@ void VNA::SweepHalted() {
 	if(!active) {
 		return;
 	}
-	LOG_DEBUG("Halted before point %d", pointCnt);
+	LOG_DEBUG("Halted before point %lu", pointCnt);
 	// Check if IF table has entry at this point
 	if (IFTable[IFTableIndexCnt].pointCnt == pointCnt) {
 		Si5351.WriteRawCLKConfig(SiChannel::Port1LO2, IFTable[IFTableIndexCnt].clkconfig);
@@ -278,35 +782,23 @@ void VNA::SweepHalted() {
 		// PLL reset causes the 2.LO to turn off briefly and then ramp on back, needs delay before next point
 		Delay::us(1300);
 	}
-	uint64_t frequency = settings.f_start
-			+ (settings.f_stop - settings.f_start) * pointCnt
-					/ (settings.points - 1);
 	bool adcShiftRequired = false;
-	if (frequency < BandSwitchFrequency) {
-		// need the Si5351 as Source
-		Si5351.SetCLK(SiChannel::LowbandSource, frequency, Si5351C::PLL::B,
-				sourceHighPower ? Si5351C::DriveStrength::mA8 : Si5351C::DriveStrength::mA4);
+	if (pointCnt < lowbandPoints) {
+		// need the Si5351 as Source. Only the divider configuration changes, no PLL reset and no delay required
+		if (pointCnt < LowbandTableNumEntries) {
+			Si5351.WriteRawCLKConfig(SiChannel::LowbandSource, LowbandTable[pointCnt].clkconfig);
+			adcShiftRequired = LowbandTable[pointCnt].adcShift;
+		} else {
+			uint64_t frequency = Protocol::SweepFrequency(settings, pointCnt, &segmentTable);
+			uint8_t clkconfig[8];
+			Si5351.CalculateRawCLKConfig(SiChannel::LowbandSource, frequency, Si5351C::PLL::B, clkconfig);
+			Si5351.WriteRawCLKConfig(SiChannel::LowbandSource, clkconfig);
+			adcShiftRequired = ADCShiftRequired(frequency);
+		}
 		if (pointCnt == 0) {
 			// First point in sweep, enable CLK
 			Si5351.Enable(SiChannel::LowbandSource);
 			FPGA::Disable(FPGA::Periphery::SourceRF);
-			Delay::us(1300);
-		}
-
-		// At low frequencies the 1.LO feedtrough mixes with the 2.LO in the second mixer.
-		// Depending on the stimulus frequency, the resulting mixing product might alias to the 2.IF
-		// in the ADC which causes a spike. Check for this and shift the ADC sampling frequency if necessary
-		uint32_t LO_mixing = (HW::IF1 + frequency) - (HW::IF1 - HW::IF2);
-		// move frequency into ADC range
-		LO_mixing %= HW::ADCSamplerate;
-		// fold at half the samplerate
-		if(LO_mixing >= HW::ADCSamplerate / 2) {
-			LO_mixing = HW::ADCSamplerate - LO_mixing;
-		}
-		if(abs(LO_mixing - HW::IF2) <= actualBandwidth * 2) {
-			// the image is in or near the IF bandwidth and would cause a peak
-			// Use a slightly different ADC samplerate
-			adcShiftRequired = true;
 		}
 	} else if(!FPGA::IsEnabled(FPGA::Periphery::SourceRF)){
 		// first sweep point in highband is also halted, disable lowband source
@@ -315,6 +807,7 @@ void VNA::SweepHalted() {
 	}
 
 	if(adcShiftRequired) {
+		// Use a slightly different ADC samplerate
 		FPGA::WriteRegister(FPGA::Reg::ADCPrescaler, alternativePrescaler);
 		FPGA::WriteRegister(FPGA::Reg::PhaseIncrement, alternativePhaseInc);
 		adcShifted = true;
@@ -325,10 +818,105 @@ void VNA::SweepHalted() {
 		adcShifted = false;
 	}
 
+	if(usb_transmit_space() < BackpressureMinSpace) {
+		// The host is not keeping up, hold the sweep until the fifo has been drained (see ResumeStalled)
+		stalled = true;
+		stallCnt++;
+		return;
+	}
 	FPGA::ResumeHaltedSweep();
 }
 
+bool VNA::ResumeStalled() {
+	if(!stalled) {
+		return false;
+	}
+	if(usb_transmit_space() < BackpressureMinSpace) {
+		// still waiting for the host
+		return true;
+	}
+	LOG_DEBUG("Resuming sweep at point %lu", pointCnt);
+	stalled = false;
+	FPGA::ResumeHaltedSweep();
+	return false;
+}
+
+void VNA::PrepareSegment() {
+	bool wasComplete = planComplete;
+	// a waiting sweep only continues once the segment is complete, no datapoints have to be sent in the meantime
+	for (uint16_t i = 0; i < SegmentRefillMaxPoints || segmentWaiting; i++) {
+		// VNA::Work only selects the next segment once all of its points are written. Until then, the next
+		// point does not change and can be calculated without blocking the interrupts
+		if (!active || !segmented || preparedPoints >= NextSegmentLength()) {
+			break;
+		}
+		if (!pointPending) {
+			CalculateNextPoint();
+		}
+		// only writing the point has to be protected from VNA::Work and the FPGA interrupts
+		taskENTER_CRITICAL();
+		bool waiting = segmentWaiting;
+		bool possible = true;
+		if (!waiting && portBlocked && excitingPort1) {
+			// the current segment is going to be measured again with port 2 excited
+			possible = false;
+		}
+		if (!waiting && pointCnt < segmentStart + preparedPoints + SegmentRefillDistance) {
+			// the FPGA has not left this point behind yet (or the sweep wrapped around and is about to continue
+			// with the first segment)
+			possible = false;
+		}
+		if (possible) {
+			WritePendingPoint(!waiting);
+		}
+		taskEXIT_CRITICAL();
+		if (!possible) {
+			break;
+		}
+	}
+	taskENTER_CRITICAL();
+	if (active && segmentWaiting && preparedPoints >= NextSegmentLength()) {
+		// segment complete, continue the sweep. Tried again with the next call if the dispatch fifo is full
+		if (STM::DispatchToInterrupt(HW::Work)) {
+			segmentWaiting = false;
+		}
+	}
+	taskEXIT_CRITICAL();
+	if (!wasComplete && planComplete) {
+		LOG_INFO("Estimated sweep time: %luus", sweepTime);
+	}
+}
+
+bool VNA::BackpressureRequired() {
+	if (!hostSlow || backpressureHalts) {
+		return false;
+	}
+	hostSlow = false;
+	// used by the next setup
+	backpressureHalts = true;
+	return true;
+}
+
+void VNA::ResetBackpressure() {
+	// takes effect with the next setup
+	backpressureHalts = false;
+	hostSlow = false;
+}
+
+uint32_t VNA::GetSweepTime() {
+	return active ? sweepTime : 0;
+}
+
+uint16_t VNA::GetStallCount() {
+	uint16_t ret = stallCnt;
+	stallCnt = 0;
+	return ret;
+}
+
 void VNA::Stop() {
 	active = false;
+	stalled = false;
+	segmentWaiting = false;
+	held = false;
 	FPGA::AbortSweep();
 }
@@ -7,11 +7,42 @@
 namespace VNA {
 
 using SweepCallback = void(*)(const Protocol::Datapoint&);
+// Called from interrupt context after the last point of the configured number of sweeps
+using SweepCompleteCallback = void(*)();
 
-bool Setup(Protocol::SweepSettings s, SweepCallback cb);
+bool Setup(Protocol::SweepSettings s, SweepCallback cb, SweepCompleteCallback complete = nullptr);
+// Starts the sweeps of a triggered sweep or restarts a sweep that is held after the configured number of
+// sweeps. Returns false if no sweep is configured or the sweep is still running
+bool Trigger();
+// True while points are measured, false if the sweep is held or waiting for a trigger
+bool Sweeping();
+// Device specific parameters required by the host to calculate sweep plans
+void GetPlanParameters(Protocol::SweepPlanParameters &p);
+// Stores points of a sweep plan calculated by the host. The points have to be loaded in order, loading point 0
+// stops the sweep and starts a new plan. The plan is used by the next Setup with uploadedPlan set
+bool LoadPlan(const Protocol::SweepPlanPoints &p);
+// Stores the segment table used by the next Setup with segmentTable set. Stops the sweep, returns false
+// if the segments overlap or exceed the device limits
+bool SetSegments(const Protocol::SweepSegments &segments);
 bool MeasurementDone(const FPGA::SamplingResult &result);
 void Work();
 void SweepHalted();
+// Continues a sweep that was held because the USB transmit fifo was running full, as soon as enough
+// space is available again. Returns true if the sweep is still held. Must be called from the App task
+bool ResumeStalled();
+// Number of times the sweep was held since the last call
+uint16_t GetStallCount();
+// Returns true (once) if the host did not keep up with a sweep that has no backpressure halts. The next Setup
+// adds the halts, the App task should set up the sweep again. Must be called from the App task
+bool BackpressureRequired();
+// Sweeps without backpressure halts again (e.g. for a new host), takes effect with the next Setup
+void ResetBackpressure();
+// Prepares the next segment of a sweep with more points than the FPGA can hold while the current segment is
+// measured. Must be called from the App task after points have been measured. If the FPGA reaches the end of a
+// segment before the next one is prepared, the sweep waits until this function has completed it
+void PrepareSegment();
+// Estimated duration of a single sweep in us (zero if no sweep is active)
+uint32_t GetSweepTime();
 void Stop();
 
 }
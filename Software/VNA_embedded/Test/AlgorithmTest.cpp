@@ -0,0 +1,145 @@
+// Rational approximation test: compares the continued fraction solver (Algorithm::BestRationalApproximation)
+// exhaustively with a brute force search and with the previous Stern-Brocot solver. The new solver has to find
+// the closest fraction and must never be worse than the Stern-Brocot solver. Also prints the time both solvers
+// need for the fractional dividers of the MAX2871
+//
+// AlgorithmTest
+
+#include "algorithm.hpp"
+#include "Reference/SternBrocot.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+
+using Algorithm::RationalApproximation;
+
+// Distance between p/q and the approximation, scaled by q*denom
+static uint64_t Deviation(uint32_t p, uint32_t q, const RationalApproximation &a) {
+	int64_t dev = (int64_t) p * a.denom - (int64_t) a.num * q;
+	return dev >= 0 ? dev : -dev;
+}
+
+// Compares the deviations of two approximations of p/q: negative if a is closer, positive if b is closer
+static int Compare(uint32_t p, uint32_t q, const RationalApproximation &a, const RationalApproximation &b) {
+	// scaled deviations are less than q, the products need up to 64 bits
+	unsigned __int128 dev_a = (unsigned __int128) Deviation(p, q, a) * b.denom;
+	unsigned __int128 dev_b = (unsigned __int128) Deviation(p, q, b) * a.denom;
+	return dev_a < dev_b ? -1 : dev_a > dev_b ? 1 : 0;
+}
+
+static bool Valid(const RationalApproximation &a, uint32_t max_denom) {
+	return a.denom >= 1 && a.denom <= max_denom && a.num <= a.denom;
+}
+
+// Closest fraction by trying every denominator
+static RationalApproximation BruteForce(uint32_t p, uint32_t q, uint32_t max_denom) {
+	RationalApproximation best = {0, 1};
+	for (uint32_t denom = 1; denom <= max_denom; denom++) {
+		RationalApproximation a;
+		a.denom = denom;
+		// rounded numerator
+		a.num = ((uint64_t) p * denom * 2 + q) / (2 * (uint64_t) q);
+		if (Compare(p, q, a, best) < 0) {
+			best = a;
+		}
+	}
+	return best;
+}
+
+// Every ratio p/q with q <= maxQ against the brute force search for several denominator limits
+static bool TestOptimal(uint32_t maxQ) {
+	const uint32_t limits[] = {1, 2, 3, 7, 16, 64, 255};
+	uint64_t cases = 0, failed = 0;
+	for (auto max_denom : limits) {
+		for (uint32_t q = 1; q <= maxQ; q++) {
+			for (uint32_t p = 0; p < q; p++) {
+				auto a = Algorithm::BestRationalApproximation(p, q, max_denom);
+				auto best = BruteForce(p, q, max_denom);
+				cases++;
+				if (!Valid(a, max_denom) || Compare(p, q, a, best) != 0) {
+					if (failed++ < 10) {
+						printf("    %u/%u (max denominator %u): got %u/%u, closest is %u/%u\n", p, q, max_denom, a.num,
+								a.denom, best.num, best.denom);
+					}
+				}
+			}
+		}
+	}
+	printf("%-24s %10llu ratios %s\n", "closest_fraction", (unsigned long long) cases, failed ? "FAILED" : "OK");
+	return !failed;
+}
+
+// Compares both solvers for the given ratios. Returns false if the new solver is worse for any of them
+template<typename F> static bool TestAgainstSternBrocot(const char *name, uint32_t max_denom, F forEachRatio) {
+	uint64_t cases = 0, better = 0, worse = 0;
+	forEachRatio([&](uint32_t p, uint32_t q) {
+		auto a = Algorithm::BestRationalApproximation(p, q, max_denom);
+		auto ref = Reference::SternBrocot((float) p / q, max_denom);
+		cases++;
+		int cmp = Valid(a, max_denom) ? Compare(p, q, a, ref) : 1;
+		if (cmp < 0) {
+			better++;
+		} else if (cmp > 0) {
+			if (worse++ < 10) {
+				printf("    %u/%u: got %u/%u, Stern-Brocot found %u/%u\n", p, q, a.num, a.denom, ref.num, ref.denom);
+			}
+		}
+	});
+	printf("%-24s %10llu ratios %10llu identical %10llu closer %10llu worse %s\n", name, (unsigned long long) cases,
+			(unsigned long long) (cases - better - worse), (unsigned long long) better, (unsigned long long) worse,
+			worse ? "FAILED" : "OK");
+	return !worse;
+}
+
+// Fractional part of the MAX2871 N divider: remainders in 1kHz steps for a 100MHz phase detector frequency
+template<typename F> static void ForEachMAX2871Ratio(F f) {
+	const uint32_t f_PFD = 100000000;
+	for (uint32_t rem = 0; rem < f_PFD; rem += 1000) {
+		f(rem, f_PFD);
+	}
+}
+
+// Time per call in ns for all MAX2871 ratios
+template<typename F> static double MeasureSolver(F solver) {
+	using namespace std::chrono;
+	uint32_t calls = 0, sum = 0;
+	auto start = steady_clock::now();
+	ForEachMAX2871Ratio([&](uint32_t p, uint32_t q) {
+		// use the result, otherwise the call might be optimized away
+		sum += solver(p, q).denom;
+		calls++;
+	});
+	auto ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+	return sum ? (double) ns / calls : 0;
+}
+
+int main() {
+	unsigned failed = 0;
+	failed += !TestOptimal(300);
+	failed += !TestAgainstSternBrocot("stern_brocot_4095", 4095, [](std::function<void(uint32_t, uint32_t)> f) {
+		for (uint32_t q = 1; q <= 1500; q++) {
+			for (uint32_t p = 0; p < q; p++) {
+				f(p, q);
+			}
+		}
+	});
+	failed += !TestAgainstSternBrocot("stern_brocot_max2871", 4095, [](std::function<void(uint32_t, uint32_t)> f) {
+		ForEachMAX2871Ratio(f);
+	});
+
+	auto t_new = MeasureSolver([](uint32_t p, uint32_t q) {
+		return Algorithm::BestRationalApproximation(p, q, 4095);
+	});
+	auto t_ref = MeasureSolver([](uint32_t p, uint32_t q) {
+		return Reference::SternBrocot((float) p / q, 4095);
+	});
+	printf("MAX2871 dividers: continued fractions %.1fns, Stern-Brocot %.1fns per calculation\n", t_new, t_ref);
+
+	if (failed) {
+		printf("%u tests failed\n", failed);
+		return 1;
+	}
+	printf("All tests passed\n");
+	return 0;
+}
@@ -0,0 +1,85 @@
+// CRC benchmark: compares the table driven Protocol::CRC32 with a bitwise reference implementation. Checks that
+// both calculate the same CRC (also when a replacement CRC function is not available and the software
+// implementation takes over) and prints the throughput of both on the build machine
+//
+// CRCBenchmark [repetitions]
+
+#include "Protocol.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Bit by bit calculation, the CRC of the protocol before the lookup tables were added
+static uint32_t BitwiseCRC32(uint32_t crc, const void *data, uint32_t len) {
+	auto u8buf = (const uint8_t*) data;
+	crc = ~crc;
+	while (len--) {
+		crc ^= *u8buf++;
+		for (uint8_t k = 0; k < 8; k++) {
+			crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+		}
+	}
+	return ~crc;
+}
+
+// Replacement that is never available, e.g. a CRC unit that is always in use
+static bool UnavailableCRC32(uint32_t&, const void*, uint32_t) {
+	return false;
+}
+
+// Throughput in MB/s for CRCs over the given length
+template<typename F> static double Measure(F crc, const std::vector<uint8_t> &data, uint32_t len,
+		unsigned repetitions) {
+	using namespace std::chrono;
+	uint32_t result = 0;
+	uint64_t bytes = 0;
+	auto start = steady_clock::now();
+	for (unsigned i = 0; i < repetitions; i++) {
+		for (uint32_t offset = 0; offset + len <= data.size(); offset += len) {
+			result ^= crc(result, &data[offset], len);
+			bytes += len;
+		}
+	}
+	auto ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+	// use the result, otherwise the calculation might be optimized away
+	return result == 0x12345678 ? 0 : bytes * 1000.0 / ns;
+}
+
+int main(int argc, char *argv[]) {
+	unsigned repetitions = argc > 1 ? atoi(argv[1]) : 20;
+	std::vector<uint8_t> data(65536);
+	srand(1);
+	for (auto &d : data) {
+		d = rand();
+	}
+
+	// every length and alignment up to 64 bytes, both with and without an unavailable replacement
+	unsigned failed = 0;
+	for (uint32_t offset = 0; offset < 8; offset++) {
+		for (uint32_t len = 0; len <= 64; len++) {
+			uint32_t expected = BitwiseCRC32(0x5A5A5A5A, &data[offset], len);
+			Protocol::SetCRCFunction(nullptr);
+			failed += Protocol::CRC32(0x5A5A5A5A, &data[offset], len) != expected;
+			Protocol::SetCRCFunction(UnavailableCRC32);
+			failed += Protocol::CRC32(0x5A5A5A5A, &data[offset], len) != expected;
+		}
+	}
+	Protocol::SetCRCFunction(nullptr);
+	// "123456789" is the standard check value of CRC-32
+	failed += Protocol::CRC32(0, "123456789", 9) != 0xCBF43926;
+	if (failed) {
+		printf("%u CRC calculations differ from the bitwise reference\n", failed);
+		return 1;
+	}
+
+	printf("%-10s %16s %16s\n", "length", "bitwise [MB/s]", "table [MB/s]");
+	// a single datapoint, a full batch packet and the largest USB transfer
+	for (uint32_t len : {48u, 512u, 1024u, 65536u}) {
+		auto bitwise = Measure(BitwiseCRC32, data, len, repetitions);
+		auto table = Measure(Protocol::CRC32, data, len, repetitions);
+		printf("%-10u %16.1f %16.1f\n", len, bitwise, table);
+	}
+	return 0;
+}
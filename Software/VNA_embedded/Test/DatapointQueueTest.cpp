@@ -0,0 +1,98 @@
+// Datapoint queue test: the VNA interrupt pushes the measured points into the queue of the App task (same size as
+// in App.cpp) while a consumer takes points at different rates. Checks that the points arrive in order, that
+// every lost point is counted by the overflow counter and that nothing is lost if the consumer keeps up
+//
+// DatapointQueueTest [--verbose]
+
+#include "Sweep.hpp"
+#include "DatapointQueue.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+static DatapointQueue<32> *queue;
+static uint32_t produced;
+
+static void PointCallback(const Protocol::Datapoint &d) {
+	produced++;
+	queue->Push(d);
+}
+
+// Measures a sweep while the consumer takes one point after every interval FPGA interrupts (none during the sweep
+// if zero). Returns false if the points received by the consumer and the counted overflows do not match the sweep
+static bool SlowConsumer(const char *name, uint32_t points, uint32_t interval, bool expectOverflows) {
+	DatapointQueue<32> q;
+	queue = &q;
+	produced = 0;
+	VNA::Setup(Sweep::Settings(1000000, 6000000000, points), PointCallback);
+	uint32_t received = 0, lost = 0, interrupts = 0, nextPoint = 0;
+	bool inOrder = true;
+	auto consume = [&](uint32_t maxPoints) {
+		Protocol::Datapoint d;
+		while (maxPoints-- && q.Pop(d)) {
+			if (d.pointNum < nextPoint) {
+				inOrder = false;
+			}
+			// points missing in the sequence have been dropped by the queue
+			lost += d.pointNum - nextPoint;
+			nextPoint = d.pointNum + 1;
+			received++;
+		}
+	};
+	while (produced < points && interrupts < 100000) {
+		if (!Mock::FPGAStep()) {
+			VNA::ResumeStalled();
+			if (!Mock::FPGAStep()) {
+				break;
+			}
+		}
+		interrupts++;
+		Mock::RunDispatched();
+		VNA::PrepareSegment();
+		Mock::RunDispatched();
+		if (interval && interrupts % interval == 0) {
+			consume(1);
+		}
+	}
+	// the sweep is done, empty the queue
+	consume(UINT32_MAX);
+	lost += points - nextPoint;
+
+	bool ok = produced == points && inOrder && received + q.Overflows() == points && lost == q.Overflows()
+			&& (q.Overflows() > 0) == expectOverflows;
+	printf("%-24s %6lu points %6lu received %6lu overflows %s\n", name, (unsigned long) points,
+			(unsigned long) received, (unsigned long) q.Overflows(), ok ? "OK" : "FAILED");
+	if (!inOrder) {
+		printf("    points received out of order\n");
+	}
+	if (lost != q.Overflows()) {
+		printf("    %lu points missing, overflow counter is %lu\n", (unsigned long) lost,
+				(unsigned long) q.Overflows());
+	}
+	return ok;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1 && !strcmp(argv[1], "--verbose")) {
+		Mock::SetVerbose(true);
+	}
+	if (!Sweep::Init()) {
+		fprintf(stderr, "Hardware initialization failed\n");
+		return 1;
+	}
+	unsigned failed = 0;
+	// a point needs one interrupt per excited port, taking one point every two interrupts just keeps up
+	failed += !SlowConsumer("consumer_keeps_up", 1001, 2, false);
+	// one point taken for every two measured, the queue indices wrap around many times
+	failed += !SlowConsumer("consumer_half_speed", 1001, 4, true);
+	// nothing taken during the sweep: the queue holds the first 32 points, all others are lost
+	failed += !SlowConsumer("consumer_stalled", 101, 0, true);
+	// the complete sweep fits into the queue
+	failed += !SlowConsumer("consumer_stalled_short", 32, 0, false);
+	if (failed) {
+		printf("%u tests failed\n", failed);
+		return 1;
+	}
+	printf("All tests passed\n");
+	return 0;
+}
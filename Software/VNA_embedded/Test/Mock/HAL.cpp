@@ -0,0 +1,314 @@
+#include "Mock.hpp"
+#include "stm32g4xx_hal.h"
+#include "main.h"
+#include "FPGA/FPGA.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+
+GPIO_TypeDef MockGPIOA, MockGPIOB, MockGPIOF;
+SPI_TypeDef MockSPI1, MockSPI2;
+SCB_Type MockSCB;
+const uint16_t MockTempsensorCal1 = 1000, MockTempsensorCal2 = 1400;
+
+SPI_HandleTypeDef hspi1 = {.Instance = SPI1};
+SPI_HandleTypeDef hspi2 = {.Instance = SPI2};
+I2C_HandleTypeDef hi2c2;
+ADC_HandleTypeDef hadc1;
+
+extern "C" void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi);
+
+static Mock::Trace trace;
+// register contents of the I2C devices (only the Si5351C is connected)
+static uint8_t i2cRegisters[128][256];
+static uint16_t fpgaStatus;
+// Sweep state of the FPGA, only what is required to generate the interrupts of a sweep
+static struct {
+	uint16_t points;
+	uint16_t systemControl;
+	bool halt[8192];
+	bool running;
+	// next point and number of its measurements already done (one per excited port)
+	uint16_t point;
+	uint8_t measurements;
+	// halt of the current point signaled, waiting for FPGA::ResumeHaltedSweep
+	bool haltSignaled;
+	bool halted;
+} fpga;
+// N divider of the last register 0 written to a MAX2871, determines the VCO reported by the readback
+static uint16_t max2871N;
+
+// FNV-1a, processes the type of the access followed by its data
+static void Record(char type, uint32_t target, const uint8_t *data, uint16_t len) {
+	auto add = [](uint8_t byte) {
+		trace.hash ^= byte;
+		trace.hash *= 0x100000001B3ULL;
+	};
+	add(type);
+	for (uint8_t i = 0; i < 4; i++) {
+		add(target >> (8 * i));
+	}
+	for (uint16_t i = 0; i < len; i++) {
+		add(data[i]);
+	}
+}
+
+static uint8_t PortIndex(const GPIO_TypeDef *gpio) {
+	if (gpio == GPIOA) {
+		return 0;
+	} else if (gpio == GPIOB) {
+		return 1;
+	} else {
+		return 5;
+	}
+}
+
+static uint8_t SPIIndex(const SPI_HandleTypeDef *hspi) {
+	return hspi == &hspi1 ? 1 : 2;
+}
+
+// The FPGA SPI runs at 32MHz, the MAX2871 are accessed at 16MHz (see FPGA::SetMode)
+static bool PLLSelected(const SPI_HandleTypeDef *hspi) {
+	return hspi == &hspi1 && (hspi->Instance->CR1 & SPI_CR1_BR_Msk) == SPI_BAUDRATEPRESCALER_8;
+}
+
+static void RecordSPI(char type, SPI_HandleTypeDef *hspi, const uint8_t *data, uint16_t size) {
+	Record(type, SPIIndex(hspi), data, size);
+	trace.spiTransfers++;
+	trace.spiBytes += size;
+}
+
+void Mock::BSRRRegister::operator=(uint32_t value) {
+	// the register is a member of the GPIO_TypeDef, find out which one
+	auto gpio = &MockGPIOA;
+	if (this == &MockGPIOB.BSRR) {
+		gpio = &MockGPIOB;
+	} else if (this == &MockGPIOF.BSRR) {
+		gpio = &MockGPIOF;
+	}
+	gpio->ODR = (gpio->ODR | (value & 0xFFFF)) & ~(value >> 16);
+	if (gpio == FPGA_AUX3_GPIO_Port && (value & FPGA_AUX3_Pin)) {
+		// rising edge of AUX3 starts the sweep (see FPGA::StartSweep)
+		fpga.running = true;
+		fpga.point = 0;
+		fpga.measurements = 0;
+		fpga.haltSignaled = false;
+		fpga.halted = false;
+	} else if (gpio == FPGA_AUX3_GPIO_Port && (value & (FPGA_AUX3_Pin << 16))) {
+		fpga.running = false;
+	}
+	Record('G', PortIndex(gpio), (const uint8_t*) &value, sizeof(value));
+	trace.gpioWrites++;
+}
+
+void Mock::ResetHAL() {
+	for (auto gpio : {&MockGPIOA, &MockGPIOB, &MockGPIOF}) {
+		gpio->ODR = 0;
+		// inputs are high: FPGA configured, MAX2871 locked
+		gpio->IDR = 0xFFFF;
+	}
+	MockSPI1.CR1 = MockSPI2.CR1 = 0;
+	memset(i2cRegisters, 0, sizeof(i2cRegisters));
+	fpgaStatus = 0;
+	memset(&fpga, 0, sizeof(fpga));
+	max2871N = 0;
+	ClearTrace();
+}
+
+void Mock::ClearTrace() {
+	trace = {};
+	trace.hash = 0xCBF29CE484222325ULL;
+}
+
+Mock::Trace Mock::GetTrace() {
+	return trace;
+}
+
+std::string Mock::ToString(const Trace &t) {
+	char buf[100];
+	snprintf(buf, sizeof(buf), "%016llx %u %u %u %u", (unsigned long long) t.hash, t.spiTransfers, t.spiBytes,
+			t.i2cWrites, t.gpioWrites);
+	return buf;
+}
+
+void Mock::SetFPGAStatus(uint16_t status) {
+	fpgaStatus = status;
+}
+
+bool Mock::FPGAStep() {
+	if (!fpga.running || fpga.halted) {
+		return false;
+	}
+	if (fpga.halt[fpga.point] && !fpga.haltSignaled) {
+		// the halt is signaled before the point is measured
+		fpga.haltSignaled = true;
+		fpga.halted = true;
+		SetFPGAStatus((uint16_t) FPGA::Interrupt::SweepHalted);
+		FPGAInterrupt();
+		return true;
+	}
+	uint8_t ports = 0;
+	if (fpga.systemControl & (uint16_t) FPGA::Periphery::ExcitePort1) {
+		ports++;
+	}
+	if (fpga.systemControl & (uint16_t) FPGA::Periphery::ExcitePort2) {
+		ports++;
+	}
+	// the point is complete before the interrupt, the firmware may already restart the sweep in it
+	if (++fpga.measurements >= ports) {
+		fpga.measurements = 0;
+		fpga.haltSignaled = false;
+		if (++fpga.point >= fpga.points) {
+			fpga.running = false;
+		}
+	}
+	SetFPGAStatus((uint16_t) FPGA::Interrupt::NewData);
+	FPGAInterrupt();
+	return true;
+}
+
+bool Mock::FPGAHalted() {
+	return fpga.running && fpga.halted;
+}
+
+// Updates the FPGA state from the commands sent to it (see FPGA.cpp)
+static void FPGACommand(const uint8_t *data, uint16_t size) {
+	if (size == 4 && data[0] == 0x80) {
+		uint16_t value = (uint16_t) data[2] << 8 | data[3];
+		switch ((FPGA::Reg) data[1]) {
+		case FPGA::Reg::SweepPoints:
+			fpga.points = value + 1;
+			break;
+		case FPGA::Reg::SystemControl:
+			fpga.systemControl = value;
+			break;
+		default:
+			break;
+		}
+	} else if (size == 14) {
+		// sweep configuration of a single point
+		uint16_t point = ((uint16_t) data[0] << 8 | data[1]) & 0x1FFF;
+		fpga.halt[point] = data[2] & 0x80;
+	} else if (size == 2 && data[0] == 0x20) {
+		fpga.halted = false;
+	}
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init) {
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+	RecordSPI('T', hspi, pData, Size);
+	if (hspi == &hspi1 && !PLLSelected(hspi)) {
+		FPGACommand(pData, Size);
+	} else if (PLLSelected(hspi) && Size == 4) {
+		uint32_t reg = (uint32_t) pData[0] << 24 | (uint32_t) pData[1] << 16 | (uint32_t) pData[2] << 8 | pData[3];
+		if ((reg & 0x07) == 0) {
+			max2871N = (reg & 0x7FFF8000) >> 15;
+		}
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+	// ADC limits and flash contents are all zero
+	memset(pData, 0, Size);
+	RecordSPI('R', hspi, pData, Size);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size,
+		uint32_t Timeout) {
+	RecordSPI('X', hspi, pTxData, Size);
+	memset(pRxData, 0, Size);
+	if (PLLSelected(hspi)) {
+		if (Size == 4) {
+			// MAX2871 register 6 readback: the VCO bands are spread evenly over 3-6GHz (100MHz PFD)
+			int vco = ((int) max2871N - 30) * 64 / 30;
+			if (vco < 0) {
+				vco = 0;
+			} else if (vco > 63) {
+				vco = 63;
+			}
+			// the firmware shifts the result by two bits and takes the VCO from bits 3 to 8
+			uint32_t readback = (uint32_t) vco << 1;
+			pRxData[2] = readback >> 8;
+			pRxData[3] = readback & 0xFF;
+		}
+	} else if (hspi == &hspi1 && pTxData[0] == 0x40) {
+		// FPGA status and identification
+		pRxData[0] = fpgaStatus >> 8;
+		pRxData[1] = fpgaStatus & 0xFF;
+		if (Size >= 4) {
+			pRxData[2] = 0xF0;
+			pRxData[3] = 0xA5;
+		}
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size) {
+	// the transfer completes immediately
+	RecordSPI('D', hspi, pData, Size);
+	FPGACommand(pData, Size);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size) {
+	RecordSPI('Y', hspi, pTxData, Size);
+	memset(pRxData, 0, Size);
+	pRxData[0] = fpgaStatus >> 8;
+	pRxData[1] = fpgaStatus & 0xFF;
+	// all six sample values (48 bit each) are 1000
+	for (uint8_t offset = 2; offset + 6 <= Size; offset += 6) {
+		pRxData[offset] = 1000 >> 8;
+		pRxData[offset + 1] = 1000 & 0xFF;
+	}
+	HAL_SPI_TxRxCpltCallback(hspi);
+	return HAL_OK;
+}
+
+HAL_SPI_StateTypeDef HAL_SPI_GetState(SPI_HandleTypeDef *hspi) {
+	return HAL_SPI_STATE_READY;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+		uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+	uint16_t target = DevAddress << 8 | MemAddress;
+	Record('I', target, pData, Size);
+	trace.i2cWrites++;
+	for (uint16_t i = 0; i < Size && MemAddress + i < 256; i++) {
+		i2cRegisters[(DevAddress >> 1) & 0x7F][MemAddress + i] = pData[i];
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+		uint16_t MemAddSize, uint8_t *pData, uint16_t Size, uint32_t Timeout) {
+	for (uint16_t i = 0; i < Size; i++) {
+		// status registers read as zero: no loss of lock, no missing clock input
+		pData[i] = MemAddress + i < 256 ? i2cRegisters[(DevAddress >> 1) & 0x7F][MemAddress + i] : 0;
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_Start(ADC_HandleTypeDef *hadc) {
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_ADC_PollForConversion(ADC_HandleTypeDef *hadc, uint32_t Timeout) {
+	return HAL_OK;
+}
+
+uint32_t HAL_ADC_GetValue(ADC_HandleTypeDef *hadc) {
+	return 1100;
+}
+
+uint32_t HAL_GetTick(void) {
+	static auto start = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void HAL_Delay(uint32_t Delay) {
+}
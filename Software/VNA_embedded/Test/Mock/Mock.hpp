@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "Protocol.hpp"
+
+// Mocked hardware of the host build. Every access to the hardware (SPI transfers, I2C register writes and GPIO
+// outputs) is recorded in a trace. The trace is kept as a hash and a few counters, this allows comparing the
+// register writes of whole sweeps without storing them
+namespace Mock {
+
+struct Trace {
+	uint64_t hash;
+	uint32_t spiTransfers;
+	uint32_t spiBytes;
+	uint32_t i2cWrites;
+	uint32_t gpioWrites;
+};
+
+// Resets the hardware state (register contents of the mocked chips, pending interrupts) and the trace
+void Reset();
+void ResetHAL();
+// Starts a new trace without changing the hardware state
+void ClearTrace();
+Trace GetTrace();
+std::string ToString(const Trace &t);
+
+// Status word returned by the FPGA with the next sample read (see FPGA::InitiateSampleRead)
+void SetFPGAStatus(uint16_t status);
+// Simulates the FPGA interrupt: starts the sample read, the DMA transfer completes immediately
+void FPGAInterrupt();
+// Lets the FPGA continue the sweep until the next interrupt (a measurement or a halt) and raises it. Returns
+// false if no sweep is running or the sweep is halted (see FPGAHalted)
+bool FPGAStep();
+// The sweep is halted and waits for FPGA::ResumeHaltedSweep
+bool FPGAHalted();
+// Runs the functions dispatched with STM::DispatchToInterrupt
+void RunDispatched();
+// Free space reported by usb_transmit_space
+void SetUSBSpace(uint16_t space);
+// Number of packets sent with Communication::Send/SendWithoutPayload since the last reset
+uint32_t SentPackets(Protocol::PacketType type);
+// Enables the output of the firmware log
+void SetVerbose(bool verbose);
+
+}
@@ -0,0 +1,121 @@
+#include "Mock.hpp"
+#include "stm.hpp"
+#include "Exti.hpp"
+#include "delay.hpp"
+#include "Communication.h"
+#include "USB/usb.h"
+#include "Log.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "main.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Replacements of the firmware modules that only interact with the MCU (interrupts, USB, log output)
+
+static std::vector<void(*)(void)> dispatched;
+static Exti::Callback fpgaInterrupt;
+static void *fpgaInterruptPtr;
+static uint16_t usbSpace = 4092;
+static uint32_t sentPackets[256];
+static bool verbose = false;
+
+void Mock::Reset() {
+	ResetHAL();
+	dispatched.clear();
+	usbSpace = 4092;
+	memset(sentPackets, 0, sizeof(sentPackets));
+}
+
+void Mock::FPGAInterrupt() {
+	if (fpgaInterrupt) {
+		fpgaInterrupt(fpgaInterruptPtr);
+	}
+}
+
+void Mock::RunDispatched() {
+	// dispatched functions may dispatch further functions
+	while (!dispatched.empty()) {
+		auto cb = dispatched.front();
+		dispatched.erase(dispatched.begin());
+		cb();
+	}
+}
+
+void Mock::SetUSBSpace(uint16_t space) {
+	usbSpace = space;
+}
+
+uint32_t Mock::SentPackets(Protocol::PacketType type) {
+	return sentPackets[(uint8_t) type];
+}
+
+void Mock::SetVerbose(bool v) {
+	verbose = v;
+}
+
+bool STM::DispatchToInterrupt(void (*cb)(void)) {
+	// same capacity as the callback fifo of the firmware
+	if (dispatched.size() >= 9) {
+		return false;
+	}
+	dispatched.push_back(cb);
+	return true;
+}
+
+bool Exti::SetCallback(GPIO_TypeDef *gpio, uint16_t pin, EdgeType edge, Pull pull, Callback cb, void *ptr) {
+	if (gpio == FPGA_INTR_GPIO_Port && pin == FPGA_INTR_Pin) {
+		fpgaInterrupt = cb;
+		fpgaInterruptPtr = ptr;
+	}
+	return true;
+}
+
+bool Exti::ClearCallback(GPIO_TypeDef *gpio, uint16_t pin) {
+	if (gpio == FPGA_INTR_GPIO_Port && pin == FPGA_INTR_Pin) {
+		fpgaInterrupt = nullptr;
+	}
+	return true;
+}
+
+void Delay::ms(uint32_t t) {
+}
+
+void Delay::us(uint32_t t) {
+}
+
+void vTaskDelay(TickType_t ticks) {
+}
+
+bool Communication::Send(const Protocol::PacketInfo &packet) {
+	sentPackets[(uint8_t) packet.type]++;
+	return true;
+}
+
+bool Communication::SendWithoutPayload(Protocol::PacketType type, uint8_t sequence) {
+	sentPackets[(uint8_t) type]++;
+	return true;
+}
+
+uint16_t usb_transmit_space() {
+	return usbSpace;
+}
+
+uint16_t usb_transmit_highwater() {
+	return 4092 - usbSpace;
+}
+
+void _log_write(const char *module, const char *level, const char *fmt, ...) {
+	if (!verbose) {
+		return;
+	}
+	va_list args;
+	va_start(args, fmt);
+	printf("[%s,%s]: ", module, level);
+	vprintf(fmt, args);
+	printf("\n");
+	va_end(args);
+}
@@ -0,0 +1,342 @@
+// Protocol test: encodes packets like the device and the host do and decodes them again. Checks the datapoint
+// batches in every format, the length dependent decoding of the extended packets (older firmware/host versions
+// send shorter payloads) and that malformed payloads are rejected instead of being decoded from beyond the frame
+//
+// ProtocolTest
+
+#include "Protocol.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace Protocol;
+
+// first byte of every frame (see Protocol.cpp)
+static constexpr uint8_t frameHeader = 0x5A;
+
+// Payload of an encoded packet (without sequence number)
+static std::vector<uint8_t> Payload(const PacketInfo &p) {
+	uint8_t buf[1024];
+	uint16_t size = EncodePacket(p, buf, sizeof(buf));
+	if (size < 8) {
+		return {};
+	}
+	return std::vector<uint8_t>(&buf[4], &buf[size - 4]);
+}
+
+// Frames the payload like EncodePacket does (including the CRC) and decodes the frame.
+// The buffer has to stay valid as long as a decoded batch is used
+static PacketInfo Decode(PacketType type, const std::vector<uint8_t> &payload, std::vector<uint8_t> &buf) {
+	uint16_t length = payload.size() + 8;
+	buf.resize(length);
+	buf[0] = frameHeader;
+	memcpy(&buf[1], &length, 2);
+	buf[3] = (uint8_t) type;
+	memcpy(&buf[4], payload.data(), payload.size());
+	uint32_t crc = CRC32(0, buf.data(), length - 4);
+	memcpy(&buf[length - 4], &crc, 4);
+	PacketInfo info;
+	info.type = PacketType::None;
+	DecodeBuffer(buf.data(), length, &info);
+	return info;
+}
+
+static const char *FormatName(DatapointFormat format) {
+	switch (format) {
+	case DatapointFormat::Full: return "full";
+	case DatapointFormat::ImplicitFrequency: return "implicit";
+	case DatapointFormat::Compact16: return "compact16";
+	default: return "unknown";
+	}
+}
+
+static const char *PortsName(DatapointPorts ports) {
+	switch (ports) {
+	case DatapointPorts::Both: return "both";
+	case DatapointPorts::Port1: return "port1";
+	case DatapointPorts::Port2: return "port2";
+	default: return "unknown";
+	}
+}
+
+// Compares a transmitted S-parameter. Compact16 shares the exponent between real and imaginary part, the
+// error depends on the larger of both values. Parameters of the port that was not excited are not transferred
+static bool SameParameter(float sent_real, float sent_imag, float real, float imag, DatapointFormat format,
+		bool transferred) {
+	if (!transferred) {
+		return real == 0 && imag == 0;
+	}
+	if (format != DatapointFormat::Compact16) {
+		return real == sent_real && imag == sent_imag;
+	}
+	float max = fabsf(sent_real) > fabsf(sent_imag) ? fabsf(sent_real) : fabsf(sent_imag);
+	float tolerance = ldexpf(max, -14);
+	return fabsf(real - sent_real) <= tolerance && fabsf(imag - sent_imag) <= tolerance;
+}
+
+// Encodes a batch and compares the decoded points with the original ones
+static bool BatchRoundTrip(DatapointFormat format, DatapointPorts ports, uint32_t firstPointNum, uint8_t count) {
+	// the point numbers of long batches require more than 16 bits
+	auto settings = SweepSettings();
+	settings.f_start = 1000000;
+	settings.f_stop = 6000000000;
+	settings.points = 100000;
+	Datapoint points[MaxBatchPoints];
+	for (uint8_t i = 0; i < count; i++) {
+		auto &d = points[i];
+		// values over several orders of magnitude, the compact format scales each value pair individually
+		float scale = powf(10.0f, -(float) (i % 5));
+		d.real_S11 = 0.9f * scale;
+		d.imag_S11 = -0.3f * scale;
+		d.real_S21 = 0.001f * (i + 1);
+		d.imag_S21 = 0.0005f;
+		d.real_S12 = -0.002f * (i + 1);
+		d.imag_S12 = 0;
+		d.real_S22 = 0.25f;
+		d.imag_S22 = -0.75f * scale;
+		d.pointNum = firstPointNum + i;
+		d.frequency = SweepFrequency(settings, d.pointNum);
+		d.ports = ports;
+	}
+	PacketInfo p;
+	p.type = PacketType::DatapointBatch;
+	p.batch.firstPointNum = firstPointNum;
+	p.batch.count = count;
+	p.batch.format = format;
+	p.batch.ports = ports;
+	p.batch.points = points;
+	auto payload = Payload(p);
+	bool longHeader = firstPointNum > 0xFFFF;
+	// the header only grows for point numbers that do not fit into 16 bits
+	bool ok = payload.size() > 4 && ((payload[3] & 0x20) != 0) == longHeader;
+	std::vector<uint8_t> buf;
+	auto info = Decode(PacketType::DatapointBatch, payload, buf);
+	ok &= info.type == PacketType::DatapointBatch && info.batch.firstPointNum == firstPointNum
+			&& info.batch.count == count && info.batch.format == format && info.batch.ports == ports;
+	bool S11S21 = ports != DatapointPorts::Port2;
+	bool S12S22 = ports != DatapointPorts::Port1;
+	for (uint8_t i = 0; ok && i < count; i++) {
+		auto &sent = points[i];
+		auto d = GetBatchDatapoint(info.batch, i, &settings);
+		ok &= d.pointNum == sent.pointNum && d.frequency == sent.frequency && d.ports == ports
+				&& SameParameter(sent.real_S11, sent.imag_S11, d.real_S11, d.imag_S11, format, S11S21)
+				&& SameParameter(sent.real_S21, sent.imag_S21, d.real_S21, d.imag_S21, format, S11S21)
+				&& SameParameter(sent.real_S12, sent.imag_S12, d.real_S12, d.imag_S12, format, S12S22)
+				&& SameParameter(sent.real_S22, sent.imag_S22, d.real_S22, d.imag_S22, format, S12S22);
+	}
+	char name[64];
+	snprintf(name, sizeof(name), "batch_%s_%s%s", FormatName(format), PortsName(ports), longHeader ? "_long" : "");
+	printf("%-28s %2u points %4zu bytes %s\n", name, count, payload.size(), ok ? "OK" : "FAILED");
+	return ok;
+}
+
+// Checks that a modified payload is decoded (expected) or dropped
+static bool Check(const char *name, PacketType type, const std::vector<uint8_t> &payload, bool expected) {
+	std::vector<uint8_t> buf;
+	auto info = Decode(type, payload, buf);
+	bool decoded = info.type == type;
+	bool ok = decoded == expected;
+	printf("%-28s %4zu bytes %-8s %s\n", name, payload.size(), decoded ? "decoded" : "dropped", ok ? "OK" : "FAILED");
+	return ok;
+}
+
+static unsigned MalformedBatches() {
+	Datapoint points[4] = {};
+	PacketInfo p;
+	p.type = PacketType::DatapointBatch;
+	p.batch.firstPointNum = 1000;
+	p.batch.count = 4;
+	p.batch.format = DatapointFormat::Full;
+	p.batch.ports = DatapointPorts::Both;
+	p.batch.points = points;
+	auto valid = Payload(p);
+	unsigned failed = 0;
+	failed += !Check("batch_valid", PacketType::DatapointBatch, valid, true);
+	auto payload = valid;
+	payload.pop_back();
+	failed += !Check("batch_truncated", PacketType::DatapointBatch, payload, false);
+	payload = valid;
+	payload.push_back(0);
+	failed += !Check("batch_trailing_byte", PacketType::DatapointBatch, payload, false);
+	payload = valid;
+	payload.resize(2);
+	failed += !Check("batch_short_header", PacketType::DatapointBatch, payload, false);
+	// a complete header but no points at all is a valid (empty) batch
+	payload = valid;
+	payload.resize(4);
+	payload[2] = 0;
+	failed += !Check("batch_empty", PacketType::DatapointBatch, payload, true);
+	// the flag announces the upper bits of the point number but they are missing
+	payload[3] |= 0x20;
+	failed += !Check("batch_long_missing", PacketType::DatapointBatch, payload, false);
+	// the length matches the number of points but there are more than a batch may contain
+	payload = valid;
+	payload[2] = MaxBatchPoints + 1;
+	payload.resize(4 + (MaxBatchPoints + 1) * (valid.size() - 4) / 4);
+	failed += !Check("batch_too_many_points", PacketType::DatapointBatch, payload, false);
+	payload = valid;
+	payload[3] = 3;
+	failed += !Check("batch_unknown_format", PacketType::DatapointBatch, payload, false);
+	payload = valid;
+	payload[3] = 3 << 6;
+	failed += !Check("batch_unknown_ports", PacketType::DatapointBatch, payload, false);
+	// a damaged batch is dropped by the CRC check
+	std::vector<uint8_t> buf;
+	Decode(PacketType::DatapointBatch, valid, buf);
+	buf[10] ^= 0x01;
+	PacketInfo info;
+	info.type = PacketType::None;
+	DecodeBuffer(buf.data(), buf.size(), &info);
+	bool ok = info.type == PacketType::None;
+	printf("%-28s %4zu bytes %-8s %s\n", "batch_crc_error", valid.size(), ok ? "dropped" : "decoded", ok ? "OK" : "FAILED");
+	failed += !ok;
+	return failed;
+}
+
+// SweepSettings sent by older hosts end after one of the extensions, the missing values have to be defaults
+static unsigned SweepSettingsLengths() {
+	PacketInfo p;
+	p.type = PacketType::SweepSettings;
+	p.settings = SweepSettings();
+	p.settings.f_start = 1000000;
+	p.settings.f_stop = 6000000000;
+	p.settings.points = 0x12345;
+	p.settings.if_bandwidth = 1000;
+	p.settings.cdbm_excitation = -1000;
+	p.settings.excitePort1 = 1;
+	p.settings.excitePort2 = 1;
+	p.settings.dataFormat = (uint8_t) DatapointFormat::Compact16;
+	p.settings.segmentTable = 1;
+	p.settings.logSweep = 1;
+	p.settings.triggered = 1;
+	p.settings.extendedSettling = 1;
+	p.settings.sweeps = 3;
+	p.settings.averages = 10;
+	auto full = Payload(p);
+	// base settings, upper bits of the points, sweep mode bits, sweeps, averages
+	const uint16_t lengths[] = {25, 27, 28, 30, 32};
+	unsigned failed = 0;
+	if (full.size() != 32) {
+		printf("%-28s %4zu bytes, expected 32 FAILED\n", "settings_size", full.size());
+		failed++;
+	}
+	for (auto len : lengths) {
+		std::vector<uint8_t> payload(full.begin(), full.begin() + len);
+		std::vector<uint8_t> buf;
+		auto info = Decode(PacketType::SweepSettings, payload, buf);
+		auto &s = info.settings;
+		bool ok = info.type == PacketType::SweepSettings && s.f_start == p.settings.f_start
+				&& s.f_stop == p.settings.f_stop && s.if_bandwidth == p.settings.if_bandwidth
+				&& s.cdbm_excitation == p.settings.cdbm_excitation && s.excitePort1 && s.excitePort2
+				&& s.dataFormat == p.settings.dataFormat && s.segmentTable
+				&& s.points == (len > 25 ? p.settings.points : p.settings.points & 0xFFFF)
+				&& s.logSweep == (len > 27) && s.triggered == (len > 27) && s.extendedSettling == (len > 27)
+				&& s.sweeps == (len > 28 ? p.settings.sweeps : 0)
+				&& s.averages == (len > 30 ? p.settings.averages : 0);
+		char name[32];
+		snprintf(name, sizeof(name), "settings_%u", len);
+		printf("%-28s %4u bytes %6lu points %u sweeps %2u averages %s\n", name, len, (unsigned long) s.points,
+				s.sweeps, s.averages, ok ? "OK" : "FAILED");
+		failed += !ok;
+	}
+	return failed;
+}
+
+// DeviceLimits of older firmware end before the maximum number of sweep points
+static unsigned DeviceLimitsLengths() {
+	PacketInfo p;
+	p.type = PacketType::DeviceLimits;
+	p.limits = DeviceLimits();
+	p.limits.minFreq = 0;
+	p.limits.maxFreq = 6000000000;
+	p.limits.minIFBW = 10;
+	p.limits.maxIFBW = 50000;
+	p.limits.maxPoints = 4501;
+	p.limits.cdbm_min = -4000;
+	p.limits.cdbm_max = 0;
+	p.limits.minRBW = 10;
+	p.limits.maxRBW = 100000;
+	p.limits.maxSweepPoints = 65536 * 2;
+	auto full = Payload(p);
+	unsigned failed = 0;
+	for (uint16_t len : {(uint16_t) 38, (uint16_t) full.size()}) {
+		std::vector<uint8_t> payload(full.begin(), full.begin() + len);
+		std::vector<uint8_t> buf;
+		auto info = Decode(PacketType::DeviceLimits, payload, buf);
+		auto &l = info.limits;
+		bool ok = info.type == PacketType::DeviceLimits && l.maxFreq == p.limits.maxFreq
+				&& l.maxIFBW == p.limits.maxIFBW && l.maxPoints == p.limits.maxPoints
+				&& l.cdbm_min == p.limits.cdbm_min && l.maxRBW == p.limits.maxRBW
+				&& l.maxSweepPoints == (len > 38 ? p.limits.maxSweepPoints : p.limits.maxPoints);
+		char name[32];
+		snprintf(name, sizeof(name), "limits_%u", len);
+		printf("%-28s %4u bytes %6lu sweep points %s\n", name, len, (unsigned long) l.maxSweepPoints,
+				ok ? "OK" : "FAILED");
+		failed += !ok;
+	}
+	return failed;
+}
+
+// The sweep plan packets have to match their length exactly
+static unsigned PlanPacketLengths() {
+	unsigned failed = 0;
+	PacketInfo p;
+	p.type = PacketType::SweepPlanParameters;
+	p.planParameters = SweepPlanParameters();
+	p.planParameters.revision = 2;
+	p.planParameters.ADCSamplerate = 800000;
+	p.planParameters.sourceVCOMapValid = 1;
+	p.planParameters.sourceVCOMap[SweepPlanNumVCOs - 1] = 60000;
+	auto payload = Payload(p);
+	failed += !Check("plan_parameters", p.type, payload, true);
+	payload.pop_back();
+	failed += !Check("plan_parameters_short", p.type, payload, false);
+
+	p.type = PacketType::SweepPlanPoints;
+	p.planPoints = SweepPlanPoints();
+	p.planPoints.count = 2;
+	p.planPoints.points[1].LO2Shift = 1;
+	payload = Payload(p);
+	failed += !Check("plan_points", p.type, payload, true);
+	auto modified = payload;
+	modified.pop_back();
+	failed += !Check("plan_points_short", p.type, modified, false);
+	modified = payload;
+	modified.push_back(0);
+	failed += !Check("plan_points_long", p.type, modified, false);
+
+	p.type = PacketType::SweepSegments;
+	p.segments = SweepSegments();
+	p.segments.count = 2;
+	payload = Payload(p);
+	failed += !Check("segments", p.type, payload, true);
+	modified = payload;
+	modified.pop_back();
+	failed += !Check("segments_short", p.type, modified, false);
+	modified = payload;
+	modified[0] = MaxSweepSegments + 1;
+	failed += !Check("segments_too_many", p.type, modified, false);
+	return failed;
+}
+
+int main() {
+	unsigned failed = 0;
+	for (auto format : {DatapointFormat::Full, DatapointFormat::ImplicitFrequency, DatapointFormat::Compact16}) {
+		for (auto ports : {DatapointPorts::Both, DatapointPorts::Port1, DatapointPorts::Port2}) {
+			failed += !BatchRoundTrip(format, ports, 1000, MaxBatchPoints);
+			failed += !BatchRoundTrip(format, ports, 70000, 5);
+		}
+	}
+	failed += MalformedBatches();
+	failed += SweepSettingsLengths();
+	failed += DeviceLimitsLengths();
+	failed += PlanPacketLengths();
+	if (failed) {
+		printf("%u tests failed\n", failed);
+		return 1;
+	}
+	printf("All tests passed\n");
+	return 0;
+}
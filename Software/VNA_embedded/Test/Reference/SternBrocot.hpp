@@ -0,0 +1,11 @@
+#pragma once
+
+#include "algorithm.hpp"
+
+// Rational approximation used by the firmware before the continued fraction solver: walks the Stern-Brocot tree
+// on the float ratio until the denominator limit is reached. Only used as the reference in the tests
+namespace Reference {
+
+Algorithm::RationalApproximation SternBrocot(float ratio, uint32_t max_denom);
+
+}
@@ -0,0 +1,8 @@
+// Replaces the continued fraction solver of algorithm.cpp with the Stern-Brocot reference. Linked instead of
+// algorithm.cpp to compare the sweep setup time of both solvers (see SetupBenchmark)
+
+#include "SternBrocot.hpp"
+
+Algorithm::RationalApproximation Algorithm::BestRationalApproximation(uint32_t p, uint32_t q, uint32_t max_denom) {
+	return Reference::SternBrocot((float) p / q, max_denom);
+}
@@ -0,0 +1,246 @@
+// Golden register test: runs the hardware initialization and a set of sweeps against the mocked hardware and
+// compares the recorded register writes (SPI, I2C and GPIO) with the expected ones.
+//
+// RegisterTest <golden file>			compares with the expected register writes
+// RegisterTest --update <golden file>	stores the current register writes as the expected ones
+//
+// Only update the golden file if the register writes changed on purpose. The traces depend on the order of
+// the scenarios (the firmware keeps state between sweeps), new scenarios are added at the end
+
+#include "Sweep.hpp"
+#include "SpectrumAnalyzer.hpp"
+#include "SweepPlan.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <vector>
+
+static uint32_t pointCnt;
+
+static void PointCallback(const Protocol::Datapoint&) {
+	pointCnt++;
+}
+
+// Configures the sweep and lets the FPGA measure one complete sweep. Returns false if the sweep did not complete
+static bool VNASweep(Protocol::SweepSettings s) {
+	pointCnt = 0;
+	VNA::Setup(s, PointCallback);
+	uint32_t points = s.points > HW::MaxSweepPoints ? HW::MaxSweepPoints : s.points;
+	if (s.portBlocked && s.excitePort1 && s.excitePort2) {
+		points *= 2;
+	}
+	Sweep::Run(pointCnt, points);
+	return pointCnt == points;
+}
+
+using Scenario = struct {
+	const char *name;
+	// returns false if the scenario could not be completed
+	std::function<bool()> run;
+};
+
+static const std::vector<Scenario> scenarios = {
+	{"init", [] {
+		return Sweep::Init();
+	}},
+	{"vna_101", [] {
+		return VNASweep(Sweep::Settings(1000000, 6000000000, 101));
+	}},
+	{"vna_101_unchanged", [] {
+		return VNASweep(Sweep::Settings(1000000, 6000000000, 101));
+	}},
+	{"vna_lowband_501", [] {
+		return VNASweep(Sweep::Settings(10000, 50000000, 501, 1000));
+	}},
+	{"vna_4501", [] {
+		return VNASweep(Sweep::Settings(100000, 6000000000, 4501, 100000));
+	}},
+	{"vna_log_201", [] {
+		auto s = Sweep::Settings(100000, 6000000000, 201);
+		s.logSweep = 1;
+		return VNASweep(s);
+	}},
+	{"vna_port1_1001", [] {
+		auto s = Sweep::Settings(2000000000, 2100000000, 1001);
+		s.excitePort2 = 0;
+		s.cdbm_excitation = 0;
+		return VNASweep(s);
+	}},
+	{"vna_portblocked_201", [] {
+		auto s = Sweep::Settings(1000000, 3000000000, 201);
+		s.portBlocked = 1;
+		return VNASweep(s);
+	}},
+	{"vna_averages_101", [] {
+		auto s = Sweep::Settings(1000000, 6000000000, 101, 1000);
+		s.averages = 10;
+		return VNASweep(s);
+	}},
+	{"vna_settling_201", [] {
+		auto s = Sweep::Settings(1000000, 6000000000, 201);
+		s.extendedSettling = 1;
+		return VNASweep(s);
+	}},
+	{"vna_long_10000", [] {
+		return VNASweep(Sweep::Settings(100000, 6000000000, 10000, 100000));
+	}},
+	{"vna_triggered_101", [] {
+		auto s = Sweep::Settings(1000000, 6000000000, 101);
+		s.triggered = 1;
+		pointCnt = 0;
+		VNA::Setup(s, PointCallback);
+		if (!VNA::Trigger()) {
+			return false;
+		}
+		Sweep::Run(pointCnt, s.points);
+		return pointCnt == s.points;
+	}},
+	{"sa_201", [] {
+		Protocol::SpectrumAnalyzerSettings s = {};
+		s.f_start = 100000000;
+		s.f_stop = 200000000;
+		s.RBW = 100000;
+		s.pointNum = 201;
+		s.WindowType = 1;
+		s.Detector = 0;
+		SA::Setup(s);
+		// SA results are not passed through a callback, measure a fixed number of samples instead
+		uint32_t samples = 0;
+		Sweep::Run(samples, 1, 5000);
+		return Mock::SentPackets(Protocol::PacketType::SpectrumAnalyzerResult) > 0;
+	}},
+	{"vna_slow_host_101", [] {
+		// the USB fifo fills up during a sweep without halts, the sweep is set up again with backpressure halts.
+		// Starts above the lowband, its points are always halted
+		auto s = Sweep::Settings(100000000, 6000000000, 101);
+		Mock::SetUSBSpace(1000);
+		bool completed = VNASweep(s);
+		bool required = VNA::BackpressureRequired();
+		Mock::SetUSBSpace(4092);
+		completed &= VNASweep(s);
+		// only requested once
+		required &= !VNA::BackpressureRequired();
+		VNA::ResetBackpressure();
+		return completed && required;
+	}},
+	{"vna_segments_141", [] {
+		// sparse and fast outside of the passband, dense with a narrow IF bandwidth and more power inside
+		Protocol::SweepSegments segments = {};
+		segments.count = 3;
+		segments.segments[0] = {1000000, 900000000, 21, 50000, -1000};
+		segments.segments[1] = {900000000, 1000000000, 101, 1000, 0};
+		segments.segments[2] = {1000000000, 6000000000, 19, 50000, -1000};
+		if (!VNA::SetSegments(segments)) {
+			return false;
+		}
+		auto s = Sweep::Settings(0, 0, Protocol::SegmentTablePoints(segments));
+		s.segmentTable = 1;
+		return VNASweep(s);
+	}},
+	{"vna_uploaded_plan_101", [] {
+		// plan calculated like the host does and uploaded before the settings
+		auto s = Sweep::Settings(1000000, 6000000000, 101);
+		s.uploadedPlan = 1;
+		Protocol::SweepPlanParameters p;
+		VNA::GetPlanParameters(p);
+		auto samplesPerPoint = SweepPlan::SamplesPerPoint(s.if_bandwidth, p.ADCSamplerate, s.averages);
+		SweepPlan::Calculator calc(p, s, p.ADCSamplerate / samplesPerPoint);
+		Protocol::SweepPlanPoints plan = {};
+		plan.revision = p.revision;
+		for (uint32_t i = 0; i < s.points; i++) {
+			if (!calc.Next(plan.points[plan.count])) {
+				return false;
+			}
+			plan.count++;
+			if (plan.count == Protocol::MaxPlanPoints || i == s.points - 1) {
+				if (!VNA::LoadPlan(plan)) {
+					return false;
+				}
+				plan.firstPoint += plan.count;
+				plan.count = 0;
+			}
+		}
+		return VNASweep(s);
+	}},
+};
+
+int main(int argc, char *argv[]) {
+	bool update = false;
+	const char *filename = nullptr;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--update")) {
+			update = true;
+		} else if (!strcmp(argv[i], "--verbose")) {
+			Mock::SetVerbose(true);
+		} else {
+			filename = argv[i];
+		}
+	}
+	if (!filename) {
+		fprintf(stderr, "Usage: %s [--update] [--verbose] <golden file>\n", argv[0]);
+		return 2;
+	}
+
+	// run all scenarios in order, each one starts a new trace
+	std::vector<std::pair<std::string, std::string>> traces;
+	unsigned failed = 0;
+	for (auto &s : scenarios) {
+		Mock::ClearTrace();
+		if (!s.run()) {
+			printf("%-24s NOT COMPLETED\n", s.name);
+			failed++;
+		}
+		traces.push_back({s.name, Mock::ToString(Mock::GetTrace())});
+	}
+	if (failed) {
+		printf("%u scenarios could not be completed\n", failed);
+		return 1;
+	}
+
+	if (update) {
+		std::ofstream f(filename);
+		f << "# scenario hash spi_transfers spi_bytes i2c_writes gpio_writes (generated by RegisterTest --update)\n";
+		for (auto &t : traces) {
+			f << t.first << " " << t.second << "\n";
+		}
+		printf("Stored register writes of %zu scenarios in %s\n", traces.size(), filename);
+		return 0;
+	}
+
+	std::ifstream f(filename);
+	if (!f) {
+		fprintf(stderr, "Unable to open %s\n", filename);
+		return 2;
+	}
+	std::map<std::string, std::string> expected;
+	std::string line;
+	while (std::getline(f, line)) {
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		auto sep = line.find(' ');
+		expected[line.substr(0, sep)] = line.substr(sep + 1);
+	}
+	for (auto &t : traces) {
+		auto it = expected.find(t.first);
+		if (it == expected.end()) {
+			printf("%-24s MISSING (got %s)\n", t.first.c_str(), t.second.c_str());
+			failed++;
+		} else if (it->second != t.second) {
+			printf("%-24s FAILED\n    expected %s\n    got      %s\n", t.first.c_str(), it->second.c_str(),
+					t.second.c_str());
+			failed++;
+		} else {
+			printf("%-24s OK\n", t.first.c_str());
+		}
+	}
+	if (failed) {
+		printf("%u of %zu scenarios changed their register writes\n", failed, traces.size());
+		return 1;
+	}
+	printf("All %zu scenarios passed\n", traces.size());
+	return 0;
+}
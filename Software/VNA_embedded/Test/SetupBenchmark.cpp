@@ -0,0 +1,82 @@
+// Sweep setup benchmark: measures the time VNA::Setup takes on the build machine for different numbers of points
+// and the time until the first point has been measured (setup latency, the mocked FPGA measures instantly).
+// The absolute numbers say little about the STM32, the relative changes between firmware versions do.
+// Every setup uses slightly different settings, otherwise the unchanged sweep configuration would be reused.
+// Sweeps with more points than the FPGA can hold only calculate the first segment in the setup.
+// The SPI column is the number of bytes transferred during the setup, the host does not spend any time on them.
+// On the device, the FPGA SPI runs at 40MHz (0.2us per byte) and the PLL SPI at 20MHz
+//
+// SetupBenchmark [repetitions]
+
+#include "Sweep.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+static uint32_t pointCnt;
+
+static void PointCallback(const Protocol::Datapoint&) {
+	pointCnt++;
+}
+
+using Result = struct {
+	// average durations in us
+	double setup;
+	double firstPoint;
+	// SPI bytes per setup
+	uint32_t spiBytes;
+};
+
+static Result MeasureSetup(Protocol::SweepSettings s, unsigned repetitions) {
+	using namespace std::chrono;
+	Result r = {};
+	for (unsigned i = 0; i < repetitions; i++) {
+		// force a new calculation
+		s.f_stop -= 1000;
+		pointCnt = 0;
+		Mock::ClearTrace();
+		auto start = steady_clock::now();
+		VNA::Setup(s, PointCallback);
+		auto setup = steady_clock::now();
+		r.spiBytes = Mock::GetTrace().spiBytes;
+		Sweep::Run(pointCnt, 1);
+		auto first = steady_clock::now();
+		r.setup += duration_cast<nanoseconds>(setup - start).count() / 1000.0;
+		r.firstPoint += duration_cast<nanoseconds>(first - start).count() / 1000.0;
+	}
+	r.setup /= repetitions;
+	r.firstPoint /= repetitions;
+	return r;
+}
+
+static void Print(const char *name, uint32_t points, const Result &r) {
+	printf("%-24s %8u %12.1f %10.3f %16.1f %10u\n", name, points, r.setup, r.setup / points, r.firstPoint,
+			r.spiBytes);
+}
+
+int main(int argc, char *argv[]) {
+	unsigned repetitions = argc > 1 ? atoi(argv[1]) : 20;
+	if (!Sweep::Init()) {
+		fprintf(stderr, "Hardware initialization failed\n");
+		return 1;
+	}
+
+	const uint32_t points[] = {101, 501, 1001, 4501, 10001, 20001, 100000};
+	printf("%-24s %8s %12s %10s %16s %10s\n", "sweep", "points", "setup [us]", "us/point", "first point [us]",
+			"SPI bytes");
+	for (auto p : points) {
+		auto s = Sweep::Settings(1000000, 6000000000, p);
+		Print("1MHz-6GHz", p, MeasureSetup(s, repetitions));
+	}
+	for (auto p : {101u, 1001u, 4501u}) {
+		auto s = Sweep::Settings(10000, 30000000, p);
+		Print("10kHz-30MHz (lowband)", p, MeasureSetup(s, repetitions));
+	}
+	for (auto p : {101u, 1001u, 4501u}) {
+		auto s = Sweep::Settings(100000, 6000000000, p);
+		s.logSweep = 1;
+		Print("100kHz-6GHz (log)", p, MeasureSetup(s, repetitions));
+	}
+	return 0;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+// Host replacement of the FreeRTOS types used by the firmware modules of the host build
+
+#include <stdint.h>
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void* TaskHandle_t;
+
+#define pdFALSE	((BaseType_t) 0)
+#define pdTRUE	((BaseType_t) 1)
+#define pdPASS	pdTRUE
+#define pdFAIL	pdFALSE
+#define portMAX_DELAY	((TickType_t) 0xFFFFFFFFUL)
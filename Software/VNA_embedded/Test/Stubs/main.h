@@ -0,0 +1,28 @@
+#pragma once
+
+// Pin assignment of Inc/main.h without the LL driver includes
+
+#include "stm32g4xx_hal.h"
+
+#define FPGA_INIT_B_Pin GPIO_PIN_1
+#define FPGA_INIT_B_GPIO_Port GPIOF
+#define FPGA_AUX1_Pin GPIO_PIN_1
+#define FPGA_AUX1_GPIO_Port GPIOA
+#define FPGA_AUX3_Pin GPIO_PIN_2
+#define FPGA_AUX3_GPIO_Port GPIOA
+#define FPGA_AUX2_Pin GPIO_PIN_3
+#define FPGA_AUX2_GPIO_Port GPIOA
+#define FPGA_CS_Pin GPIO_PIN_4
+#define FPGA_CS_GPIO_Port GPIOA
+#define FLASH_CS_Pin GPIO_PIN_0
+#define FLASH_CS_GPIO_Port GPIOB
+#define FPGA_INTR_Pin GPIO_PIN_1
+#define FPGA_INTR_GPIO_Port GPIOB
+#define FPGA_PROGRAM_B_Pin GPIO_PIN_2
+#define FPGA_PROGRAM_B_GPIO_Port GPIOB
+#define EN_6V_Pin GPIO_PIN_12
+#define EN_6V_GPIO_Port GPIOB
+#define FPGA_RESET_Pin GPIO_PIN_5
+#define FPGA_RESET_GPIO_Port GPIOB
+#define FPGA_DONE_Pin GPIO_PIN_9
+#define FPGA_DONE_GPIO_Port GPIOB
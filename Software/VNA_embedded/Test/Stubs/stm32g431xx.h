@@ -0,0 +1,56 @@
+#pragma once
+
+// Host replacement of the CMSIS device header. Only provides the peripherals used by the firmware modules
+// that are part of the host build. GPIO output registers record their writes (see Mock.hpp)
+
+#include <stdint.h>
+
+#define __IO volatile
+
+namespace Mock {
+
+// Writes to a GPIO BSRR register set/reset the output and are recorded
+class BSRRRegister {
+public:
+	void operator=(uint32_t value);
+};
+
+}
+
+typedef struct {
+	__IO uint32_t IDR;
+	__IO uint32_t ODR;
+	Mock::BSRRRegister BSRR;
+} GPIO_TypeDef;
+
+typedef struct {
+	__IO uint32_t CR1;
+	__IO uint32_t CR2;
+	__IO uint32_t SR;
+	__IO uint32_t DR;
+} SPI_TypeDef;
+
+typedef struct {
+	__IO uint32_t ICSR;
+} SCB_Type;
+
+extern GPIO_TypeDef MockGPIOA, MockGPIOB, MockGPIOF;
+extern SPI_TypeDef MockSPI1, MockSPI2;
+extern SCB_Type MockSCB;
+
+#define GPIOA	(&MockGPIOA)
+#define GPIOB	(&MockGPIOB)
+#define GPIOF	(&MockGPIOF)
+#define SPI1	(&MockSPI1)
+#define SPI2	(&MockSPI2)
+#define SCB		(&MockSCB)
+
+#define SCB_ICSR_VECTACTIVE_Msk	0x1FFUL
+#define SPI_CR1_BR_Pos			3U
+#define SPI_CR1_BR_Msk			(0x7UL << SPI_CR1_BR_Pos)
+
+extern const uint16_t MockTempsensorCal1, MockTempsensorCal2;
+#define TEMPSENSOR_CAL1_ADDR	(&MockTempsensorCal1)
+#define TEMPSENSOR_CAL2_ADDR	(&MockTempsensorCal2)
+#define TEMPSENSOR_CAL1_TEMP	30
+#define TEMPSENSOR_CAL2_TEMP	130
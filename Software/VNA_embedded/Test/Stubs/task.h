@@ -0,0 +1,12 @@
+#pragma once
+
+// Host replacement of the FreeRTOS task API. There is no scheduler, the tests call the task and interrupt
+// functions in the order they want to simulate
+
+#include "FreeRTOS.h"
+
+void vTaskDelay(TickType_t ticks);
+
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+#define portYIELD_FROM_ISR(x)	(void) (x)
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Mock.hpp"
+#include "Hardware.hpp"
+#include "VNA.hpp"
+
+// Helpers shared by the tests and benchmarks: sweep settings and a simulated App task that lets the FPGA
+// measure the sweep
+namespace Sweep {
+
+static inline Protocol::SweepSettings Settings(uint64_t f_start, uint64_t f_stop, uint32_t points,
+		uint32_t if_bandwidth = 10000) {
+	Protocol::SweepSettings s = {};
+	s.f_start = f_start;
+	s.f_stop = f_stop;
+	s.points = points;
+	s.if_bandwidth = if_bandwidth;
+	s.cdbm_excitation = -1000;
+	s.excitePort1 = 1;
+	s.excitePort2 = 1;
+	s.suppressPeaks = 1;
+	return s;
+}
+
+// Resets the mocked hardware and initializes it like the firmware does after power up
+static inline bool Init() {
+	Mock::Reset();
+	return HW::Init();
+}
+
+// Lets the FPGA measure until the callback counted the given number of points or the FPGA does not continue
+// anymore. The functions called from the App task run after every interrupt. Returns the number of FPGA interrupts
+static inline uint32_t Run(const uint32_t &pointCounter, uint32_t points, uint32_t maxInterrupts = 1000000) {
+	uint32_t interrupts = 0;
+	while (pointCounter < points && interrupts < maxInterrupts) {
+		if (!Mock::FPGAStep()) {
+			// the sweep might be held because of USB backpressure, the App task resumes it once there is space
+			VNA::ResumeStalled();
+			if (!Mock::FPGAStep()) {
+				break;
+			}
+		}
+		interrupts++;
+		Mock::RunDispatched();
+		VNA::PrepareSegment();
+		// continues a long sweep that was waiting for its next segment
+		Mock::RunDispatched();
+	}
+	return interrupts;
+}
+
+}